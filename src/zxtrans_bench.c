@@ -0,0 +1,861 @@
+/*
+   ZX-Trans Bench - loopback benchmark of the sender against a model of
+   the receiver, over a pseudo-terminal.
+
+   waiting on changes to the CTS line rather than polling it.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _XOPEN_SOURCE 700 /* For posix_openpt, clock_gettime */
+#define _DEFAULT_SOURCE /* For MAP_ANONYMOUS */
+
+#define Z80_CLOCK 3546900.0 /* T-states per second, 128k and +3 */
+#define READ_TSTATES 400 /* Default receiver overhead per byte read */
+#define LDIR_TSTATES 21 /* Per byte filled or copied by receiver */
+#define BITS_PER_BYTE 10 /* Start, 8 data and stop bits */
+#define MODEL_CHUNK 64 /* Most bytes taken from terminal at once */
+#define POLL_MS 100 /* Wait before checking sender has not exited */
+#define CODELEN 80 /* Length of Z80 set-state block */
+#define PAGELIST 70 /* Offset of page list in set-state block */
+#define FLAGS (CODELEN-1) /* Offset of transfer options */
+#define LADDER_PAUSE 0.06 /* Seconds receiver holds CTS low after a
+			     whole test pattern */
+#define STANDIN_HOST "127.0.0.1" /* Stand-in terminal server's address */
+#define STANDIN_SUB 16 /* Longest telnet subnegotiation kept */
+
+/* Telnet, and RFC 2217 com port control, as far as the stand-in
+   terminal server needs them */
+#define TELNET_SE 240
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_IAC 255
+#define COM_PORT 44
+#define SET_BAUDRATE 1
+#define SET_CONTROL 5
+#define NOTIFY_MODEMSTATE 107
+#define CONTROL_RTS_ON 11
+#define CONTROL_RTS_OFF 12
+#define MODEMSTATE_CTS 0x10
+#define IN_DATA 0 /* Telnet stream is in data, else after this byte */
+#define IN_SUB_IAC 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <libspectrum.h>
+#include "zxtrans_bench.h"
+#include "zxtrans_image.h"
+#include "zxtrans_pack.h"
+
+/* Receiver model, reading from master side of the pseudo-terminal,
+   or from a connection to a stand-in terminal server */
+struct zxtrans_bench_model {
+  int fd;
+  int telnet;			/* Connection is RFC 2217 */
+  int telnetState;
+  libspectrum_byte sub[STANDIN_SUB];
+  size_t subLength;
+  pid_t sender;
+  libspectrum_byte buffer[MODEL_CHUNK];
+  size_t length;
+  size_t next;
+  unsigned long received;
+  double readSeconds;		/* Receiver overhead per byte */
+  double due;			/* When receiver is next free */
+  libspectrum_byte memory[8][ZXTRANS_PAGELEN];
+};
+
+struct zxtrans_bench_result {
+  unsigned long bytes;
+  double seconds;
+  int loaded;			/* Stream was complete and well formed */
+  int mismatches;		/* Bytes differing from snapshot */
+};
+
+static double now(void);
+static void sleep_until(double when);
+static void usage(void);
+static libspectrum_snap *read_snapshot(const char *filename);
+static int run_transfer(const char *snapshotName, libspectrum_snap *snapshot,
+			int serialMode, int baudRate, int readTstates,
+			const char *options, int burstSize,
+			const char *transport, int verbose,
+			struct zxtrans_bench_result *result);
+static int open_standin(struct zxtrans_bench_model *model,
+			const char *transport, char *portName,
+			size_t size);
+static int accept_sender(struct zxtrans_bench_model *model);
+static int next_byte(struct zxtrans_bench_model *model);
+static void set_cts(struct zxtrans_bench_model *model, int cts);
+static size_t take_telnet(struct zxtrans_bench_model *model, size_t length);
+static int settle_rate(struct zxtrans_bench_model *model);
+static void busy(struct zxtrans_bench_model *model, size_t bytes);
+static int load_page(struct zxtrans_bench_model *model,
+		     const libspectrum_byte *pageList, int index, int flags);
+static int load_data(struct zxtrans_bench_model *model,
+		     libspectrum_byte *page, size_t start, size_t end,
+		     int flags);
+static int check_memory(struct zxtrans_bench_model *model,
+			libspectrum_snap *snapshot,
+			const libspectrum_byte *pageList);
+
+int main(int argc, char *argv[]){
+  int modes[3] = {0, 1, 2};
+  int modeCount = 3;
+  int baudRate = 9600;
+  int readTstates = READ_TSTATES;
+  int burstSize = 0;
+  const char *transport = NULL;
+  int verbose = 0;
+  char options[8] = "";
+  int failed = 0;
+  int opt;
+  libspectrum_snap *snapshot;
+
+  while((opt = getopt(argc, argv, "f:b:c:zmaB:t:vh")) != -1){
+    switch(opt){
+    case 'f' : /* Only benchmark one transfer mode */
+      modes[0] = atoi(optarg);
+      modeCount = 1;
+
+      if(modes[0] < 0 || modes[0] > 2){
+	printf("Transfer mode must be 0, 1, or 2.\n");
+	exit(EXIT_FAILURE);
+      }
+
+      break;
+    case 'b' : /* Starting baud rate */
+      baudRate = atoi(optarg);
+      break;
+    case 'c' : /* Receiver overhead per byte */
+      readTstates = atoi(optarg);
+      break;
+    case 'B' : /* Bytes per handshake in mode 0, passed on to sender */
+      burstSize = atoi(optarg);
+      break;
+    case 't' : /* Send over TCP, to a stand-in terminal server */
+      transport = optarg;
+
+      if(0 != strcmp(transport, "tcp") && 0 != strcmp(transport, "rfc2217")){
+	printf("Transport must be tcp or rfc2217.\n");
+	exit(EXIT_FAILURE);
+      }
+
+      break;
+    case 'z' : /* Options passed on to sender */
+    case 'm' :
+    case 'a' :
+      if(NULL == strchr(options, opt))
+	options[strlen(options)] = opt;
+
+      break;
+    case 'v' :
+      verbose = 1;
+      break;
+    case 'h' :
+    default:
+      usage();
+      exit('h' == opt ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if(optind != argc-1 || baudRate <= 0 || readTstates < 0){
+    usage();
+    exit(EXIT_FAILURE);
+  }
+
+  /* Fast mode changes baud rate, which raw TCP cannot */
+  if(NULL != transport && 0 == strcmp(transport, "tcp")){
+    if(1 == modeCount && 2 == modes[0]){
+      printf("Transfer mode 2 needs rfc2217, not tcp.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    if(modeCount > 2)
+      modeCount = 2;
+  }
+
+  libspectrum_init();
+
+  if(NULL == (snapshot = read_snapshot(argv[optind])))
+    exit(EXIT_FAILURE);
+
+  /* Modem lines shared with sender, once forked */
+  zxtrans_bench_line = mmap(NULL, sizeof(*zxtrans_bench_line), \
+			    PROT_READ | PROT_WRITE, \
+			    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if(MAP_FAILED == zxtrans_bench_line){
+    printf("Unable to share modem lines with sender.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%-4s %6s %8s %8s %9s  %s\n", "Mode", "Baud", "Bytes", "Seconds", \
+	 "Achieved", "Memory");
+
+  for(int i=0; i<modeCount; i++){
+    struct zxtrans_bench_result result;
+
+    if(!run_transfer(argv[optind], snapshot, modes[i], baudRate, \
+		     readTstates, options, burstSize, transport, verbose, \
+		     &result))
+      exit(EXIT_FAILURE);
+
+    printf("%-4d %6d %8lu %8.2f %9.0f  ", modes[i], baudRate, result.bytes, \
+	   result.seconds, (result.seconds > 0) ? \
+	   result.bytes*BITS_PER_BYTE/result.seconds : 0);
+
+    if(!result.loaded)
+      printf("incomplete\n");
+    else if(result.mismatches > 0)
+      printf("%d bytes differ\n", result.mismatches);
+    else
+      printf("OK\n");
+
+    failed |= !result.loaded || result.mismatches > 0;
+  }
+
+  libspectrum_snap_free(snapshot);
+  munmap(zxtrans_bench_line, sizeof(*zxtrans_bench_line));
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static double now(void){
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static void sleep_until(double when){
+  double wait = when-now();
+  struct timespec t;
+
+  if(wait <= 0)
+    return;
+
+  t.tv_sec = (time_t) wait;
+  t.tv_nsec = (long) ((wait-t.tv_sec)*1e9);
+  nanosleep(&t, NULL);
+}
+
+static void usage(void){
+  printf("ZX-Trans Bench: times the sender against a model of the receiver\n");
+  printf("Usage: zxtrans_bench [options] <snapshot filename>\n");
+  printf(" -f<transfer mode>\tOnly benchmark one mode (default: 0, 1 and 2)\n");
+  printf(" -b<baud rate>\t\tStarting baud rate (default: 9600)\n");
+  printf(" -c<T-states>\t\tReceiver overhead per byte (default: %d)\n", \
+	 READ_TSTATES);
+  printf(" -z, -m, -a, -B<bytes>\tPassed on to sender\n");
+  printf(" -t<tcp|rfc2217>\tSend over TCP to a stand-in terminal server,\n" \
+	 "\t\t\trather than through a pseudo-terminal\n");
+  printf(" -v\t\t\tShow sender's output\n");
+}
+
+static libspectrum_snap *read_snapshot(const char *filename){
+  FILE *file;
+  long length;
+  libspectrum_byte *buffer;
+  libspectrum_snap *snapshot;
+  libspectrum_id_t type;
+  libspectrum_class_t class;
+
+  if(NULL == (file = fopen(filename, "rb"))){
+    printf("Error opening input file.\n");
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if(length <= 0 || NULL == (buffer = malloc(length)) || \
+     fread(buffer, 1, length, file) != (size_t) length){
+    printf("Error reading input file.\n");
+    fclose(file);
+    return NULL;
+  }
+
+  fclose(file);
+  snapshot = libspectrum_snap_alloc();
+
+  if(libspectrum_identify_file_with_class(&type, &class, filename, \
+					  buffer, length) || \
+     LIBSPECTRUM_CLASS_SNAPSHOT != class || \
+     libspectrum_snap_read(snapshot, buffer, length, type, filename)){
+    printf("Input file is not a snapshot.\n");
+    libspectrum_snap_free(snapshot);
+    snapshot = NULL;
+  }
+
+  free(buffer);
+
+  return snapshot;
+}
+
+/* Send snapshot in serialMode to the receiver model and check the
+   memory it ends up with, over transport if it is not NULL. Returns 0
+   if the transfer could not be set up. */
+static int run_transfer(const char *snapshotName, libspectrum_snap *snapshot,
+			int serialMode, int baudRate, int readTstates,
+			const char *options, int burstSize,
+			const char *transport, int verbose,
+			struct zxtrans_bench_result *result){
+  static struct zxtrans_bench_model model;
+  libspectrum_byte state[CODELEN];
+  char modeOption[8], baudOption[16], burstOption[16], senderOptions[8];
+  char portName[64];
+  char *slaveName = portName;
+  struct termios term;
+  double start;
+  int slave = -1, status;
+  int senderArgc = 0;
+  char *senderArgv[10];
+
+  memset(result, 0, sizeof(*result));
+  memset(&model, 0, sizeof(model));
+  memset((void *) zxtrans_bench_line, 0, sizeof(*zxtrans_bench_line));
+
+  if(NULL != transport){
+    if(!open_standin(&model, transport, portName, sizeof(portName)))
+      return 0;
+
+    /* Raw TCP leaves the line as it is */
+    zxtrans_bench_line->baudRate = baudRate;
+    zxtrans_bench_line->lastBaudRate = baudRate;
+  }
+  else if(-1 == (model.fd = posix_openpt(O_RDWR | O_NOCTTY)) || \
+     grantpt(model.fd) || unlockpt(model.fd) || \
+     NULL == (slaveName = ptsname(model.fd))){
+    printf("Unable to open pseudo-terminal.\n");
+    return 0;
+  }
+
+  /* Held open, so the terminal stays up between sender's writes */
+  if(NULL == transport && \
+     -1 == (slave = open(slaveName, O_RDWR | O_NOCTTY))){
+    printf("Unable to open %s.\n", slaveName);
+    close(model.fd);
+    return 0;
+  }
+
+  if(NULL == transport && 0 == tcgetattr(slave, &term)){
+    term.c_iflag = 0;
+    term.c_oflag = 0;
+    term.c_lflag = 0;
+    term.c_cflag = (term.c_cflag & ~(CSIZE | PARENB)) | CS8 | CREAD;
+    tcsetattr(slave, TCSANOW, &term);
+  }
+
+  snprintf(modeOption, sizeof(modeOption), "-f%d", serialMode);
+  snprintf(baudOption, sizeof(baudOption), "-b%d", baudRate);
+  snprintf(burstOption, sizeof(burstOption), "-B%d", burstSize);
+  snprintf(senderOptions, sizeof(senderOptions), "-%s", options);
+
+  senderArgv[senderArgc++] = "zxtrans";
+  senderArgv[senderArgc++] = "-s";
+  senderArgv[senderArgc++] = slaveName;
+  senderArgv[senderArgc++] = modeOption;
+  senderArgv[senderArgc++] = baudOption;
+
+  if(options[0])
+    senderArgv[senderArgc++] = senderOptions;
+
+  if(burstSize > 0)
+    senderArgv[senderArgc++] = burstOption;
+
+  senderArgv[senderArgc++] = (char *) snapshotName;
+  senderArgv[senderArgc] = NULL;
+
+  fflush(stdout);
+  start = now();
+
+  if(-1 == (model.sender = fork())){
+    printf("Unable to start sender.\n");
+    return 0;
+  }
+
+  if(0 == model.sender){
+    int quiet = open("/dev/null", O_WRONLY);
+
+    close(model.fd);
+
+    if(slave >= 0)
+      close(slave);
+
+    if(!verbose && quiet >= 0)
+      dup2(quiet, STDOUT_FILENO);
+
+    /* Sender parses its own options afresh */
+    optind = 1;
+    exit(zxtrans_sender_main(senderArgc, senderArgv));
+  }
+
+  model.readSeconds = readTstates/Z80_CLOCK;
+  model.due = start;
+
+  /* Set-state block carries the page list and transfer options */
+  result->loaded = (NULL == transport) || accept_sender(&model);
+
+  for(int i=0; i<CODELEN && result->loaded; i++){
+    int byte = next_byte(&model);
+
+    result->loaded = (byte >= 0);
+    state[i] = byte;
+  }
+
+  if(result->loaded && (state[FLAGS] & ZXTRANS_FLAG_FAST))
+    result->loaded = settle_rate(&model);
+
+  for(int i=0; result->loaded && i<8 && 0xFF != state[PAGELIST+i]; i++)
+    result->loaded = (state[PAGELIST+i] < 8) && \
+      !(state[FLAGS] & ZXTRANS_FLAG_DELTA) && \
+      load_page(&model, &state[PAGELIST], i, state[FLAGS]);
+
+  sleep_until(model.due);
+  result->seconds = now()-start;
+  result->bytes = model.received;
+
+  if(result->loaded)
+    result->mismatches = check_memory(&model, snapshot, &state[PAGELIST]);
+
+  close(model.fd);
+
+  if(slave >= 0)
+    close(slave);
+
+  if(model.sender > 0)
+    waitpid(model.sender, &status, 0);
+
+  return 1;
+}
+
+/* Listen on STANDIN_HOST for the sender, which is given the port to
+   connect to as portName, of size. Returns 0, having said why, if the
+   stand-in cannot listen. */
+static int open_standin(struct zxtrans_bench_model *model,
+			const char *transport, char *portName,
+			size_t size){
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = 0;		/* Any port that is free */
+  inet_pton(AF_INET, STANDIN_HOST, &address.sin_addr);
+
+  if(-1 == (model->fd = socket(AF_INET, SOCK_STREAM, 0)) || \
+     0 != bind(model->fd, (struct sockaddr *) &address, length) || \
+     0 != listen(model->fd, 1) || \
+     0 != getsockname(model->fd, (struct sockaddr *) &address, &length)){
+    printf("Unable to open stand-in terminal server.\n");
+
+    if(model->fd >= 0)
+      close(model->fd);
+
+    return 0;
+  }
+
+  model->telnet = (0 == strcmp(transport, "rfc2217"));
+  snprintf(portName, size, "%s://%s:%d", transport, STANDIN_HOST, \
+	   ntohs(address.sin_port));
+
+  return 1;
+}
+
+/* Wait for the sender to connect to the stand-in terminal server,
+   which then stops listening. Returns 0 if the sender exits first.
+   Notifications go out at once, as from a real terminal server, and
+   not held back by Nagle's algorithm until the last is acknowledged. */
+static int accept_sender(struct zxtrans_bench_model *model){
+  struct pollfd ready = {model->fd, POLLIN, 0};
+  int connection, status;
+  int noDelay = 1;
+
+  while(0 == poll(&ready, 1, POLL_MS))
+    if(model->sender == waitpid(model->sender, &status, WNOHANG)){
+      model->sender = 0;
+      return 0;
+    }
+
+  connection = accept(model->fd, NULL, NULL);
+  close(model->fd);
+  model->fd = connection;
+
+  if(connection >= 0)
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, \
+	       sizeof(noDelay));
+
+  return (connection >= 0);
+}
+
+/* Next byte from the sender, as the receiver would see it: CTS is
+   asserted only while waiting for data, and each byte keeps the
+   receiver busy for its time on the line plus the cost of reading it.
+   Returns -1 if sender stops before the stream is complete. */
+static int next_byte(struct zxtrans_bench_model *model){
+  struct zxtrans_bench_line *line = zxtrans_bench_line;
+  int baudRate;
+
+  while(model->next == model->length){
+    struct pollfd ready = {model->fd, POLLIN, 0};
+    ssize_t n;
+    int status;
+
+    sleep_until(model->due);
+    set_cts(model, 1);
+
+    if(0 == poll(&ready, 1, POLL_MS)){
+      if(model->sender > 0 && \
+	 model->sender == waitpid(model->sender, &status, WNOHANG)){
+	model->sender = 0;
+	set_cts(model, 0);
+	return -1;
+      }
+
+      continue;
+    }
+
+    n = read(model->fd, model->buffer, sizeof(model->buffer));
+    set_cts(model, 0);
+
+    if(n <= 0){
+      if(n < 0 && EINTR == errno)
+	continue;
+
+      return -1;
+    }
+
+    model->length = model->telnet ? take_telnet(model, n) : (size_t) n;
+    model->next = 0;
+
+    if(now() > model->due)
+      model->due = now();
+  }
+
+  baudRate = (model->received < line->baudChanged) ? line->lastBaudRate : \
+    line->baudRate;
+  model->due += (double) BITS_PER_BYTE/baudRate + model->readSeconds;
+  model->received++;
+
+  return model->buffer[model->next++];
+}
+
+/* As a terminal server would, notify the sender of changes to CTS
+   over RFC 2217 */
+static void set_cts(struct zxtrans_bench_model *model, int cts){
+  libspectrum_byte notify[] = {TELNET_IAC, TELNET_SB, COM_PORT, \
+			       NOTIFY_MODEMSTATE, 0, TELNET_IAC, TELNET_SE};
+
+  if(model->telnet && cts != zxtrans_bench_line->cts){
+    notify[4] = cts ? MODEMSTATE_CTS : 0;
+
+    if(write(model->fd, notify, sizeof(notify)) < 0)
+      model->telnet = 0;	/* Sender has gone */
+  }
+
+  zxtrans_bench_line->cts = cts;
+}
+
+/* Take the data from length bytes of telnet stream in model->buffer,
+   acting on changes to baud rate and RTS as they come. Returns the
+   number of bytes of data, which are moved to the start. */
+static size_t take_telnet(struct zxtrans_bench_model *model, size_t length){
+  struct zxtrans_bench_line *line = zxtrans_bench_line;
+  size_t data = 0;
+
+  for(size_t i=0; i<length; i++){
+    libspectrum_byte c = model->buffer[i];
+
+    switch(model->telnetState){
+    case IN_DATA:
+      if(TELNET_IAC == c)
+	model->telnetState = TELNET_IAC;
+      else
+	model->buffer[data++] = c;
+      break;
+
+    case TELNET_IAC:
+      model->telnetState = IN_DATA;
+      model->subLength = 0;
+
+      if(TELNET_IAC == c)
+	model->buffer[data++] = c;
+      else if(TELNET_SB == c || c >= TELNET_WILL)
+	model->telnetState = c;	/* Subnegotiation or option follows */
+      break;
+
+    case TELNET_SB:
+      if(TELNET_IAC == c)
+	model->telnetState = IN_SUB_IAC;
+      else if(model->subLength < STANDIN_SUB)
+	model->sub[model->subLength++] = c;
+      break;
+
+    case IN_SUB_IAC:
+      model->telnetState = TELNET_SB;
+
+      if(TELNET_IAC == c){
+	if(model->subLength < STANDIN_SUB)
+	  model->sub[model->subLength++] = c;
+
+	break;
+      }
+
+      model->telnetState = IN_DATA;
+
+      if(TELNET_SE != c || model->subLength < 3 || COM_PORT != model->sub[0])
+	break;
+
+      /* Bytes ahead of a new rate in the stream are sent at the old */
+      if(SET_BAUDRATE == model->sub[1] && 6 == model->subLength){
+	line->lastBaudRate = line->baudRate;
+	line->baudRate = model->sub[2] << 24 | model->sub[3] << 16 | \
+	  model->sub[4] << 8 | model->sub[5];
+	line->baudChanged = model->received + data;
+      }
+      else if(SET_CONTROL == model->sub[1] && \
+	      CONTROL_RTS_ON == model->sub[2])
+	line->rts = 1;
+      else if(SET_CONTROL == model->sub[1] && \
+	      CONTROL_RTS_OFF == model->sub[2])
+	line->rts = 0;
+      break;
+
+    default:			/* Options are taken as offered */
+      model->telnetState = IN_DATA;
+      break;
+    }
+  }
+
+  return data;
+}
+
+/* Read test pattern at the rate the sender starts with, as the +3
+   receiver does before its fast serial loop, then the go-ahead. Returns
+   0 if the pattern is not whole. */
+static int settle_rate(struct zxtrans_bench_model *model){
+  libspectrum_byte pattern[ZXTRANS_LADDER_LEN];
+
+  zxtrans_image_ladder(pattern);
+
+  for(int i=0; i<ZXTRANS_LADDER_LEN; i++)
+    if(pattern[i] != next_byte(model))
+      return 0;
+
+  /* Sender takes CTS coming back soon as a pass */
+  model->due += LADDER_PAUSE;
+
+  return next_byte(model) >= 0;
+}
+
+/* Receiver time to fill or copy bytes */
+static void busy(struct zxtrans_bench_model *model, size_t bytes){
+  model->due += bytes*LDIR_TSTATES/Z80_CLOCK;
+}
+
+/* Load page pageList[index], in the form zxtrans_image_page() prepares
+   it. Returns 0 if the stream ends early or is malformed. */
+static int load_page(struct zxtrans_bench_model *model,
+		     const libspectrum_byte *pageList, int index, int flags){
+  int pageNo = pageList[index];
+  libspectrum_byte *page = model->memory[pageNo];
+  size_t length;
+
+  if(!(flags & ZXTRANS_FLAG_SPANS))
+    return load_data(model, page, 0, ZXTRANS_PAGELEN, flags);
+
+  for(size_t pos=0; pos<ZXTRANS_PAGELEN; pos+=length){
+    int low = next_byte(model);
+    int high = next_byte(model);
+    int param = 0;
+    int type;
+    const libspectrum_byte *source;
+
+    if(low < 0 || high < 0)
+      return 0;
+
+    type = high>>5;
+    length = ((high & 0x1F)<<8 | low) + 1;
+
+    if(pos+length > ZXTRANS_PAGELEN)
+      return 0;
+
+    if(ZXTRANS_SPAN_COPY == type || ZXTRANS_SPAN_BANK == type){
+      low = next_byte(model);
+      high = next_byte(model);
+
+      if(low < 0 || high < 0)
+	return 0;
+
+      param = high<<8 | low;
+    }
+
+    switch(type){
+    case ZXTRANS_SPAN_DATA:
+      if(!load_data(model, page, pos, pos+length, flags))
+	return 0;
+
+      break;
+    case ZXTRANS_SPAN_ZERO:
+      memset(&page[pos], 0, length);
+      busy(model, length);
+      break;
+    case ZXTRANS_SPAN_COPY:
+      /* Address in memory map, with page being loaded at 0xC000 */
+      if(param < 0x4000 || (param & 0x3FFF)+length > ZXTRANS_PAGELEN)
+	return 0;
+
+      source = model->memory[(0x4000 == (param & 0xC000)) ? 5 : \
+			     (0x8000 == (param & 0xC000)) ? 2 : pageNo];
+      memmove(&page[pos], &source[param & 0x3FFF], length);
+      busy(model, length);
+      break;
+    case ZXTRANS_SPAN_BANK:
+      memmove(&page[pos], &model->memory[param & 7][pos], length);
+      busy(model, length);
+      break;
+    case ZXTRANS_SPAN_KEEP:
+      break;
+    default:
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Load bytes start to end-1 of page, unpacking if flags say they are
+   packed (see zxtrans_pack.h) */
+static int load_data(struct zxtrans_bench_model *model,
+		     libspectrum_byte *page, size_t start, size_t end,
+		     int flags){
+  size_t pos = start;
+
+  while(pos < end){
+    int token = next_byte(model);
+    size_t length, offset;
+
+    if(token < 0)
+      return 0;
+
+    if(!(flags & ZXTRANS_FLAG_PACKED)){
+      page[pos++] = token;
+      continue;
+    }
+
+    if(token < 0x80){
+      if(pos+token+1 > end)
+	return 0;
+
+      for(int i=0; i<=token; i++){
+	int byte = next_byte(model);
+
+	if(byte < 0)
+	  return 0;
+
+	page[pos++] = byte;
+      }
+
+      continue;
+    }
+
+    length = token & ZXTRANS_PACK_LENGTH_EXT;
+
+    if(ZXTRANS_PACK_LENGTH_EXT == length){
+      int extra = next_byte(model);
+
+      if(extra < 0)
+	return 0;
+
+      length += extra;
+    }
+
+    if(token & 0x40){
+      int low = next_byte(model);
+      int high = next_byte(model);
+
+      if(low < 0 || high < 0)
+	return 0;
+
+      length += ZXTRANS_PACK_LONG_MIN;
+      offset = high<<8 | low;
+    }
+    else{
+      int byte = next_byte(model);
+
+      if(byte < 0)
+	return 0;
+
+      length += ZXTRANS_PACK_SHORT_MIN;
+      offset = byte+1;
+    }
+
+    if(offset > pos || pos+length > end)
+      return 0;
+
+    /* Byte at a time, as LDIR repeats overlapping data */
+    for(size_t i=0; i<length; i++, pos++)
+      page[pos] = page[pos-offset];
+
+    busy(model, length);
+  }
+
+  return 1;
+}
+
+/* Count bytes of the pages sent that differ from the snapshot */
+static int check_memory(struct zxtrans_bench_model *model,
+			libspectrum_snap *snapshot,
+			const libspectrum_byte *pageList){
+  int mismatches = 0;
+
+  for(int i=0; i<8 && 0xFF != pageList[i]; i++){
+    const libspectrum_byte *page = \
+      libspectrum_snap_pages(snapshot, pageList[i]);
+
+    for(int j=0; j<ZXTRANS_PAGELEN; j++)
+      mismatches += (page[j] != model->memory[pageList[i]][j]);
+  }
+
+  return mismatches;
+}
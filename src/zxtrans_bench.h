@@ -0,0 +1,56 @@
+/*
+   ZX-Trans Bench - loopback benchmark of the sender against a model of
+   the receiver, over a pseudo-terminal.
+
+   waiting on changes to the CTS line rather than polling it.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_BENCH_H
+#define ZXTRANS_BENCH_H
+
+/* Pseudo-terminals have no modem lines, so the bench's own serial port
+   (zxtrans_bench_port.c) keeps them here, in memory shared between the
+   sender and the receiver model. Baud rate is recorded with the number
+   of bytes written when it last changed, so bytes already on their way
+   arrive at the old rate. */
+struct zxtrans_bench_line {
+  volatile int rts;		/* Set by sender */
+  volatile int cts;		/* Set by receiver model */
+  volatile int baudRate;
+  volatile int lastBaudRate;	/* Rate before last change */
+  volatile unsigned long baudChanged; /* Bytes written at last change */
+  volatile unsigned long written; /* Bytes written by sender */
+};
+
+extern struct zxtrans_bench_line *zxtrans_bench_line;
+
+/* Sender's main(), built into the bench under this name */
+int zxtrans_sender_main(int argc, char *argv[]);
+
+#endif
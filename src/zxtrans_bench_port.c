@@ -0,0 +1,241 @@
+/*
+   ZX-Trans Bench Port - the parts of libserialport used by the sender,
+   implemented over a pseudo-terminal for the loopback benchmark.
+
+   waiting on changes to the CTS line rather than polling it.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _XOPEN_SOURCE 700 /* For poll, strdup */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <libserialport.h>
+#include "zxtrans_bench.h"
+
+struct sp_port {
+  char *name;
+  int fd;
+};
+
+struct zxtrans_bench_line *zxtrans_bench_line=NULL;
+
+enum sp_return sp_get_port_by_name(const char *portname,
+				   struct sp_port **port_ptr){
+  struct sp_port *port;
+
+  if(NULL == (port = malloc(sizeof(*port))))
+    return SP_ERR_MEM;
+
+  if(NULL == (port->name = strdup(portname))){
+    free(port);
+    return SP_ERR_MEM;
+  }
+
+  port->fd = -1;
+  *port_ptr = port;
+
+  return SP_OK;
+}
+
+void sp_free_port(struct sp_port *port){
+  if(NULL == port)
+    return;
+
+  free(port->name);
+  free(port);
+}
+
+enum sp_return sp_open(struct sp_port *port, enum sp_mode flags){
+  struct termios term;
+
+  (void) flags;
+
+  if(NULL == zxtrans_bench_line || \
+     -1 == (port->fd = open(port->name, O_RDWR | O_NOCTTY)))
+    return SP_ERR_FAIL;
+
+  /* Raw bytes, as a serial port would carry them */
+  if(0 == tcgetattr(port->fd, &term)){
+    term.c_iflag = 0;
+    term.c_oflag = 0;
+    term.c_lflag = 0;
+    term.c_cflag = (term.c_cflag & ~(CSIZE | PARENB)) | CS8 | CREAD;
+    tcsetattr(port->fd, TCSANOW, &term);
+  }
+
+  return SP_OK;
+}
+
+enum sp_return sp_close(struct sp_port *port){
+  close(port->fd);
+  port->fd = -1;
+
+  return SP_OK;
+}
+
+enum sp_return sp_get_port_handle(const struct sp_port *port,
+				  void *result_ptr){
+  (void) port;
+  (void) result_ptr;
+
+  /* No modem lines to wait on, so flow control polls */
+  return SP_ERR_SUPP;
+}
+
+void sp_free_config(struct sp_port_config *config){
+  (void) config;
+}
+
+enum sp_return sp_set_baudrate(struct sp_port *port, int baudrate){
+  (void) port;
+
+  if(baudrate <= 0)
+    return SP_ERR_ARG;
+
+  zxtrans_bench_line->lastBaudRate = (0 == zxtrans_bench_line->baudRate) ? \
+    baudrate : zxtrans_bench_line->baudRate;
+  zxtrans_bench_line->baudChanged = zxtrans_bench_line->written;
+  zxtrans_bench_line->baudRate = baudrate;
+
+  return SP_OK;
+}
+
+/* Model times each byte at the rate in force when it was written, so
+   there is no need to wait for earlier ones to reach it */
+enum sp_return sp_drain(struct sp_port *port){
+  (void) port;
+
+  return SP_OK;
+}
+
+enum sp_return sp_set_bits(struct sp_port *port, int bits){
+  (void) port;
+
+  return (8 == bits) ? SP_OK : SP_ERR_SUPP;
+}
+
+enum sp_return sp_set_parity(struct sp_port *port, enum sp_parity parity){
+  (void) port;
+
+  return (SP_PARITY_NONE == parity) ? SP_OK : SP_ERR_SUPP;
+}
+
+enum sp_return sp_set_stopbits(struct sp_port *port, int stopbits){
+  (void) port;
+
+  return (1 == stopbits) ? SP_OK : SP_ERR_SUPP;
+}
+
+/* Receiver model holds back reading while it is busy, so the
+   pseudo-terminal's buffer provides the hardware flow control */
+enum sp_return sp_set_flowcontrol(struct sp_port *port,
+				  enum sp_flowcontrol flowcontrol){
+  (void) port;
+  (void) flowcontrol;
+
+  return SP_OK;
+}
+
+enum sp_return sp_set_rts(struct sp_port *port, enum sp_rts rts){
+  (void) port;
+
+  zxtrans_bench_line->rts = (SP_RTS_ON == rts);
+
+  return SP_OK;
+}
+
+enum sp_return sp_get_signals(struct sp_port *port,
+			      enum sp_signal *signal_mask){
+  (void) port;
+
+  *signal_mask = zxtrans_bench_line->cts ? SP_SIG_CTS : 0;
+
+  return SP_OK;
+}
+
+enum sp_return sp_blocking_write(struct sp_port *port, const void *buf,
+				 size_t count, unsigned int timeout_ms){
+  const unsigned char *bytes = buf;
+  size_t written=0;
+
+  while(written < count){
+    struct pollfd ready = {port->fd, POLLOUT, 0};
+    ssize_t n;
+
+    if(poll(&ready, 1, (0 == timeout_ms) ? -1 : (int) timeout_ms) <= 0)
+      break;
+
+    if((n = write(port->fd, &bytes[written], count-written)) < 0){
+      if(EINTR == errno || EAGAIN == errno)
+	continue;
+
+      return (0 == written) ? SP_ERR_FAIL : (enum sp_return) written;
+    }
+
+    written += n;
+    zxtrans_bench_line->written += n;
+  }
+
+  /* Receiver drops CTS as soon as data reaches it, before the model
+     gets around to reading it */
+  if(written > 0)
+    zxtrans_bench_line->cts = 0;
+
+  return (enum sp_return) written;
+}
+
+/* Receiver model never answers, so reads wait out their timeout */
+enum sp_return sp_blocking_read(struct sp_port *port, void *buf,
+				size_t count, unsigned int timeout_ms){
+  struct pollfd ready = {port->fd, POLLIN, 0};
+  ssize_t n;
+
+  if(0 == count || \
+     poll(&ready, 1, (0 == timeout_ms) ? -1 : (int) timeout_ms) <= 0)
+    return 0;
+
+  if((n = read(port->fd, buf, count)) < 0)
+    return (EINTR == errno || EAGAIN == errno) ? 0 : SP_ERR_FAIL;
+
+  return (enum sp_return) n;
+}
+
+/* Model drops CTS as soon as bytes are written, not once it has them,
+   so output is left for it to read */
+enum sp_return sp_flush(struct sp_port *port, enum sp_buffer buffers){
+  if(SP_BUF_INPUT & buffers)
+    tcflush(port->fd, TCIFLUSH);
+
+  return SP_OK;
+}
@@ -0,0 +1,58 @@
+/*
+   ZX-Trans Binaries - Z80 programs built into the sender, so that
+   nothing need be found on disk when it runs.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_BINARIES_H
+#define ZXTRANS_BINARIES_H
+
+/* Generated by the Makefile with xxd -i from the binaries in the top
+   directory, so each is named after its file:
+
+     zxtrans_stub.bin            IF1 boot-strap program and receiver,
+                                 as loaded by the Interface 1 ROM
+     zxtrans_receiver.bin        IF1 receiver, with tape header
+     zxtrans_receiver_plus3.bin  +3 receiver, with tape header
+     zxtrans_receiver_plus3_direct.bin
+                                 +3 receiver that loads in place, with
+                                 tape header
+     zxtrans_receiver_tape.bin   Tape receiver, with tape header */
+
+extern unsigned char zxtrans_stub_bin[];
+extern unsigned int zxtrans_stub_bin_len;
+extern unsigned char zxtrans_receiver_bin[];
+extern unsigned int zxtrans_receiver_bin_len;
+extern unsigned char zxtrans_receiver_plus3_bin[];
+extern unsigned int zxtrans_receiver_plus3_bin_len;
+extern unsigned char zxtrans_receiver_plus3_direct_bin[];
+extern unsigned int zxtrans_receiver_plus3_direct_bin_len;
+extern unsigned char zxtrans_receiver_tape_bin[];
+extern unsigned int zxtrans_receiver_tape_bin_len;
+
+#endif
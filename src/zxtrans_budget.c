@@ -0,0 +1,826 @@
+/*
+   ZX-Trans Budget - runs the receiver programs in a Z80 core, with
+   serial input stubbed, to count the T-states they spend on each byte,
+   each page and the final relocation.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _XOPEN_SOURCE 700 /* For mkstemp */
+
+#define Z80_CLOCK 3546900.0 /* T-states per second, 128k and +3 */
+#define BITS_PER_BYTE 10 /* Start, 8 data and stop bits */
+#define BYTE_BUDGET 280 /* Default T-states receiver may spend on each
+			   byte, on average ... */
+#define PACKED_BYTE_BUDGET 600 /* ... or with -z or -m */
+#define RELOCATE_BUDGET 13000 /* Default T-states for moving the system
+				 variables into place */
+#define STEP_LIMIT 200000000UL /* Instructions before receiver is taken
+				  to be stuck */
+#define CODELEN 80 /* Length of Z80 set-state block */
+#define PAGELIST 70 /* Offset of page list in set-state block */
+#define STATE_PHASE 8 /* Phase for set-state block, after pages 0-7 */
+#define RETURN_ADDR 0x0001 /* Where receiver returns to BASIC, in place
+			      of the USR call */
+#define RECEIVER_START 0x4000
+#define RECEIVER_HEADER 9 /* Tape header before receiver's code */
+#define PROG 0x5C53 /* Address of BASIC program, and so end of system
+		       variables */
+#define BANKM 0x5B5C /* Copy of last write to port 0x7FFD */
+#define BANK678 0x5B67 /* Copy of last write to port 0x1FFD */
+#define DIRECT_HOME_BANK 3 /* Bank the receiver that loads in place
+			      runs from */
+#define IF1_READ_BYTE 0x1D /* Interface 1 hook codes, after RST 8 */
+#define IF1_WRITE_BYTE 0x1E
+#define PLUS3_READ_BYTE 0x3A00 /* +3 ROM serial read */
+#define LINE_RATE 57600 /* Baud rate of serial line modelled on the AY
+			   port, the first of ZXTRANS_LADDER_RATES, which
+			   the sender's test pattern is for */
+#define CTS_BITS 1 /* Bit times sender takes to start a byte once CTS
+		       is asserted */
+#define AY_PORT_A 14 /* AY register holding RS232 lines */
+#define AY_CTS_BUSY 0x04 /* Bit of it that stops sender (CTS) */
+#define AY_RXD_SPACE 0x80 /* Bit of it set while RXD is a zero */
+#define IN_SAMPLE 9 /* T-states into IN r,(C) that port is read ... */
+#define OUT_WRITE 8 /* ... and into OUT (C),r that it is written */
+#define RECEIVERS 3
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <libspectrum.h>
+#include "zxtrans_bench.h"
+#include "zxtrans_binaries.h"
+#include "zxtrans_image.h"
+#include "zxtrans_z80.h"
+
+/* Receiver program, built into this tool as into the sender */
+struct zxtrans_budget_receiver {
+  const char *name;
+  const unsigned char *code;
+  const unsigned int *length;
+  libspectrum_word prog;	/* PROG, as the receiver is started */
+  const char *mode;		/* Sender options it needs, or NULL */
+  int lineRate;			/* Baud rate of serial line it reads itself,
+				   on the AY port, or 0 */
+  libspectrum_word pause;	/* Pauses on CTS while settling the baud
+				   rate, skipped as waits, or 0 */
+  int inPlace;			/* Loads in place, with special paging */
+};
+
+/* T-states spent between reads while loading one part of the
+   snapshot, charged to the part last written to */
+struct zxtrans_budget_phase {
+  unsigned long bytes;
+  unsigned long long tstates;
+  unsigned long longest;	/* Longest gap between reads */
+};
+
+/* 128k Spectrum, with the ROM reduced to its serial routines */
+struct zxtrans_budget_machine {
+  struct zxtrans_z80 cpu;
+  libspectrum_byte memory[8][ZXTRANS_PAGELEN];
+  libspectrum_byte rom[ZXTRANS_PAGELEN];
+  int bank;
+  int locked;
+  int paging;			/* Snapshot is for a 128k model, or
+				   receiver pages for itself */
+  int special;			/* Last write to port 0x1FFD */
+  int inPlace;
+  /* Serial line on the AY port, for a receiver that reads it itself */
+  double bitTstates;		/* 0 if the line is not modelled */
+  int ayRegister;
+  libspectrum_byte ayPortA;
+  double ctsSince;		/* When CTS was asserted, or -1 */
+  double byteStart;		/* When byte on line started, or -1 */
+  double lineFree;		/* When last byte on line ended */
+  double lastSample;		/* When receiver last read the line */
+  double lineSince;		/* When line could carry byte on it */
+  double lineTstates;		/* Spent by the sender on the line */
+  size_t goAhead;		/* Go-ahead after test pattern, once the
+				   line carries the pattern */
+  const libspectrum_byte *stream;
+  size_t length;
+  size_t next;
+  int phase;			/* Page being loaded, or STATE_PHASE */
+  unsigned long long lastRead;	/* T-states at last byte read */
+  struct zxtrans_budget_phase phases[STATE_PHASE+1];
+};
+
+/* Pause for the receiver that loads in place is its ZXT_PAUSE, so must
+   follow the assembler source */
+static const struct zxtrans_budget_receiver receivers[RECEIVERS] = {
+  {"inf1", zxtrans_receiver_bin, &zxtrans_receiver_bin_len, 0x5D05, \
+   NULL, 0, 0, 0},
+  {"plus3", zxtrans_receiver_plus3_bin, &zxtrans_receiver_plus3_bin_len, \
+   0x5CCB, NULL, 0, 0, 0},
+  {"direct", zxtrans_receiver_plus3_direct_bin, \
+   &zxtrans_receiver_plus3_direct_bin_len, 0x5CCB, "-pf2", LINE_RATE, \
+   0xC402, 1}
+};
+
+static void usage(void);
+static libspectrum_snap *read_snapshot(const char *filename);
+static libspectrum_byte *make_stream(const char *snapshotName,
+				     const char *mode, const char *options,
+				     int verbose, size_t *length);
+static int run_receiver(const struct zxtrans_budget_receiver *receiver,
+			libspectrum_snap *snapshot,
+			const libspectrum_byte *stream, size_t length,
+			unsigned long byteBudget,
+			unsigned long relocateBudget);
+static int check_memory(struct zxtrans_budget_machine *machine,
+			libspectrum_snap *snapshot);
+static int bank_at(struct zxtrans_budget_machine *machine,
+		   libspectrum_word addr);
+static libspectrum_byte *address(struct zxtrans_budget_machine *machine,
+				 libspectrum_word addr);
+static uint8_t read_memory(struct zxtrans_z80 *cpu, uint16_t addr);
+static void write_memory(struct zxtrans_z80 *cpu, uint16_t addr,
+			 uint8_t value);
+static uint8_t read_port(struct zxtrans_z80 *cpu, uint16_t port);
+static void write_port(struct zxtrans_z80 *cpu, uint16_t port,
+		       uint8_t value);
+static int serial_read(struct zxtrans_budget_machine *machine);
+static void charge(struct zxtrans_budget_machine *machine,
+		   unsigned long long at);
+static void line_advance(struct zxtrans_budget_machine *machine, double t);
+static int line_space(struct zxtrans_budget_machine *machine, double t);
+static void ret(struct zxtrans_z80 *cpu);
+
+int main(int argc, char *argv[]){
+  const char *only = NULL;
+  unsigned long byteBudget = 0;
+  unsigned long relocateBudget = RELOCATE_BUDGET;
+  int verbose = 0;
+  char options[8] = "";
+  int failed = 0;
+  int known = 0;
+  int opt;
+  libspectrum_snap *snapshot;
+  libspectrum_byte *stream;
+  size_t length;
+
+  while((opt = getopt(argc, argv, "r:b:e:zmvh")) != -1){
+    switch(opt){
+    case 'r' : /* Only run one receiver */
+      only = optarg;
+      break;
+    case 'b' : /* Budget for each byte */
+      byteBudget = strtoul(optarg, NULL, 10);
+      break;
+    case 'e' : /* Budget for final relocation */
+      relocateBudget = strtoul(optarg, NULL, 10);
+      break;
+    case 'z' : /* Options passed on to sender */
+    case 'm' :
+      if(NULL == strchr(options, opt))
+	options[strlen(options)] = opt;
+
+      break;
+    case 'v' :
+      verbose = 1;
+      break;
+    case 'h' :
+    default:
+      usage();
+      exit('h' == opt ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if(optind != argc-1){
+    usage();
+    exit(EXIT_FAILURE);
+  }
+
+  for(int i=0; i<RECEIVERS; i++)
+    known |= (NULL == only || 0 == strcmp(only, receivers[i].name));
+
+  if(!known){
+    printf("Receiver must be inf1, plus3 or direct.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(0 == byteBudget)
+    byteBudget = options[0] ? PACKED_BYTE_BUDGET : BYTE_BUDGET;
+
+  libspectrum_init();
+
+  if(NULL == (snapshot = read_snapshot(argv[optind])))
+    exit(EXIT_FAILURE);
+
+  printf("%-8s %-6s %8s %11s %7s %7s\n", "Receiver", "Part", "Bytes", \
+	 "T-states", "T/byte", "Longest");
+
+  for(int i=0; i<RECEIVERS; i++){
+    libspectrum_word sp = libspectrum_snap_sp(snapshot);
+
+    if(NULL != only && 0 != strcmp(only, receivers[i].name))
+      continue;
+
+    /* As the sender checks with -p, the receiver that loads in place
+       takes only 16k and 48k snapshots, with room below the stack */
+    if(receivers[i].inPlace && \
+       ((LIBSPECTRUM_MACHINE_CAPABILITY_128_MEMORY & \
+	 libspectrum_machine_capabilities(libspectrum_snap_machine(snapshot))) \
+	|| (0 != sp && sp < ZXTRANS_DIRECT_SP_MIN))){
+      printf("%-8s cannot load this snapshot in place\n", receivers[i].name);
+      failed |= (NULL != only);
+      continue;
+    }
+
+    if(NULL == (stream = make_stream(argv[optind], receivers[i].mode, \
+				     options, verbose, &length))){
+      failed = 1;
+      continue;
+    }
+
+    failed |= !run_receiver(&receivers[i], snapshot, stream, length, \
+			    byteBudget, relocateBudget);
+    free(stream);
+  }
+
+  libspectrum_snap_free(snapshot);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(void){
+  printf("ZX-Trans Budget: counts the receivers' T-states for a snapshot\n");
+  printf("Usage: zxtrans_budget [options] <snapshot filename>\n");
+  printf(" -r<receiver>\t\tOnly run inf1, plus3 or direct (default: all)\n");
+  printf(" -b<T-states>\t\tMost for each byte, on average (default: %d,\n", \
+	 BYTE_BUDGET);
+  printf("\t\t\tor %d with -z or -m)\n", PACKED_BYTE_BUDGET);
+  printf(" -e<T-states>\t\tMost for final relocation (default: %d)\n", \
+	 RELOCATE_BUDGET);
+  printf(" -z, -m\t\t\tPassed on to sender\n");
+  printf(" -v\t\t\tShow sender's output\n");
+}
+
+static libspectrum_snap *read_snapshot(const char *filename){
+  FILE *file;
+  long length;
+  libspectrum_byte *buffer;
+  libspectrum_snap *snapshot;
+  libspectrum_id_t type;
+  libspectrum_class_t class;
+
+  if(NULL == (file = fopen(filename, "rb"))){
+    printf("Error opening input file.\n");
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if(length <= 0 || NULL == (buffer = malloc(length)) || \
+     fread(buffer, 1, length, file) != (size_t) length){
+    printf("Error reading input file.\n");
+    fclose(file);
+    return NULL;
+  }
+
+  fclose(file);
+  snapshot = libspectrum_snap_alloc();
+
+  if(libspectrum_identify_file_with_class(&type, &class, filename, \
+					  buffer, length) || \
+     LIBSPECTRUM_CLASS_SNAPSHOT != class || \
+     libspectrum_snap_read(snapshot, buffer, length, type, filename)){
+    printf("Input file is not a snapshot.\n");
+    libspectrum_snap_free(snapshot);
+    snapshot = NULL;
+  }
+
+  free(buffer);
+
+  return snapshot;
+}
+
+/* Have the sender write the snapshot to a temporary file, as it would
+   send it (in mode 0, or as mode gives, without the Interface 1
+   boot-strap), and read that back. Returns NULL, having said why, if
+   it cannot. */
+static libspectrum_byte *make_stream(const char *snapshotName,
+				     const char *mode, const char *options,
+				     int verbose, size_t *length){
+  char fileName[] = "/tmp/zxtrans_budgetXXXXXX";
+  char senderOptions[8];
+  char *senderArgv[8];
+  int senderArgc = 0;
+  libspectrum_byte *stream = NULL;
+  FILE *file;
+  pid_t sender;
+  long size;
+  int fd, status;
+
+  if(-1 == (fd = mkstemp(fileName))){
+    printf("Unable to create temporary file.\n");
+    return NULL;
+  }
+
+  close(fd);
+  snprintf(senderOptions, sizeof(senderOptions), "-n%s", options);
+  senderArgv[senderArgc++] = "zxtrans";
+  senderArgv[senderArgc++] = "-o";
+  senderArgv[senderArgc++] = fileName;
+  senderArgv[senderArgc++] = senderOptions;
+
+  if(NULL != mode)
+    senderArgv[senderArgc++] = (char *) mode;
+
+  senderArgv[senderArgc++] = (char *) snapshotName;
+  senderArgv[senderArgc] = NULL;
+
+  fflush(stdout);
+
+  if(-1 == (sender = fork())){
+    printf("Unable to start sender.\n");
+    unlink(fileName);
+    return NULL;
+  }
+
+  if(0 == sender){
+    int quiet = open("/dev/null", O_WRONLY);
+
+    if(!verbose && quiet >= 0)
+      dup2(quiet, STDOUT_FILENO);
+
+    /* Sender parses its own options afresh */
+    optind = 1;
+    exit(zxtrans_sender_main(senderArgc, senderArgv));
+  }
+
+  if(sender != waitpid(sender, &status, 0) || !WIFEXITED(status) || \
+     EXIT_SUCCESS != WEXITSTATUS(status)){
+    printf("Sender failed to write snapshot.\n");
+    unlink(fileName);
+    return NULL;
+  }
+
+  if(NULL == (file = fopen(fileName, "rb"))){
+    printf("Error opening temporary file.\n");
+    unlink(fileName);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if(size < CODELEN || NULL == (stream = malloc(size)) || \
+     fread(stream, 1, size, file) != (size_t) size){
+    printf("Error reading temporary file.\n");
+    free(stream);
+    stream = NULL;
+  }
+
+  fclose(file);
+  unlink(fileName);
+  *length = size;
+
+  return stream;
+}
+
+/* Run receiver on stream, as if started with USR 16384, until it jumps
+   to the snapshot's program counter, and report the T-states it took.
+   Serial reads are answered at once, so only the receiver's own time is
+   counted (not the ROM's, or the wait for bytes to arrive). A receiver
+   that reads the serial line itself runs against a modelled line, whose
+   time is taken off its own. Returns 0 if the receiver goes wrong or is
+   over budget. */
+static int run_receiver(const struct zxtrans_budget_receiver *receiver,
+			libspectrum_snap *snapshot,
+			const libspectrum_byte *stream, size_t length,
+			unsigned long byteBudget,
+			unsigned long relocateBudget){
+  static struct zxtrans_budget_machine machine;
+  struct zxtrans_z80 *cpu = &machine.cpu;
+  libspectrum_word target = libspectrum_snap_pc(snapshot);
+  unsigned long long relocate = 0, finish, loading, bytes = 0;
+  unsigned long steps = 0;
+  const char *fault = NULL;
+  double own;
+  int mismatches;
+
+  memset(&machine, 0, sizeof(machine));
+  memset(machine.rom, 0xFF, sizeof(machine.rom));
+
+  /* Memory starts full of something other than the snapshot, so a part
+     the receiver fails to load shows up */
+  for(int i=0; i<8; i++)
+    for(int j=0; j<ZXTRANS_PAGELEN; j++)
+      machine.memory[i][j] = j*7 + i*13;
+
+  memcpy(machine.memory[5], receiver->code+RECEIVER_HEADER, \
+	 *receiver->length-RECEIVER_HEADER);
+  machine.memory[5][PROG-0x4000] = receiver->prog & 0xFF;
+  machine.memory[5][PROG+1-0x4000] = receiver->prog >> 8;
+  machine.memory[5][BANKM-0x4000] = 0x10;
+  machine.memory[5][BANK678-0x4000] = 0x04;
+  machine.paging = receiver->inPlace || \
+    (LIBSPECTRUM_MACHINE_CAPABILITY_128_MEMORY & \
+     libspectrum_machine_capabilities(libspectrum_snap_machine(snapshot)));
+  machine.inPlace = receiver->inPlace;
+  machine.ctsSince = machine.byteStart = -1;
+
+  if(receiver->lineRate > 0)
+    machine.bitTstates = Z80_CLOCK/receiver->lineRate;
+
+  machine.stream = stream;
+  machine.length = length;
+  machine.phase = STATE_PHASE;
+
+  zxtrans_z80_reset(cpu);
+  cpu->read = read_memory;
+  cpu->write = write_memory;
+  cpu->in = read_port;
+  cpu->out = write_port;
+  cpu->machine = &machine;
+  cpu->iy = 0x5C3A;
+  cpu->im = 1;
+  cpu->sp = 0x5BF0;
+  cpu->pc = RECEIVER_START;
+  cpu->sp -= 2;
+  *address(&machine, cpu->sp) = RETURN_ADDR & 0xFF;
+  *address(&machine, cpu->sp+1) = RETURN_ADDR >> 8;
+
+  while(NULL == fault && (target != cpu->pc || machine.next < length)){
+    if(++steps > STEP_LIMIT)
+      fault = "runs on without finishing";
+    else if(RETURN_ADDR == cpu->pc)
+      fault = "returned to BASIC";
+    else if(0x0008 == cpu->pc && 0 == strcmp(receiver->name, "inf1")){
+      libspectrum_word next = read_memory(cpu, cpu->sp) | \
+	read_memory(cpu, cpu->sp+1) << 8;
+      int code = read_memory(cpu, next);
+
+      /* Hook code follows RST 8, and is skipped on return */
+      ret(cpu);
+      cpu->pc++;
+
+      if(IF1_READ_BYTE == code){
+	if(!serial_read(&machine))
+	  fault = "read past end of stream";
+      }
+      else if(IF1_WRITE_BYTE != code)
+	fault = "called an unexpected Interface 1 hook";
+    }
+    else if(PLUS3_READ_BYTE == cpu->pc && !(machine.special & 1) && \
+	    0 != strcmp(receiver->name, "inf1")){
+      ret(cpu);
+
+      if(!serial_read(&machine))
+	fault = "read past end of stream";
+    }
+    else if(0 != receiver->pause && receiver->pause == cpu->pc){
+      /* Leaves B, DE and A at zero */
+      ret(cpu);
+      cpu->a = cpu->b = cpu->d = cpu->e = 0;
+    }
+    else if(cpu->pc < 0x4000 && !(machine.special & 1))
+      fault = "called an unexpected ROM routine";
+    else{
+      /* Once the last byte is read, the system variables held in the
+	 receiver's own space are copied into place */
+      int block = (machine.next == length && \
+		   0xED == read_memory(cpu, cpu->pc) && \
+		   0xB0 == read_memory(cpu, cpu->pc+1) && \
+		   cpu->h >= RECEIVER_START>>8 && \
+		   (cpu->h<<8 | cpu->l) < RECEIVER_START+ZXTRANS_DISP_SKIP_MAX);
+      int t = zxtrans_z80_step(cpu);
+
+      if(block)
+	relocate += t;
+    }
+  }
+
+  if(NULL != fault){
+    printf("%-8s %s after %lu of %lu bytes\n", receiver->name, fault, \
+	   (unsigned long) machine.next, (unsigned long) length);
+    return 0;
+  }
+
+  finish = cpu->tstates - machine.lastRead;
+  loading = machine.lastRead;
+  own = loading - machine.lineTstates;
+  mismatches = check_memory(&machine, snapshot);
+
+  for(int i=0; i<=STATE_PHASE; i++){
+    int phase = (i+STATE_PHASE) % (STATE_PHASE+1); /* State block first */
+    struct zxtrans_budget_phase *part = &machine.phases[phase];
+    char name[8];
+
+    if(0 == part->bytes)
+      continue;
+
+    if(STATE_PHASE == phase)
+      snprintf(name, sizeof(name), "state");
+    else
+      snprintf(name, sizeof(name), "page %d", phase);
+
+    bytes += part->bytes;
+    printf("%-8s %-6s %8lu %11llu %7.1f %7lu\n", receiver->name, name, \
+	   part->bytes, part->tstates, (double) part->tstates/part->bytes, \
+	   part->longest);
+  }
+
+  printf("%-8s %-6s %8s %11llu\n", receiver->name, "reloc", "", relocate);
+  printf("%-8s %-6s %8s %11llu\n", receiver->name, "finish", "", finish);
+
+  if(machine.bitTstates > 0)
+    printf("%-8s %-6s %8s %11.0f\n", receiver->name, "line", "", \
+	   machine.lineTstates);
+
+  printf("%-8s %-6s %8llu %11llu %7.1f          keeps up with %.0f baud\n", \
+	 receiver->name, "total", bytes, loading+finish, \
+	 (double) loading/bytes, Z80_CLOCK*BITS_PER_BYTE*bytes/loading);
+
+  if(mismatches > 0)
+    printf("%-8s %d bytes differ from snapshot\n", receiver->name, \
+	   mismatches);
+
+  if(own > byteBudget*bytes)
+    printf("%-8s over budget of %lu T-states a byte\n", receiver->name, \
+	   byteBudget);
+
+  if(relocate > relocateBudget)
+    printf("%-8s over budget of %lu T-states to relocate\n", \
+	   receiver->name, relocateBudget);
+
+  return 0 == mismatches && own <= byteBudget*bytes && \
+    relocate <= relocateBudget;
+}
+
+/* Count bytes of the pages sent that differ from the snapshot, except
+   for the start of the display, where the receiver itself runs, or,
+   loading in place, the hand-over code below the stack pointer */
+static int check_memory(struct zxtrans_budget_machine *machine,
+			libspectrum_snap *snapshot){
+  const libspectrum_byte *pageList = &machine->stream[PAGELIST];
+  long top = libspectrum_snap_sp(snapshot) ? \
+    libspectrum_snap_sp(snapshot) : 0x10000;
+  int mismatches = 0;
+
+  for(int i=0; i<8 && 0xFF != pageList[i]; i++){
+    int bank = pageList[i] & 7;
+    const libspectrum_byte *page = libspectrum_snap_pages(snapshot, bank);
+    long base = (5 == bank) ? 0x4000 : (2 == bank) ? 0x8000 : 0xC000;
+
+    for(int j=(5 == bank && !machine->inPlace) ? ZXTRANS_DISP_SKIP_MAX : 0; \
+	j<ZXTRANS_PAGELEN; j++)
+      if(!machine->inPlace || base+j < top-ZXTRANS_DIRECT_HANDOVER || \
+	 base+j >= top)
+	mismatches += (page[j] != machine->memory[bank][j]);
+  }
+
+  return mismatches;
+}
+
+/* RAM bank at addr, in the current paging, or -1 for ROM */
+static int bank_at(struct zxtrans_budget_machine *machine,
+		   libspectrum_word addr){
+  static const int special[4][4] = {
+    {0, 1, 2, 3}, {4, 5, 6, 7}, {4, 5, 6, 3}, {4, 7, 6, 3}
+  };
+
+  if(machine->special & 1)
+    return special[machine->special>>1 & 3][addr>>14];
+
+  switch(addr & 0xC000){
+  case 0x0000:
+    return -1;
+  case 0x4000:
+    return 5;
+  case 0x8000:
+    return 2;
+  default:
+    return machine->bank;
+  }
+}
+
+/* Memory at addr, in the current paging */
+static libspectrum_byte *address(struct zxtrans_budget_machine *machine,
+				 libspectrum_word addr){
+  int bank = bank_at(machine, addr);
+
+  return (bank < 0) ? &machine->rom[addr] : \
+    &machine->memory[bank][addr & 0x3FFF];
+}
+
+static uint8_t read_memory(struct zxtrans_z80 *cpu, uint16_t addr){
+  return *address(cpu->machine, addr);
+}
+
+/* Writes to ROM are the part of the display skipped. Writes to the
+   receiver's own space (its variables, stack and the system variables
+   it holds until the end), and to BANKM as it pages, leave the phase as
+   it was. Loading in place, only writes with special paging, outside
+   the receiver's bank, are loading. */
+static void write_memory(struct zxtrans_z80 *cpu, uint16_t addr,
+			 uint8_t value){
+  struct zxtrans_budget_machine *machine = cpu->machine;
+  int bank = bank_at(machine, addr);
+
+  if(bank < 0){
+    machine->phase = 5;
+    return;
+  }
+
+  machine->memory[bank][addr & 0x3FFF] = value;
+
+  if(machine->inPlace){
+    if((machine->special & 1) && DIRECT_HOME_BANK != bank)
+      machine->phase = bank;
+  }
+  else if(addr >= 0x4000+ZXTRANS_DISP_SKIP_MAX && BANKM != addr)
+    machine->phase = (addr < 0x8000) ? 5 : (addr < 0xC000) ? 2 : \
+      machine->bank;
+}
+
+/* RS232 lines, on the AY port, where the serial line is modelled */
+static uint8_t read_port(struct zxtrans_z80 *cpu, uint16_t port){
+  struct zxtrans_budget_machine *machine = cpu->machine;
+  double t = cpu->tstates + IN_SAMPLE;
+  uint8_t value;
+
+  if(0 == machine->bitTstates || 0xC000 != (port & 0xC002) || \
+     AY_PORT_A != machine->ayRegister)
+    return 0xFF;
+
+  value = (machine->ayPortA & ~AY_RXD_SPACE) | \
+    (line_space(machine, t) ? AY_RXD_SPACE : 0);
+  machine->lastSample = t;
+
+  return value;
+}
+
+/* 128k memory paging, on port 0x7FFD, +3 special paging, on port
+   0x1FFD (which the 128k decoding of 0x7FFD would also match), and
+   CTS, on the AY port, where the serial line is modelled */
+static void write_port(struct zxtrans_z80 *cpu, uint16_t port,
+		       uint8_t value){
+  struct zxtrans_budget_machine *machine = cpu->machine;
+
+  if(0x1000 == (port & 0xF002)){
+    if(machine->paging && !machine->locked)
+      machine->special = value & 7;
+  }
+  else if(machine->bitTstates > 0 && 0xC000 == (port & 0xC002))
+    machine->ayRegister = value & 0x0F;
+  else if(machine->bitTstates > 0 && 0x8000 == (port & 0xC002)){
+    double t = cpu->tstates + OUT_WRITE;
+
+    if(AY_PORT_A != machine->ayRegister)
+      return;
+
+    /* Line is brought up to now under CTS as it was */
+    line_advance(machine, t);
+
+    if(value & AY_CTS_BUSY)
+      machine->ctsSince = -1;
+    else if(machine->ctsSince < 0)
+      machine->ctsSince = t;
+
+    machine->ayPortA = value;
+  }
+  else if(0 == (port & 0x8002) && machine->paging && !machine->locked){
+    machine->bank = value & 7;
+    machine->locked = value & 0x20;
+  }
+}
+
+/* Answer a serial read with the next byte of the stream. Returns 0 if
+   the stream is used up. */
+static int serial_read(struct zxtrans_budget_machine *machine){
+  struct zxtrans_z80 *cpu = &machine->cpu;
+
+  if(machine->next == machine->length)
+    return 0;
+
+  cpu->a = machine->stream[machine->next];
+  cpu->f |= 0x01;		/* Carry set for a byte read */
+  charge(machine, cpu->tstates);
+
+  return 1;
+}
+
+/* Take the next byte of the stream as read at T-state at, charging the
+   T-states since the last one to the part being loaded */
+static void charge(struct zxtrans_budget_machine *machine,
+		   unsigned long long at){
+  struct zxtrans_budget_phase *part = &machine->phases[machine->phase];
+  unsigned long long gap = at - machine->lastRead;
+
+  part->bytes++;
+  part->tstates += gap;
+
+  if(gap > part->longest)
+    part->longest = gap;
+
+  machine->lastRead = at;
+  machine->next++;
+}
+
+/* Bring the serial line up to T-state t. A byte is read as its stop bit
+   ends. The sender starts the next once the line is free and CTS has
+   been asserted for CTS_BITS, though not before the receiver last
+   looked at the line, so that the start bit is seen only as the
+   receiver polls for it. */
+static void line_advance(struct zxtrans_budget_machine *machine, double t){
+  for(;;){
+    double start;
+
+    if(machine->byteStart >= 0){
+      double end = machine->byteStart + BITS_PER_BYTE*machine->bitTstates;
+
+      if(t < end)
+	return;
+
+      machine->byteStart = -1;
+      machine->lineFree = end;
+      machine->lineTstates += end - machine->lineSince;
+      charge(machine, end);
+    }
+
+    if(machine->next == machine->length || machine->ctsSince < 0)
+      return;
+
+    /* Go-ahead after test pattern waits for CTS to be asserted anew */
+    if(machine->next == machine->goAhead && \
+       machine->ctsSince < machine->lineFree)
+      return;
+
+    start = machine->ctsSince + CTS_BITS*machine->bitTstates;
+
+    machine->lineSince = (machine->ctsSince > machine->lineFree) ? \
+      machine->ctsSince : machine->lineFree;
+
+    if(start < machine->lineFree)
+      start = machine->lineFree;
+
+    if(start <= machine->lastSample)
+      start = machine->lastSample + 1;
+
+    if(start > t)
+      return;
+
+    if(0 == machine->goAhead)
+      machine->goAhead = machine->next + ZXTRANS_LADDER_LEN;
+
+    machine->byteStart = start;
+  }
+}
+
+/* Whether RXD is a zero (space) at T-state t: for the start bit, and
+   for each data bit, low bit first, that is zero */
+static int line_space(struct zxtrans_budget_machine *machine, double t){
+  int bit;
+
+  line_advance(machine, t);
+
+  if(machine->byteStart < 0)
+    return 0;
+
+  bit = (t - machine->byteStart)/machine->bitTstates;
+
+  if(0 == bit)
+    return 1;
+
+  return bit <= 8 && !(machine->stream[machine->next] >> (bit-1) & 1);
+}
+
+/* Return from a ROM routine the core does not run */
+static void ret(struct zxtrans_z80 *cpu){
+  cpu->pc = read_memory(cpu, cpu->sp) | read_memory(cpu, cpu->sp+1) << 8;
+  cpu->sp += 2;
+}
@@ -0,0 +1,341 @@
+/*
+   ZX-Trans Cache - prepared snapshots, kept on disk so that sending
+   one again need not read and encode it again.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _XOPEN_SOURCE 700 /* For mmap */
+
+#define CACHE_MAGIC "ZXTP"
+#define CACHE_VERSION 2 /* Change whenever the receiver's wire format
+			   does, so older images are not used */
+#define CACHE_DIR ".zxtrans" /* Under home directory, unless
+				ZXTRANS_CACHE is set */
+#define HEADER_LEN 6 /* Magic, version and page count, followed by a
+			32-bit length (low byte first) for each page */
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "zxtrans_cache.h"
+#include "zxtrans_image.h"
+
+static int map_file(const char *filename, struct zxtrans_cache *cache);
+static size_t header_length(int pageCount);
+
+/* Name of file called name in the cache directory, which is created if
+   needed. Returns NULL if no cache directory can be found; caller must
+   free result. */
+char *zxtrans_cache_path(const char *name){
+  const char *dir = getenv("ZXTRANS_CACHE");
+  char *filename;
+  size_t length;
+
+  if(NULL == dir){
+    const char *home = getenv("HOME");
+
+#ifdef _WIN32
+    if(NULL == home)
+      home = getenv("USERPROFILE");
+#endif
+
+    if(NULL == home)
+      return NULL;
+
+    length = strlen(home)+strlen(CACHE_DIR)+2;
+
+    if(NULL == (filename = malloc(length)))
+      return NULL;
+
+    snprintf(filename, length, "%s/%s", home, CACHE_DIR);
+  }
+  else{
+    if(NULL == (filename = malloc(strlen(dir)+1)))
+      return NULL;
+
+    strcpy(filename, dir);
+  }
+
+#ifdef _WIN32
+  _mkdir(filename);
+#else
+  mkdir(filename, 0755);
+#endif
+
+  length = strlen(filename);
+  filename = realloc(filename, length+strlen(name)+2);
+
+  if(NULL == filename)
+    return NULL;
+
+  filename[length++] = '/';
+  strcpy(&filename[length], name);
+
+  return filename;
+}
+
+/* Name of cached image of the snapshot file held in snapshot, sent
+   with transfer options flags. Returns NULL if there is no cache
+   directory; caller must free result. */
+char *zxtrans_cache_name(const libspectrum_byte *snapshot, size_t length,
+			 int flags){
+  uint64_t hash = FNV_OFFSET;
+  char name[32];
+
+  /* FNV-1a, over the whole file */
+  for(size_t i=0; i<length; i++){
+    hash ^= snapshot[i];
+    hash *= FNV_PRIME;
+  }
+
+  snprintf(name, sizeof(name), "%016llx-%02x.zxp", \
+	   (unsigned long long) hash, flags & 0xFF);
+
+  return zxtrans_cache_path(name);
+}
+
+/* Map cached image in filename into cache. Returns 1 on success, or 0
+   if there is no usable image. */
+int zxtrans_cache_open(const char *filename, struct zxtrans_cache *cache){
+  size_t offset;
+
+  memset(cache, 0, sizeof(*cache));
+
+  if(!map_file(filename, cache))
+    return 0;
+
+  if(cache->length < HEADER_LEN || \
+     memcmp(cache->image, CACHE_MAGIC, 4) || \
+     CACHE_VERSION != cache->image[4] || 0 == cache->image[5] || \
+     cache->image[5] > ZXTRANS_MAX_PAGES || \
+     cache->length < header_length(cache->image[5])+ZXTRANS_CACHE_STATE_LEN){
+    zxtrans_cache_close(cache);
+    return 0;
+  }
+
+  cache->pageCount = cache->image[5];
+  offset = header_length(cache->pageCount);
+  cache->state = &cache->image[offset];
+  offset += ZXTRANS_CACHE_STATE_LEN;
+
+  for(int i=0; i<cache->pageCount; i++){
+    const libspectrum_byte *field = &cache->image[HEADER_LEN+4*i];
+    size_t length = field[0] | field[1]<<8 | \
+      (size_t) field[2]<<16 | (size_t) field[3]<<24;
+
+    /* Image written in part is never renamed into place, but may
+       still be damaged */
+    if(0 == length || length > ZXTRANS_IMAGE_BOUND || \
+       length > cache->length-offset){
+      zxtrans_cache_close(cache);
+      return 0;
+    }
+
+    cache->pages[i] = &cache->image[offset];
+    cache->pageLength[i] = length;
+    offset += length;
+  }
+
+  if(offset != cache->length){
+    zxtrans_cache_close(cache);
+    return 0;
+  }
+
+  return 1;
+}
+
+void zxtrans_cache_close(struct zxtrans_cache *cache){
+  if(NULL != cache->image){
+#ifdef _WIN32
+    free(cache->image);
+#else
+    munmap(cache->image, cache->length);
+#endif
+  }
+
+  memset(cache, 0, sizeof(*cache));
+}
+
+/* Start writing image of pageCount pages, sent after set-state block
+   state, to filename. Returns 1 on success. */
+int zxtrans_cache_create(struct zxtrans_cache_writer *writer,
+			 const char *filename,
+			 const libspectrum_byte *state, int pageCount){
+  libspectrum_byte header[HEADER_LEN+4*ZXTRANS_MAX_PAGES];
+  size_t length = header_length(pageCount);
+
+  memset(writer, 0, sizeof(*writer));
+
+  if(pageCount < 1 || pageCount > ZXTRANS_MAX_PAGES)
+    return 0;
+
+  writer->pageCount = pageCount;
+
+  if(NULL == (writer->filename = malloc(strlen(filename)+1)) || \
+     NULL == (writer->tempName = malloc(strlen(filename)+5))){
+    free(writer->filename);
+    writer->filename = NULL;
+    return 0;
+  }
+
+  strcpy(writer->filename, filename);
+  sprintf(writer->tempName, "%s.tmp", filename);
+
+  /* Page lengths are filled in once they are known */
+  memset(header, 0, length);
+  memcpy(header, CACHE_MAGIC, 4);
+  header[4] = CACHE_VERSION;
+  header[5] = pageCount;
+
+  if(NULL == (writer->file = fopen(writer->tempName, "wb")) || \
+     length != fwrite(header, 1, length, writer->file) || \
+     ZXTRANS_CACHE_STATE_LEN != fwrite(state, 1, ZXTRANS_CACHE_STATE_LEN, \
+				       writer->file)){
+    if(NULL != writer->file){
+      fclose(writer->file);
+      remove(writer->tempName);
+    }
+
+    free(writer->filename);
+    free(writer->tempName);
+    memset(writer, 0, sizeof(*writer));
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Append next page of image. Errors are reported on commit. */
+void zxtrans_cache_add(struct zxtrans_cache_writer *writer,
+		       const libspectrum_byte *page, size_t length){
+  if(NULL == writer->file || writer->added >= writer->pageCount)
+    return;
+
+  fwrite(page, 1, length, writer->file);
+  writer->pageLength[writer->added++] = length;
+}
+
+/* Finish image and move it into place, if every page was added.
+   Returns 1 if the image is now in the cache. */
+int zxtrans_cache_commit(struct zxtrans_cache_writer *writer){
+  libspectrum_byte lengths[4*ZXTRANS_MAX_PAGES];
+  int ok;
+
+  if(NULL == writer->file)
+    return 0;
+
+  for(int i=0; i<writer->pageCount; i++){
+    lengths[4*i] = writer->pageLength[i] & 0xFF;
+    lengths[4*i+1] = (writer->pageLength[i] >> 8) & 0xFF;
+    lengths[4*i+2] = (writer->pageLength[i] >> 16) & 0xFF;
+    lengths[4*i+3] = (writer->pageLength[i] >> 24) & 0xFF;
+  }
+
+  ok = writer->added == writer->pageCount && !ferror(writer->file) && \
+    0 == fseek(writer->file, HEADER_LEN, SEEK_SET) && \
+    (size_t) 4*writer->pageCount == fwrite(lengths, 1, 4*writer->pageCount, \
+					   writer->file);
+
+  if(fclose(writer->file))
+    ok = 0;
+
+  /* Another sender may have cached the same image first, which does
+     no harm */
+  if(!ok || 0 != rename(writer->tempName, writer->filename))
+    remove(writer->tempName);
+
+  free(writer->filename);
+  free(writer->tempName);
+  memset(writer, 0, sizeof(*writer));
+
+  return ok;
+}
+
+static int map_file(const char *filename, struct zxtrans_cache *cache){
+#ifdef _WIN32
+  FILE *file;
+  long length;
+
+  if(NULL == (file = fopen(filename, "rb")))
+    return 0;
+
+  if(0 != fseek(file, 0, SEEK_END) || (length = ftell(file)) <= 0 || \
+     0 != fseek(file, 0, SEEK_SET) || \
+     NULL == (cache->image = malloc(length))){
+    fclose(file);
+    return 0;
+  }
+
+  if((size_t) length != fread(cache->image, 1, length, file)){
+    free(cache->image);
+    cache->image = NULL;
+    fclose(file);
+    return 0;
+  }
+
+  fclose(file);
+  cache->length = length;
+#else
+  struct stat status;
+  void *image;
+  int fd;
+
+  if(-1 == (fd = open(filename, O_RDONLY)))
+    return 0;
+
+  if(0 != fstat(fd, &status) || status.st_size <= 0){
+    close(fd);
+    return 0;
+  }
+
+  image = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(MAP_FAILED == image)
+    return 0;
+
+  cache->image = image;
+  cache->length = status.st_size;
+#endif
+
+  return 1;
+}
+
+static size_t header_length(int pageCount){
+  return HEADER_LEN + 4*pageCount;
+}
@@ -0,0 +1,79 @@
+/*
+   ZX-Trans Cache - prepared snapshots, kept on disk so that sending
+   one again need not read and encode it again.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_CACHE_H
+#define ZXTRANS_CACHE_H
+
+#include <stdio.h>
+#include <libspectrum.h>
+#include "zxtrans_delta.h"
+
+#define ZXTRANS_CACHE_STATE_LEN 80 /* Length of Z80 set-state block */
+
+/* A cached image holds the set-state block and every page of one
+   snapshot, as sent for one set of transfer options. It is named after
+   a hash of the snapshot file and the options, so it is found again
+   whatever the snapshot is called, and is never out of date. Images of
+   delta reloads depend on what was sent before, so are not cached. */
+
+/* Image found in the cache */
+struct zxtrans_cache {
+  libspectrum_byte *image;	/* Whole file, mapped or read */
+  size_t length;
+  int pageCount;
+  const libspectrum_byte *state;
+  const libspectrum_byte *pages[ZXTRANS_MAX_PAGES];
+  size_t pageLength[ZXTRANS_MAX_PAGES];
+};
+
+/* Image being added to the cache, page by page as it is sent */
+struct zxtrans_cache_writer {
+  FILE *file;
+  char *filename;
+  char *tempName;		/* Written here, then renamed */
+  int pageCount;
+  int added;
+  size_t pageLength[ZXTRANS_MAX_PAGES];
+};
+
+char *zxtrans_cache_path(const char *name);
+char *zxtrans_cache_name(const libspectrum_byte *snapshot, size_t length,
+			 int flags);
+int zxtrans_cache_open(const char *filename, struct zxtrans_cache *cache);
+void zxtrans_cache_close(struct zxtrans_cache *cache);
+int zxtrans_cache_create(struct zxtrans_cache_writer *writer,
+			 const char *filename,
+			 const libspectrum_byte *state, int pageCount);
+void zxtrans_cache_add(struct zxtrans_cache_writer *writer,
+		       const libspectrum_byte *page, size_t length);
+int zxtrans_cache_commit(struct zxtrans_cache_writer *writer);
+
+#endif
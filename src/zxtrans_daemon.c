@@ -0,0 +1,248 @@
+/*
+   ZX-Trans Daemon - local control socket, over which a long-running
+   sender is asked to send snapshots.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _XOPEN_SOURCE 700 /* For fdopen */
+
+#define LISTEN_BACKLOG 8
+#define REQUEST_TIMEOUT 5 /* Seconds a client has to send its request */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "zxtrans_daemon.h"
+
+#ifndef _WIN32
+static int socket_address(const char *path, struct sockaddr_un *address);
+
+/* Listen for requests on a UNIX socket at path, replacing any left by
+   an earlier daemon. Only the user running the daemon may connect.
+   Returns the listening socket, or -1 if it cannot be created. */
+int zxtrans_daemon_listen(const char *path){
+  struct sockaddr_un address;
+  mode_t mask;
+  int listener;
+  int bound;
+
+  if(!socket_address(path, &address))
+    return -1;
+
+  if(-1 == (listener = socket(AF_UNIX, SOCK_STREAM, 0)))
+    return -1;
+
+  unlink(path);
+
+  /* Socket is created without access for group or others, rather than
+     changed after, when another user could already have connected */
+  mask = umask(S_IRWXG | S_IRWXO);
+  bound = bind(listener, (struct sockaddr *) &address, sizeof(address));
+  umask(mask);
+
+  if(0 != bound || 0 != listen(listener, LISTEN_BACKLOG)){
+    close(listener);
+    return -1;
+  }
+
+  /* A client that goes away mid-transfer must not stop the daemon */
+  signal(SIGPIPE, SIG_IGN);
+
+  return listener;
+}
+
+/* Wait for the next client. Returns a stream for the replies to its
+   request, or NULL on error. A client that does not send its request
+   within REQUEST_TIMEOUT seconds is treated as sending nothing, so it
+   cannot hold up the daemon. */
+FILE *zxtrans_daemon_accept(int listener){
+  struct timeval timeout;
+  FILE *client;
+  int fd;
+
+  if(-1 == (fd = accept(listener, NULL, NULL)))
+    return NULL;
+
+  memset(&timeout, 0, sizeof(timeout));
+  timeout.tv_sec = REQUEST_TIMEOUT;
+
+  if(0 != setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, \
+		     sizeof(timeout))){
+    close(fd);
+    return NULL;
+  }
+
+  if(NULL == (client = fdopen(fd, "w"))){
+    close(fd);
+    return NULL;
+  }
+
+  /* Replies are read as they are written */
+  setvbuf(client, NULL, _IOLBF, 0);
+
+  return client;
+}
+
+/* Read and parse one request from client. The request is read from the
+   socket directly, as the stream is only for replies. Returns 1 on
+   success, 0 if the client sent nothing (or timed out), or -1 if the
+   request is not understood. */
+int zxtrans_daemon_read(FILE *client, struct zxtrans_request *request){
+  char *command, *ports, *save;
+  size_t length=0;
+  ssize_t got=1;
+  char c;
+
+  memset(request, 0, sizeof(*request));
+
+  while(length < sizeof(request->line)-1 && \
+	1 == (got = read(fileno(client), &c, 1)) && '\n' != c)
+    request->line[length++] = c;
+
+  if(got < 0 || 0 == length)
+    return 0;
+
+  /* Command, then any ports and snapshot */
+  request->line[strcspn(request->line, "\r")] = '\0';
+  command = request->line;
+
+  if(NULL != (ports = strchr(command, ' ')))
+    *ports++ = '\0';
+
+  if(0 == strcmp(command, "status")){
+    request->type = ZXTRANS_REQUEST_STATUS;
+    return 1;
+  }
+
+  if(0 == strcmp(command, "quit")){
+    request->type = ZXTRANS_REQUEST_QUIT;
+    return 1;
+  }
+
+  if(0 != strcmp(command, "send") || NULL == ports)
+    return -1;
+
+  request->type = ZXTRANS_REQUEST_SEND;
+
+  /* Rest of line is snapshot, whose name may hold spaces */
+  if(NULL == (request->snapshot = strchr(ports, ' ')))
+    return -1;
+
+  *request->snapshot++ = '\0';
+
+  if('\0' == *request->snapshot)
+    return -1;
+
+  for(char *port=strtok_r(ports, ",", &save); NULL != port;
+      port=strtok_r(NULL, ",", &save)){
+    if(ZXTRANS_DAEMON_PORTS == request->portCount)
+      return -1;
+
+    request->ports[request->portCount++] = port;
+  }
+
+  return request->portCount > 0 ? 1 : -1;
+}
+
+void zxtrans_daemon_stop(int listener, const char *path){
+  close(listener);
+  unlink(path);
+}
+
+/* Connect to daemon listening at path. Returns a stream for the
+   request and then the replies (flushing between them), or NULL if no
+   daemon answers. */
+FILE *zxtrans_daemon_connect(const char *path){
+  struct sockaddr_un address;
+  FILE *daemon;
+  int fd;
+
+  if(!socket_address(path, &address))
+    return NULL;
+
+  if(-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0)))
+    return NULL;
+
+  if(0 != connect(fd, (struct sockaddr *) &address, sizeof(address)) || \
+     NULL == (daemon = fdopen(fd, "r+"))){
+    close(fd);
+    return NULL;
+  }
+
+  setvbuf(daemon, NULL, _IOLBF, 0);
+
+  return daemon;
+}
+
+static int socket_address(const char *path, struct sockaddr_un *address){
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+
+  if(strlen(path) >= sizeof(address->sun_path))
+    return 0;
+
+  strcpy(address->sun_path, path);
+
+  return 1;
+}
+#else
+/* No UNIX sockets to listen on */
+int zxtrans_daemon_listen(const char *path){
+  (void) path;
+  return -1;
+}
+
+FILE *zxtrans_daemon_accept(int listener){
+  (void) listener;
+  return NULL;
+}
+
+int zxtrans_daemon_read(FILE *client, struct zxtrans_request *request){
+  (void) client;
+  (void) request;
+  return 0;
+}
+
+void zxtrans_daemon_stop(int listener, const char *path){
+  (void) listener;
+  (void) path;
+}
+
+FILE *zxtrans_daemon_connect(const char *path){
+  (void) path;
+  return NULL;
+}
+#endif
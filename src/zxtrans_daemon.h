@@ -0,0 +1,73 @@
+/*
+   ZX-Trans Daemon - local control socket, over which a long-running
+   sender is asked to send snapshots.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_DAEMON_H
+#define ZXTRANS_DAEMON_H
+
+#include <stdio.h>
+
+#define ZXTRANS_DAEMON_LINE 1024 /* Longest request or reply */
+#define ZXTRANS_DAEMON_PORTS 16 /* Most ports one request sends to */
+
+/* Requests are lines of text, one per connection:
+
+     send <port>[,<port>...] <snapshot>
+				Send snapshot (an absolute path) to each
+				port at once. Ports must be those the
+				daemon was started with.
+     status			List open ports and prepared snapshots.
+     quit			Stop the daemon.
+
+   The daemon answers with lines starting "progress " while sending to
+   a single port, any lines of status, then a last line starting "ok "
+   or "error ". */
+
+enum zxtrans_request_type {
+  ZXTRANS_REQUEST_SEND,
+  ZXTRANS_REQUEST_STATUS,
+  ZXTRANS_REQUEST_QUIT
+};
+
+struct zxtrans_request {
+  enum zxtrans_request_type type;
+  int portCount;
+  char *ports[ZXTRANS_DAEMON_PORTS]; /* Point into line */
+  char *snapshot;
+  char line[ZXTRANS_DAEMON_LINE];
+};
+
+int zxtrans_daemon_listen(const char *path);
+FILE *zxtrans_daemon_accept(int listener);
+int zxtrans_daemon_read(FILE *client, struct zxtrans_request *request);
+void zxtrans_daemon_stop(int listener, const char *path);
+FILE *zxtrans_daemon_connect(const char *path);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+   ZX-Trans Delta - cache of last snapshot sent to each destination,
+   so later transfers need only send memory that has changed.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define CACHE_MAGIC "ZXTD"
+#define CACHE_VERSION 1
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zxtrans_cache.h"
+#include "zxtrans_delta.h"
+
+static int page_count(const libspectrum_byte *pageList);
+
+/* Name of file caching last snapshot sent to destination (a serial
+   port or output file). Directory is created if needed. Returns NULL
+   if no cache directory can be found; caller must free result. */
+char *zxtrans_delta_cache_name(const char *destination){
+  char *name, *filename;
+  size_t length=0;
+
+  if(NULL == (name = malloc(strlen(destination)+5)))
+    return NULL;
+
+  /* Port names such as /dev/ttyUSB0 or COM1 become a plain file name */
+  for(const char *c=destination; *c; c++)
+    name[length++] = (isalnum((unsigned char) *c) || '-' == *c) ? *c : '_';
+
+  strcpy(&name[length], ".img");
+
+  filename = zxtrans_cache_path(name);
+  free(name);
+
+  return filename;
+}
+
+/* Read cache file into previous. Returns 1 on success, or 0 if there is
+   no usable cache. */
+int zxtrans_delta_load(const char *filename, struct zxtrans_delta *previous){
+  FILE *cache;
+  libspectrum_byte header[6];
+  int ok=1;
+
+  memset(previous, 0, sizeof(*previous));
+
+  if(NULL == (cache = fopen(filename, "rb")))
+    return 0;
+
+  if(sizeof(header) != fread(header, 1, sizeof(header), cache) || \
+     memcmp(header, CACHE_MAGIC, 4) || CACHE_VERSION != header[4] || \
+     header[5] > ZXTRANS_MAX_PAGES || \
+     header[5] != fread(previous->pageList, 1, header[5], cache)){
+    fclose(cache);
+    return 0;
+  }
+
+  previous->pageCount = header[5];
+
+  for(int i=0; i<previous->pageCount && ok; i++){
+    previous->pages[i] = malloc(ZXTRANS_PAGELEN);
+
+    ok = (NULL != previous->pages[i]) && \
+      ZXTRANS_PAGELEN == fread(previous->pages[i], 1, ZXTRANS_PAGELEN, cache);
+  }
+
+  fclose(cache);
+
+  if(!ok)
+    zxtrans_delta_free(previous);
+
+  return ok;
+}
+
+/* Record pages of snapshot in pageList (ending 0xFF) as last sent.
+   Returns 1 on success. */
+int zxtrans_delta_save(const char *filename, libspectrum_snap *snapshot,
+		       const libspectrum_byte *pageList){
+  FILE *cache;
+  int count = page_count(pageList);
+  int ok;
+
+  if(NULL == (cache = fopen(filename, "wb")))
+    return 0;
+
+  ok = (4 == fwrite(CACHE_MAGIC, 1, 4, cache)) && \
+    (EOF != fputc(CACHE_VERSION, cache)) && (EOF != fputc(count, cache)) && \
+    (count == (int) fwrite(pageList, 1, count, cache));
+
+  for(int i=0; i<count && ok; i++)
+    ok = ZXTRANS_PAGELEN == fwrite(libspectrum_snap_pages(snapshot, \
+							  pageList[i]), \
+				   1, ZXTRANS_PAGELEN, cache);
+
+  if(fclose(cache))
+    ok = 0;
+
+  return ok;
+}
+
+/* Compare snapshot with previous, marking in keep the blocks of each
+   page in pageList that the receiver should already hold, and write
+   the table it uses to check them to dst (which must hold
+   ZXTRANS_DELTA_TABLE_BOUND bytes). With ZXTRANS_FLAG_FAST in flags,
+   the end of page 2 is overwritten by the receiver, so is never kept.
+   Returns table length, or 0 if nothing can be kept, as when the page
+   lists differ. */
+size_t zxtrans_delta_table(libspectrum_snap *snapshot,
+			   const libspectrum_byte *pageList,
+			   const struct zxtrans_delta *previous, int flags,
+			   libspectrum_byte keep[][ZXTRANS_KEEP_MAP_LEN],
+			   libspectrum_byte *dst){
+  int count = page_count(pageList);
+  size_t out=0;
+
+  memset(keep, 0, count*ZXTRANS_KEEP_MAP_LEN);
+
+  if(count != previous->pageCount || \
+     memcmp(pageList, previous->pageList, count))
+    return 0;
+
+  for(int i=0; i<count; i++){
+    const libspectrum_byte *page = \
+      libspectrum_snap_pages(snapshot, pageList[i]);
+    libspectrum_byte sum1=0, sum2=0;
+    int kept=0;
+
+    /* Page 5 holds the receiver, so is always sent */
+    if(5 == pageList[i])
+      continue;
+
+    for(int block=0; block<ZXTRANS_PAGELEN/ZXTRANS_KEEP_BLOCK; block++){
+      size_t start = block*ZXTRANS_KEEP_BLOCK;
+
+      if(2 == pageList[i] && (flags & ZXTRANS_FLAG_FAST) && \
+	 start+ZXTRANS_KEEP_BLOCK > ZXTRANS_FAST_START)
+	continue;
+
+      if(memcmp(&page[start], &previous->pages[i][start], ZXTRANS_KEEP_BLOCK))
+	continue;
+
+      keep[i][block/8] |= 0x80>>(block%8);
+      kept++;
+
+      for(size_t j=start; j<start+ZXTRANS_KEEP_BLOCK; j++){
+	sum1 += page[j];
+	sum2 += sum1;
+      }
+    }
+
+    if(0 == kept)
+      continue;
+
+    dst[out++] = pageList[i];
+    memcpy(&dst[out], keep[i], ZXTRANS_KEEP_MAP_LEN);
+    out += ZXTRANS_KEEP_MAP_LEN;
+    dst[out++] = sum1;
+    dst[out++] = sum2;
+  }
+
+  if(0 == out)
+    return 0;
+
+  dst[out++] = 0xFF;
+
+  return out;
+}
+
+void zxtrans_delta_free(struct zxtrans_delta *previous){
+  for(int i=0; i<previous->pageCount; i++)
+    free(previous->pages[i]);
+
+  memset(previous, 0, sizeof(*previous));
+}
+
+static int page_count(const libspectrum_byte *pageList){
+  int count=0;
+
+  while(count < ZXTRANS_MAX_PAGES && 0xFF != pageList[count])
+    count++;
+
+  return count;
+}
@@ -0,0 +1,70 @@
+/*
+   ZX-Trans Delta - cache of last snapshot sent to each destination,
+   so later transfers need only send memory that has changed.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_DELTA_H
+#define ZXTRANS_DELTA_H
+
+#include <stddef.h>
+#include <libspectrum.h>
+#include "zxtrans_image.h"
+
+#define ZXTRANS_KEEP_BLOCK 256 /* Memory kept in units of this many bytes */
+#define ZXTRANS_KEEP_MAP_LEN (ZXTRANS_PAGELEN/ZXTRANS_KEEP_BLOCK/8)
+#define ZXTRANS_MAX_PAGES 8
+
+/* Verification table sent after Z80 set-state block of a delta reload.
+   For each page with memory to be kept, one entry holding the page
+   number, a map of 256-byte blocks to be kept (bit 7 of first byte for
+   first block), and a 16-bit checksum of those blocks: the sum of the
+   bytes in its low byte and the sum of the running sums in its high
+   byte, each modulo 256. The table ends with 0xFF. */
+#define ZXTRANS_DELTA_TABLE_BOUND \
+  (ZXTRANS_MAX_PAGES*(1+ZXTRANS_KEEP_MAP_LEN+2)+1)
+
+/* Memory last sent to a destination */
+struct zxtrans_delta {
+  int pageCount;
+  libspectrum_byte pageList[ZXTRANS_MAX_PAGES];
+  libspectrum_byte *pages[ZXTRANS_MAX_PAGES];
+};
+
+char *zxtrans_delta_cache_name(const char *destination);
+int zxtrans_delta_load(const char *filename, struct zxtrans_delta *previous);
+int zxtrans_delta_save(const char *filename, libspectrum_snap *snapshot,
+		       const libspectrum_byte *pageList);
+size_t zxtrans_delta_table(libspectrum_snap *snapshot,
+			   const libspectrum_byte *pageList,
+			   const struct zxtrans_delta *previous, int flags,
+			   libspectrum_byte keep[][ZXTRANS_KEEP_MAP_LEN],
+			   libspectrum_byte *dst);
+void zxtrans_delta_free(struct zxtrans_delta *previous);
+
+#endif
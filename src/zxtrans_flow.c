@@ -0,0 +1,242 @@
+/*
+   ZX-Trans Flow - hardware flow control for byte-by-byte transfers,
+   waiting on changes to the CTS line rather than polling it.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _POSIX_C_SOURCE 200809L /* For clock_gettime, nanosleep */
+
+#define WAIT_SLICE_MS 20 /* Longest single wait before checking CTS again,
+			    in case a change is missed */
+#define POLL_SLEEP_US 100 /* Between checks of CTS, where line changes
+			    are not waited on */
+#define BURST_GROW_AFTER 8 /* Clean handshakes before burst doubles */
+#define BITS_PER_BYTE 10 /* Start, 8 data and stop bits */
+#define STALL_FACTOR 2 /* Receiver stalled if it took longer than this
+			  many times the line time of a burst ... */
+#define STALL_SLACK 0.005 /* ... plus this (in seconds) to be ready for
+			     more */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "zxtrans_flow.h"
+
+static double now(void);
+static int wait_cts_state(struct zxtrans_port *port, int asserted,
+			  unsigned int timeout_ms);
+static void wait_change(struct zxtrans_port *port, unsigned int wait_ms);
+static void sleep_us(unsigned long wait_us);
+
+void zxtrans_flow_burst_init(struct zxtrans_flow_burst *burst, size_t size,
+			     int adaptive, int baudRate){
+  if(size < 1)
+    size = 1;
+
+  if(size > ZXTRANS_FLOW_BURST_MAX)
+    size = ZXTRANS_FLOW_BURST_MAX;
+
+  burst->size = size;
+  burst->adaptive = adaptive;
+  burst->byteSeconds = (double) BITS_PER_BYTE/baudRate;
+  burst->clean = 0;
+}
+
+/* Adjust burst size after the receiver took waited seconds to be ready
+   for more, following a burst of sent bytes. A receiver keeping up is
+   ready soon after the last byte reaches it. */
+void zxtrans_flow_burst_update(struct zxtrans_flow_burst *burst,
+			       size_t sent, double waited){
+  if(!burst->adaptive)
+    return;
+
+  if(waited > STALL_FACTOR*sent*burst->byteSeconds + STALL_SLACK)
+    zxtrans_flow_burst_shrink(burst);
+  else if(++burst->clean >= BURST_GROW_AFTER){
+    burst->clean = 0;
+
+    if(2*burst->size <= ZXTRANS_FLOW_BURST_MAX)
+      burst->size *= 2;
+  }
+}
+
+/* Receiver stalled, or a write fell short */
+void zxtrans_flow_burst_shrink(struct zxtrans_flow_burst *burst){
+  if(!burst->adaptive)
+    return;
+
+  burst->clean = 0;
+
+  if(burst->size > 1)
+    burst->size /= 2;
+}
+
+/* Wait until receiver asserts CTS, or timeout_ms (0 for no limit) has
+   passed. Blocks on changes to modem lines on Windows, and otherwise
+   polls with a short sleep. Returns 1 if CTS is asserted, 0 on timeout,
+   or -1 if the port signals cannot be read. */
+int zxtrans_flow_wait_cts(struct zxtrans_port *port, unsigned int timeout_ms,
+			  struct zxtrans_flow_stats *stats){
+  double start;
+  int ready;
+
+  stats->waits++;
+
+  if(0 != (ready = zxtrans_port_cts(port)))
+    return ready;
+
+  stats->stalls++;
+  start = now();
+  ready = wait_cts_state(port, 1, timeout_ms);
+  stats->stalledSeconds += now()-start;
+
+  return ready;
+}
+
+/* Wait until receiver drops CTS, or timeout_ms (0 for no limit) has
+   passed. Returns 1 if CTS is dropped, 0 on timeout, or -1 if the port
+   signals cannot be read. */
+int zxtrans_flow_wait_cts_drop(struct zxtrans_port *port,
+			       unsigned int timeout_ms){
+  return wait_cts_state(port, 0, timeout_ms);
+}
+
+/* Wait until CTS is asserted or dropped, as given, or timeout_ms (0 for
+   no limit) has passed. Returns 1 once CTS is as asked, 0 on timeout,
+   or -1 on error. */
+static int wait_cts_state(struct zxtrans_port *port, int asserted,
+			  unsigned int timeout_ms){
+  double start = now(), elapsed;
+  int state;
+
+  while(asserted != (state = zxtrans_port_cts(port)) && state >= 0){
+    unsigned int wait_ms = WAIT_SLICE_MS;
+
+    elapsed = now()-start;
+
+    if(timeout_ms > 0){
+      if(elapsed*1000 >= timeout_ms)
+	return 0;
+
+      if(timeout_ms - elapsed*1000 < wait_ms)
+	wait_ms = timeout_ms - elapsed*1000 + 1;
+    }
+
+    wait_change(port, wait_ms);
+  }
+
+  return (state < 0) ? -1 : 1;
+}
+
+static double now(void){
+#ifdef _WIN32
+  return GetTickCount64()/1000.0;
+#else
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec/1e9;
+#endif
+}
+
+#ifdef _WIN32
+/* Wait for a CTS change event on the port's overlapped handle, or
+   for a terminal server to notify one. libserialport has no CTS event
+   for sp_wait(), so the handle's event mask is set to EV_CTS for the
+   wait, and put back to the mask libserialport had set as soon as the
+   wait is over. */
+static void wait_change(struct zxtrans_port *port, unsigned int wait_ms){
+  HANDLE handle;
+  OVERLAPPED overlapped;
+  DWORD oldMask, events, done;
+
+  if(NULL == port->serial){
+    zxtrans_port_wait(port, wait_ms);
+    return;
+  }
+
+  if(port->pollCts || \
+     SP_OK != sp_get_port_handle(port->serial, &handle) || \
+     !GetCommMask(handle, &oldMask) || !SetCommMask(handle, EV_CTS)){
+    port->pollCts = 1;
+    sleep_us(1000);
+    return;
+  }
+
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+  if(!WaitCommEvent(handle, &events, &overlapped)){
+    if(ERROR_IO_PENDING == GetLastError()){
+      if(WAIT_OBJECT_0 != WaitForSingleObject(overlapped.hEvent, wait_ms))
+	CancelIo(handle);
+
+      /* Cancelled or not, the wait must be over before overlapped, on
+	 this stack, goes */
+      GetOverlappedResult(handle, &overlapped, &done, TRUE);
+    }
+    else{
+      port->pollCts = 1;
+      sleep_us(1000);
+    }
+  }
+
+  CloseHandle(overlapped.hEvent);
+  SetCommMask(handle, oldMask);
+}
+
+static void sleep_us(unsigned long wait_us){
+  Sleep((wait_us+999)/1000);
+}
+#else
+/* Sleep briefly, before CTS is checked again. Blocking in TIOCMIWAIT
+   has no deadline of its own, and bounding it with a timer would need
+   a process-wide signal, which cannot be aimed at the thread waiting,
+   so the port is polled instead. A terminal server notifies changes
+   over its connection. */
+static void wait_change(struct zxtrans_port *port, unsigned int wait_ms){
+  if(NULL == port->serial){
+    zxtrans_port_wait(port, wait_ms);
+    return;
+  }
+
+  sleep_us(POLL_SLEEP_US);
+}
+
+static void sleep_us(unsigned long wait_us){
+  struct timespec t;
+
+  t.tv_sec = wait_us/1000000;
+  t.tv_nsec = (wait_us%1000000)*1000L;
+  nanosleep(&t, NULL);
+}
+#endif
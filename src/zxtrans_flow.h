@@ -0,0 +1,68 @@
+/*
+   ZX-Trans Flow - hardware flow control for byte-by-byte transfers,
+   waiting on changes to the CTS line rather than polling it.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_FLOW_H
+#define ZXTRANS_FLOW_H
+
+#include <stddef.h>
+#include "zxtrans_port.h"
+
+#define ZXTRANS_FLOW_BURST 2 /* Default bytes sent per RTS assertion */
+#define ZXTRANS_FLOW_BURST_MAX 256
+
+/* Time spent waiting for receiver */
+struct zxtrans_flow_stats {
+  unsigned long waits;		/* Times CTS was checked */
+  unsigned long stalls;		/* Times CTS was not asserted */
+  double stalledSeconds;	/* Total time spent waiting for CTS */
+};
+
+/* Bytes sent for each RTS/CTS handshake in mode 0. If adaptive, the
+   burst doubles after a run of handshakes where the receiver was soon
+   ready for more, and halves when it stalls. */
+struct zxtrans_flow_burst {
+  size_t size;
+  int adaptive;
+  double byteSeconds;		/* Line time of one byte */
+  unsigned int clean;		/* Handshakes since last stall */
+};
+
+void zxtrans_flow_burst_init(struct zxtrans_flow_burst *burst, size_t size,
+			     int adaptive, int baudRate);
+void zxtrans_flow_burst_update(struct zxtrans_flow_burst *burst,
+			       size_t sent, double waited);
+void zxtrans_flow_burst_shrink(struct zxtrans_flow_burst *burst);
+int zxtrans_flow_wait_cts(struct zxtrans_port *port, unsigned int timeout_ms,
+			  struct zxtrans_flow_stats *stats);
+int zxtrans_flow_wait_cts_drop(struct zxtrans_port *port,
+			       unsigned int timeout_ms);
+
+#endif
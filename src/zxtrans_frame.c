@@ -0,0 +1,102 @@
+/*
+   ZX-Trans Frame - checked frames, which let the receiver have part of
+   a transfer sent again, rather than the whole snapshot.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#include <string.h>
+#include "zxtrans_frame.h"
+
+#define CRC_POLYNOMIAL 0x1021
+
+void zxtrans_frames_init(struct zxtrans_frames *frames){
+  frames->fill = 0;
+  frames->sequence = 0;
+}
+
+/* Add up to count bytes to current frame. Returns the number taken,
+   which is less than count once the frame is full. */
+size_t zxtrans_frames_add(struct zxtrans_frames *frames,
+			  const libspectrum_byte *data, size_t count){
+  size_t room = ZXTRANS_FRAME_LEN - frames->fill;
+
+  if(count > room)
+    count = room;
+
+  memcpy(&frames->wire[2+frames->fill], data, count);
+  frames->fill += count;
+
+  return count;
+}
+
+/* Complete current frame, padding it if part-filled. Returns the bytes
+   to send, which stay valid until zxtrans_frames_next(). */
+const libspectrum_byte *zxtrans_frames_seal(struct zxtrans_frames *frames){
+  unsigned int crc;
+
+  memset(&frames->wire[2+frames->fill], 0, ZXTRANS_FRAME_LEN-frames->fill);
+  frames->wire[0] = ZXTRANS_FRAME_SOH;
+  frames->wire[1] = frames->sequence;
+
+  crc = zxtrans_frame_crc(&frames->wire[1], ZXTRANS_FRAME_LEN+1);
+  frames->wire[ZXTRANS_FRAME_LEN+2] = (crc & 0xFF00)>>8;
+  frames->wire[ZXTRANS_FRAME_LEN+3] = crc & 0xFF;
+
+  return frames->wire;
+}
+
+/* Start next frame, once receiver holds current one */
+void zxtrans_frames_next(struct zxtrans_frames *frames){
+  frames->fill = 0;
+  frames->sequence++;
+}
+
+unsigned int zxtrans_frame_crc(const libspectrum_byte *data,
+			       size_t length){
+  unsigned int crc=0;
+
+  for(size_t i=0; i<length; i++){
+    crc ^= data[i]<<8;
+
+    for(int bit=0; bit<8; bit++)
+      crc = (crc & 0x8000) ? (crc<<1 ^ CRC_POLYNOMIAL) : crc<<1;
+  }
+
+  return crc & 0xFFFF;
+}
+
+/* Wait up to timeout_ms for receiver to answer a frame. Returns the
+   byte received, or -1 if there was none. */
+int zxtrans_frame_answer(struct zxtrans_port *port, unsigned int timeout_ms){
+  unsigned char answer;
+
+  if(1 != zxtrans_port_read(port, &answer, 1, timeout_ms))
+    return -1;
+
+  return answer;
+}
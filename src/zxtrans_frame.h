@@ -0,0 +1,89 @@
+/*
+   ZX-Trans Frame - checked frames, which let the receiver have part of
+   a transfer sent again, rather than the whole snapshot.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_FRAME_H
+#define ZXTRANS_FRAME_H
+
+#include <stddef.h>
+#include <libspectrum.h>
+#include "zxtrans_port.h"
+
+/* With ZXTRANS_FLAG_FRAMED, everything after the set-state block is
+   split into frames, decoded by ZXT_READ_FRAME in zxtrans_receiver.asm.
+   Each frame is sent as:
+
+     ZXTRANS_FRAME_SOH
+     Sequence number, counting from 0 (modulo 256)
+     ZXTRANS_FRAME_LEN bytes (the last frame is padded with zeros)
+     CRC-16 of sequence number and bytes, high byte first
+
+   The CRC uses the CCITT polynomial (0x1021), starting from zero, as
+   XMODEM does. The receiver answers each frame with ZXTRANS_FRAME_ACK
+   once it holds it, or ZXTRANS_FRAME_NAK to have it sent again.
+
+   An interrupted transfer is resumed by sending ZXTRANS_FRAME_ENQ in
+   place of a frame: enough to complete any frame the receiver is still
+   waiting for, and then a run of ZXTRANS_FRAME_ENQ_RUN. The receiver
+   answers with ZXTRANS_FRAME_ENQ, the position in the page list of the
+   first page it has not loaded, and that position complemented. Only
+   the 128k banks loaded one at a time (from position
+   ZXTRANS_FRAME_RESUME_FIRST) can be resumed; before those, the
+   position is 0xFF. The transfer then goes on from that page, in
+   frames numbered from 0. */
+
+#define ZXTRANS_FRAME_LEN 128
+#define ZXTRANS_FRAME_WIRE_LEN (ZXTRANS_FRAME_LEN+4) /* Bytes sent per frame */
+#define ZXTRANS_FRAME_SOH 0x01
+#define ZXTRANS_FRAME_ACK 0x06
+#define ZXTRANS_FRAME_NAK 0x15
+#define ZXTRANS_FRAME_FILL 0xFF /* Sent to complete a frame the receiver
+				   is still waiting for */
+#define ZXTRANS_FRAME_ENQ 0x05
+#define ZXTRANS_FRAME_ENQ_RUN 8
+#define ZXTRANS_FRAME_RESUME_FIRST 3
+
+/* Frame being filled, and the one to follow it */
+struct zxtrans_frames {
+  libspectrum_byte wire[ZXTRANS_FRAME_WIRE_LEN];
+  size_t fill;			/* Bytes of snapshot held */
+  libspectrum_byte sequence;
+};
+
+void zxtrans_frames_init(struct zxtrans_frames *frames);
+size_t zxtrans_frames_add(struct zxtrans_frames *frames,
+			  const libspectrum_byte *data, size_t count);
+const libspectrum_byte *zxtrans_frames_seal(struct zxtrans_frames *frames);
+void zxtrans_frames_next(struct zxtrans_frames *frames);
+unsigned int zxtrans_frame_crc(const libspectrum_byte *data,
+			       size_t length);
+int zxtrans_frame_answer(struct zxtrans_port *port, unsigned int timeout_ms);
+
+#endif
@@ -0,0 +1,280 @@
+/*
+   ZX-Trans Image - preparation of snapshot memory pages for transfer
+   to the ZX-Trans receiver.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define ZERO_RUN_MIN 8 /* Shortest run of zeros worth a span of its own */
+
+#include <string.h>
+#include "zxtrans_image.h"
+#include "zxtrans_delta.h"
+#include "zxtrans_pack.h"
+
+static int block_kept(const libspectrum_byte *keep, int block);
+static size_t span_header(int type, size_t length, libspectrum_byte *dst);
+static size_t fill_spans(int type, size_t length, libspectrum_byte *dst);
+static size_t sparse_spans(const libspectrum_byte *page, size_t start,
+			   size_t end, int flags,
+			   const struct zxtrans_pack_zone *zones,
+			   int zoneCount, libspectrum_byte *dst);
+static size_t copy_spans(int type, libspectrum_word source, int step,
+			 libspectrum_byte *dst);
+static size_t data_spans(const libspectrum_byte *page, size_t start,
+			 size_t end, int flags,
+			 const struct zxtrans_pack_zone *zones, int zoneCount,
+			 libspectrum_byte *dst);
+
+/* Receiver relocates parts of page 5 while loading it, so packed data
+   must not refer to (or into) these */
+static const struct zxtrans_pack_zone page5Zones[] = {
+  {0, ZXTRANS_DISP_SKIP_MAX},
+  {ZXTRANS_DISP_LEN, ZXTRANS_DISP_LEN+ZXTRANS_IF1_ENV_LEN}
+};
+
+/* ... as does the end of page 2, which holds the fast serial loop */
+static const struct zxtrans_pack_zone page2FastZones[] = {
+  {ZXTRANS_FAST_START, ZXTRANS_PAGELEN}
+};
+
+/* Prepare page pageList[index] of snapshot for sending, according to
+   transfer options in flags. With ZXTRANS_FLAG_DELTA, keep maps the
+   256-byte blocks the receiver already holds (see zxtrans_delta.h).
+   Writes at most ZXTRANS_IMAGE_BOUND bytes to dst and returns number
+   written, or 0 on error. */
+size_t zxtrans_image_page(libspectrum_snap *snapshot,
+			  const libspectrum_byte *pageList, int index,
+			  int flags, const libspectrum_byte *keep,
+			  libspectrum_byte *dst){
+  int pageNo = pageList[index];
+  const libspectrum_byte *page = libspectrum_snap_pages(snapshot, pageNo);
+  const struct zxtrans_pack_zone *zones = (5 == pageNo) ? page5Zones : NULL;
+  int zoneCount = (5 == pageNo) ? 2 : 0;
+  int fast = flags & ZXTRANS_FLAG_FAST;
+  int kept=0;
+  size_t out=0;
+  size_t length;
+
+  if(2 == pageNo && fast){
+    zones = page2FastZones;
+    zoneCount = 1;
+  }
+
+  if(!(flags & ZXTRANS_FLAG_SPANS))
+    return data_spans(page, 0, ZXTRANS_PAGELEN, flags, zones, zoneCount, \
+		      dst);
+
+  if(flags & ZXTRANS_FLAG_DELTA)
+    for(int i=0; i<ZXTRANS_KEEP_MAP_LEN; i++)
+      kept |= keep[i];
+
+  /* A page identical to one already sent is copied by the receiver,
+     unless it is blank or partly kept. Page 5 is partly relocated while
+     loading, so is never used, nor is page 2 while it holds the fast
+     serial loop. */
+  int blank = (0 == page[0]) && !memcmp(page, &page[1], ZXTRANS_PAGELEN-1);
+
+  for(int i=0; i<index && 5 != pageNo && !blank && !kept; i++){
+    int earlier = pageList[i];
+
+    if(5 == earlier || (2 == earlier && fast) || \
+       memcmp(page, libspectrum_snap_pages(snapshot, earlier), \
+	      ZXTRANS_PAGELEN))
+      continue;
+
+    if(2 == earlier)
+      return copy_spans(ZXTRANS_SPAN_COPY, 0x8000, 1, dst);
+
+    /* Banks at 0xC000 can only be copied to another bank there */
+    if(2 != pageNo)
+      return copy_spans(ZXTRANS_SPAN_BANK, earlier, 0, dst);
+  }
+
+  if(!kept)
+    return sparse_spans(page, 0, ZXTRANS_PAGELEN, flags, zones, zoneCount, \
+			dst);
+
+  /* Otherwise, alternate between runs of kept blocks and changed ones */
+  for(size_t pos=0; pos<ZXTRANS_PAGELEN; pos+=length){
+    int block = pos/ZXTRANS_KEEP_BLOCK;
+    int keepRun = block_kept(keep, block);
+
+    for(length=0; pos+length < ZXTRANS_PAGELEN; \
+	length+=ZXTRANS_KEEP_BLOCK, block++)
+      if(keepRun != block_kept(keep, block))
+	break;
+
+    if(keepRun)
+      out += fill_spans(ZXTRANS_SPAN_KEEP, length, &dst[out]);
+    else{
+      size_t changed = sparse_spans(page, pos, pos+length, flags, \
+				    zones, zoneCount, &dst[out]);
+
+      if(0 == changed)
+	return 0;
+
+      out += changed;
+    }
+  }
+
+  return out;
+}
+
+/* Fill pattern with the ZXTRANS_LADDER_LEN bytes of test pattern sent
+   at each rate tried for the fast serial loop */
+void zxtrans_image_ladder(libspectrum_byte *pattern){
+  libspectrum_byte byte = ZXTRANS_LADDER_FIRST;
+
+  for(int i=0; i<ZXTRANS_LADDER_LEN; i++, byte += ZXTRANS_LADDER_STEP)
+    pattern[i] = byte;
+}
+
+static int block_kept(const libspectrum_byte *keep, int block){
+  return 0 != (keep[block/8] & 0x80>>(block%8));
+}
+
+static size_t span_header(int type, size_t length, libspectrum_byte *dst){
+  libspectrum_word header = (type<<13) | (length-1);
+
+  dst[0] = header & 0xFF;
+  dst[1] = (header & 0xFF00)>>8;
+
+  return 2;
+}
+
+/* Spans of type with no parameter, covering length bytes */
+static size_t fill_spans(int type, size_t length, libspectrum_byte *dst){
+  size_t out=0;
+
+  for(size_t done=0; done<length; ){
+    size_t span = length-done;
+
+    if(span > ZXTRANS_SPAN_MAX)
+      span = ZXTRANS_SPAN_MAX;
+
+    out += span_header(type, span, &dst[out]);
+    done += span;
+  }
+
+  return out;
+}
+
+/* Bytes start to end-1 of page, with runs of zeros sent as fill spans
+   and data between. Returns 0 on error. */
+static size_t sparse_spans(const libspectrum_byte *page, size_t start,
+			   size_t end, int flags,
+			   const struct zxtrans_pack_zone *zones,
+			   int zoneCount, libspectrum_byte *dst){
+  size_t out=0;
+  size_t length;
+
+  for(size_t pos=start; pos<end; ){
+    size_t run=0;
+
+    while(pos+run < end && 0 == page[pos+run])
+      run++;
+
+    if(run < ZERO_RUN_MIN && pos+run < end){
+      pos += run+1;
+      continue;
+    }
+
+    length = data_spans(page, start, pos, flags, zones, zoneCount, \
+			&dst[out]);
+
+    if(0 == length && start < pos)
+      return 0;
+
+    out += length + fill_spans(ZXTRANS_SPAN_ZERO, run, &dst[out+length]);
+    pos += run;
+    start = pos;
+  }
+
+  length = data_spans(page, start, end, flags, zones, zoneCount, &dst[out]);
+
+  if(0 == length && start < end)
+    return 0;
+
+  return out+length;
+}
+
+/* Spans copying a whole page from source onwards, which advances by
+   step with each span */
+static size_t copy_spans(int type, libspectrum_word source, int step,
+			 libspectrum_byte *dst){
+  size_t out=0;
+
+  for(size_t done=0; done<ZXTRANS_PAGELEN; done+=ZXTRANS_SPAN_MAX){
+    libspectrum_word param = source + step*done;
+
+    out += span_header(type, ZXTRANS_SPAN_MAX, &dst[out]);
+    dst[out++] = param & 0xFF;
+    dst[out++] = (param & 0xFF00)>>8;
+  }
+
+  return out;
+}
+
+/* Bytes start to end-1 of page, as data spans if flags ask for spans,
+   and compressed if flags ask for packing. Returns 0 on error. */
+static size_t data_spans(const libspectrum_byte *page, size_t start,
+			 size_t end, int flags,
+			 const struct zxtrans_pack_zone *zones, int zoneCount,
+			 libspectrum_byte *dst){
+  size_t out=0;
+
+  while(start < end){
+    size_t length = end-start;
+    size_t header = 0;
+
+    if(flags & ZXTRANS_FLAG_SPANS){
+      if(length > ZXTRANS_SPAN_MAX)
+	length = ZXTRANS_SPAN_MAX;
+
+      header = span_header(ZXTRANS_SPAN_DATA, length, &dst[out]);
+    }
+
+    if(flags & ZXTRANS_FLAG_PACKED){
+      size_t packed = zxtrans_pack(page, start, start+length, \
+				   zones, zoneCount, &dst[out+header]);
+
+      if(0 == packed)
+	return 0;
+
+      out += header+packed;
+    }
+    else{
+      memcpy(&dst[out+header], &page[start], length);
+      out += header+length;
+    }
+
+    start += length;
+  }
+
+  return out;
+}
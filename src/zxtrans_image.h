@@ -0,0 +1,104 @@
+/*
+   ZX-Trans Image - preparation of snapshot memory pages for transfer
+   to the ZX-Trans receiver.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_IMAGE_H
+#define ZXTRANS_IMAGE_H
+
+#include <stddef.h>
+#include <libspectrum.h>
+
+#define ZXTRANS_PAGELEN 0x4000 /* Length of RAM page */
+#define ZXTRANS_DISP_LEN 6912 /* Length of display buffer */
+#define ZXTRANS_DISP_SKIP_MAX 2304 /* Most of display a receiver may skip */
+#define ZXTRANS_IF1_ENV_LEN 600 /* Receiver space for relocated system
+				   variables */
+
+/* Transfer options, sent in last byte of Z80 set-state block */
+#define ZXTRANS_FLAG_PACKED 0x01 /* Memory pages are compressed */
+#define ZXTRANS_FLAG_SPANS 0x02 /* Memory pages are sent as spans */
+#define ZXTRANS_FLAG_DELTA 0x04 /* Only changes from last snapshot are
+				   sent */
+#define ZXTRANS_FLAG_FAST 0x08 /* Baud rate is raised after set-state
+				  block, for the +3 receiver's fast loop */
+#define ZXTRANS_FLAG_FRAMED 0x10 /* Rest of transfer is sent in checked
+				    frames (see zxtrans_frame.h) */
+
+/* With ZXTRANS_FLAG_FAST, the +3 receiver runs its fast serial loop
+   from the end of page 2, loading that part of the page elsewhere
+   until it has finished */
+#define ZXTRANS_FAST_START (ZXTRANS_PAGELEN-0xC8)
+
+/* The +3 receiver that loads in place (zxtrans_receiver_plus3_direct)
+   takes only 16k and 48k snapshots, with ZXTRANS_FLAG_FAST. It hands
+   over to the snapshot from the ZXTRANS_DIRECT_HANDOVER bytes below its
+   stack pointer, which must not reach into the first few bytes of the
+   display, where it runs from last. */
+#define ZXTRANS_DIRECT_HANDOVER 89
+#define ZXTRANS_DIRECT_SP_MIN 0x405E
+
+/* The fast loop then settles with the sender on a rate, trying each of
+   ZXTRANS_LADDER_RATES in turn. At each, the sender sends a test
+   pattern of ZXTRANS_LADDER_LEN bytes, the first ZXTRANS_LADDER_FIRST
+   and each of the rest ZXTRANS_LADDER_STEP more than the one before
+   (modulo 256). The receiver drops CTS once it has the pattern. If the
+   pattern was whole, it asserts CTS again within ZXTRANS_LADDER_PASS_MS,
+   for ZXTRANS_LADDER_GO at that rate, after which the transfer goes on;
+   otherwise it waits several times as long, then tries the next rate. */
+#define ZXTRANS_LADDER_RATES {57600, 38400, 19200, 9600}
+#define ZXTRANS_LADDER_COUNT 4
+#define ZXTRANS_LADDER_LEN 16
+#define ZXTRANS_LADDER_FIRST 0x55
+#define ZXTRANS_LADDER_STEP 0x35
+#define ZXTRANS_LADDER_GO 0x00
+#define ZXTRANS_LADDER_PASS_MS 150
+
+/* With ZXTRANS_FLAG_SPANS, each page is a sequence of spans, each
+   starting with a 16-bit header (low byte first) holding the span type
+   in bits 13-15 and its length, less one, in bits 0-12. Copy spans
+   (types 2 and 3) add a 16-bit parameter. */
+#define ZXTRANS_SPAN_DATA 0 /* Bytes follow (compressed, if packed) */
+#define ZXTRANS_SPAN_ZERO 1 /* Fill with zeros */
+#define ZXTRANS_SPAN_COPY 2 /* Copy from address in parameter */
+#define ZXTRANS_SPAN_BANK 3 /* Copy from same address in RAM bank given
+			       by parameter */
+#define ZXTRANS_SPAN_KEEP 4 /* Leave memory as it is */
+#define ZXTRANS_SPAN_MAX 8192 /* Longest span */
+
+/* Room needed to prepare one page, whatever the options */
+#define ZXTRANS_IMAGE_BOUND (2*ZXTRANS_PAGELEN)
+
+size_t zxtrans_image_page(libspectrum_snap *snapshot,
+			  const libspectrum_byte *pageList, int index,
+			  int flags, const libspectrum_byte *keep,
+			  libspectrum_byte *dst);
+void zxtrans_image_ladder(libspectrum_byte *pattern);
+
+#endif
@@ -0,0 +1,387 @@
+/*
+   ZX-Trans Metrics - timing of each block sent over the serial port,
+   with progress display and machine-readable reports.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _POSIX_C_SOURCE 200809L /* For clock_gettime, fileno */
+
+#define PROGRESS_INTERVAL 0.25 /* Seconds between progress updates */
+
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+#include "zxtrans_metrics.h"
+
+static double achieved_baud(const struct zxtrans_block_metrics *block);
+static void write_json_string(FILE *out, const char *text);
+static void write_csv_string(FILE *out, const char *text);
+static void write_json_block(FILE *out,
+			     const struct zxtrans_block_metrics *block);
+static void write_json_histogram(FILE *out, const char *name,
+				 const struct zxtrans_metrics_histogram
+				 *histogram);
+static double bucket_limit(int bucket);
+static void write_csv_block(FILE *out, const struct zxtrans_metrics *metrics,
+			    const char *started,
+			    const struct zxtrans_block_metrics *block);
+
+double zxtrans_metrics_now(void){
+#ifdef _WIN32
+  return GetTickCount64()/1000.0;
+#else
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec/1e9;
+#endif
+}
+
+/* Begin recording transfer of snapshot, showing progress on progress
+   (NULL for none). Progress is redrawn in place on a terminal, and
+   otherwise written a line at a time, except that it is not shown on
+   stdout unless that is a terminal. */
+void zxtrans_metrics_start(struct zxtrans_metrics *metrics,
+			   const char *snapshot, const char *port,
+			   int baudRate, int serialMode, int pageCount,
+			   FILE *progress){
+  memset(metrics, 0, sizeof(*metrics));
+  metrics->snapshot = snapshot;
+  metrics->port = port;
+  metrics->baudRate = baudRate;
+  metrics->serialMode = serialMode;
+  metrics->started = time(NULL);
+  metrics->redraw = NULL != progress && isatty(fileno(progress));
+  metrics->progress = (stdout != progress || metrics->redraw) ? \
+    progress : NULL;
+  metrics->pageCount = pageCount;
+  metrics->start = zxtrans_metrics_now();
+}
+
+/* Begin timing a block of bytes. Returns its record, which
+   zxtrans_write_block() fills in. ZXTRANS_METRICS_MAX_BLOCKS allows
+   for every block a transfer sends, so callers need not check for
+   NULL, which is only returned if that ever changes. */
+struct zxtrans_block_metrics *
+zxtrans_metrics_block(struct zxtrans_metrics *metrics, const char *label,
+		      size_t bytes){
+  struct zxtrans_block_metrics *block;
+
+  if(metrics->blockCount == ZXTRANS_METRICS_MAX_BLOCKS)
+    return NULL;
+
+  block = &metrics->block[metrics->blockCount++];
+  memset(block, 0, sizeof(*block));
+  snprintf(block->label, sizeof(block->label), "%s", label);
+  block->bytes = bytes;
+  block->seconds = zxtrans_metrics_now();
+
+  return block;
+}
+
+void zxtrans_metrics_end_block(struct zxtrans_metrics *metrics,
+			       int isPage){
+  struct zxtrans_block_metrics *block = \
+    &metrics->block[metrics->blockCount-1];
+
+  block->seconds = zxtrans_metrics_now() - block->seconds;
+
+  if(isPage)
+    metrics->pagesDone++;
+
+  zxtrans_metrics_progress(metrics);
+}
+
+/* Redraw progress line, at most every PROGRESS_INTERVAL seconds. ETA
+   assumes the remaining pages take as long as those sent so far. */
+void zxtrans_metrics_progress(struct zxtrans_metrics *metrics){
+  const struct zxtrans_block_metrics *block = \
+    &metrics->block[metrics->blockCount-1];
+  double now = zxtrans_metrics_now();
+  double elapsed = now - metrics->start;
+  double done = metrics->pagesDone;
+  struct zxtrans_block_metrics total;
+
+  if(NULL == metrics->progress || \
+     now - metrics->lastShown < PROGRESS_INTERVAL)
+    return;
+
+  metrics->lastShown = now;
+
+  /* Count part of page being sent */
+  if(metrics->pagesDone < metrics->pageCount && 0 == strncmp(block->label, \
+							    "page", 4) && \
+     block->bytes > 0)
+    /* Frames also carry their checks, so may send more than bytes */
+    done += (block->sent < block->bytes) ? \
+      (double) block->sent / block->bytes : 1;
+
+  zxtrans_metrics_total(metrics, &total);
+
+  /* Elsewhere, each line is marked as progress */
+  fprintf(metrics->progress, "%s%3.0f%% %zu bytes %.0f baud", \
+	  metrics->redraw ? "\r" : "progress ", \
+	  100.0 * done / metrics->pageCount, total.sent, \
+	  elapsed > 0 ? total.sent*ZXTRANS_METRICS_BITS_PER_BYTE/elapsed : 0);
+
+  if(done > 0){
+    int eta = elapsed * (metrics->pageCount - done) / done + 0.5;
+
+    fprintf(metrics->progress, " ETA %d:%02d ", eta/60, eta%60);
+  }
+
+  if(!metrics->redraw)
+    fprintf(metrics->progress, "\n");
+
+  fflush(metrics->progress);
+}
+
+/* End progress line */
+void zxtrans_metrics_finish(struct zxtrans_metrics *metrics){
+  if(NULL != metrics->progress){
+    metrics->lastShown = 0;
+    zxtrans_metrics_progress(metrics);
+
+    if(metrics->redraw)
+      fprintf(metrics->progress, "\n");
+  }
+}
+
+/* Sum of all blocks so far */
+void zxtrans_metrics_total(const struct zxtrans_metrics *metrics,
+			   struct zxtrans_block_metrics *total){
+  memset(total, 0, sizeof(*total));
+  snprintf(total->label, sizeof(total->label), "total");
+  total->seconds = zxtrans_metrics_now() - metrics->start;
+
+  for(int i=0; i<metrics->blockCount; i++){
+    const struct zxtrans_block_metrics *block = &metrics->block[i];
+
+    total->bytes += block->bytes;
+    total->sent += block->sent;
+    total->flow.waits += block->flow.waits;
+    total->flow.stalls += block->flow.stalls;
+    total->flow.stalledSeconds += block->flow.stalledSeconds;
+    total->rtsToggles += block->rtsToggles;
+    total->shortWrites += block->shortWrites;
+    total->framesResent += block->framesResent;
+  }
+}
+
+/* Count time taken in its bucket */
+void zxtrans_metrics_sample(struct zxtrans_metrics_histogram *histogram,
+			    double seconds){
+  int bucket = 0;
+
+  while(bucket < ZXTRANS_METRICS_BUCKETS-1 && \
+	seconds*1e6 >= bucket_limit(bucket))
+    bucket++;
+
+  histogram->count[bucket]++;
+  histogram->samples++;
+
+  if(seconds > histogram->maxSeconds)
+    histogram->maxSeconds = seconds;
+}
+
+/* Show histogram on out, a line per bucket from the first to the last
+   that is not empty */
+void zxtrans_metrics_print_histogram(FILE *out, const char *title,
+				     const struct zxtrans_metrics_histogram
+				     *histogram){
+  int first = 0, last = ZXTRANS_METRICS_BUCKETS-1;
+
+  if(0 == histogram->samples)
+    return;
+
+  while(0 == histogram->count[first])
+    first++;
+
+  while(0 == histogram->count[last])
+    last--;
+
+  fprintf(out, "%s (%lu, longest %.0fus):\n", title, histogram->samples, \
+	  histogram->maxSeconds*1e6);
+
+  for(int i=first; i<=last; i++)
+    if(i < ZXTRANS_METRICS_BUCKETS-1)
+      fprintf(out, "  under %8.0fus %10lu\n", bucket_limit(i), \
+	      histogram->count[i]);
+    else
+      fprintf(out, "  longer         %10lu\n", histogram->count[i]);
+}
+
+/* Append record of transfer to filename: as CSV, one row per block and
+   a total, if its name ends ".csv"; otherwise as one line of JSON.
+   Returns 1 on success. */
+int zxtrans_metrics_write(const struct zxtrans_metrics *metrics,
+			  const char *filename){
+  size_t length = strlen(filename);
+  int csv = length > 4 && 0 == strcmp(&filename[length-4], ".csv");
+  struct zxtrans_block_metrics total;
+  char started[32];
+  FILE *out;
+
+  if(NULL == (out = fopen(filename, "a")))
+    return 0;
+
+  zxtrans_metrics_total(metrics, &total);
+  strftime(started, sizeof(started), "%Y-%m-%dT%H:%M:%SZ", \
+	   gmtime(&metrics->started));
+
+  if(csv){
+    /* New file needs a header */
+    fseek(out, 0, SEEK_END);
+
+    if(0 == ftell(out))
+      fprintf(out, "time,snapshot,port,baud,mode,block,bytes,sent," \
+	      "seconds,achieved_baud,stalled_seconds,stalls,rts_toggles," \
+	      "short_writes,frames_resent\n");
+
+    for(int i=0; i<metrics->blockCount; i++)
+      write_csv_block(out, metrics, started, &metrics->block[i]);
+
+    write_csv_block(out, metrics, started, &total);
+  }
+  else{
+    fprintf(out, "{\"time\":\"%s\",\"snapshot\":", started);
+    write_json_string(out, metrics->snapshot);
+    fprintf(out, ",\"port\":");
+    write_json_string(out, metrics->port);
+    fprintf(out, ",\"baud\":%d,\"mode\":%d,", metrics->baudRate, \
+	    metrics->serialMode);
+    write_json_block(out, &total);
+    write_json_histogram(out, "turnaround", &metrics->turnaround);
+    write_json_histogram(out, "gap", &metrics->gaps);
+    fprintf(out, ",\"blocks\":[");
+
+    for(int i=0; i<metrics->blockCount; i++){
+      fprintf(out, "%s{", i ? "," : "");
+      write_json_block(out, &metrics->block[i]);
+      fprintf(out, "}");
+    }
+
+    fprintf(out, "]}\n");
+  }
+
+  return 0 == fclose(out);
+}
+
+/* Bits per second actually achieved */
+static double achieved_baud(const struct zxtrans_block_metrics *block){
+  if(block->seconds <= 0)
+    return 0;
+
+  return block->sent * ZXTRANS_METRICS_BITS_PER_BYTE / block->seconds;
+}
+
+static void write_json_string(FILE *out, const char *text){
+  fputc('"', out);
+
+  for(const char *c=text; *c; c++)
+    if('"' == *c || '\\' == *c)
+      fprintf(out, "\\%c", *c);
+    else if((unsigned char) *c < 0x20)
+      fprintf(out, "\\u%04x", (unsigned char) *c);
+    else
+      fputc(*c, out);
+
+  fputc('"', out);
+}
+
+static void write_csv_string(FILE *out, const char *text){
+  fputc('"', out);
+
+  for(const char *c=text; *c; c++){
+    if('"' == *c)
+      fputc('"', out);
+
+    fputc(*c, out);
+  }
+
+  fputc('"', out);
+}
+
+static void write_json_block(FILE *out,
+			     const struct zxtrans_block_metrics *block){
+  fprintf(out, "\"block\":\"%s\",\"bytes\":%zu,\"sent\":%zu," \
+	  "\"seconds\":%.3f,\"achieved_baud\":%.0f," \
+	  "\"stalled_seconds\":%.3f,\"stalls\":%lu,\"rts_toggles\":%lu," \
+	  "\"short_writes\":%lu,\"frames_resent\":%lu", block->label, \
+	  block->bytes, block->sent, block->seconds, achieved_baud(block), \
+	  block->flow.stalledSeconds, block->flow.stalls, block->rtsToggles, \
+	  block->shortWrites, block->framesResent);
+}
+
+/* Bucket counts, with bucket limits in microseconds, as name_us and the
+   longest as name_max_us; nothing if there were no samples */
+static void write_json_histogram(FILE *out, const char *name,
+				 const struct zxtrans_metrics_histogram
+				 *histogram){
+  if(0 == histogram->samples)
+    return;
+
+  fprintf(out, ",\"%s_max_us\":%.0f,\"%s_us\":{", name, \
+	  histogram->maxSeconds*1e6, name);
+
+  for(int i=0; i<ZXTRANS_METRICS_BUCKETS; i++)
+    if(i < ZXTRANS_METRICS_BUCKETS-1)
+      fprintf(out, "%s\"%.0f\":%lu", i ? "," : "", bucket_limit(i), \
+	      histogram->count[i]);
+    else
+      fprintf(out, ",\"more\":%lu", histogram->count[i]);
+
+  fprintf(out, "}");
+}
+
+/* Microseconds that samples in bucket are under */
+static double bucket_limit(int bucket){
+  return (double) ZXTRANS_METRICS_BUCKET_US * (1UL << bucket);
+}
+
+static void write_csv_block(FILE *out, const struct zxtrans_metrics *metrics,
+			    const char *started,
+			    const struct zxtrans_block_metrics *block){
+  fprintf(out, "%s,", started);
+  write_csv_string(out, metrics->snapshot);
+  fputc(',', out);
+  write_csv_string(out, metrics->port);
+  fprintf(out, ",%d,%d,%s,%zu,%zu,%.3f,%.0f,%.3f,%lu,%lu,%lu,%lu\n", \
+	  metrics->baudRate, metrics->serialMode, block->label, \
+	  block->bytes, block->sent, block->seconds, achieved_baud(block), \
+	  block->flow.stalledSeconds, block->flow.stalls, block->rtsToggles, \
+	  block->shortWrites, block->framesResent);
+}
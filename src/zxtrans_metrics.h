@@ -0,0 +1,119 @@
+/*
+   ZX-Trans Metrics - timing of each block sent over the serial port,
+   with progress display and machine-readable reports.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_METRICS_H
+#define ZXTRANS_METRICS_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include "zxtrans_delta.h"
+#include "zxtrans_flow.h"
+
+/* Blocks of one transfer: leader, set-state, rate ladder, table, each
+   page and last frame's padding, or when resumed the resume request,
+   pages and padding. Frames, and any sent again, are counted in the
+   block they carry, and the ladder's steps in one, so no transfer has
+   more. */
+#define ZXTRANS_METRICS_MAX_BLOCKS (ZXTRANS_MAX_PAGES+5)
+#define ZXTRANS_METRICS_BITS_PER_BYTE 10 /* Start, 8 data and stop bits */
+#define ZXTRANS_METRICS_BUCKETS 16 /* Histogram buckets, doubling from
+				      16us; the last has no limit */
+#define ZXTRANS_METRICS_BUCKET_US 16
+
+/* One call to zxtrans_write_block() */
+struct zxtrans_block_metrics {
+  char label[16];		/* For example "state" or "page 5" */
+  size_t bytes;			/* Bytes to send */
+  size_t sent;			/* Bytes accepted by port */
+  double seconds;
+  struct zxtrans_flow_stats flow; /* CTS waits, in mode 0 */
+  unsigned long rtsToggles;
+  unsigned long shortWrites;	/* Writes that timed out part-way */
+  unsigned long framesResent;	/* Checked frames sent again */
+};
+
+/* Times taken, in mode 0, counted in buckets: the first for under
+   ZXTRANS_METRICS_BUCKET_US microseconds, each after for up to twice
+   the one before */
+struct zxtrans_metrics_histogram {
+  unsigned long count[ZXTRANS_METRICS_BUCKETS];
+  unsigned long samples;
+  double maxSeconds;
+};
+
+/* One snapshot sent over the serial port */
+struct zxtrans_metrics {
+  const char *snapshot;
+  const char *port;
+  int baudRate;
+  int serialMode;
+  time_t started;
+
+  FILE *progress;		/* Where to keep progress up to date, if
+				   anywhere */
+  int redraw;			/* Progress is one line on a terminal */
+  int pageCount;		/* Pages in snapshot, for progress */
+  int pagesDone;
+  double start;
+  double lastShown;
+
+  int blockCount;
+  struct zxtrans_block_metrics block[ZXTRANS_METRICS_MAX_BLOCKS];
+
+  struct zxtrans_metrics_histogram turnaround; /* RTS on until CTS */
+  struct zxtrans_metrics_histogram gaps; /* End of one burst until the
+					    next starts */
+};
+
+double zxtrans_metrics_now(void);
+void zxtrans_metrics_start(struct zxtrans_metrics *metrics,
+			   const char *snapshot, const char *port,
+			   int baudRate, int serialMode, int pageCount,
+			   FILE *progress);
+struct zxtrans_block_metrics *
+zxtrans_metrics_block(struct zxtrans_metrics *metrics, const char *label,
+		      size_t bytes);
+void zxtrans_metrics_end_block(struct zxtrans_metrics *metrics,
+			       int isPage);
+void zxtrans_metrics_progress(struct zxtrans_metrics *metrics);
+void zxtrans_metrics_finish(struct zxtrans_metrics *metrics);
+void zxtrans_metrics_total(const struct zxtrans_metrics *metrics,
+			   struct zxtrans_block_metrics *total);
+void zxtrans_metrics_sample(struct zxtrans_metrics_histogram *histogram,
+			    double seconds);
+void zxtrans_metrics_print_histogram(FILE *out, const char *title,
+				     const struct zxtrans_metrics_histogram
+				     *histogram);
+int zxtrans_metrics_write(const struct zxtrans_metrics *metrics,
+			  const char *filename);
+
+#endif
@@ -0,0 +1,265 @@
+/*
+   ZX-Trans Packer - LZ compression of memory pages for transfer to
+   the ZX-Trans receiver.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define HASH_BITS 12 /* Size of match-finder hash table */
+#define HASH_SIZE (1<<HASH_BITS)
+#define CHAIN_DEPTH 256 /* Candidates examined per position */
+#define SHORT_OFFSET_MAX 256
+#define LONG_OFFSET_MAX 0xFFFF
+#define MATCH_MAX (ZXTRANS_PACK_LENGTH_EXT + 0xFF + ZXTRANS_PACK_SHORT_MIN)
+
+#include <stdlib.h>
+#include <string.h>
+#include "zxtrans_pack.h"
+
+struct zxtrans_match {
+  size_t length;
+  size_t offset;
+  int saving; /* Bytes saved over sending the match as literals */
+};
+
+static size_t hash3(const libspectrum_byte *p);
+static void insert_hashes(const libspectrum_byte *src, size_t length,
+			  size_t pos, long *head, long *prev,
+			  size_t *inserted);
+static int match_cost(size_t length, size_t offset);
+static void find_match(const libspectrum_byte *src, size_t pos,
+		       size_t limit, const size_t *nextBlocked,
+		       const long *head, const long *prev,
+		       struct zxtrans_match *best);
+static size_t flush_literals(const libspectrum_byte *src, size_t start,
+			     size_t end, libspectrum_byte *dst);
+static size_t emit_match(const struct zxtrans_match *match,
+			 libspectrum_byte *dst);
+
+/* Pack bytes start to length-1 of src into dst, which must hold at
+   least ZXTRANS_PACK_BOUND(length-start) bytes. Matches may refer back
+   to bytes before start, which the receiver will already hold. Returns
+   the packed length, or 0 if working memory could not be allocated. */
+size_t zxtrans_pack(const libspectrum_byte *src, size_t start,
+		    size_t length, const struct zxtrans_pack_zone *zones,
+		    int zoneCount, libspectrum_byte *dst){
+  long head[HASH_SIZE];
+  long *prev=NULL;
+  size_t *nextBlocked=NULL;
+  size_t out=0;
+  size_t literalStart=start;
+  size_t pos=start;
+  size_t inserted=0;
+  struct zxtrans_match match, lazy;
+
+  prev = malloc(length*sizeof(long));
+  nextBlocked = malloc((length+1)*sizeof(size_t));
+
+  if(NULL == prev || NULL == nextBlocked){
+    free(prev);
+    free(nextBlocked);
+    return 0;
+  }
+
+  /* nextBlocked[i] is the first literal-only position at or after i,
+     which bounds any match touching position i */
+  nextBlocked[length] = length;
+
+  for(size_t i=length; i-- > 0; ){
+    nextBlocked[i] = nextBlocked[i+1];
+
+    for(int z=0; z<zoneCount; z++)
+      if(i >= zones[z].start && i < zones[z].end)
+	nextBlocked[i] = i;
+  }
+
+  for(int h=0; h<HASH_SIZE; h++)
+    head[h] = -1;
+
+  while(pos < length){
+    int threshold;
+
+    insert_hashes(src, length, pos, head, prev, &inserted);
+    find_match(src, pos, length, nextBlocked, head, prev, &match);
+
+    /* A match inside a literal run also costs a token to restart the
+       run, so it must save more than one byte */
+    threshold = (literalStart < pos) ? 1 : 0;
+
+    if(match.saving > threshold){
+      /* Prefer a literal now if the next position matches better */
+      insert_hashes(src, length, pos+1, head, prev, &inserted);
+      find_match(src, pos+1, length, nextBlocked, head, prev, &lazy);
+
+      if(lazy.saving > match.saving)
+	match.saving = 0;
+    }
+
+    if(match.saving <= threshold){
+      pos++;
+      continue;
+    }
+
+    out += flush_literals(src, literalStart, pos, &dst[out]);
+    out += emit_match(&match, &dst[out]);
+    pos += match.length;
+    literalStart = pos;
+  }
+
+  out += flush_literals(src, literalStart, length, &dst[out]);
+
+  free(prev);
+  free(nextBlocked);
+
+  return out;
+}
+
+static size_t hash3(const libspectrum_byte *p){
+  return ((p[0]<<8 ^ p[1]<<4 ^ p[2]) * 2654435761u) >> (32-HASH_BITS) \
+    & (HASH_SIZE-1);
+}
+
+/* Add every position before pos to the hash chains */
+static void insert_hashes(const libspectrum_byte *src, size_t length,
+			  size_t pos, long *head, long *prev,
+			  size_t *inserted){
+  while(*inserted < pos && *inserted+2 < length){
+    size_t h = hash3(&src[*inserted]);
+    prev[*inserted] = head[h];
+    head[h] = (*inserted)++;
+  }
+}
+
+/* Number of packed bytes needed to encode a match */
+static int match_cost(size_t length, size_t offset){
+  if(offset <= SHORT_OFFSET_MAX)
+    return (length-ZXTRANS_PACK_SHORT_MIN >= ZXTRANS_PACK_LENGTH_EXT) ? 3 : 2;
+  else
+    return (length-ZXTRANS_PACK_LONG_MIN >= ZXTRANS_PACK_LENGTH_EXT) ? 4 : 3;
+}
+
+static void find_match(const libspectrum_byte *src, size_t pos,
+		       size_t limit, const size_t *nextBlocked,
+		       const long *head, const long *prev,
+		       struct zxtrans_match *best){
+  size_t maxLength;
+  int depth=0;
+
+  best->length = 0;
+  best->offset = 0;
+  best->saving = 0;
+
+  /* Matches may not write into a literal-only zone */
+  maxLength = nextBlocked[pos] - pos;
+
+  if(maxLength > limit-pos)
+    maxLength = limit-pos;
+
+  if(maxLength > MATCH_MAX)
+    maxLength = MATCH_MAX;
+
+  if(maxLength < ZXTRANS_PACK_SHORT_MIN)
+    return;
+
+  for(long cand=head[hash3(&src[pos])];
+      cand >= 0 && depth < CHAIN_DEPTH; cand=prev[cand], depth++){
+    size_t offset = pos-cand;
+    size_t candMax = maxLength;
+    size_t length = 0;
+    int saving;
+
+    if(offset > LONG_OFFSET_MAX)
+      break;
+
+    /* ... nor read from one */
+    if(candMax > nextBlocked[cand]-cand)
+      candMax = nextBlocked[cand]-cand;
+
+    while(length < candMax && src[cand+length] == src[pos+length])
+      length++;
+
+    if(length < ZXTRANS_PACK_SHORT_MIN || \
+       (offset > SHORT_OFFSET_MAX && length < ZXTRANS_PACK_LONG_MIN))
+      continue;
+
+    saving = (int) length - match_cost(length, offset);
+
+    if(saving > best->saving){
+      best->length = length;
+      best->offset = offset;
+      best->saving = saving;
+
+      if(length == maxLength)
+	break;
+    }
+  }
+}
+
+static size_t flush_literals(const libspectrum_byte *src, size_t start,
+			     size_t end, libspectrum_byte *dst){
+  size_t out=0;
+
+  while(start < end){
+    size_t run = end-start;
+
+    if(run > ZXTRANS_PACK_MAX_LITERAL)
+      run = ZXTRANS_PACK_MAX_LITERAL;
+
+    dst[out++] = run-1;
+    memcpy(&dst[out], &src[start], run);
+    out += run;
+    start += run;
+  }
+
+  return out;
+}
+
+static size_t emit_match(const struct zxtrans_match *match,
+			 libspectrum_byte *dst){
+  size_t out=0;
+  size_t field;
+  int isLong = match->offset > SHORT_OFFSET_MAX;
+
+  field = match->length - (isLong ? ZXTRANS_PACK_LONG_MIN : \
+			   ZXTRANS_PACK_SHORT_MIN);
+
+  if(field >= ZXTRANS_PACK_LENGTH_EXT){
+    dst[out++] = (isLong ? 0xC0 : 0x80) | ZXTRANS_PACK_LENGTH_EXT;
+    dst[out++] = field - ZXTRANS_PACK_LENGTH_EXT;
+  }
+  else
+    dst[out++] = (isLong ? 0xC0 : 0x80) | field;
+
+  if(isLong){
+    dst[out++] = match->offset & 0xFF;
+    dst[out++] = (match->offset & 0xFF00)>>8;
+  }
+  else
+    dst[out++] = match->offset-1;
+
+  return out;
+}
@@ -0,0 +1,72 @@
+/*
+   ZX-Trans Packer - LZ compression of memory pages for transfer to
+   the ZX-Trans receiver.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_PACK_H
+#define ZXTRANS_PACK_H
+
+#include <stddef.h>
+#include <libspectrum.h>
+
+/* Packed stream format, decoded by ZXT_LOAD_PACKED in
+   zxtrans_unpack.asm. Each token is one byte:
+
+     0x00-0x7F  Literal run: the next (token+1) bytes are copied as-is.
+     0x80-0xBF  Short match: copy (field+3) bytes from 1-256 bytes back;
+		one offset byte (offset-1) follows.
+     0xC0-0xFF  Long match: copy (field+4) bytes from up to 65535 bytes
+		back; a 16-bit little-endian offset follows.
+
+   The 6-bit length field of a match holds 0x3F when an extension byte
+   (added to 0x3F) precedes the offset. Matches are copied with LDIR,
+   so overlapping matches repeat data. */
+
+#define ZXTRANS_PACK_MAX_LITERAL 128
+#define ZXTRANS_PACK_SHORT_MIN 3
+#define ZXTRANS_PACK_LONG_MIN 4
+#define ZXTRANS_PACK_LENGTH_EXT 0x3F
+
+/* Worst-case packed size of n bytes (all literals) */
+#define ZXTRANS_PACK_BOUND(n) ((n) + ((n) + ZXTRANS_PACK_MAX_LITERAL - 1) / \
+			       ZXTRANS_PACK_MAX_LITERAL)
+
+/* Range of input in which the packer may only emit literals. The
+   receiver stores some parts of a page away from their final address
+   while loading, so matches must neither read from nor write to them. */
+struct zxtrans_pack_zone {
+  size_t start;
+  size_t end;		/* One past last byte */
+};
+
+size_t zxtrans_pack(const libspectrum_byte *src, size_t start,
+		    size_t length, const struct zxtrans_pack_zone *zones,
+		    int zoneCount, libspectrum_byte *dst);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+   ZX-Trans Pipeline - preparation of memory pages on a worker thread,
+   overlapping with sending of earlier pages.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#include <stdlib.h>
+#include "zxtrans_pipeline.h"
+#include "zxtrans_image.h"
+
+static void *prepare_pages(void *arg);
+
+/* Start preparing the pageCount pages in pageList, according to
+   transfer options in flags. Returns 1 on success, or 0 if the worker
+   could not be started. */
+int zxtrans_pipeline_start(struct zxtrans_pipeline *pipeline,
+			   libspectrum_snap *snapshot,
+			   const libspectrum_byte *pageList, int pageCount,
+			   int flags,
+			   libspectrum_byte keep[][ZXTRANS_KEEP_MAP_LEN]){
+  pipeline->snapshot = snapshot;
+  pipeline->pageList = pageList;
+  pipeline->pageCount = pageCount;
+  pipeline->flags = flags;
+  pipeline->keep = keep;
+  pipeline->prepared = 0;
+  pipeline->released = 0;
+
+  for(int i=0; i<ZXTRANS_PIPELINE_DEPTH; i++)
+    if(NULL == (pipeline->buffer[i] = malloc(ZXTRANS_IMAGE_BOUND))){
+      while(i-- > 0)
+	free(pipeline->buffer[i]);
+
+      return 0;
+    }
+
+  pthread_mutex_init(&pipeline->lock, NULL);
+  pthread_cond_init(&pipeline->changed, NULL);
+
+  if(0 != pthread_create(&pipeline->worker, NULL, prepare_pages, pipeline)){
+    pthread_cond_destroy(&pipeline->changed);
+    pthread_mutex_destroy(&pipeline->lock);
+
+    for(int i=0; i<ZXTRANS_PIPELINE_DEPTH; i++)
+      free(pipeline->buffer[i]);
+
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Wait for next page to be prepared. Returns its data, which stays
+   valid until released, or NULL if it could not be prepared. */
+const libspectrum_byte *zxtrans_pipeline_next(struct zxtrans_pipeline *pipeline,
+					      size_t *length){
+  int slot = pipeline->released % ZXTRANS_PIPELINE_DEPTH;
+
+  pthread_mutex_lock(&pipeline->lock);
+
+  while(pipeline->prepared <= pipeline->released)
+    pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+
+  *length = pipeline->length[slot];
+
+  pthread_mutex_unlock(&pipeline->lock);
+
+  return (0 == *length) ? NULL : pipeline->buffer[slot];
+}
+
+/* Hand buffer of page last returned back to the worker */
+void zxtrans_pipeline_release(struct zxtrans_pipeline *pipeline){
+  pthread_mutex_lock(&pipeline->lock);
+  pipeline->released++;
+  pthread_cond_broadcast(&pipeline->changed);
+  pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* Wait for worker to finish, once every page has been released */
+void zxtrans_pipeline_finish(struct zxtrans_pipeline *pipeline){
+  pthread_join(pipeline->worker, NULL);
+  pthread_cond_destroy(&pipeline->changed);
+  pthread_mutex_destroy(&pipeline->lock);
+
+  for(int i=0; i<ZXTRANS_PIPELINE_DEPTH; i++)
+    free(pipeline->buffer[i]);
+}
+
+static void *prepare_pages(void *arg){
+  struct zxtrans_pipeline *pipeline = arg;
+
+  for(int i=0; i<pipeline->pageCount; i++){
+    int slot = i % ZXTRANS_PIPELINE_DEPTH;
+    size_t length;
+
+    /* Wait for a free buffer */
+    pthread_mutex_lock(&pipeline->lock);
+
+    while(i - pipeline->released >= ZXTRANS_PIPELINE_DEPTH)
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+
+    pthread_mutex_unlock(&pipeline->lock);
+
+    length = zxtrans_image_page(pipeline->snapshot, pipeline->pageList, i, \
+				pipeline->flags, pipeline->keep[i], \
+				pipeline->buffer[slot]);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->length[slot] = length;
+    pipeline->prepared++;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    /* Sender gives up on a page that could not be prepared */
+    if(0 == length)
+      break;
+  }
+
+  return NULL;
+}
@@ -0,0 +1,71 @@
+/*
+   ZX-Trans Pipeline - preparation of memory pages on a worker thread,
+   overlapping with sending of earlier pages.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_PIPELINE_H
+#define ZXTRANS_PIPELINE_H
+
+#include <pthread.h>
+#include <libspectrum.h>
+#include "zxtrans_delta.h"
+
+#define ZXTRANS_PIPELINE_DEPTH 2 /* Pages prepared ahead of sending */
+
+/* Pages of one snapshot, prepared in turn by a worker thread into a
+   ring of buffers and handed to the sender in page-list order */
+struct zxtrans_pipeline {
+  libspectrum_snap *snapshot;
+  const libspectrum_byte *pageList;
+  int pageCount;
+  int flags;
+  libspectrum_byte (*keep)[ZXTRANS_KEEP_MAP_LEN];
+
+  libspectrum_byte *buffer[ZXTRANS_PIPELINE_DEPTH];
+  size_t length[ZXTRANS_PIPELINE_DEPTH];
+  int prepared;			/* Pages prepared so far */
+  int released;			/* Pages finished with by sender */
+
+  pthread_t worker;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;	/* Signalled as pages are prepared or
+				   released */
+};
+
+int zxtrans_pipeline_start(struct zxtrans_pipeline *pipeline,
+			   libspectrum_snap *snapshot,
+			   const libspectrum_byte *pageList, int pageCount,
+			   int flags,
+			   libspectrum_byte keep[][ZXTRANS_KEEP_MAP_LEN]);
+const libspectrum_byte *zxtrans_pipeline_next(struct zxtrans_pipeline *pipeline,
+					      size_t *length);
+void zxtrans_pipeline_release(struct zxtrans_pipeline *pipeline);
+void zxtrans_pipeline_finish(struct zxtrans_pipeline *pipeline);
+
+#endif
@@ -0,0 +1,732 @@
+/*
+   ZX-Trans Port - where a transfer is sent: a serial port, a file, or
+   a terminal server over TCP.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _POSIX_C_SOURCE 200809L /* For getaddrinfo, clock_gettime */
+
+#define HOST_MAX 256 /* Longest host name of a terminal server */
+#define CLOSE_QUIET_MS 5000 /* Longest wait for terminal server to close,
+			       once it has stopped sending */
+#define BITS_PER_BYTE 10 /* Start, 8 data and stop bits */
+#define NOTIFY_WAIT 0.05 /* Seconds, after bytes sent should have left
+			    the terminal server, to wait for it to notify
+			    CTS afresh */
+
+/* Telnet, as in RFC 854 and RFC 856 */
+#define TELNET_SE 240
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_IAC 255
+#define TELNET_BINARY 0
+#define TELNET_SGA 3
+
+/* Incoming telnet stream is in data, or in a subnegotiation just after
+   an IAC, or else just after the byte starting a command */
+#define IN_DATA 0
+#define IN_SUB_IAC 1
+
+/* Com port control, as in RFC 2217 */
+#define COM_PORT 44
+#define SET_BAUDRATE 1
+#define SET_DATASIZE 2
+#define SET_PARITY 3
+#define SET_STOPSIZE 4
+#define SET_CONTROL 5
+#define NOTIFY_MODEMSTATE 107	/* Server's commands are client's + 100 */
+#define SET_MODEMSTATE_MASK 11
+#define PURGE_DATA 12
+#define PARITY_NONE 1
+#define CONTROL_HARDWARE 3
+#define MODEMSTATE_CTS 0x10
+#define PURGE_RECEIVED 1	/* From receiver, not yet sent on */
+#define PURGE_TO_SEND 2		/* Not yet sent to receiver */
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "zxtrans_port.h"
+
+static const char *after_prefix(const char *name, const char *prefix);
+#ifndef _WIN32
+static int open_socket(const char *address);
+static void hold(struct zxtrans_port *port, const unsigned char *bytes,
+		 size_t length);
+static void command(struct zxtrans_port *port, unsigned char code,
+		    const unsigned char *value, size_t length);
+static void command_byte(struct zxtrans_port *port, unsigned char code,
+			 unsigned char value);
+static enum sp_return send_held(struct zxtrans_port *port,
+				unsigned int timeout_ms);
+static int receive(struct zxtrans_port *port, int wait_ms);
+static void receive_telnet(struct zxtrans_port *port,
+			   const unsigned char *bytes, size_t length);
+static void negotiate(struct zxtrans_port *port, unsigned char verb,
+		      unsigned char option);
+static double now(void);
+#endif
+
+/* Open the port called name (see zxtrans_port.h), for reading as well
+   as writing if the receiver answers. Returns NULL, having said why,
+   if it cannot be opened. */
+struct zxtrans_port *zxtrans_port_open(const char *name, int readWrite){
+  struct zxtrans_port *port;
+  const char *address;
+  enum sp_return sp_err;
+
+  if(NULL == (port = calloc(1, sizeof(*port)))){
+    printf("Out of memory.\n");
+    return NULL;
+  }
+
+  port->socket = -1;
+  port->cts = 1;		/* Until terminal server says otherwise */
+
+  if(NULL != (address = after_prefix(name, ZXTRANS_PORT_FILE_PREFIX))){
+    port->kind = ZXTRANS_PORT_FILE;
+
+    if(NULL == (port->file = fopen(address, "wb"))){
+      printf("Error opening output file %s.\n", address);
+      free(port);
+      return NULL;
+    }
+
+    return port;
+  }
+
+  if(NULL != (address = after_prefix(name, ZXTRANS_PORT_TCP_PREFIX)))
+    port->kind = ZXTRANS_PORT_TCP;
+  else if(NULL != (address = after_prefix(name, ZXTRANS_PORT_RFC2217_PREFIX)))
+    port->kind = ZXTRANS_PORT_RFC2217;
+
+  if(NULL != address){
+#ifdef _WIN32
+    printf("Network ports are not supported on Windows.\n");
+    free(port);
+    return NULL;
+#else
+    if(-1 == (port->socket = open_socket(address))){
+      free(port);
+      return NULL;
+    }
+
+    return port;
+#endif
+  }
+
+  port->kind = ZXTRANS_PORT_SERIAL;
+
+  if((sp_err = sp_get_port_by_name(name, &port->serial)) != SP_OK){
+    printf("Error initialising serial port %d\n", sp_err);
+    free(port);
+    return NULL;
+  }
+
+  if((sp_err = sp_open(port->serial, readWrite ? SP_MODE_READ_WRITE : \
+		       SP_MODE_WRITE)) != SP_OK){
+    printf("Error opening serial port %d\n", sp_err);
+    sp_free_port(port->serial);
+    free(port);
+    return NULL;
+  }
+
+  return port;
+}
+
+/* Set baud rate, 8 data bits, no parity, 1 stop bit and RTS/CTS flow
+   control. A raw TCP connection or a file is left as it is. Returns 1
+   on success, or 0 having said why. */
+int zxtrans_port_configure(struct zxtrans_port *port, int baudRate){
+  enum sp_return sp_err=SP_OK;
+
+  switch(port->kind){
+  case ZXTRANS_PORT_SERIAL:
+    if((sp_err = sp_set_baudrate(port->serial, baudRate)) != SP_OK)
+      printf("Error setting baud rate of serial port %d\n", sp_err);
+    else if((sp_err = sp_set_parity(port->serial, SP_PARITY_NONE)) != SP_OK)
+      printf("Error setting parity of serial port\n");
+    else if((sp_err = sp_set_bits(port->serial, 8)) != SP_OK)
+      printf("Error setting bits of serial port\n");
+    else if((sp_err = sp_set_stopbits(port->serial, 1)) != SP_OK)
+      printf("Error setting stop bits of serial port\n");
+    /* sp_err = sp_set_cts(port->serial, SP_CTS_FLOW_CONTROL); */
+    else if((sp_err = sp_set_flowcontrol(port->serial, \
+					 SP_FLOWCONTROL_RTSCTS)) != SP_OK)
+      printf("Error setting flow control of serial port\n");
+    break;
+
+#ifndef _WIN32
+  case ZXTRANS_PORT_RFC2217:{
+    const unsigned char offer[] = {
+      TELNET_IAC, TELNET_WILL, TELNET_BINARY,
+      TELNET_IAC, TELNET_DO, TELNET_BINARY,
+      TELNET_IAC, TELNET_WILL, COM_PORT
+    };
+    /* Held, so sent as one segment, with the first data */
+    memcpy(port->out, offer, sizeof(offer));
+    port->outLength = sizeof(offer);
+    zxtrans_port_set_baudrate(port, baudRate);
+    command_byte(port, SET_DATASIZE, 8);
+    command_byte(port, SET_PARITY, PARITY_NONE);
+    command_byte(port, SET_STOPSIZE, 1);
+    command_byte(port, SET_CONTROL, CONTROL_HARDWARE);
+    command_byte(port, SET_MODEMSTATE_MASK, MODEMSTATE_CTS);
+    break;
+  }
+#endif
+
+  default:
+    break;
+  }
+
+  return (SP_OK == sp_err);
+}
+
+void zxtrans_port_close(struct zxtrans_port *port){
+  switch(port->kind){
+  case ZXTRANS_PORT_SERIAL:
+    sp_close(port->serial);
+    sp_free_port(port->serial);
+    break;
+
+  case ZXTRANS_PORT_FILE:
+    fclose(port->file);
+    break;
+
+  default:
+#ifndef _WIN32
+    /* Terminal server may still be sending bytes on, and notifying
+       changes to CTS, after the sender is done. Closing with its
+       notifications unread would reset the connection and lose the
+       rest, so wait for it to close first. */
+    send_held(port, 0);
+    shutdown(port->socket, SHUT_WR);
+
+    do
+      port->inLength = 0;
+    while(receive(port, CLOSE_QUIET_MS) > 0);
+
+    close(port->socket);
+#endif
+    break;
+  }
+
+  free(port);
+}
+
+/* Over RFC 2217, the new rate follows the bytes already held */
+enum sp_return zxtrans_port_set_baudrate(struct zxtrans_port *port,
+					 int baudRate){
+  if(ZXTRANS_PORT_SERIAL == port->kind)
+    return sp_set_baudrate(port->serial, baudRate);
+
+#ifndef _WIN32
+  if(ZXTRANS_PORT_RFC2217 == port->kind){
+    unsigned char value[4];
+
+    value[0] = (baudRate >> 24) & 0xFF;
+    value[1] = (baudRate >> 16) & 0xFF;
+    value[2] = (baudRate >> 8) & 0xFF;
+    value[3] = baudRate & 0xFF;
+    command(port, SET_BAUDRATE, value, sizeof(value));
+    port->baudRate = baudRate;
+  }
+#endif
+
+  return SP_OK;
+}
+
+/* Over RFC 2217, RTS is left to the line's hardware flow control, as
+   many terminal servers ignore changes to it while that is on */
+enum sp_return zxtrans_port_set_rts(struct zxtrans_port *port, int on){
+  if(ZXTRANS_PORT_SERIAL == port->kind)
+    return sp_set_rts(port->serial, on ? SP_RTS_ON : SP_RTS_OFF);
+
+  return SP_OK;
+}
+
+/* Returns 1 if CTS is asserted, 0 if not, or -1 if it cannot be read.
+   Over RFC 2217, held bytes are sent first, and CTS is as last
+   notified after the bytes sent, or, if the terminal server says
+   nothing, once they should have reached the receiver. */
+int zxtrans_port_cts(struct zxtrans_port *port){
+  enum sp_signal signals;
+
+  switch(port->kind){
+  case ZXTRANS_PORT_SERIAL:
+    if(SP_OK != sp_get_signals(port->serial, &signals))
+      return -1;
+
+    return (signals & SP_SIG_CTS) ? 1 : 0;
+
+#ifndef _WIN32
+  case ZXTRANS_PORT_RFC2217:{
+    int received;
+    double left;
+
+    if(SP_OK != send_held(port, 0))
+      return -1;
+
+    while((received = receive(port, 0)) > 0)
+      ;
+
+    /* CTS notified before the bytes last sent reached the receiver says
+       nothing of whether it is ready for more */
+    while(received >= 0 && port->ctsStale && \
+	  (left = port->lineEnd + NOTIFY_WAIT - now()) > 0)
+      received = receive(port, left*1000 + 1);
+
+    port->ctsStale = 0;
+
+    return (received < 0) ? -1 : port->cts;
+  }
+#endif
+
+  default:
+    return 1;
+  }
+}
+
+/* Wait up to wait_ms for the terminal server to notify a change to
+   CTS. Serial ports are waited on by zxtrans_flow. */
+void zxtrans_port_wait(struct zxtrans_port *port, unsigned int wait_ms){
+#ifndef _WIN32
+  if(ZXTRANS_PORT_RFC2217 == port->kind)
+    receive(port, wait_ms);
+#else
+  (void) port;
+  (void) wait_ms;
+#endif
+}
+
+/* Write count bytes from buf, waiting up to timeout_ms (0 for no
+   limit) for any that go out before returning. Returns the number
+   written, or an error. */
+enum sp_return zxtrans_port_write(struct zxtrans_port *port,
+				  const void *buf, size_t count,
+				  unsigned int timeout_ms){
+  switch(port->kind){
+  case ZXTRANS_PORT_SERIAL:
+    return sp_blocking_write(port->serial, buf, count, timeout_ms);
+
+  case ZXTRANS_PORT_FILE:
+    return fwrite(buf, 1, count, port->file);
+
+  default:
+#ifndef _WIN32
+    port->outData += count;
+    hold(port, buf, count);
+
+    if(port->outLength >= ZXTRANS_PORT_BATCH){
+      if(SP_OK != send_held(port, timeout_ms))
+	return SP_ERR_FAIL;
+
+      /* Keep up with notifications, which are not otherwise read
+	 while sending in modes 1 and 2 */
+      while(receive(port, 0) > 0)
+	;
+    }
+#endif
+    return count;
+  }
+}
+
+/* Read up to count bytes into buf, waiting up to timeout_ms (0 for no
+   limit) for the first. Returns the number read, which is 0 on
+   timeout, or an error. Held bytes are sent first. */
+enum sp_return zxtrans_port_read(struct zxtrans_port *port, void *buf,
+				 size_t count, unsigned int timeout_ms){
+  switch(port->kind){
+  case ZXTRANS_PORT_SERIAL:
+    return sp_blocking_read(port->serial, buf, count, timeout_ms);
+
+  case ZXTRANS_PORT_FILE:
+    return 0;
+
+  default:
+#ifndef _WIN32
+    {
+      double end = now() + timeout_ms/1000.0;
+      int received = 1;
+
+      if(SP_OK != send_held(port, 0))
+	return SP_ERR_FAIL;
+
+      while(0 == port->inLength && received >= 0){
+	int wait_ms = -1;
+
+	if(timeout_ms > 0 && (wait_ms = (end-now())*1000) <= 0)
+	  break;
+
+	received = receive(port, wait_ms);
+      }
+
+      if(received < 0)
+	return SP_ERR_FAIL;
+
+      if(count > port->inLength)
+	count = port->inLength;
+
+      memcpy(buf, port->in, count);
+      memmove(port->in, port->in+count, port->inLength-count);
+      port->inLength -= count;
+    }
+#endif
+    return count;
+  }
+}
+
+/* Wait until all bytes written have gone out. Over TCP, they have only
+   reached the terminal server. */
+enum sp_return zxtrans_port_drain(struct zxtrans_port *port){
+  switch(port->kind){
+  case ZXTRANS_PORT_SERIAL:
+    return sp_drain(port->serial);
+
+  case ZXTRANS_PORT_FILE:
+    return (0 == fflush(port->file)) ? SP_OK : SP_ERR_FAIL;
+
+  default:
+#ifndef _WIN32
+    return send_held(port, 0);
+#else
+    return SP_ERR_SUPP;
+#endif
+  }
+}
+
+/* Discard bytes not yet sent, or received and not yet read, as
+   buffers says */
+enum sp_return zxtrans_port_flush(struct zxtrans_port *port,
+				  enum sp_buffer buffers){
+  if(ZXTRANS_PORT_SERIAL == port->kind)
+    return sp_flush(port->serial, buffers);
+
+#ifndef _WIN32
+  if(ZXTRANS_PORT_FILE != port->kind){
+    if(buffers & SP_BUF_OUTPUT)
+      port->outLength = port->outData = 0;
+
+    if(buffers & SP_BUF_INPUT)
+      do
+	port->inLength = 0;
+      while(receive(port, 0) > 0);
+
+    if(ZXTRANS_PORT_RFC2217 == port->kind)
+      command_byte(port, PURGE_DATA, \
+		   ((buffers & SP_BUF_INPUT) ? PURGE_RECEIVED : 0) | \
+		   ((buffers & SP_BUF_OUTPUT) ? PURGE_TO_SEND : 0));
+  }
+#endif
+
+  return SP_OK;
+}
+
+/* Rest of name, if it starts with prefix, or else NULL */
+static const char *after_prefix(const char *name, const char *prefix){
+  size_t length = strlen(prefix);
+
+  return (0 == strncmp(name, prefix, length)) ? name+length : NULL;
+}
+
+#ifndef _WIN32
+/* Connect to a terminal server at address, given as host:port, with
+   Nagle's algorithm turned off. Returns the socket, or -1 having said
+   why. */
+static int open_socket(const char *address){
+  const char *name = address;
+  const char *colon = strrchr(address, ':');
+  char host[HOST_MAX];
+  struct addrinfo hints, *found, *a;
+  size_t length;
+  int s = -1;
+  int noDelay = 1;
+  int error;
+
+  if(NULL == colon || colon == address || \
+     (length = colon-address) >= sizeof(host)){
+    printf("Network port must be given as host:port, not %s\n", address);
+    return -1;
+  }
+
+  /* IPv6 addresses are given in brackets */
+  if('[' == address[0] && ']' == address[length-1]){
+    address++;
+    length -= 2;
+  }
+
+  memcpy(host, address, length);
+  host[length] = '\0';
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if(0 != (error = getaddrinfo(host, colon+1, &hints, &found))){
+    printf("Error finding terminal server %s: %s\n", host, \
+	   gai_strerror(error));
+    return -1;
+  }
+
+  for(a = found; NULL != a && -1 == s; a = a->ai_next)
+    if(-1 != (s = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) && \
+       0 != connect(s, a->ai_addr, a->ai_addrlen)){
+      close(s);
+      s = -1;
+    }
+
+  freeaddrinfo(found);
+
+  if(-1 == s){
+    printf("Error connecting to terminal server %s\n", name);
+    return -1;
+  }
+
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  /* A terminal server that drops the connection must not stop the
+     sender before it says so */
+  signal(SIGPIPE, SIG_IGN);
+
+  return s;
+}
+
+/* Hold bytes to be sent, escaping any IAC for RFC 2217. Held bytes go
+   out first if there is no more room. */
+static void hold(struct zxtrans_port *port, const unsigned char *bytes,
+		 size_t length){
+  for(size_t i=0; i<length; i++){
+    if(port->outLength+2 > sizeof(port->out))
+      send_held(port, 0);
+
+    port->out[port->outLength++] = bytes[i];
+
+    if(TELNET_IAC == bytes[i] && ZXTRANS_PORT_RFC2217 == port->kind)
+      port->out[port->outLength++] = TELNET_IAC;
+  }
+}
+
+/* Hold an RFC 2217 command, in order with the bytes around it */
+static void command(struct zxtrans_port *port, unsigned char code,
+		    const unsigned char *value, size_t length){
+  const unsigned char start[] = {TELNET_IAC, TELNET_SB, COM_PORT, code};
+  const unsigned char end[] = {TELNET_IAC, TELNET_SE};
+
+  if(port->outLength + sizeof(start) + 2*length + sizeof(end) > \
+     sizeof(port->out))
+    send_held(port, 0);
+
+  memcpy(&port->out[port->outLength], start, sizeof(start));
+  port->outLength += sizeof(start);
+  hold(port, value, length);
+  memcpy(&port->out[port->outLength], end, sizeof(end));
+  port->outLength += sizeof(end);
+}
+
+static void command_byte(struct zxtrans_port *port, unsigned char code,
+			 unsigned char value){
+  command(port, code, &value, 1);
+}
+
+/* Send all held bytes, in one segment where the connection allows,
+   waiting up to timeout_ms (0 for no limit). Once data has gone, CTS
+   is stale until notified again, and the terminal server is taken to
+   send it on at the line's baud rate. */
+static enum sp_return send_held(struct zxtrans_port *port,
+				unsigned int timeout_ms){
+  struct pollfd ready;
+  size_t sent = 0;
+
+  ready.fd = port->socket;
+  ready.events = POLLOUT;
+
+  while(sent < port->outLength){
+    ssize_t result;
+
+    if(poll(&ready, 1, (0 == timeout_ms) ? -1 : (int) timeout_ms) <= 0)
+      break;
+
+    if((result = send(port->socket, &port->out[sent], \
+		      port->outLength-sent, 0)) < 0)
+      break;
+
+    sent += result;
+  }
+
+  memmove(port->out, &port->out[sent], port->outLength-sent);
+  port->outLength -= sent;
+
+  if(0 == port->outLength && port->outData > 0){
+    double start = now();
+
+    if(port->lineEnd < start)
+      port->lineEnd = start;
+
+    if(port->baudRate > 0)
+      port->lineEnd += (double) port->outData*BITS_PER_BYTE/port->baudRate;
+
+    port->outData = 0;
+    port->ctsStale = (ZXTRANS_PORT_RFC2217 == port->kind);
+  }
+
+  return (0 == port->outLength) ? SP_OK : SP_ERR_FAIL;
+}
+
+/* Wait up to wait_ms (-1 for no limit) for bytes from the terminal
+   server, taking only as many as there is room to keep. Returns 1 if
+   any were received, 0 if not, or -1 if the connection has gone. */
+static int receive(struct zxtrans_port *port, int wait_ms){
+  unsigned char bytes[ZXTRANS_PORT_IN];
+  struct pollfd ready;
+  ssize_t length;
+
+  if(port->inLength >= sizeof(port->in))
+    return 0;
+
+  ready.fd = port->socket;
+  ready.events = POLLIN;
+
+  if(poll(&ready, 1, wait_ms) <= 0)
+    return 0;
+
+  if((length = recv(port->socket, bytes, sizeof(port->in)-port->inLength, \
+		    0)) <= 0)
+    return -1;
+
+  if(ZXTRANS_PORT_RFC2217 == port->kind)
+    receive_telnet(port, bytes, length);
+  else{
+    memcpy(&port->in[port->inLength], bytes, length);
+    port->inLength += length;
+  }
+
+  return 1;
+}
+
+/* Keep data from the telnet stream, and act on commands in it */
+static void receive_telnet(struct zxtrans_port *port,
+			   const unsigned char *bytes, size_t length){
+  for(size_t i=0; i<length; i++){
+    unsigned char c = bytes[i];
+
+    switch(port->telnet){
+    case IN_DATA:
+      if(TELNET_IAC == c)
+	port->telnet = TELNET_IAC;
+      else
+	port->in[port->inLength++] = c;
+      break;
+
+    case TELNET_IAC:
+      port->telnet = IN_DATA;
+
+      if(TELNET_IAC == c)
+	port->in[port->inLength++] = c;
+      else if(TELNET_SB == c){
+	port->telnet = TELNET_SB;
+	port->subLength = 0;
+      }
+      else if(c >= TELNET_WILL)
+	port->telnet = c;	/* Option follows */
+      break;
+
+    case TELNET_SB:
+      if(TELNET_IAC == c)
+	port->telnet = IN_SUB_IAC;
+      else if(port->subLength < sizeof(port->sub))
+	port->sub[port->subLength++] = c;
+      break;
+
+    case IN_SUB_IAC:
+      port->telnet = TELNET_SB;
+
+      if(TELNET_IAC == c){
+	if(port->subLength < sizeof(port->sub))
+	  port->sub[port->subLength++] = c;
+      }
+      else{
+	port->telnet = IN_DATA;
+
+	if(TELNET_SE == c && port->subLength >= 3 && \
+	   COM_PORT == port->sub[0] && NOTIFY_MODEMSTATE == port->sub[1]){
+	  port->cts = (port->sub[2] & MODEMSTATE_CTS) ? 1 : 0;
+	  port->ctsStale = 0;
+	}
+      }
+      break;
+
+    default:
+      negotiate(port, port->telnet, c);
+      port->telnet = IN_DATA;
+      break;
+    }
+  }
+}
+
+/* Refuse any option offered or asked for other than those the sender
+   uses, so the terminal server does not wait on it */
+static void negotiate(struct zxtrans_port *port, unsigned char verb,
+		      unsigned char option){
+  unsigned char refusal[3] = {TELNET_IAC, 0, option};
+
+  if(TELNET_DO == verb && TELNET_BINARY != option && COM_PORT != option)
+    refusal[1] = TELNET_WONT;
+  else if(TELNET_WILL == verb && TELNET_BINARY != option && \
+	  TELNET_SGA != option)
+    refusal[1] = TELNET_DONT;
+  else
+    return;
+
+  if(port->outLength + sizeof(refusal) > sizeof(port->out))
+    send_held(port, 0);
+
+  memcpy(&port->out[port->outLength], refusal, sizeof(refusal));
+  port->outLength += sizeof(refusal);
+}
+
+static double now(void){
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+#endif
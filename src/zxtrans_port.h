@@ -0,0 +1,114 @@
+/*
+   ZX-Trans Port - where a transfer is sent: a serial port, a file, or
+   a terminal server over TCP.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_PORT_H
+#define ZXTRANS_PORT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <libserialport.h>
+
+#define ZXTRANS_PORT_BATCH 256 /* Bytes held back to go over a network
+				  together, as one handshake's worth in
+				  mode 0 or one write in modes 1 and 2 */
+#define ZXTRANS_PORT_IN 256 /* Bytes from receiver held until read */
+#define ZXTRANS_PORT_SUB 16 /* Longest telnet subnegotiation kept */
+#define ZXTRANS_PORT_FILE_PREFIX "file:"
+#define ZXTRANS_PORT_TCP_PREFIX "tcp://"
+#define ZXTRANS_PORT_RFC2217_PREFIX "rfc2217://"
+
+/* A port is named as for libserialport, or with a prefix for the
+   others:
+
+     file:<path>           bytes are written to a file, as they would
+                           be sent; CTS is always asserted, and nothing
+                           is ever read back
+     tcp://<host>:<port>   raw TCP connection to a terminal server,
+                           which has the serial line and its flow
+                           control; CTS is always asserted
+     rfc2217://<host>:<port>
+                           telnet connection to a terminal server that
+                           takes baud rate and hardware flow control,
+                           and notifies CTS, over the connection, as in
+                           RFC 2217
+
+   Over TCP, Nagle's algorithm is turned off, and bytes are instead
+   held back until ZXTRANS_PORT_BATCH are waiting, or the sender waits
+   for CTS or an answer, so each handshake goes out in one segment.
+   Functions return as libserialport's do,
+   and network ports are not available on Windows. */
+
+enum zxtrans_port_kind {
+  ZXTRANS_PORT_SERIAL,
+  ZXTRANS_PORT_FILE,
+  ZXTRANS_PORT_TCP,
+  ZXTRANS_PORT_RFC2217
+};
+
+struct zxtrans_port {
+  enum zxtrans_port_kind kind;
+  struct sp_port *serial;
+  FILE *file;
+  int socket;
+  int cts;			/* As last notified by terminal server */
+  int ctsStale;			/* Not notified since data last sent */
+  int baudRate;			/* Of terminal server's line */
+  double lineEnd;		/* When data sent so far leaves it */
+  int pollCts;			/* Waiting for line changes failed on
+				   this port, so CTS is polled */
+  unsigned char out[2*ZXTRANS_PORT_BATCH]; /* Held back, escaped */
+  size_t outLength;
+  size_t outData;		/* Bytes of data among those held */
+  unsigned char in[ZXTRANS_PORT_IN];
+  size_t inLength;
+  int telnet;			/* Where incoming telnet stream is up to */
+  unsigned char sub[ZXTRANS_PORT_SUB];
+  size_t subLength;
+};
+
+struct zxtrans_port *zxtrans_port_open(const char *name, int readWrite);
+int zxtrans_port_configure(struct zxtrans_port *port, int baudRate);
+void zxtrans_port_close(struct zxtrans_port *port);
+enum sp_return zxtrans_port_set_baudrate(struct zxtrans_port *port,
+					 int baudRate);
+enum sp_return zxtrans_port_set_rts(struct zxtrans_port *port, int on);
+int zxtrans_port_cts(struct zxtrans_port *port);
+void zxtrans_port_wait(struct zxtrans_port *port, unsigned int wait_ms);
+enum sp_return zxtrans_port_write(struct zxtrans_port *port,
+				  const void *buf, size_t count,
+				  unsigned int timeout_ms);
+enum sp_return zxtrans_port_read(struct zxtrans_port *port, void *buf,
+				 size_t count, unsigned int timeout_ms);
+enum sp_return zxtrans_port_drain(struct zxtrans_port *port);
+enum sp_return zxtrans_port_flush(struct zxtrans_port *port,
+				  enum sp_buffer buffers);
+
+#endif
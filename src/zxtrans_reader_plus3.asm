@@ -1,35 +1,416 @@
-	;; This routine reads a block of binary data into memory from the built-in
+	;; This routine reads a single byte from the built-in
 	;; serial interface on the ZX Spectrum 128k +3 and +2A models.
 	;;
-	;; On entry:
-	;;   hl = base address for block to be written to
-	;;   bc = number of bytes to read
-	;;
 	;; On exit:
+	;;   a = byte read
 	;;   CF = set if read is successful; reset otherwise
+	;;   bc, de, hl and hl' are preserved
 
 READ_BYTE:	equ 0x3a00	; Address of read function for +3/+2A serial port (in ROM3)
 
-ZXT_LOAD_BLOCK:
+AY_REG:		equ 0xFFFD	; Port to select (and read) AY register
+AY_DATA:	equ 0xBFFD	; Port to write AY register
+AY_PORT_A:	equ 14		; AY I/O port A, which carries RS232 lines
+ZXT_CTS_BUSY:	equ %00000100	; Bit 2 high stops sender (CTS)
+ZXT_TXD_SPACE:	equ %00001000	; Bit 3 is TXD, which (like RXD) is set
+				; for a zero
+ZXT_CATCH_LOOPS: equ 40		; Polls for a late byte, before and after
+				; CTS is dropped
+ZXT_RATE_COUNT:	equ 4		; Rates in ZXT_RATES
+ZXT_LADDER_LEN:	equ 16		; Bytes of test pattern sent at each rate
+ZXT_LADDER_FIRST: equ 0x55	; First byte of pattern, each of the rest
+ZXT_LADDER_STEP: equ 0x35	; adding this to the one before
+ZXT_PAUSE_LOOPS: equ 2728	; About 20ms of ZXT_PAUSE
+ZXT_PASS_PAUSE:	equ 3		; CTS is held low this many pauses after
+ZXT_FAIL_PAUSE:	equ 15		; a pattern, to tell sender how it went
+
+ZXT_READ_SERIAL:
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST
+	jr nz, ZXT_FAST_BYTE
+	push hl			; Preserve registers used by caller
+	push de
+	push bc
 	exx
 	push hl			; Preserve HL' for return to BASIC
 	exx
-ZXS_LOOP_2:	
-	push hl			; Save current destination address and number of
-	push bc			; bytes still to read
 ZXS_READ_BYTE:	
 	call READ_BYTE
 	jr nc, ZXS_READ_BYTE	; Try again, if no byte read
-	pop bc			; Restore current destination address and number of
-	pop hl			; bytes still to read
-	ld (hl),a		; Store byte read
-	inc hl			; Advance to next address
-	dec bc			; Decrement counter
-	ld a,b			; Check if done
+	exx
+	pop hl			; Restore HL' for return to BASIC
+	exx
+	pop bc
+	pop de
+	pop hl
+	ret			; Exit, with CF set
+
+ZXT_FAST_BYTE:
+	push hl
+	push bc
+	ld hl, ZXT_FAST_BUF
+	ld bc, 0x0001
+	call ZXT_FAST_RAW
+	pop bc
+	pop hl
+	ld a, (ZXT_FAST_BUF)
+	ret			; Exit, with CF set
+
+	;;
+	;; Read BC bytes to HL with the fast serial loop, starting with
+	;; any byte it caught after CTS was last dropped.
+	;;
+	;; On exit:
+	;;   hl = address following block
+	;;   CF = set
+	;;   de and hl' are preserved
+	;;
+ZXT_FAST_RAW:
+	ld a, (ZXT_SERFL)	; Byte caught at end of last block?
+	and a
+	jr z, ZXT_FAST_RAW_1
+	xor a
+	ld (ZXT_SERFL), a
+	ld a, (ZXT_SERFL+1)
+	ld (hl), a
+	inc hl
+	dec bc
+	ld a, b
 	or c
-	jr nz, ZXS_LOOP_2	; Loop if not
+	scf
+	ret z
+ZXT_FAST_RAW_1:
+	push de
+	call ZXT_FAST_ADDR	; Read rest of block
+	pop de
+	ld bc, 0x0000
+	ret
+
+	;;
+	;; Send byte in A to the sender, which only happens in a checked
+	;; transfer. The sender always raises the baud rate for one, so
+	;; this uses the fast serial loop's routine, at the rate settled on.
+	;;
+	;; On exit:
+	;;   bc, de, hl and hl' are preserved
+	;;
+ZXT_WRITE_BYTE:
+	push hl
+	push de
+	push bc
+	call ZXF_SEND+ZXF
+	pop bc
+	pop de
+	pop hl
+	ret
+
+	;;
+	;; Copy fast serial loop to page 2, where it runs, and settle on
+	;; a baud rate with the sender. Working down ZXT_RATES, the sender
+	;; sends a test pattern at each rate, until one arrives intact.
+	;; The receiver answers each pattern on CTS, which works whatever
+	;; the rate: it holds CTS low for ZXT_PASS_PAUSE pauses, then
+	;; raises it for one more byte, if the pattern passed, or for
+	;; ZXT_FAIL_PAUSE pauses, before trying the next rate, if not.
+	;;
+	;; On exit:
+	;;   CF = set if a rate passed; reset otherwise
+	;;
+ZXT_FAST_INIT:
+	ld hl, ZXT_FAST_CODE
+	ld de, ZXT_FAST_ADDR
+	ld bc, ZXF_END-ZXT_FAST_CODE
+	ldir
+	xor a			; Start at fastest rate
+ZXT_LADDER:
+	push af
+	call ZXT_FAST_RATE
+	xor a			; No byte caught yet
+	ld (ZXT_SERFL), a
+	ld hl, ZXT_FRAME_BUF	; Not yet in use
+	push hl
+	ld bc, ZXT_LADDER_LEN
+	call ZXT_FAST_RAW
+	xor a			; Forget anything sent to finish pattern
+	ld (ZXT_SERFL), a
+	pop hl
+	ld b, ZXT_LADDER_LEN
+	ld a, ZXT_LADDER_FIRST
+ZXT_LADDER_1:
+	cp (hl)
+	jr nz, ZXT_LADDER_2	; Pattern damaged, so try slower
+	inc hl
+	add a, ZXT_LADDER_STEP
+	djnz ZXT_LADDER_1
+	pop af
+	ld b, ZXT_PASS_PAUSE
+	call ZXT_PAUSE
+	call ZXT_FAST_BYTE	; Sender's go-ahead
 	scf			; Indicates success
+	ret
+ZXT_LADDER_2:
+	ld b, ZXT_FAIL_PAUSE
+	call ZXT_PAUSE
+	pop af
+	inc a
+	cp ZXT_RATE_COUNT
+	jr c, ZXT_LADDER
+	ret			; No rate left, with CF reset
+
+	;;
+	;; Wait for B pauses, of about 20ms each
+	;;
+ZXT_PAUSE:
+	ld de, ZXT_PAUSE_LOOPS
+ZXT_PAUSE_1:
+	dec de
+	ld a, d
+	or e
+	jr nz, ZXT_PAUSE_1
+	djnz ZXT_PAUSE
+	ret
+
+	;;
+	;; Time fast serial loop for rate A of ZXT_RATES, by patching its
+	;; delays
+	;;
+ZXT_FAST_RATE:
+	ld hl, ZXT_RATES
+	ld e, a
+	add a, a
+	add a, a
+	add a, a
+	sub e
+	ld e, a
+	ld d, 0x00
+	add hl, de		; Row A, of seven bytes
+	ld a, (hl)
+	ld (ZXF_BIT+1+ZXF), a
+	ld (ZXF_LATE_N+1+ZXF), a
+	inc hl
+	ld a, (hl)
+	ld (ZXF_HALF+1+ZXF), a
+	inc hl
+	ld a, (hl)
+	ld (ZXF_LATE_HALF+1+ZXF), a
+	inc hl
+	ld a, (hl)
+	ld (ZXF_SEND_WAIT+1+ZXF), a
+	inc hl
+	ld a, (hl)
+	ld (ZXF_SEND_JP+1+ZXF), a
+	inc hl
+	ld a, (hl)
+	ld (ZXF_NEXT+1+ZXF), a
+	inc hl
+	ld a, (hl)
+	ld (ZXF_LAST_JP+1+ZXF), a
+	ret
+
+	;;
+	;; Delays for each rate, fastest first, as counts of the 16 T-state
+	;; loops in ZXF_BIT, ZXF_HALF, ZXF_LATE_HALF and ZXF_SEND_WAIT, then
+	;; where the send loop, and the receive loop after each byte and
+	;; after the last, jump to. Counts are explained below.
+	;;
+ZXT_RATES:
+	db 1, 2, 1, 0, (ZXF_SEND_2+ZXF) & 0xFF	; 57600 baud
+	db (ZXF_WAIT+ZXF) & 0xFF, (ZXF_LATE+ZXF) & 0xFF
+	db 3, 3, 4, 1, (ZXF_SEND_WAIT+ZXF) & 0xFF ; 38400 baud
+	db (ZXF_WAIT+ZXF) & 0xFF, (ZXF_LATE+ZXF) & 0xFF
+	db 9, 5, 12, 7, (ZXF_SEND_WAIT+ZXF) & 0xFF ; 19200 baud
+	db (ZXF_STOP+ZXF) & 0xFF, (ZXF_LAST+ZXF) & 0xFF
+	db 20, 13, 31, 18, (ZXF_SEND_WAIT+ZXF) & 0xFF ; 9600 baud
+	db (ZXF_STOP+ZXF) & 0xFF, (ZXF_LAST+ZXF) & 0xFF
+
+	;;
+	;; Fast serial loop, which reads bits from the AY port directly,
+	;; rather than through the ROM. Code in page 5 runs at a speed
+	;; that depends on the display, so this is copied to ZXT_FAST_ADDR
+	;; in page 2, where timing can be counted in T-states. Jumps are
+	;; made relative to that address, using ZXF, and the loop must fit
+	;; in ZXT_FAST_LEN bytes.
+	;;
+	;; At 3.5469MHz, a bit at 57600 baud lasts 61.6 T-states. Each
+	;; byte is timed from the leading edge of its start bit, which is
+	;; seen within 22 T-states, and the loop takes 62 T-states per bit,
+	;; so samples fall within 15 T-states of the middle of each bit.
+	;; Slower rates only lengthen the delays in ZXF_HALF and ZXF_BIT,
+	;; which ZXT_FAST_RATE patches with counts of 16 T-state loops:
+	;;
+	;;   Baud   Bit (T)  ZXF_BIT  Loop (T)  ZXF_HALF  First sample (T)
+	;;   57600   61.6       1        62        2         78-100
+	;;   38400   92.4       3        94        3        126-148
+	;;   19200  184.7       9       190        5        254-276
+	;;    9600  369.5      20       366       13        558-580
+	;;
+	;; Below 38400 baud, the loop is back before the stop bit of a byte
+	;; ending in a zero has begun, so it waits in ZXF_STOP for that.
+	;; A late byte is seen within 38 T-states, and ZXF_LATE_HALF then
+	;; makes the first sample 70, 118, 246 or 550 T-states after that.
+	;;
+	;; CTS is held ready for the whole block, so the sender can stream
+	;; it. A byte the sender starts before seeing CTS drop again is
+	;; kept in ZXT_SERFL, for the next call.
+	;;
+	;; On entry:
+	;;   hl = base address for block to be written to
+	;;   bc = number of bytes to write (at least one)
+	;;
+	;; On exit:
+	;;   hl = address following block
+	;;   CF = set
+	;;   hl' is preserved
+	;;
+ZXT_FAST_CODE:
+	di			; Timing must not be disturbed
+	exx
+	push hl			; Preserve HL' for return to BASIC
+	push de
+	push bc
+	exx
+	push bc
 	exx
+	pop de			; DE' counts bytes left
+	exx
+	ld bc, AY_REG		; Select port holding RS232 lines
+	ld a, AY_PORT_A
+	out (c), a
+ZXF_IDLE:
+	in a, (c)		; Let any byte caught last time finish
+	jp m, ZXF_IDLE+ZXF
+	and 0xFF-ZXT_CTS_BUSY	; Raise CTS, so sender starts
+	ld b, AY_DATA/256
+	out (c), a
+	or ZXT_CTS_BUSY		; Keep value to drop CTS again
+	ld e, a
+	ld b, AY_REG/256	; Ready to sample RXD, in bit 7
+	ld d, 0x80		; Marker, shifted out after eight bits
+	jr ZXF_WAIT
+ZXF_STOP:
+	in a, (c)		; Wait for stop bit, below 38400 baud
+	jp m, ZXF_STOP+ZXF
+ZXF_WAIT:
+	in a, (c)		; 12 Wait for start bit (bit 7 set)
+	jp p, ZXF_WAIT+ZXF	; 10
+ZXF_HALF:
+	ld a, 0x02		;  7 Delay to middle of first data bit
+	dec a			;  4
+	jr nz, $-1		; 12
+ZXF_BIT:
+	ld a, 0x01		;  7 Delay, to make 62 T-states per bit
+	dec a			;  4
+	jr nz, $-1		; 12
+	nop			;  4
+	in a, (c)		; 12 Sample RXD, which is set for a zero
+	cpl			;  4
+	rla			;  4
+	rr d			;  8 Shift in bit, low bit first
+	jr nc, ZXF_BIT		; 12
+	ld (hl), d		;  7 Store byte
+	inc hl			;  6
+	exx			;  4
+	dec de			;  6
+	ld a, d			;  4
+	or e			;  4
+	exx			;  4
+	ld d, 0x80		;  7
+ZXF_NEXT:
+	jp nz, ZXF_WAIT+ZXF	; 10 Back in time for next start bit
+	push hl			; Address following block, as L counts
+ZXF_LAST:
+	in a, (c)		; Sender may still be streaming
+ZXF_LAST_JP:
+	jp m, ZXF_LATE+ZXF
+	ld l, ZXT_CATCH_LOOPS
+ZXF_CATCH:
+	in a, (c)		; 12
+	jp m, ZXF_LATE+ZXF	; 10
+	dec l			;  4
+	jr nz, ZXF_CATCH	; 12
+	ld b, AY_DATA/256	; Drop CTS
+	out (c), e
+	ld b, AY_REG/256
+	ld l, ZXT_CATCH_LOOPS	; Sender may have started a byte just
+ZXF_CATCH_2:			; before it saw CTS drop
+	in a, (c)
+	jp m, ZXF_LATE+ZXF
+	dec l
+	jr nz, ZXF_CATCH_2
+	jr ZXF_DONE
+ZXF_LATE:
+	ld b, AY_DATA/256	;  7 Drop CTS, so this is the last byte
+	out (c), e		; 12
+	ld b, AY_REG/256	;  7
+ZXF_LATE_HALF:
+	ld a, 0x01		;  7 As above, allowing for slower polling
+ZXF_LATE_BIT:
+	dec a			;  4
+	jr nz, ZXF_LATE_BIT	; 12
+	nop			;  4
+	in a, (c)		; 12
+	cpl			;  4
+	rla			;  4
+	rr d			;  8
+ZXF_LATE_N:
+	ld a, 0x01		;  7
+	jr nc, ZXF_LATE_BIT	; 12
+	ld e, 0x01		; Keep byte for next call
+	ld (ZXT_SERFL), de
+ZXF_DONE:
+	pop hl			; Address following block
+	exx
+	pop bc
+	pop de
 	pop hl			; Restore HL' for return to BASIC
 	exx
-	ret			; Exit
+	ei
+	scf			; Indicates success
+	ret
+	;;
+	;; Send byte in A on TXD, with bits timed as above. Below 57600
+	;; baud, each bit jumps through ZXF_SEND_WAIT, which makes it
+	;; 74 T-states and the patched count of 16 T-state loops long.
+	;;
+ZXF_SEND:
+	di			; Timing must not be disturbed
+	ld d, a			; Byte to send
+	ld bc, AY_REG		; Select port holding RS232 lines
+	ld a, AY_PORT_A
+	out (c), a
+	in a, (c)
+	and 0xFF-ZXT_TXD_SPACE	; Idle line, for a one
+	ld e, a
+	or ZXT_TXD_SPACE	; For a zero, and leaves CF reset for
+	ld l, a			; start bit
+	ld b, AY_DATA/256
+	ld h, 0x09		; Start bit and eight data bits
+ZXF_SEND_BIT:
+	ld a, e			;  4
+	jr c, ZXF_SEND_1	; 12
+	ld a, l			;  4
+ZXF_SEND_1:
+	out (c), a		; 12
+ZXF_SEND_JP:
+	jp ZXF_SEND_2+ZXF	; 10 Makes 62 T-states per bit
+ZXF_SEND_2:
+	rr d			;  8 Next bit, low bit first
+	dec h			;  4
+	jr nz, ZXF_SEND_BIT	; 12
+	out (c), e		; Stop bit, until next byte
+	ei
+	ret
+ZXF_SEND_WAIT:
+	ld a, 0x00		; Count patched for rate
+	dec a
+	jr nz, $-1
+	jp ZXF_SEND_2+ZXF
+ZXF_END:
+	ds ZXT_FAST_LEN-(ZXF_END-ZXT_FAST_CODE) ; Rest of space for end
+				; of page 2, while loading
+ZXF:		equ ZXT_FAST_ADDR-ZXT_FAST_CODE	; Offset for jumps
+
+ZXT_SERFL:	db 0x00, 0x00	; Flag and byte caught by fast loop
+ZXT_FAST_BUF:	db 0x00		; Byte read by fast loop
+ZXT_HOLD:	equ ZXT_FAST_CODE ; End of page 2 is held here, once fast
+				; loop has been copied there
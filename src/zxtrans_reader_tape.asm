@@ -0,0 +1,271 @@
+	;; This routine reads a single byte from tape, through the EAR
+	;; socket of any ZX Spectrum with at least 48k of memory.
+	;;
+	;; The sender writes the transfer as numbered blocks of
+	;; ZXT_TAPE_BLOCK_LEN bytes, each loaded whole into ZXT_FRAME_BUF
+	;; (the tape receiver is never sent checked frames, so it keeps
+	;; blocks there, with the frame variables) and then handed out a
+	;; byte at a time. The pause before each block's leader is long
+	;; enough for the receiver to use the block before.
+	;;
+	;; On exit:
+	;;   a = byte read
+	;;   CF = set if read is successful; reset otherwise
+	;;   bc, de, hl and hl' are preserved
+
+ULA_PORT:	equ 0xFE	; Port for EAR input, and border
+ZXT_EAR:	equ %01000000	; EAR input, in bit 6
+ZXT_BREAK_ROW:	equ 0x7F	; Keyboard row holding SPACE (BREAK)
+ZXT_TAPE_BLOCK_LEN: equ 254	; Bytes of transfer in each block, after
+				; its number and before its checksum
+ZXT_LEADER_CYCLES: equ 32	; Steady leader cycles needed for a block
+ZXT_CYCLE_MIN:	equ 8		; Shortest leader cycle, in ZXL_EDGE loops
+ZXT_STRIPE:	equ ZXT_EAR+%00000110 ; Flips EAR level kept, and border
+				; between black and yellow
+
+ZXT_READ_SERIAL:
+	push hl
+	ld hl, ZXT_FRAME_LEFT
+	ld a, (hl)
+	and a
+	jr nz, ZXT_READ_TAPE_1
+	call ZXT_TAPE_BLOCK	; Block used up, so load next
+	jr nc, ZXT_READ_TAPE_2
+ZXT_READ_TAPE_1:
+	dec (hl)
+	ld hl, (ZXT_FRAME_PTR)
+	ld a, (hl)
+	inc hl
+	ld (ZXT_FRAME_PTR), hl
+	scf			; Indicates success
+ZXT_READ_TAPE_2:
+	pop hl
+	ret
+
+	;;
+	;; Load next block from tape into ZXT_FRAME_BUF, and check it is
+	;; intact and the one expected. Timed loop is copied to page 2
+	;; before the first, as for the +3 fast serial loop.
+	;;
+	;; On exit:
+	;;   hl = ZXT_FRAME_LEFT
+	;;   CF = set if block is loaded; reset otherwise
+	;;   bc and de are preserved
+	;;
+ZXT_TAPE_BLOCK:
+	push bc
+	push de
+	ld a, (ZXT_FLAGS)	; Options are zero until state block, in
+	and a			; first block, is loaded
+	jr nz, ZXT_TAPE_1
+	ld hl, ZXT_TAPE_CODE
+	ld de, ZXT_FAST_ADDR
+	ld bc, ZXL_END-ZXT_TAPE_CODE
+	ldir
+ZXT_TAPE_1:
+	ld hl, ZXT_FRAME_BUF
+	call ZXT_FAST_ADDR
+	jr nc, ZXT_TAPE_4	; BREAK pressed, or tape stopped
+	ld hl, ZXT_FRAME_BUF	; Number, bytes and checksum XOR to zero,
+	xor a			; if block is intact
+	ld b, a
+ZXT_TAPE_2:
+	xor (hl)
+	inc hl
+	djnz ZXT_TAPE_2
+	and a
+	jr nz, ZXT_TAPE_3
+	ld hl, ZXT_FRAME_SEQ
+	ld a, (ZXT_FRAME_BUF)
+	sub (hl)
+	jr nz, ZXT_TAPE_3	; Block missed
+	inc (hl)		; Number of block to follow
+	ld hl, ZXT_FRAME_BUF+1
+	ld (ZXT_FRAME_PTR), hl
+	ld hl, ZXT_FRAME_LEFT
+	ld (hl), ZXT_TAPE_BLOCK_LEN
+	scf			; Indicates success
+	jr ZXT_TAPE_4
+ZXT_TAPE_3:
+	and a			; Indicates failure
+ZXT_TAPE_4:
+	ld hl, ZXT_FRAME_LEFT
+	pop de
+	pop bc
+	ret
+
+	;;
+	;; Tape cannot be answered, so the tape receiver is never sent
+	;; checked frames
+	;;
+ZXT_WRITE_BYTE:	ret
+
+	;;
+	;; The sender always sets ZXT_FLAG_FAST for tape, so the end of
+	;; page 2 is loaded out of the way of the timed loop, which is
+	;; already in place
+	;;
+ZXT_FAST_INIT:
+	scf			; Indicates success
+	ret
+ZXT_FAST_RAW:	equ ZXT_LOAD_BYTES
+
+	;;
+	;; Timed loop, which reads one block of 256 bytes from tape. Like
+	;; the +3 fast serial loop, it is copied to ZXT_FAST_ADDR in page
+	;; 2, where its timing is not disturbed by the display, and jumps
+	;; are made relative to that address using ZXL.
+	;;
+	;; Each block starts with a leader tone, then a sync pulse, with
+	;; bits sent as in the ROM's format (most significant first, each
+	;; a cycle that is twice as long for a one) but at several times
+	;; the speed. Rather than fixing the speed, the loop times 32
+	;; cycles of leader in 43 T-state loops of ZXL_EDGE, and counts a
+	;; bit as a one if its cycle takes more than 0.59 of their average:
+	;; the sender makes a zero 0.39 and a one 0.79 of a leader cycle,
+	;; so the loop suits any speed the sender picks, and a tape that
+	;; runs fast or slow.
+	;;
+	;; On entry:
+	;;   hl = base address for block to be written to
+	;;
+	;; On exit:
+	;;   CF = set if block is read; reset if BREAK is pressed, or the
+	;;        tape stops during the block
+	;;   hl' is preserved
+	;;
+ZXT_TAPE_CODE:
+	di			; Timing must not be disturbed
+	push hl
+ZXL_START:
+	ld a, ZXT_BREAK_ROW	; Give up if BREAK is pressed
+	in a, (ULA_PORT)
+	rra
+	jp nc, ZXL_BREAK+ZXL
+	in a, (ULA_PORT)	; Level of EAR input
+	and ZXT_EAR
+	ld c, a
+	ld b, 0x00		; Wait for an edge, so a whole cycle is
+	call ZXL_EDGE+ZXL	; timed
+	jr nc, ZXL_START	; Nothing on tape yet
+	ld b, 0x00
+	call ZXL_CYCLE+ZXL	; Time one cycle of leader
+	jr nc, ZXL_START
+	ld a, b
+	cp ZXT_CYCLE_MIN
+	jr c, ZXL_START		; Too short for a leader
+	ld (ZXL_LEADER_2+1+ZXL), a ; Cycle the rest of leader must match
+	srl a
+	srl a
+	ld e, a			; Quarter of a cycle, as tolerance, and
+				; longest sync pulse
+	ld hl, 0x0000		; Total of leader cycles, which times the
+	ld d, ZXT_LEADER_CYCLES	; rest
+ZXL_LEADER:
+	ld b, 0x00
+	call ZXL_CYCLE+ZXL
+	jr nc, ZXL_START
+	ld a, b
+	add a, l
+	ld l, a
+	jr nc, ZXL_LEADER_1
+	inc h
+ZXL_LEADER_1:
+	ld a, b
+ZXL_LEADER_2:
+	sub 0x00		; Patched with first cycle, above
+	jr nc, ZXL_LEADER_3
+	neg
+ZXL_LEADER_3:
+	cp e
+	jr nc, ZXL_START	; Not a steady tone, so not a leader
+	dec d
+	jr nz, ZXL_LEADER
+	push de			; Split between a zero and a one is 19/32
+	add hl, hl		; of average leader cycle (total/32), less
+	add hl, hl		; one for time outside ZXL_EDGE, which is
+	ld d, h			; taken from h once total is scaled by
+	ld e, l			; 4*19/16. This is worked out in the half
+	srl d			; cycle of leader after the last one timed,
+	rr e			; rather than once the sync pulse leaves
+	srl d			; little time.
+	rr e
+	srl d
+	rr e
+	add hl, de
+	srl d
+	rr e
+	add hl, de
+	dec h
+	ld a, h
+	ld (ZXL_SPLIT+1+ZXL), a
+	pop de
+	ld b, 0x00		; Rest of that half cycle, which is too
+	call ZXL_EDGE+ZXL	; short to time
+	jr nc, ZXL_START
+ZXL_SYNC:
+	ld b, 0x00		; Leader goes on until sync pulse
+	call ZXL_EDGE+ZXL
+	jr nc, ZXL_START
+	ld a, b
+	cp e
+	jr nc, ZXL_SYNC
+	ld b, 0x00		; Second half of sync pulse
+	call ZXL_EDGE+ZXL
+	jr nc, ZXL_START
+	pop hl
+	ld d, 0x00		; Count 256 bytes
+ZXL_BYTE:
+	ld (hl), 0x01		; Marker, shifted out after eight bits
+ZXL_BIT:
+	ld b, 0x00
+	call ZXL_CYCLE+ZXL
+	jr nc, ZXL_FAIL
+ZXL_SPLIT:
+	ld a, 0x00		; Patched with split, above
+	cp b			; CF is set for a one
+	rl (hl)
+	jr nc, ZXL_BIT
+	inc hl
+	dec d
+	jr nz, ZXL_BYTE
+	ei
+	scf			; Indicates success
+	ret
+ZXL_BREAK:
+	pop hl
+ZXL_FAIL:
+	ei
+	and a			; Indicates failure
+	ret
+	;;
+	;; Wait for two changes in EAR level (ZXL_CYCLE) or one
+	;; (ZXL_EDGE), counting 43 T-state loops in B. Each change
+	;; flips the border colour, as the ROM does.
+	;;
+	;; On exit:
+	;;   CF = set, or reset if B reached 256
+	;;
+ZXL_CYCLE:
+	call ZXL_EDGE+ZXL
+	ret nc
+ZXL_EDGE:
+	inc b			;  4
+	ret z			;  5 (CF is reset, by AND)
+	in a, (ULA_PORT)	; 11
+	xor c			;  4
+	and ZXT_EAR		;  7
+	jr z, ZXL_EDGE		; 12
+	ld a, c
+	xor ZXT_STRIPE
+	ld c, a
+	out (ULA_PORT), a
+	scf
+	ret
+ZXL_END:
+	ds ZXT_FAST_LEN-(ZXL_END-ZXT_TAPE_CODE) ; Rest of space for end
+				; of page 2, while loading
+ZXL:		equ ZXT_FAST_ADDR-ZXT_TAPE_CODE	; Offset for jumps
+
+ZXT_HOLD:	equ ZXT_TAPE_CODE ; End of page 2 is held here, once timed
+				; loop has been copied there
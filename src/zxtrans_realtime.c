@@ -0,0 +1,341 @@
+/*
+   ZX-Trans Realtime - sending at real-time priority, with memory locked
+   and serial driver latency kept low, so handshakes are not held up.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _GNU_SOURCE /* For CPU_SET, pthread_setaffinity_np, realpath */
+
+#define LATENCY_TIMER "/sys/class/tty/%s/device/latency_timer" /* Of an
+							  FTDI adapter */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+#include "zxtrans_realtime.h"
+
+static void say_once(int *said, const char *format, ...);
+#ifdef __linux__
+static void restore_all(void);
+
+/* Driver settings changed by zxtrans_realtime_low_latency(), to be put
+   back when the port is closed, or the sender exits first */
+struct changed_port {
+  struct zxtrans_port *port;
+  int lowLatency;		/* ASYNC_LOW_LATENCY was set */
+  int latency;			/* Latency timer before, or 0 */
+  char timerName[PATH_MAX+64];
+  struct changed_port *next;
+};
+
+static struct changed_port *changedPorts=NULL;
+static int restoreAtExit=0;
+#endif
+
+/* Reasons already given, so each is said once rather than for every
+   snapshot and port */
+static pthread_mutex_t sayLock = PTHREAD_MUTEX_INITIALIZER;
+static int saidPriority=0;
+static int saidCpu=0;
+
+/* Lock the sender's memory, now and as it grows, so no page fault holds
+   up a handshake. Once locked, memory can only grow within the limit on
+   locked memory, so it is only locked if there is none. Returns 1 on
+   success, or 0 having said why. */
+int zxtrans_realtime_lock(void){
+#ifdef _WIN32
+  printf("Memory cannot be locked on Windows; sending without.\n");
+  return 0;
+#else
+  struct rlimit limit;
+
+  if(0 == getrlimit(RLIMIT_MEMLOCK, &limit) && \
+     RLIM_INFINITY != limit.rlim_cur && RLIM_INFINITY == limit.rlim_max){
+    limit.rlim_cur = RLIM_INFINITY;
+    setrlimit(RLIMIT_MEMLOCK, &limit);
+  }
+
+  /* Root is not held to the limit */
+  if(0 != geteuid() && (0 != getrlimit(RLIMIT_MEMLOCK, &limit) || \
+			RLIM_INFINITY != limit.rlim_cur)){
+    printf("Locked memory is limited (see ulimit -l); sending without " \
+	   "locking it.\n");
+    return 0;
+  }
+
+  if(0 != mlockall(MCL_CURRENT | MCL_FUTURE)){
+    printf("Unable to lock memory (%s); sending without.\n", \
+	   strerror(errno));
+    return 0;
+  }
+
+  return 1;
+#endif
+}
+
+/* Send from the calling thread at real-time priority, pinned to cpu
+   unless it is negative, keeping its scheduling in saved. Returns 1 on
+   success, or 0 having said why (the first time). */
+int zxtrans_realtime_enter(struct zxtrans_realtime *saved, int cpu){
+#ifdef _WIN32
+  HANDLE thread = GetCurrentThread();
+  DWORD_PTR cpus;
+
+  memset(saved, 0, sizeof(*saved));
+  saved->priority = GetThreadPriority(thread);
+  saved->raised = SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL);
+
+  if(!saved->raised)
+    say_once(&saidPriority, "Unable to send at real-time priority.\n");
+
+  if(cpu >= 0){
+    if(0 != (cpus = SetThreadAffinityMask(thread, (DWORD_PTR) 1 << cpu))){
+      memcpy(saved->cpus, &cpus, sizeof(cpus));
+      saved->pinned = 1;
+    }
+    else
+      say_once(&saidCpu, "Unable to send from CPU %d.\n", cpu);
+  }
+#else
+  pthread_t self = pthread_self();
+  struct sched_param param;
+  int error;
+
+  memset(saved, 0, sizeof(*saved));
+
+  if(0 == (error = pthread_getschedparam(self, &saved->policy, &param))){
+    saved->priority = param.sched_priority;
+    param.sched_priority = ZXTRANS_REALTIME_PRIORITY;
+    error = pthread_setschedparam(self, SCHED_FIFO, &param);
+  }
+
+  if(0 == error)
+    saved->raised = 1;
+  else
+    say_once(&saidPriority, "Unable to send at real-time priority (%s).\n", \
+	     strerror(error));
+
+  if(cpu >= 0){
+#ifdef __linux__
+    cpu_set_t cpus;
+
+    if(sizeof(cpus) <= sizeof(saved->cpus) && cpu < CPU_SETSIZE && \
+       0 == pthread_getaffinity_np(self, sizeof(cpus), &cpus)){
+      memcpy(saved->cpus, &cpus, sizeof(cpus));
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu, &cpus);
+      saved->pinned = (0 == pthread_setaffinity_np(self, sizeof(cpus), \
+						   &cpus));
+    }
+#endif
+
+    if(!saved->pinned)
+      say_once(&saidCpu, "Unable to send from CPU %d.\n", cpu);
+  }
+#endif
+
+  return saved->raised && (cpu < 0 || saved->pinned);
+}
+
+/* Put back scheduling of the calling thread, as zxtrans_realtime_enter()
+   found it */
+void zxtrans_realtime_leave(const struct zxtrans_realtime *saved){
+#ifdef _WIN32
+  DWORD_PTR cpus;
+
+  if(saved->raised)
+    SetThreadPriority(GetCurrentThread(), saved->priority);
+
+  if(saved->pinned){
+    memcpy(&cpus, saved->cpus, sizeof(cpus));
+    SetThreadAffinityMask(GetCurrentThread(), cpus);
+  }
+#else
+  if(saved->raised){
+    struct sched_param param;
+
+    param.sched_priority = saved->priority;
+    pthread_setschedparam(pthread_self(), saved->policy, &param);
+  }
+
+#ifdef __linux__
+  if(saved->pinned){
+    cpu_set_t cpus;
+
+    memcpy(&cpus, saved->cpus, sizeof(cpus));
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#endif
+#endif
+}
+
+/* Have the serial driver for port (called portName) pass on each byte
+   and change to CTS at once, rather than gather them: ASYNC_LOW_LATENCY
+   for a UART, and the shortest latency timer for an FTDI adapter, which
+   otherwise holds bytes back for up to 16ms. Each is left alone where
+   the driver does not have it, or it cannot be changed. The driver is
+   shared with every other user of the device, so what is changed is
+   put back by zxtrans_realtime_restore(), or at exit. Returns the
+   number of settings changed. */
+int zxtrans_realtime_low_latency(struct zxtrans_port *port,
+				 const char *portName){
+  int changed = 0;
+#ifdef __linux__
+  struct serial_struct serial;
+  struct changed_port *saved;
+  char path[PATH_MAX];
+  FILE *timer;
+  int fd, latency;
+
+  if(NULL == port->serial || \
+     NULL == (saved = calloc(1, sizeof(struct changed_port))))
+    return 0;
+
+  if(SP_OK == sp_get_port_handle(port->serial, &fd) && \
+     0 == ioctl(fd, TIOCGSERIAL, &serial) && \
+     !(serial.flags & ASYNC_LOW_LATENCY)){
+    serial.flags |= ASYNC_LOW_LATENCY;
+
+    if(0 == ioctl(fd, TIOCSSERIAL, &serial)){
+      saved->lowLatency = 1;
+      changed++;
+    }
+  }
+
+  /* Port may be named through a link, such as /dev/serial/by-id */
+  if(NULL != realpath(portName, path) && NULL != strrchr(path, '/')){
+    snprintf(saved->timerName, sizeof(saved->timerName), LATENCY_TIMER, \
+	     strrchr(path, '/')+1);
+
+    if(NULL != (timer = fopen(saved->timerName, "r+"))){
+      if(1 == fscanf(timer, "%d", &latency) && latency > 1){
+	rewind(timer);
+
+	if(fprintf(timer, "1\n") > 0 && 0 == fflush(timer)){
+	  saved->latency = latency;
+	  changed++;
+	}
+      }
+
+      fclose(timer);
+    }
+  }
+
+  if(0 == changed){
+    free(saved);
+    return 0;
+  }
+
+  if(!restoreAtExit)
+    restoreAtExit = (0 == atexit(restore_all));
+
+  saved->port = port;
+  saved->next = changedPorts;
+  changedPorts = saved;
+#else
+  (void) port;
+  (void) portName;
+#endif
+
+  return changed;
+}
+
+/* Put back driver settings of port, before it is closed, as they were
+   before zxtrans_realtime_low_latency() */
+void zxtrans_realtime_restore(struct zxtrans_port *port){
+#ifdef __linux__
+  struct changed_port **link = &changedPorts;
+  struct changed_port *saved;
+  struct serial_struct serial;
+  FILE *timer;
+  int fd;
+
+  while(NULL != *link && port != (*link)->port)
+    link = &(*link)->next;
+
+  if(NULL == (saved = *link))
+    return;
+
+  *link = saved->next;
+
+  if(saved->lowLatency && \
+     SP_OK == sp_get_port_handle(port->serial, &fd) && \
+     0 == ioctl(fd, TIOCGSERIAL, &serial)){
+    serial.flags &= ~ASYNC_LOW_LATENCY;
+    ioctl(fd, TIOCSSERIAL, &serial);
+  }
+
+  if(saved->latency > 0 && NULL != (timer = fopen(saved->timerName, "w"))){
+    fprintf(timer, "%d\n", saved->latency);
+    fclose(timer);
+  }
+
+  free(saved);
+#else
+  (void) port;
+#endif
+}
+
+#ifdef __linux__
+/* Sender is exiting with ports still open, perhaps on an error */
+static void restore_all(void){
+  while(NULL != changedPorts)
+    zxtrans_realtime_restore(changedPorts->port);
+}
+#endif
+
+static void say_once(int *said, const char *format, ...){
+  va_list arguments;
+
+  pthread_mutex_lock(&sayLock);
+
+  if(!*said){
+    *said = 1;
+    va_start(arguments, format);
+    vprintf(format, arguments);
+    va_end(arguments);
+  }
+
+  pthread_mutex_unlock(&sayLock);
+}
@@ -0,0 +1,58 @@
+/*
+   ZX-Trans Realtime - sending at real-time priority, with memory locked
+   and serial driver latency kept low, so handshakes are not held up.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_REALTIME_H
+#define ZXTRANS_REALTIME_H
+
+#include "zxtrans_port.h"
+
+#define ZXTRANS_REALTIME_PRIORITY 40 /* SCHED_FIFO priority for sending,
+					below the kernel's interrupt threads
+					(50), which pass on CTS changes */
+
+/* Scheduling of a thread before it sent at real-time priority, to be
+   put back afterwards */
+struct zxtrans_realtime {
+  int raised;			/* Priority was raised */
+  int policy;
+  int priority;
+  int pinned;			/* Thread was pinned to a CPU */
+  unsigned long cpus[16];	/* Affinity before, as a cpu_set_t */
+};
+
+int zxtrans_realtime_lock(void);
+int zxtrans_realtime_enter(struct zxtrans_realtime *saved, int cpu);
+void zxtrans_realtime_leave(const struct zxtrans_realtime *saved);
+int zxtrans_realtime_low_latency(struct zxtrans_port *port,
+				 const char *portName);
+void zxtrans_realtime_restore(struct zxtrans_port *port);
+
+#endif
@@ -39,28 +39,32 @@
 	;; Version 0.3, Written 2nd September 2015 
 	;; Version 1.0, Written 17th September 2015 - 48k support
 	;; Version 1.1, Written 27th September 2015 - 16k support added
+	;; Version 1.2, Written 16th October 2026 - compressed transfers
+	;; Version 1.3, Written 16th October 2026 - sparse page maps
+	;; Version 1.4, Written 16th October 2026 - delta reloads
+	;; Version 1.5, Written 16th October 2026 - fast serial loop (+3)
+	;; Version 1.6, Written 16th October 2026 - checked frames
+	;; Version 1.7, Written 17th October 2026 - baud rate ladder (+3)
+	;; Version 1.8, Written 17th October 2026 - turbo tape
+	;; Version 1.9, Written 17th October 2026 - resumed transfers
+	;; Version 2.0, Written 17th October 2026 - direct loading (+3)
 	;;
 	;; 
+include 'zxtrans_receiver_defs.asm'	; Definitions shared by all receivers
 	;;
 	;; Program parameters
 	;;
 ZXT_IF1_ENV_LEN: equ 600	; Length of space for sys var, etc.
 ZXT_DISP_LEN: 	equ 6912	; Size of display buffer
-ZXT_DISP_SKIP_LEN: equ 1024 	; Number of display bytes to skip
+ZXT_DISP_SKIP_LEN: equ 2304 	; Number of display bytes to skip (must
+				; cover receiver and frame buffer, up to
+				; 2304 bytes)
 ZXT_16K_LEN:	equ 16384	; No. bytes in 16k RAM
 ZXT_48K_LEN:	equ 49152	; No. bytes in 48k RAM
-DISPLAY:	equ 0x4000	; Start of display buffer
 PRINT_BUFFER:	equ 23296	; Start of print buffer in memory
 PROG:		equ 0x5C53	; PROG system variable addr
-BANKM:		equ 0x5B5C	; Port for horizontal RAM switches
-BANK1:		equ 0x7FFD	; Copy of last value sent to horizontal RAM switch
-HEADER_LEN:	equ 9		; Length of standard, binary-block header
-STATE_LEN:	equ 80		; Length of Z80 state block
-	;; 
-	;; Error codes
-	;; 
-ZXT_OKAY:	equ 00
-ZXT_ERR:	equ 01
+ZXT_FAST_ADDR:	equ 0xC000-ZXT_FAST_LEN ; Fast serial loop, at end of page 2
+				; (which is never contended)
 	;; 
 	;; Nine bytes of header information for ZX Spectrum loader
 	;; (only used for Interface 1 version)
@@ -95,12 +99,21 @@ ZXT_START:
 	ld (ZXT_RET_ADDR), hl
 	ld (ZXT_PREV_SP), sp
 	ld sp, ZXT_IF1_ENV - 1
+	xor a			; No literals pending for unpacker
+	ld (ZXT_LITERALS), a
+	ld (ZXT_FLAGS), a	; Options are not known until state block
+				; is loaded
+	ld h, a			; No span in progress
+	ld l, a
+	ld (ZXT_SPAN_LEFT), hl
+	ld (ZXT_FRAME_LEFT), hl	; No frame held, and first is number 0
+	ld (ZXT_RESUME_AT), hl	; Nothing to resume yet
 	;;
-	;; Load Z80 set-state block
+	;; Load Z80 set-state block, which is never compressed
 	;; 
 	ld hl, 0x4000
 	ld bc, STATE_LEN
-	call ZXT_LOAD_BLOCK
+	call ZXT_LOAD_RAW
 	;;
 	;; Continue if successful
 	;;
@@ -111,6 +124,36 @@ ZXT_START:
 	ld bc, ZXT_ERR
 	jp ZXT_EXIT
 ZXT_CONT_0:
+	;;
+	;; If sender has raised baud rate, switch to fast serial loop,
+	;; settling with sender on a rate both ends can manage
+	;;
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST
+	jr z, ZXT_CONT_0B
+	call ZXT_FAST_INIT
+	jr c, ZXT_CONT_0B
+	;; 
+	;; otherwise return to BASIC
+	;; 
+	ld bc, ZXT_ERR
+	jp ZXT_EXIT
+ZXT_CONT_0B:
+	;;
+	;; For a delta reload, check memory still holds the parts of
+	;; last snapshot to be kept, before overwriting anything
+	;;
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_DELTA
+	jr z, ZXT_CONT_0A
+	call ZXT_VERIFY
+	jr c, ZXT_CONT_0A
+	;; 
+	;; otherwise return to BASIC
+	;; 
+	ld bc, ZXT_STALE
+	jp ZXT_EXIT
+ZXT_CONT_0A:
 	;;
 	;; Skip early part of display buffer by loading ZXT_DISP_SKIP_LEN
 	;; bytes of snapshot into ROM. This approach may not work if, for
@@ -209,8 +252,26 @@ ZXT_CONT_5:
 	jr z, ZXT_CONT_8
 	ld hl, 0x8000
 	ld bc, 0x8000
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST
+	jr z, ZXT_CONT_5A
+	;;
+	;; End of page 2 holds fast serial loop, so load that part
+	;; out of the way until loading is finished
+	;;
+	ld bc, ZXT_FAST_ADDR-0x8000
+	call ZXT_LOAD_BLOCK
+	jr nc, ZXT_CONT_5B
+	ld hl, ZXT_HOLD
+	ld bc, ZXT_FAST_LEN
+	call ZXT_LOAD_BLOCK
+	jr nc, ZXT_CONT_5B
+	ld hl, 0xC000
+	ld bc, 0x4000
+ZXT_CONT_5A:
 	call ZXT_LOAD_BLOCK
 	jr c, ZXT_CONT_6
+ZXT_CONT_5B:
 	;; 
 	;; Otherwise return to BASIC
 	;; 
@@ -220,26 +281,20 @@ ZXT_CONT_5:
 ZXT_CONT_6:
 	;; 
 	;; Check if this is a 48k snapshot, otherwise load
-	;; remainder of snapshot
+	;; remainder of snapshot. An interrupted transfer can be
+	;; resumed from any page of this list, with the stack as it
+	;; is here.
 	;; 
+	ld (ZXT_RESUME_SP), sp
 	ld hl, ZXT_START-7
 ZXT_CONT_6A:	
+	ld (ZXT_RESUME_AT), hl	; First page not yet loaded
 	ld a, (hl)
 	cp 0xFF
 	jr z, ZXT_CONT_8
 
 	;; Page in next RAM page
-	di			; Must disable interupts before paging
-	
-	ld a,(BANKM)		; Current ROM/ RAM configuration
-	and %11111000		; Swap ROM2 and ROM 3, RAM0 and RAM7
-	or (hl)
-	
-	ld (BANKM),a		; Store new value
-	ld bc, BANK1		; Port for horiz ROM switching and RAM paging
-	out (c),a		; Make change
-
-	ei			; Safe to reenable interupts
+	call ZXT_PAGE_IN
 
 	push hl			; Save current page
 
@@ -269,6 +324,17 @@ ZXT_CONT_8:
 	ld de, PRINT_BUFFER
 	ld hl, ZXT_IF1_ENV
 	ldir
+	;;
+	;; Put back end of page 2, now fast serial loop is finished
+	;;
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST
+	jr z, ZXT_CONT_8A
+	ld hl, ZXT_HOLD
+	ld de, ZXT_FAST_ADDR
+	ld bc, ZXT_FAST_LEN
+	ldir
+ZXT_CONT_8A:
 	;;
 	;; Finally set machine state and run
 	;;
@@ -276,7 +342,110 @@ ZXT_CONT_8:
 
 ZXT_EXIT:
 	;; BC holds exit code
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST
+	jr z, ZXT_EXIT_1
+	;;
+	;; Space holding end of page 2 may overlay receiver's copy of
+	;; fast serial loop, so put that back, ready to try again
+	;; 
+	push bc
+	ld hl, ZXT_FAST_ADDR
+	ld de, ZXT_HOLD
+	ld bc, ZXT_FAST_LEN
+	ldir
+	pop bc
+ZXT_EXIT_1:
 	ld sp,(ZXT_PREV_SP)	; Restore stack pointer
 	ld de,(ZXT_RET_ADDR)	; and restore return address
 	push de
 	ret
+
+	;;
+	;; Page RAM bank A in at 0xC000
+	;;
+ZXT_PAGE_IN:
+	push bc
+	ld c, a
+	di			; Must disable interupts before paging
+	
+	ld a,(BANKM)		; Current ROM/ RAM configuration
+	and %11111000		; Swap ROM2 and ROM 3, RAM0 and RAM7
+	or c
+	
+	ld (BANKM),a		; Store new value
+	ld bc, BANK1		; Port for horiz ROM switching and RAM paging
+	out (c),a		; Make change
+
+	ei			; Safe to reenable interupts
+	pop bc
+	ret
+
+	;;
+	;; Check memory against table of pages sent before a delta
+	;; reload. Each entry gives page number (0xFF ends table), a map
+	;; of the 256-byte blocks to be kept, and a checksum of those
+	;; blocks (sum of bytes, and sum of running sums, each modulo
+	;; 256).
+	;;
+	;; On exit:
+	;;   CF = set if memory matches; reset otherwise
+	;;
+ZXT_VERIFY:
+	ld a, (BANKM)		; Keep paging, in case of mismatch
+	push af
+ZXT_VERIFY_1:
+	call ZXT_READ_BYTE	; Next page to check
+	jr nc, ZXT_VERIFY_FAIL
+	cp 0xFF
+	jr z, ZXT_VERIFY_OK	; End of table
+	ld hl, 0x8000
+	cp 0x02			; Page 2 is always at 0x8000
+	jr z, ZXT_VERIFY_2
+	call ZXT_PAGE_IN	; Others are paged in at 0xC000
+	ld h, 0xC0
+ZXT_VERIFY_2:
+	ld de, 0x0000		; Clear checksum
+	ld b, ZXT_KEEP_MAP_LEN
+ZXT_VERIFY_3:
+	call ZXT_READ_BYTE	; Next eight blocks of map
+	jr nc, ZXT_VERIFY_FAIL
+	push bc
+	ld c, a
+	ld b, 0x08
+ZXT_VERIFY_4:
+	sla c			; Is block kept?
+	jr nc, ZXT_VERIFY_6
+ZXT_VERIFY_5:
+	ld a, (hl)		; Add block to checksum
+	add a, e
+	ld e, a
+	add a, d
+	ld d, a
+	inc l
+	jr nz, ZXT_VERIFY_5
+ZXT_VERIFY_6:
+	inc h			; Next block
+	djnz ZXT_VERIFY_4
+	pop bc
+	djnz ZXT_VERIFY_3
+	call ZXT_READ_WORD	; Expected checksum
+	jr nc, ZXT_VERIFY_FAIL
+	and a			; Reset carry flag, ready to subtract
+	sbc hl, de
+	jr z, ZXT_VERIFY_1	; Matches, so check next page
+ZXT_VERIFY_FAIL:
+	and a			; Indicates failure
+	jr ZXT_VERIFY_END
+ZXT_VERIFY_OK:
+	scf			; Indicates success
+ZXT_VERIFY_END:
+	pop bc			; Restore paging
+	push af
+	ld a, b
+	and %00000111
+	call ZXT_PAGE_IN
+	pop af
+	ret
+
+include 'zxtrans_receiver_load.asm'	; Loading routines shared by all receivers
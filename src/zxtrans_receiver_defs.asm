@@ -0,0 +1,91 @@
+	;; ZX-Trans Receiver - shared definitions
+	;; 
+	;; Memory layout, transfer options, control codes and error
+	;; codes used by every version of the receiver program.
+	;;
+	;; 
+	;; Copyright 2015 George Beckett, All Rights Reserved
+	;; 
+	;; Redistribution and use in source and binary forms,
+	;; with or without modification, are permitted provided
+	;; that the following conditions are met:
+	;; 
+	;; - Redistributions of source code must retain the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer.		
+	;; - Redistributions in binary form must reproduce the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer in the documentation and/or other materials
+	;;   provided with the distribution.
+	;; 
+	;; THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS
+	;; ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+	;; BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+	;; AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+	;; EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	;; INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	;; DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	;; SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+	;; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+	;; LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	;; (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+	;; THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	;; OF SUCH DAMAGE.
+	;;
+	;; 
+	;; Version history:
+	;; Written by George Beckett <markgbeckett@gmail.com>
+	;; Version 0.2, Written 25th June 2015
+	;; Version 0.3, Written 2nd September 2015 
+	;; Version 1.0, Written 17th September 2015 - 48k support
+	;; Version 1.1, Written 27th September 2015 - 16k support added
+	;; Version 1.2, Written 16th October 2026 - compressed transfers
+	;; Version 1.3, Written 16th October 2026 - sparse page maps
+	;; Version 1.4, Written 16th October 2026 - delta reloads
+	;; Version 1.5, Written 16th October 2026 - fast serial loop (+3)
+	;; Version 1.6, Written 16th October 2026 - checked frames
+	;; Version 1.7, Written 17th October 2026 - baud rate ladder (+3)
+	;; Version 1.8, Written 17th October 2026 - turbo tape
+	;; Version 1.9, Written 17th October 2026 - resumed transfers
+	;; Version 2.0, Written 17th October 2026 - direct loading (+3)
+	;;
+	;; 
+	;;
+	;; Parameters shared by all receivers
+	;;
+DISPLAY:	equ 0x4000	; Start of display buffer
+BANKM:		equ 0x5B5C	; Port for horizontal RAM switches
+BANK1:		equ 0x7FFD	; Copy of last value sent to horizontal RAM switch
+HEADER_LEN:	equ 9		; Length of standard, binary-block header
+STATE_LEN:	equ 80		; Length of Z80 state block
+ZXT_FLAGS:	equ ZXT_START-1	; Transfer options, in last byte of state block
+ZXT_FLAG_PACKED: equ %00000001	; Memory pages are compressed
+ZXT_FLAG_SPANS:	equ %00000010	; Memory pages are sent as spans
+ZXT_FLAG_DELTA:	equ %00000100	; Only changes from last snapshot are sent
+ZXT_FLAG_FAST:	equ %00001000	; Baud rate is raised after state block
+ZXT_FLAG_FRAMED: equ %00010000	; Rest of transfer is sent in checked frames
+ZXT_FAST_LEN:	equ 0xC8	; Space for fast serial loop
+ZXT_KEEP_MAP_LEN: equ 8		; Bytes in map of 256-byte blocks kept
+ZXT_FRAME_LEN:	equ 128		; Bytes of snapshot in each checked frame
+	;;
+	;; Control codes for checked frames
+	;;
+ZXT_SOH:	equ 0x01	; Start of frame
+ZXT_ACK:	equ 0x06	; Frame received intact
+ZXT_NAK:	equ 0x15	; Frame corrupt, so send it again
+ZXT_ENQ:	equ 0x05	; Sender asks where to resume, in a run of
+ZXT_ENQ_RUN:	equ 8	; this many
+	;;
+	;; Span types (bits 13-15 of span header)
+	;;
+ZXT_SPAN_DATA:	equ 0x00	; Bytes follow (compressed, if packed)
+ZXT_SPAN_ZERO:	equ 0x20	; Fill with zeros
+ZXT_SPAN_COPY:	equ 0x40	; Copy from address given
+ZXT_SPAN_BANK:	equ 0x60	; Copy from same address in RAM bank given
+ZXT_SPAN_KEEP:	equ 0x80	; Leave memory as it is
+	;; 
+	;; Error codes
+	;; 
+ZXT_OKAY:	equ 00
+ZXT_ERR:	equ 01
+ZXT_STALE:	equ 02		; Memory no longer holds last snapshot
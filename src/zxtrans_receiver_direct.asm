@@ -0,0 +1,455 @@
+	;; ZX-Trans Receiver (+3 Version, loading in place)
+	;; 
+	;; Load 16k or 48k ZX Spectrum snapshot, via RS232 serial port,
+	;; straight to its final addresses, based on output from
+	;; zxtrans_sender application.
+	;;
+	;; 
+	;; Copyright 2015 George Beckett, All Rights Reserved
+	;; 
+	;; Redistribution and use in source and binary forms,
+	;; with or without modification, are permitted provided
+	;; that the following conditions are met:
+	;; 
+	;; - Redistributions of source code must retain the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer.		
+	;; - Redistributions in binary form must reproduce the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer in the documentation and/or other materials
+	;;   provided with the distribution.
+	;; 
+	;; THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS
+	;; ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+	;; BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+	;; AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+	;; EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	;; INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	;; DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	;; SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+	;; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+	;; LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	;; (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+	;; THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	;; OF SUCH DAMAGE.
+	;;
+	;; 
+	;; Version history:
+	;; Written by George Beckett <markgbeckett@gmail.com>
+	;; Version 0.2, Written 25th June 2015
+	;; Version 0.3, Written 2nd September 2015 
+	;; Version 1.0, Written 17th September 2015 - 48k support
+	;; Version 1.1, Written 27th September 2015 - 16k support added
+	;; Version 1.2, Written 16th October 2026 - compressed transfers
+	;; Version 1.3, Written 16th October 2026 - sparse page maps
+	;; Version 1.4, Written 16th October 2026 - delta reloads
+	;; Version 1.5, Written 16th October 2026 - fast serial loop (+3)
+	;; Version 1.6, Written 16th October 2026 - checked frames
+	;; Version 1.7, Written 17th October 2026 - baud rate ladder (+3)
+	;; Version 1.8, Written 17th October 2026 - turbo tape
+	;; Version 1.9, Written 17th October 2026 - resumed transfers
+	;; Version 2.0, Written 17th October 2026 - direct loading (+3)
+	;;
+	;; 
+include 'zxtrans_receiver_defs.asm'	; Definitions shared by all receivers
+	;;
+	;; The standard receiver runs in the display, so it skips the
+	;; first ZXT_DISP_SKIP_LEN bytes of the screen, and it keeps the
+	;; ROM and system variables it needs by loading the start of
+	;; the snapshot out of the way and moving it into place at the
+	;; end. This version copies itself to RAM bank 3, which no 16k
+	;; or 48k snapshot uses, and, once the fast serial loop has
+	;; taken over from the ROM, loads each page in place through
+	;; the special paging modes of the +3/+2A:
+	;;
+	;;   0x1FFD   0x0000  0x4000  0x8000  0xC000
+	;;   %001        0       1       2       3
+	;;   %101        4       5       6       3
+	;;   %111        4       7       6       3
+	;;
+	;; So every byte goes straight to its final address, with
+	;; nothing to move afterwards and no limit on the system
+	;; variables. Only the fast serial loop can read the port once
+	;; the ROM and system variables are gone, so the transfer must
+	;; be sent with -f2 or -c, and not as a delta reload (-d).
+	;; 128k snapshots, which use bank 3, are left to the standard
+	;; receiver.
+	;;
+	;; Normal paging can only be restored by code in page 5 or 2,
+	;; which are at the same address either way, so a trampoline in
+	;; the first bytes of the display does it. The set-state block
+	;; then runs from just below the snapshot's stack pointer,
+	;; after code that puts back those display bytes, so these
+	;; ZXT_HANDOVER_LEN bytes are the only ones not loaded from the
+	;; snapshot: the snapshot's stack is free to overwrite them.
+	;;
+	;;
+	;; Program parameters
+	;;
+ZXT_IF1_ENV_LEN: equ 0		; Nothing is relocated
+BANK678:	equ 0x5B67	; Copy of last value sent to +3 paging port
+BANK2:		equ 0x1FFD	; Port for +3 paging
+ZXT_HOME_BANK:	equ 3		; RAM bank receiver runs from, at 0xC000
+ZXT_SPECIAL:	equ %00000001	; Special paging, in 0x1FFD
+ZXT_FAST_ADDR:	equ 0x10000-ZXT_FAST_LEN ; Fast serial loop, at end of bank 3
+ZXT_VECTORS:	equ 0xFE00	; Table for IM 2, of 257 bytes, all
+ZXT_ISR:	equ 0xFDFD	; pointing at this routine
+ZXT_STATE_PAGING: equ 1		; Offset of 128k paging in set-state
+				; block (NOPs for 16k and 48k)
+ZXT_STATE_SP:	equ 64		; Offset of stack pointer in set-state block
+ZXT_STATE_CODE_LEN: equ 70	; Length of code in set-state block
+	;; 
+	;; Nine bytes of header information for ZX Spectrum loader
+	;;
+	DB 03 			; CODE file
+	DW ZXT_BODY-ZXT_BOOT+ZXT_END-ZXT_Z80_SET_STATE ; Length
+	DW ZXT_BOOT		; Start
+	DW 0x0000		; Not used for CODE
+	DW 0x0000		; Not used for CODE
+	;;
+	;; Locate at 0x4000, for start of display buffer, from where
+	;; the rest of the receiver is copied to bank 3
+	;; 
+	org 0x4000
+ZXT_BOOT:
+	ld a, (BANKM)		; Keep BASIC's paging, for ZXT_START
+	push af
+	and %11111000
+	or ZXT_HOME_BANK
+	call ZXT_BOOT_PAGE
+	ld hl, ZXT_BODY
+	ld de, ZXT_Z80_SET_STATE
+	ld bc, ZXT_END-ZXT_Z80_SET_STATE
+	ldir
+	jp ZXT_START
+
+	;;
+	;; Page in RAM as given by A (as for BANKM). Returning to BASIC,
+	;; this must run outside bank 3, so it is entered as ZXT_LEAVE,
+	;; with BASIC's paging, and its RET then returns to BASIC.
+	;;
+ZXT_LEAVE:
+ZXT_BOOT_PAGE:
+	push bc
+	ld bc, BANK1		; Port for horiz ROM switching and RAM paging
+	di			; Must disable interupts before paging
+	ld (BANKM), a
+	out (c), a
+	ei			; Safe to reenable interupts
+	pop bc
+	ret
+ZXT_BODY:
+	;;
+	;; Rest of receiver runs from bank 3
+	;;
+	org 0xC000
+ZXT_Z80_SET_STATE:
+	ds STATE_LEN		; Leave space for customised
+	                        ; Z80 set-state routine (loaded
+	                        ; separately)
+ZXT_START:
+	;;
+	;; Start by moving stack to bank 3, keeping what is needed to
+	;; return to BASIC until loading starts
+	;;
+	pop af
+	ld (ZXT_BANKM), a
+	pop hl			; Keep return address
+	ld (ZXT_RET_ADDR), hl
+	ld (ZXT_PREV_SP), sp
+	ld sp, ZXT_IF1_ENV	; Top of ZXT_STACK
+	ld a, (BANK678)
+	ld (ZXT_BANK678), a
+	xor a			; No literals pending for unpacker
+	ld (ZXT_LITERALS), a
+	ld (ZXT_FLAGS), a	; Options are not known until state block
+				; is loaded
+	ld h, a			; No span in progress
+	ld l, a
+	ld (ZXT_SPAN_LEFT), hl
+	ld (ZXT_FRAME_LEFT), hl	; No frame held, and first is number 0
+	ld (ZXT_RESUME_AT), hl	; Nothing to resume (see ZXT_CONT_6A)
+	;;
+	;; Load Z80 set-state block, which is never compressed
+	;; 
+	ld hl, ZXT_Z80_SET_STATE
+	ld bc, STATE_LEN
+	call ZXT_LOAD_RAW
+	jr nc, ZXT_CONT_0
+	;;
+	;; Check the transfer can be loaded in place, then switch to
+	;; fast serial loop, settling with sender on a rate both ends
+	;; can manage
+	;;
+	call ZXT_CHECK
+	jr nc, ZXT_CONT_0
+	call ZXT_FAST_INIT
+	jr c, ZXT_CONT_1
+ZXT_CONT_0:
+	;; 
+	;; otherwise return to BASIC
+	;; 
+	ld bc, ZXT_ERR
+	jp ZXT_EXIT
+ZXT_CONT_1:
+	;;
+	;; BASIC is overwritten from here on, so there is no return to
+	;; it. The ROM is paged out while loading, so interrupts (which
+	;; the fast serial loop enables after each block) are sent to
+	;; a routine in bank 3.
+	;;
+	di
+	ld hl, ZXT_VECTORS
+	ld de, ZXT_VECTORS+1
+	ld bc, 0x0100
+	ld (hl), ZXT_ISR & 0xFF
+	ldir
+	ld hl, 0xC9FB		; ei; ret
+	ld (ZXT_ISR), hl
+	ld a, ZXT_VECTORS/256
+	ld i, a
+	im 2
+	ei
+	;;
+	;; Load each page of list in place. As 128k banks are the only
+	;; ones a transfer is resumed from, and there are none here,
+	;; ZXT_RESUME_AT is left at zero.
+	;;
+	ld hl, ZXT_START-10
+ZXT_CONT_6A:
+	ld a, (hl)
+	cp 0xFF
+	jr z, ZXT_CONT_8
+	push hl			; Save current page
+	call ZXT_MAP_PAGE
+	ld h, a
+	ld l, 0x00
+	ld bc, 0x4000
+	call ZXT_LOAD_BLOCK
+	pop hl
+	jr nc, ZXT_FAIL
+	inc hl			; Advance to next page
+	jr ZXT_CONT_6A
+
+ZXT_CONT_8:
+	;;
+	;; Finally set machine state and run: keep the display bytes
+	;; the trampoline goes in, put the code restoring them and the
+	;; set-state block below the stack pointer, then leave special
+	;; paging through the trampoline, with BASIC's paging
+	;;
+	di
+	ld a, 0x05
+	call ZXT_MAP_PAGE	; Page 5 at 0x4000
+	ld hl, (DISPLAY)
+	ld (ZXT_RESTORE_1+1), hl
+	ld hl, (DISPLAY+2)
+	ld (ZXT_RESTORE_2+1), hl
+	ld a, (DISPLAY+4)
+	ld (ZXT_RESTORE_3+1), a
+	ld de, (ZXT_HANDOVER)
+	inc de			; Leave two bytes of stack for set-state
+	inc de			; block
+	ld hl, ZXT_RESTORE
+	ld bc, ZXT_RESTORE_LEN
+	call ZXT_PUT
+	ld hl, ZXT_Z80_SET_STATE
+	ld bc, ZXT_STATE_CODE_LEN
+	call ZXT_PUT
+	ld a, 0x05
+	call ZXT_MAP_PAGE
+	ld hl, ZXT_TRAMPOLINE
+	ld de, DISPLAY
+	ld bc, ZXT_TRAMPOLINE_LEN
+	ldir
+	ld hl, (ZXT_HANDOVER)
+	inc hl
+	inc hl
+	ld (DISPLAY+ZXT_TRAMPOLINE_JP+1-ZXT_TRAMPOLINE), hl
+	ld sp, hl
+	ld a, (ZXT_BANKM)	; Takes effect when special paging is left
+	ld bc, BANK1
+	out (c), a
+	ld a, (ZXT_BANK678)
+	ld bc, BANK2
+	jp DISPLAY
+
+ZXT_FAIL:
+	;;
+	;; Loading failed, with BASIC already overwritten, so stop
+	;; (the fast serial loop always succeeds, so this is not
+	;; expected)
+	;;
+	di
+	halt
+
+ZXT_EXIT:
+	;; BC holds exit code
+	ld a, (ZXT_BANKM)	; BASIC's paging, restored from page 5
+	ld sp,(ZXT_PREV_SP)	; Restore stack pointer
+	ld de,(ZXT_RET_ADDR)	; and restore return address
+	push de
+	jp ZXT_LEAVE
+
+	;;
+	;; Check the transfer can be loaded in place: it must use the
+	;; fast serial loop, not be a delta reload, not be for a 128k
+	;; snapshot, and leave ZXT_HANDOVER_LEN bytes below the stack
+	;; pointer, above the trampoline. Sets ZXT_HANDOVER to the first
+	;; of them.
+	;;
+	;; On exit:
+	;;   CF = set if transfer can be loaded; reset otherwise
+	;;
+ZXT_CHECK:
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST+ZXT_FLAG_DELTA
+	cp ZXT_FLAG_FAST
+	jr nz, ZXT_CHECK_FAIL
+	ld a, (ZXT_Z80_SET_STATE+ZXT_STATE_PAGING)
+	and a
+	jr nz, ZXT_CHECK_FAIL
+	ld hl, (ZXT_Z80_SET_STATE+ZXT_STATE_SP)
+	dec hl			; Stack pointer of zero is top of memory
+	ld de, ZXT_HANDOVER_LEN-1
+	and a			; Reset carry flag, ready to subtract
+	sbc hl, de
+	jr c, ZXT_CHECK_FAIL
+	ld (ZXT_HANDOVER), hl
+	ld de, DISPLAY+ZXT_TRAMPOLINE_LEN
+	sbc hl, de		; Carry is reset, by SBC above
+	ccf			; Set, if there is room
+	ret
+ZXT_CHECK_FAIL:
+	and a			; Indicates failure
+	ret
+
+	;;
+	;; Page RAM bank A in with special paging
+	;;
+	;; On exit:
+	;;   a = high byte of address bank is at
+	;;   bc, de and hl are preserved
+	;;
+ZXT_MAP_PAGE:
+	push bc
+	push hl
+	add a, a
+	ld c, a
+	ld b, 0x00
+	ld hl, ZXT_PAGE_MAP
+	add hl, bc
+	ld a, (ZXT_BANK678)	; Keep disk motor and printer strobe
+	and %11111000
+	or (hl)
+	ld bc, BANK2
+	out (c), a
+	inc hl
+	ld a, (hl)
+	pop hl
+	pop bc
+	ret
+
+	;;
+	;; Value for 0x1FFD (bits 0-2), and high byte of address, for
+	;; each RAM bank
+	;;
+ZXT_PAGE_MAP:
+	db %001, 0x00
+	db %001, 0x40
+	db %001, 0x80
+	db %001, 0xC0		; Receiver's own bank, never loaded
+	db %101, 0x00
+	db %101, 0x40
+	db %101, 0x80
+	db %111, 0x40
+
+	;;
+	;; Copy BC bytes from HL, in bank 3, to DE, as addressed with
+	;; normal paging
+	;;
+ZXT_PUT:
+	ld a, (hl)
+	call ZXT_POKE
+	inc hl
+	inc de
+	dec bc
+	ld a, b
+	or c
+	jr nz, ZXT_PUT
+	ret
+
+	;;
+	;; Store A at DE (0x4000 or above), as addressed with normal
+	;; paging
+	;;
+	;; On exit:
+	;;   bc, de and hl are preserved
+	;;
+ZXT_POKE:
+	push bc
+	push hl
+	push af
+	ld a, d
+	rlca
+	rlca
+	and %00000011
+	ld c, a
+	ld b, 0x00
+	ld hl, ZXT_NORMAL_PAGES
+	add hl, bc
+	ld a, (hl)		; Page at DE with normal paging
+	call ZXT_MAP_PAGE
+	ld h, a
+	ld a, d
+	and %00111111
+	or h
+	ld h, a
+	ld l, e
+	pop af
+	ld (hl), a
+	pop hl
+	pop bc
+	ret
+ZXT_NORMAL_PAGES:
+	db 0xFF, 5, 2, 0	; ROM, then pages at 0x4000, 0x8000 and
+				; 0xC000
+
+	;;
+	;; Code put below the stack pointer, which restores the
+	;; display bytes used by the trampoline (patched with them
+	;; above) and is followed by the set-state block
+	;;
+ZXT_RESTORE:
+ZXT_RESTORE_1:
+	ld hl, 0x0000
+	ld (DISPLAY), hl
+ZXT_RESTORE_2:
+	ld hl, 0x0000
+	ld (DISPLAY+2), hl
+ZXT_RESTORE_3:
+	ld a, 0x00
+	ld (DISPLAY+4), a
+ZXT_RESTORE_END:
+
+	;;
+	;; Trampoline, copied to the display, which leaves special
+	;; paging from page 5 (with 0x1FFD in BC and BASIC's value for
+	;; it in A) and jumps to the restore code
+	;;
+ZXT_TRAMPOLINE:
+	out (c), a
+ZXT_TRAMPOLINE_JP:
+	jp 0x0000		; Patched with address of restore code
+ZXT_TRAMPOLINE_END:
+
+ZXT_RESTORE_LEN: equ ZXT_RESTORE_END-ZXT_RESTORE
+ZXT_TRAMPOLINE_LEN: equ ZXT_TRAMPOLINE_END-ZXT_TRAMPOLINE
+ZXT_HANDOVER_LEN: equ 2+ZXT_RESTORE_LEN+ZXT_STATE_CODE_LEN ; Stack, restore
+				; code and set-state code
+
+ZXT_BANKM:	db 0x00		; BASIC's paging, for 0x7FFD
+ZXT_BANK678:	db 0x00		; and for 0x1FFD
+ZXT_HANDOVER:	dw 0x0000	; First byte below stack pointer used
+
+include 'zxtrans_receiver_load.asm'	; Loading routines shared by all receivers
@@ -0,0 +1,396 @@
+	;; ZX-Trans Receiver - loading routines
+	;; 
+	;; Load blocks of snapshot, as spans, compressed or raw, and
+	;; read them a byte or checked frame at a time. Shared by every
+	;; version of the receiver program.
+	;;
+	;; 
+	;; Copyright 2015 George Beckett, All Rights Reserved
+	;; 
+	;; Redistribution and use in source and binary forms,
+	;; with or without modification, are permitted provided
+	;; that the following conditions are met:
+	;; 
+	;; - Redistributions of source code must retain the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer.		
+	;; - Redistributions in binary form must reproduce the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer in the documentation and/or other materials
+	;;   provided with the distribution.
+	;; 
+	;; THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS
+	;; ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+	;; BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+	;; AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+	;; EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	;; INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	;; DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	;; SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+	;; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+	;; LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	;; (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+	;; THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	;; OF SUCH DAMAGE.
+	;;
+	;; 
+	;; Version history:
+	;; Written by George Beckett <markgbeckett@gmail.com>
+	;; Version 0.2, Written 25th June 2015
+	;; Version 0.3, Written 2nd September 2015 
+	;; Version 1.0, Written 17th September 2015 - 48k support
+	;; Version 1.1, Written 27th September 2015 - 16k support added
+	;; Version 1.2, Written 16th October 2026 - compressed transfers
+	;; Version 1.3, Written 16th October 2026 - sparse page maps
+	;; Version 1.4, Written 16th October 2026 - delta reloads
+	;; Version 1.5, Written 16th October 2026 - fast serial loop (+3)
+	;; Version 1.6, Written 16th October 2026 - checked frames
+	;; Version 1.7, Written 17th October 2026 - baud rate ladder (+3)
+	;; Version 1.8, Written 17th October 2026 - turbo tape
+	;; Version 1.9, Written 17th October 2026 - resumed transfers
+	;; Version 2.0, Written 17th October 2026 - direct loading (+3)
+	;;
+	;; 
+	;;
+	;; Load block of snapshot into memory, unpacking it if the
+	;; sender has compressed it
+	;;
+	;; On entry:
+	;;   hl = base address for block to be written to
+	;;   bc = number of bytes to write
+	;;
+	;; On exit:
+	;;   hl = address following block
+	;;   CF = set if read is successful; reset otherwise
+	;; 
+ZXT_LOAD_BLOCK:
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_SPANS
+	jr nz, ZXT_LOAD_SPANS
+ZXT_LOAD_DATA:
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_PACKED
+	jp nz, ZXT_LOAD_PACKED
+ZXT_LOAD_RAW:
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST+ZXT_FLAG_FRAMED
+	cp ZXT_FLAG_FAST
+	jp z, ZXT_FAST_RAW	; Fast loop reads whole block at once,
+				; unless it comes in frames
+ZXT_LOAD_BYTES:
+	call ZXT_READ_BYTE
+	ret nc			; Return if read failed
+	ld (hl),a		; Store byte read
+	inc hl			; Advance to next address
+	dec bc			; Decrement counter
+	ld a,b			; Check if done
+	or c
+	jr nz, ZXT_LOAD_BYTES	; Loop if not
+	scf			; Indicates success
+	ret
+
+	;;
+	;; Load block as a sequence of spans. Each span starts with a
+	;; 16-bit header, holding its type in bits 13-15 and its length,
+	;; less one, in bits 0-12. Copy spans (with bit 14 set) add a
+	;; 16-bit source address (or RAM bank). A span may continue over successive
+	;; blocks, so its progress is kept in ZXT_SPAN_LEFT.
+	;;
+ZXT_LOAD_SPANS:
+	ld a, b			; Check if block is complete
+	or c
+	scf			; Indicates success
+	ret z
+	push hl			; Save destination
+	ld hl, (ZXT_SPAN_LEFT)
+	ld a, h
+	or l
+	jr nz, ZXT_SPANS_1	; Continue current span
+	call ZXT_READ_WORD	; Header of next span
+	jr nc, ZXT_SPANS_FAIL
+	ld a, h
+	and %11100000		; Type
+	ld (ZXT_SPAN_TYPE), a
+	xor h
+	ld h, a
+	inc hl			; Length
+	ld a, (ZXT_SPAN_TYPE)
+	bit 6, a		; Copy spans have a parameter
+	jr z, ZXT_SPANS_1
+	push hl
+	call ZXT_READ_WORD	; Source of copy
+	ld (ZXT_SPAN_SRC), hl
+	pop hl
+	jr nc, ZXT_SPANS_FAIL
+ZXT_SPANS_1:
+	;;
+	;; Load whichever is shorter of rest of span and rest of block
+	;; 
+	push bc			; Bytes left in block
+	and a			; Reset carry flag, ready to subtract
+	sbc hl, bc
+	jr nc, ZXT_SPANS_2	; Span covers rest of block
+	add hl, bc		; Otherwise, take rest of span
+	ld b, h
+	ld c, l
+	ld hl, 0x0000
+ZXT_SPANS_2:
+	ld (ZXT_SPAN_LEFT), hl
+	pop hl			; Bytes left in block
+	and a
+	sbc hl, bc		; less those about to be loaded
+	ex (sp), hl		; Keep them, and restore destination
+	call ZXT_LOAD_SPAN
+	pop bc
+	jr c, ZXT_LOAD_SPANS
+	ret			; Return if read failed
+ZXT_SPANS_FAIL:
+	pop hl			; Balance stack
+	ret
+
+	;;
+	;; Load BC bytes of current span to HL
+	;;
+ZXT_LOAD_SPAN:
+	ld a, (ZXT_SPAN_TYPE)
+	and a
+	jr z, ZXT_LOAD_DATA	; Bytes follow on serial line
+	cp ZXT_SPAN_COPY
+	jr z, ZXT_SPAN_COPY_1
+	cp ZXT_SPAN_BANK
+	jr z, ZXT_SPAN_BANK_1
+	cp ZXT_SPAN_KEEP
+	jr nz, ZXT_SPAN_ZERO_1
+	add hl, bc		; Skip memory to be kept
+	scf
+	ret
+ZXT_SPAN_ZERO_1:
+	ld (hl), 0		; Fill with zeros
+	inc hl
+	dec bc
+	ld a, b
+	or c
+	jr nz, ZXT_SPAN_ZERO_1
+	scf
+	ret
+ZXT_SPAN_COPY_1:
+	ex de, hl
+	ld hl, (ZXT_SPAN_SRC)
+	ldir			; Copy from memory already loaded
+	ld (ZXT_SPAN_SRC), hl	; Ready for rest of span
+	ex de, hl
+	scf
+	ret
+ZXT_SPAN_BANK_1:
+	;;
+	;; Copy from same address in another RAM bank, switching
+	;; bank for each byte
+	;; 
+	ld a, (BANKM)		; Current ROM/ RAM configuration
+	ld e, a
+	and %11111000
+	ld d, a
+	ld a, (ZXT_SPAN_SRC)	; Source bank
+	or d
+	ld d, a
+	di			; Must disable interupts before paging
+ZXT_SPAN_BANK_2:
+	push bc			; Bytes left to copy
+	ld bc, BANK1		; Port for RAM paging
+	out (c), d		; Page in source bank
+	ld a, (hl)
+	out (c), e		; Page in destination bank
+	pop bc
+	ld (hl), a
+	inc hl
+	dec bc
+	ld a, b
+	or c
+	jr nz, ZXT_SPAN_BANK_2
+	ei			; Safe to reenable interupts
+	scf
+	ret
+
+	;;
+	;; Read 16-bit value, low byte first, into HL
+	;;
+ZXT_READ_WORD:
+	call ZXT_READ_BYTE
+	ret nc
+	ld l, a
+	call ZXT_READ_BYTE
+	ld h, a
+	ret
+
+	;;
+	;; Read next byte of snapshot. In a checked transfer, bytes come
+	;; from the frame last received, and the next frame is fetched
+	;; once that is used up.
+	;;
+	;; On exit:
+	;;   a = byte read
+	;;   CF = set if read is successful; reset otherwise
+	;;   bc, de, hl and hl' are preserved
+	;;
+ZXT_READ_BYTE:
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FRAMED
+	jp z, ZXT_READ_SERIAL
+	push hl
+	ld hl, ZXT_FRAME_LEFT
+	ld a, (hl)
+	and a
+	call z, ZXT_READ_FRAME	; Frame used up, so fetch next
+	dec (hl)
+	ld hl, (ZXT_FRAME_PTR)
+	ld a, (hl)
+	inc hl
+	ld (ZXT_FRAME_PTR), hl
+	pop hl
+	scf			; Indicates success
+	ret
+
+	;;
+	;; Receive next frame of a checked transfer into ZXT_FRAME_BUF.
+	;; A frame starts with ZXT_SOH, then holds a sequence number,
+	;; ZXT_FRAME_LEN bytes of snapshot and a CRC-16 (CCITT polynomial,
+	;; high byte first) of the number and bytes. Each frame is
+	;; answered with ZXT_ACK, once it is held, or ZXT_NAK, to have it
+	;; sent again. Anything before a start of frame is ignored, so a
+	;; frame that lost or gained bytes on the way is just sent again.
+	;; A run of ZXT_ENQ_RUN ZXT_ENQ bytes, in place of a frame, asks
+	;; to resume the transfer (see ZXT_RESUME).
+	;;
+	;; On exit:
+	;;   hl = ZXT_FRAME_LEFT
+	;;   bc and de are preserved
+	;;
+ZXT_READ_FRAME:
+	push bc
+	push de
+ZXT_FRAME_0:
+	ld e, ZXT_ENQ_RUN
+ZXT_FRAME_1:
+	call ZXT_READ_SERIAL	; Wait for start of frame
+	cp ZXT_SOH
+	jr z, ZXT_FRAME_1A
+	cp ZXT_ENQ
+	jr nz, ZXT_FRAME_0
+	dec e
+	jr nz, ZXT_FRAME_1
+	jp ZXT_RESUME		; Sender asks where to resume
+ZXT_FRAME_1A:
+	ld hl, ZXT_FRAME_BUF
+	ld bc, ZXT_FRAME_LEN+3
+	ld a, (ZXT_FLAGS)
+	and ZXT_FLAG_FAST
+	jr z, ZXT_FRAME_2
+	call ZXT_FAST_RAW	; Fast loop reads whole frame at once
+	jr ZXT_FRAME_3
+ZXT_FRAME_2:
+	call ZXT_READ_SERIAL
+	ld (hl), a
+	inc hl
+	dec c
+	jr nz, ZXT_FRAME_2
+ZXT_FRAME_3:
+	;;
+	;; CRC of number, bytes and CRC sent is zero, if frame is intact
+	;;
+	ld hl, ZXT_FRAME_BUF
+	ld de, 0x0000
+	ld b, ZXT_FRAME_LEN+3
+ZXT_FRAME_4:
+	ld a, (hl)
+	xor d			; X = byte, xor high byte of CRC
+	ld d, a
+	rrca
+	rrca
+	rrca
+	rrca
+	and 0x0F
+	xor d			; X = X xor (X >> 4)
+	ld d, a
+	rrca
+	rrca
+	rrca
+	ld c, a			; X rotated right three places
+	rrca
+	and 0xF0		; X << 4
+	xor e
+	ld e, a
+	ld a, c
+	and 0x1F		; X >> 3
+	xor e
+	ld e, a			; High byte of new CRC
+	ld a, c
+	and 0xE0		; X << 5
+	xor d
+	ld d, e
+	ld e, a			; Low byte of new CRC
+	inc hl
+	djnz ZXT_FRAME_4
+	ld a, d
+	or e
+	ld a, ZXT_NAK
+	jr nz, ZXT_FRAME_5	; Corrupt, so have it sent again
+	ld hl, ZXT_FRAME_SEQ
+	ld a, (ZXT_FRAME_BUF)
+	sub (hl)
+	jr z, ZXT_FRAME_6	; Frame expected
+	inc a
+	ld a, ZXT_ACK		; Last frame again, as sender missed
+	jr z, ZXT_FRAME_5	; its answer
+	ld a, ZXT_NAK
+ZXT_FRAME_5:
+	call ZXT_WRITE_BYTE
+	jr ZXT_FRAME_0
+ZXT_FRAME_6:
+	inc (hl)		; Number of frame to follow
+	ld a, ZXT_ACK
+	call ZXT_WRITE_BYTE
+	ld hl, ZXT_FRAME_BUF+1
+	ld (ZXT_FRAME_PTR), hl
+	ld hl, ZXT_FRAME_LEFT
+	ld (hl), ZXT_FRAME_LEN
+	pop de
+	pop bc
+	ret
+
+	;;
+	;; Answer a sender resuming an interrupted transfer with ZXT_ENQ,
+	;; the position in the page list (as for PAGELIST in the sender)
+	;; of the first page not yet loaded, and that position
+	;; complemented. Loading then starts again from that page, in
+	;; frames numbered from 0. Until the list at ZXT_CONT_6A is
+	;; reached, the answer is 0xFF, and the frame is waited for as
+	;; before.
+	;;
+ZXT_RESUME:
+	ld a, ZXT_ENQ
+	call ZXT_WRITE_BYTE
+	ld hl, (ZXT_RESUME_AT)
+	ld a, h
+	or l
+	ld a, 0xFF
+	jr z, ZXT_RESUME_1	; Nothing to resume
+	ld a, l
+	sub (ZXT_START-10) & 0xFF ; Position in page list
+ZXT_RESUME_1:
+	push af
+	call ZXT_WRITE_BYTE
+	pop af
+	cpl
+	call ZXT_WRITE_BYTE
+	ld a, h
+	or l
+	jp z, ZXT_FRAME_0
+	ld sp, (ZXT_RESUME_SP)	; Abandon page being loaded
+	xor a			; and any literals or span in it
+	ld (ZXT_LITERALS), a
+	ld h, a
+	ld l, a
+	ld (ZXT_SPAN_LEFT), hl
+	ld (ZXT_FRAME_LEFT), hl	; No frame held, and next is number 0
+	ld hl, (ZXT_RESUME_AT)
+	jp ZXT_CONT_6A
@@ -44,4 +44,5 @@
 	;;
 include 'zxtrans_receiver.asm'		; Generic part of receiver program
 include 'zxtrans_reader_plus3.asm' 	; +3-specific serial input routine
+include 'zxtrans_unpack.asm'		; Expansion of compressed transfers
 include 'zxtrans_receiver_store.asm'	; Segmentation of memory used for temporary storage
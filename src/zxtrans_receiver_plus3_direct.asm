@@ -0,0 +1,50 @@
+	;; ZX-Trans Receiver (+3 Version, loading in place)
+	;; 
+	;; Load 16k or 48k ZX Spectrum snapshot, via RS232 serial port,
+	;; straight to its final addresses, based on output from
+	;; zxtrans_sender application.
+	;;
+	;; 
+	;; Copyright 2015 George Beckett, All Rights Reserved
+	;; 
+	;; Redistribution and use in source and binary forms,
+	;; with or without modification, are permitted provided
+	;; that the following conditions are met:
+	;; 
+	;; - Redistributions of source code must retain the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer.		
+	;; - Redistributions in binary form must reproduce the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer in the documentation and/or other materials
+	;;   provided with the distribution.
+	;; 
+	;; THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS
+	;; ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+	;; BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+	;; AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+	;; EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	;; INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	;; DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	;; SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+	;; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+	;; LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	;; (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+	;; THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	;; OF SUCH DAMAGE.
+	;;
+	;; 
+	;; Version history:
+	;; Written by George Beckett <markgbeckett@gmail.com>
+	;; Version 0.2, Written 25th June 2015
+	;; Version 0.3, Written 2nd September 2015 
+	;; Version 1.0, Written 17th September 2015 - 48k support
+	;; Version 1.1, Written 27th September 2015 - 16k support added
+	;; Version 2.0, Written 17th October 2026 - direct loading (+3)
+	;;
+	;; 
+	;;
+include 'zxtrans_receiver_direct.asm'	; Receiver program, loading in place from bank 3
+include 'zxtrans_reader_plus3.asm' 	; +3-specific serial input routine
+include 'zxtrans_unpack.asm'		; Expansion of compressed transfers
+include 'zxtrans_receiver_store.asm'	; Segmentation of memory used for temporary storage
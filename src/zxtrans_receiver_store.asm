@@ -53,4 +53,16 @@ ZXT_IF1_ENV:	DS ZXT_IF1_ENV_LEN
 	;; 
 	;; Program variables and state
 	;; 
+ZXT_LITERALS:	db 0x00		; Literal bytes pending in packed stream
+ZXT_SPAN_LEFT:	dw 0x0000	; Bytes left in current span
+ZXT_SPAN_TYPE:	db 0x00		; Type of current span
+ZXT_SPAN_SRC:	dw 0x0000	; Source of current copy span
+ZXT_FRAME_LEFT:	db 0x00		; Bytes of current frame still to be read
+ZXT_FRAME_SEQ:	db 0x00		; Number of next frame expected
+ZXT_FRAME_PTR:	dw 0x0000	; Next byte of current frame
+ZXT_RESUME_AT:	dw 0x0000	; Page list entry to resume from, or 0
+ZXT_RESUME_SP:	dw 0x0000	; Stack while loading page list
 ZXT_END:	
+	;; Frame being checked, which is not part of program but must
+	;; still fit in display bytes skipped
+ZXT_FRAME_BUF:	equ ZXT_END
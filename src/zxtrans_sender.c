@@ -29,28 +29,275 @@
    DAMAGE.
 */
 
+#define _POSIX_C_SOURCE 200809L /* For fileno */
 #define CODELEN 80 /* Set to (at least) length of Z80 set-state routine */
 #define CODEHDR 9 /* Standard ZX Spectrum RS232 header length */
 #define SERIAL_TIMEOUT 2000 /* Measured in milliseconds */
 #define BANK1 0x7FFD /* Port for horizontal RAM switch */
 #define BANKM 0x5B5C /* Record of current horizontal RAM switch
 			configuration */
+#define STATE_SP 64 /* Offset of stack pointer in Z80 set-state block */
+#define PAGELIST 70 /* Offset of page list in Z80 set-state block */
+#define FLAGS (CODELEN-1) /* Offset of transfer options in set-state block */
+#define WRITE_CHUNK 256 /* Bytes per write in modes 1 and 2, so progress
+			   can be followed */
+#define FRAME_TRIES 10 /* Times a checked frame is sent before giving up */
+#define FILL_TIMEOUT 50 /* Milliseconds to wait for an answer after each
+			   byte sent to complete a frame */
+#define WARM_MAX 64 /* Snapshots kept prepared by daemon */
+#define PATH_LEN 4096 /* Longest current directory */
+#define RESUME_ASK_LEN (ZXTRANS_FRAME_WIRE_LEN+ZXTRANS_FRAME_ENQ_RUN) /* Bytes
+				sent to ask the receiver where to resume */
+#define CONVERT_BUFFER (ZXTRANS_MAX_PAGES*ZXTRANS_IMAGE_BOUND) /* Output
+				buffered for each file converted, so most
+				are written at once */
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 #include <libspectrum.h>
 #include <libserialport.h>
 #include <time.h>
 #include <getopt.h>
+#include <pthread.h>
+#include "zxtrans_image.h"
+#include "zxtrans_binaries.h"
+#include "zxtrans_cache.h"
+#include "zxtrans_daemon.h"
+#include "zxtrans_delta.h"
+#include "zxtrans_flow.h"
+#include "zxtrans_frame.h"
+#include "zxtrans_metrics.h"
+#include "zxtrans_pipeline.h"
+#include "zxtrans_port.h"
+#include "zxtrans_realtime.h"
+#include "zxtrans_snapfile.h"
+#include "zxtrans_stream.h"
+#include "zxtrans_tape.h"
+
+/* One snapshot, prepared for sending */
+struct zxtrans_job {
+  libspectrum_snap *snapshot;
+  libspectrum_byte z80mc[CODEHDR+CODELEN];
+  int transferFlags;
+  int pageCount;
+  libspectrum_byte keep[ZXTRANS_MAX_PAGES][ZXTRANS_KEEP_MAP_LEN];
+  libspectrum_byte deltaTable[ZXTRANS_DELTA_TABLE_BOUND];
+  size_t deltaLength;
+  int cached;			/* Pages come from image, not snapshot */
+  struct zxtrans_cache image;
+  char *imageName;		/* Where to cache image once sent */
+  struct zxtrans_snapfile file;	/* Mapped while snapshot's pages are
+				   read from it */
+};
+
+/* Buffer a snapshot file is read into, which a caller preparing many
+   snapshots keeps from one to the next */
+struct zxtrans_input {
+  char *buffer;
+  size_t room;
+};
+
+/* What is sent to every serial port for one snapshot, shared read-only
+   between them */
+struct zxtrans_transfer {
+  const char *name;		/* Of snapshot */
+  const struct zxtrans_job *job;
+  const libspectrum_byte *leader;
+  int sizeofLeader;
+  int baudRate;
+  int fastBaud;			/* Settle on faster rate after set-state
+				   block */
+  int framed;
+  int burstSize;
+  int adaptiveBurst;
+  int realtime;			/* Send at real-time priority */
+  int realtimeCpu;		/* First CPU to send from, or -1 */
+  int direct;			/* For the +3 receiver that loads in
+				   place */
+  FILE *progress;		/* Where to show progress, if anywhere */
+  int verbosity;
+  const libspectrum_byte *pages[ZXTRANS_MAX_PAGES]; /* When fanned out */
+  size_t pageLength[ZXTRANS_MAX_PAGES];
+};
+
+/* One serial port being sent to, with its own flow control, checked
+   frames and metrics */
+struct zxtrans_link {
+  const char *portName;
+  struct zxtrans_port *port;
+  int serialMode;
+  int fast;			/* Rate settled on with fast serial loop,
+				   or 0 */
+  struct zxtrans_flow_burst burst;
+  struct zxtrans_frames frames;
+  struct zxtrans_metrics metrics;
+  char error[128];		/* Why sending stopped, if it did */
+  const struct zxtrans_transfer *transfer; /* When fanned out */
+  int cpu;			/* To send from in real-time mode, or -1 */
+  pthread_t thread;
+  int sent;			/* Whole snapshot sent */
+};
+
+/* Snapshot kept prepared by the daemon, ready to send at once */
+struct zxtrans_warm {
+  char *filename;		/* Absolute path */
+  time_t modified;		/* File as prepared */
+  long long size;
+  unsigned long lastUsed;	/* Request that last sent it */
+  struct zxtrans_job job;
+  libspectrum_byte *pageBuffer;	/* Unless pages are in cached image */
+  const libspectrum_byte *pages[ZXTRANS_MAX_PAGES];
+  size_t pageLength[ZXTRANS_MAX_PAGES];
+};
+
+/* Long-running sender, which keeps its ports open and its snapshots
+   prepared between requests */
+struct zxtrans_server {
+  const struct zxtrans_transfer *settings; /* For every request */
+  int serialMode;
+  int transferFlags;
+  int imageCache;
+  const char *metricsFilename;
+  struct zxtrans_link *links;	/* Each port opened so far */
+  int linkCount;
+  struct zxtrans_warm *warm[WARM_MAX];
+  int warmCount;
+  unsigned long requests;
+};
+
+/* Snapshots being converted to files, shared between the threads
+   converting them */
+struct zxtrans_converter {
+  const struct zxtrans_transfer *settings; /* For every snapshot */
+  int transferFlags;
+  char **jobNames;
+  char **outputNames;
+  int jobCount;
+  int next;			/* Next snapshot to be taken */
+  int converted;
+  char *failed;			/* Set for each snapshot not converted */
+  unsigned long long bytes;	/* Written to every file */
+  pthread_mutex_t lock;
+};
+
+/* Thread converting snapshots in turn, with buffers kept from one to
+   the next */
+struct zxtrans_convert_worker {
+  struct zxtrans_converter *converter;
+  pthread_t thread;
+  struct zxtrans_input input;
+  libspectrum_byte *page;	/* Page being written */
+  char *output;			/* Buffer for output file */
+};
+
+/* How memory of each machine is paged, and which RAM pages are sent */
+struct zxtrans_page_plan {
+  libspectrum_machine machine;
+  int port128;			/* Restore 128k memory port */
+  int portPlus3;		/* Restore +3 memory port */
+  libspectrum_byte pages[ZXTRANS_MAX_PAGES+1]; /* In order sent, ending
+						  0xFF */
+};
+
+/* Machines not listed are sent as a 16k Spectrum */
+static const struct zxtrans_page_plan pagePlans[] = {
+  {LIBSPECTRUM_MACHINE_16, 0, 0, {5, 0xFF}},
+  {LIBSPECTRUM_MACHINE_48, 0, 0, {5, 2, 0, 0xFF}},
+  {LIBSPECTRUM_MACHINE_128, 1, 0, {5, 2, 0, 1, 3, 4, 6, 7, 0xFF}},
+  {LIBSPECTRUM_MACHINE_PLUS2, 1, 0, {5, 2, 0, 1, 3, 4, 6, 7, 0xFF}},
+  {LIBSPECTRUM_MACHINE_PLUS2A, 1, 1, {5, 2, 0, 1, 3, 4, 6, 7, 0xFF}},
+  {LIBSPECTRUM_MACHINE_PLUS3, 1, 1, {5, 2, 0, 1, 3, 4, 6, 7, 0xFF}},
+  {LIBSPECTRUM_MACHINE_UNKNOWN, 0, 0, {5, 0xFF}}
+};
 
 libspectrum_byte lowByte(libspectrum_word regPair);
 libspectrum_byte highByte(libspectrum_word regPair);
 void usage(void);
-inline int zxtrans_write_block(struct sp_port *port,	      \
-			       const libspectrum_byte *buf,   \
-			       size_t count, int serialMode,  \
-			       unsigned int timeout_ms);
+int zxtrans_list_jobs(char *paths[], int pathCount, char ***jobNames);
+int zxtrans_prepare_job(const char *filename, int transferFlags,
+			int direct, const char *cacheName, int imageCache,
+			int verbosity, struct zxtrans_input *input,
+			struct zxtrans_job *job);
+int zxtrans_check_direct(const char *filename, struct zxtrans_job *job);
+char *zxtrans_read_file(const char *filename, struct zxtrans_input *input,
+			int *length);
+libspectrum_snap *zxtrans_parse_snapshot(const char *filename,
+					 const libspectrum_byte *buffer,
+					 size_t length);
+void zxtrans_free_snapshot(struct zxtrans_job *job);
+void zxtrans_free_job(struct zxtrans_job *job);
+const struct zxtrans_page_plan *zxtrans_find_plan(libspectrum_machine machine);
+const libspectrum_byte *zxtrans_leader(int serialMode, int verbosity,
+				      int *sizeofLeader);
+struct zxtrans_port *zxtrans_open_port(const char *portName, int baudRate,
+				       int framed, int lowLatency,
+				       int verbosity);
+void zxtrans_close_port(struct zxtrans_port *port);
+int zxtrans_send_start(struct zxtrans_link *link,
+		       const struct zxtrans_transfer *transfer);
+int zxtrans_send_page(struct zxtrans_link *link,
+		      const struct zxtrans_transfer *transfer, int index,
+		      const libspectrum_byte *pageData, size_t pageLength);
+int zxtrans_send_finish(struct zxtrans_link *link,
+			const struct zxtrans_transfer *transfer);
+void zxtrans_fan_out(struct zxtrans_link *links, int portCount,
+		     const struct zxtrans_transfer *transfer);
+void zxtrans_give_up(const struct zxtrans_link *link);
+void zxtrans_batch_wait(int batchWait, const char *next);
+char *zxtrans_absolute_path(const char *filename);
+int zxtrans_serve(const char *socketPath,
+		  const struct zxtrans_transfer *settings, int serialMode,
+		  int transferFlags, int imageCache,
+		  const char *metricsFilename, char *portNames[],
+		  int portCount, char *jobNames[], int jobCount);
+int zxtrans_serve_link(struct zxtrans_server *server, const char *portName);
+struct zxtrans_warm *zxtrans_serve_snapshot(struct zxtrans_server *server,
+					    const char *filename);
+int zxtrans_serve_find(const struct zxtrans_server *server,
+		       const char *portName);
+void zxtrans_serve_forget(struct zxtrans_server *server, int index);
+void zxtrans_serve_send(struct zxtrans_server *server,
+			const struct zxtrans_request *request, FILE *client);
+void zxtrans_serve_status(const struct zxtrans_server *server, FILE *client);
+int zxtrans_load_pages(struct zxtrans_job *job,
+		       libspectrum_byte **pageBuffer,
+		       const libspectrum_byte *pages[], size_t pageLength[]);
+int zxtrans_request_jobs(const char *socketPath, char *portNames[],
+			 int portCount, char *jobNames[], int jobCount,
+			 int batchWait, int verbosity);
+int zxtrans_convert_jobs(char *jobNames[], int jobCount,
+			 const char *outputDir, int threads,
+			 const struct zxtrans_transfer *settings,
+			 int transferFlags);
+char *zxtrans_output_name(const char *outputDir, const char *jobName);
+int zxtrans_convert_job(struct zxtrans_convert_worker *worker, int index,
+			long *written);
+inline int zxtrans_write_block(struct zxtrans_link *link,
+			       const libspectrum_byte *buf,
+			       size_t count, unsigned int timeout_ms);
+int zxtrans_send_block(struct zxtrans_link *link, const char *label,
+		       const libspectrum_byte *buf, size_t count,
+		       int isPage, int framed);
+int zxtrans_send_frame(struct zxtrans_link *link);
+int zxtrans_settle_rate(struct zxtrans_link *link,
+			const struct zxtrans_transfer *transfer);
+int zxtrans_send_resume(struct zxtrans_link *link,
+			const struct zxtrans_transfer *transfer);
+void zxtrans_write_frames(FILE *file, const libspectrum_byte *buf,
+			  size_t count, struct zxtrans_frames *frames);
+int zxtrans_hold_pages(struct zxtrans_job *job, libspectrum_byte *buffer,
+		       const libspectrum_byte *pages[], size_t pageLength[]);
+int zxtrans_write_gathered(FILE *file,
+			   const struct zxtrans_transfer *transfer);
 
 enum verbosity_level {
   SILENT,
@@ -64,6 +311,8 @@ int main(int argc, char *argv[]){
 
   int writeToSerial=1;
   char *portName="COM1";
+  char **portNames=NULL; /* Each given with -s, all sent to at once */
+  int portCount=0;
   int serialMode=0;
   int baudRate=9600;
   libspectrum_machine targetPlatform=LIBSPECTRUM_MACHINE_UNKNOWN;
@@ -71,33 +320,68 @@ int main(int argc, char *argv[]){
 			  output */
   int writeToFile=0;
   char *outputFilename="output.bin";
+  int transferFlags=0; /* Options sent to receiver (ZXTRANS_FLAG_...) */
+  int deltaReload=0; /* Send only changes from last snapshot sent */
+  char *cacheName=NULL;
+  int batchWait=-1; /* Seconds between snapshots, or -1 to wait for
+		       Enter key */
+  char *metricsFilename=NULL; /* Where to record transfer metrics */
+  int burstSize=ZXTRANS_FLOW_BURST; /* Bytes per handshake in mode 0 */
+  int adaptiveBurst=0; /* Adjust burstSize to suit receiver */
+  int framed=0; /* Send rest of transfer after set-state block in
+		   checked frames */
+  int fastBaud=0; /* Raise baud rate after set-state block */
+  struct zxtrans_frames fileFrames;
+  int imageCache=1; /* Keep prepared snapshots, to send them again
+		       without preparing them */
+  char *daemonSocket=NULL; /* Run as daemon, listening here */
+  char *clientSocket=NULL; /* Ask daemon listening here to send */
+  int portsGiven=0; /* With -s, for daemon to open at once */
+  int tapeSpeed=0; /* Write output file as tape, at this many times ROM
+		      speed */
+  char *convertDir=NULL; /* Convert each snapshot to a file here */
+  int convertThreads=0; /* Snapshots converted at once, or 0 for one for
+			   each processor */
+  int direct=0; /* Send for the +3 receiver that loads in place */
+  int resume=0; /* Go on with an interrupted transfer from the first page
+		   the receiver does not have */
+  int firstPage=0; /* Sent to serial port */
+  int realtime=0; /* Send at real-time priority, with memory locked */
+  int realtimeCpu=-1; /* CPU to send from, or -1 for any */
+  struct zxtrans_realtime scheduling; /* Before sending in real time */
+  struct zxtrans_cache_writer imageWriter;
+  struct zxtrans_tape tape;
 
-  int tmpInt=-1;
-  FILE *inputSnapshot=NULL;
   FILE *outputBinary=NULL;
-  FILE *IF1Leader=NULL;
-  char *inputBuffer=NULL;
-  
-  libspectrum_snap *snapshot=NULL;
+  struct zxtrans_link *links=NULL; /* One for each serial port */
+  struct zxtrans_transfer transfer;
+  libspectrum_byte *heldPages=NULL; /* Pages prepared up front, to be
+				       shared between ports or gathered
+				       into one write */
+  int holdPages; /* Rather than take them from the pipeline */
+  int failures=0;
+
   libspectrum_error err;
-  libspectrum_id_t bufferType;
-  libspectrum_class_t bufferClass;
   const char *libSpectrumVersion;
 
-  struct sp_port_config *pSerialOutConfig;
-  enum sp_return sp_err;
-  
-  int sizeofInputSnapshot=0; /* Length of snapshot file */
   int sizeofLeader=0; /* Size of leader used for IF1 mode */
-  int readLen=0;
-  int sizeofInputRead=0;
   int option=0;
   
-  libspectrum_byte z80mc[CODEHDR+CODELEN];
-  char *leaderBuffer=NULL;
+  const libspectrum_byte *leaderBuffer=NULL;
+
+  char **jobNames=NULL; /* Snapshots to send, in order */
+  int jobCount=0;
+  struct zxtrans_job job;
+  struct zxtrans_block_metrics total;
+  struct zxtrans_pipeline pipeline;
+
+  if(NULL == (portNames = malloc(argc*sizeof(char *)))){
+    printf("Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
   
   /* Parse input arguments */
-  while ((option = getopt(argc, argv, "vhs:o:b:f:it:")) != -1) {
+  while ((option = getopt(argc, argv, "vhs:o:b:f:it:zmdw:M:B:acnD:C:T:O:j:rR:p")) != -1) {
     switch (option) {
     case 'h' : /* Help */
       usage();
@@ -110,9 +394,9 @@ int main(int argc, char *argv[]){
       writeToSerial = 0;
       outputFilename = optarg; 
       break;
-    case 's' : /* Write output to serial port */
+    case 's' : /* Write output to serial port, or to each of several */
       writeToSerial = 1;
-      portName = optarg; 
+      portNames[portCount++] = optarg; 
       break;
     case 'b' : /* Set baud rate */
       baudRate = atoi(optarg);
@@ -139,6 +423,100 @@ int main(int argc, char *argv[]){
       if(verbosity > NORMAL)
 	printf("Serial-transfer mode set to %i\n", serialMode);
 
+      break;
+    case 'z' : /* Compress memory pages */
+      transferFlags |= ZXTRANS_FLAG_PACKED;
+
+      if(verbosity > NORMAL)
+	printf("Compressed transfer enabled\n");
+
+      break;
+    case 'm' : /* Send sparse page map */
+      transferFlags |= ZXTRANS_FLAG_SPANS;
+
+      if(verbosity > NORMAL)
+	printf("Sparse page map enabled\n");
+
+      break;
+    case 'd' : /* Delta reload, which needs sparse page map */
+      deltaReload = 1;
+      transferFlags |= ZXTRANS_FLAG_DELTA | ZXTRANS_FLAG_SPANS;
+
+      if(verbosity > NORMAL)
+	printf("Delta reload enabled\n");
+
+      break;
+    case 'w' : /* Pause between snapshots in batch mode */
+      batchWait = atoi(optarg);
+      break;
+    case 'M' : /* Record transfer metrics */
+      metricsFilename = optarg;
+      break;
+    case 'B' : /* Bytes per handshake in mode 0 */
+      burstSize = atoi(optarg);
+
+      if(burstSize < 1 || burstSize > ZXTRANS_FLOW_BURST_MAX){
+	usage();
+	exit(EXIT_FAILURE);
+      }
+
+      break;
+    case 'a' : /* Adapt burst size while sending */
+      adaptiveBurst = 1;
+      break;
+    case 'p' : /* Send for +3 receiver that loads in place */
+      direct = 1;
+      break;
+    case 'c' : /* Checked frames, resent if receiver finds them corrupt */
+      framed = 1;
+      transferFlags |= ZXTRANS_FLAG_FRAMED;
+
+      if(verbosity > NORMAL)
+	printf("Checked frames enabled\n");
+
+      break;
+    case 'n' : /* Neither use nor add to cache of prepared snapshots */
+      imageCache = 0;
+      break;
+    case 'D' : /* Run as daemon, taking requests over a UNIX socket */
+      daemonSocket = optarg;
+      break;
+    case 'C' : /* Ask daemon to send snapshots */
+      clientSocket = optarg;
+      break;
+    case 'T' : /* Write output file as turbo-speed tape */
+      tapeSpeed = atoi(optarg);
+
+      if(tapeSpeed < 1 || tapeSpeed > ZXTRANS_TAPE_SPEED_MAX){
+	usage();
+	exit(EXIT_FAILURE);
+      }
+
+      break;
+    case 'O' : /* Convert each snapshot to a file in this directory */
+      convertDir = optarg;
+      break;
+    case 'j' : /* Snapshots converted at once */
+      convertThreads = atoi(optarg);
+
+      if(convertThreads < 1){
+	usage();
+	exit(EXIT_FAILURE);
+      }
+
+      break;
+    case 'r' : /* Resume interrupted transfer */
+      resume = 1;
+      break;
+    case 'R' : /* Real-time mode, sending from this CPU */
+      realtime = 1;
+      realtimeCpu = atoi(optarg);
+
+      if(realtimeCpu < -1){
+	usage();
+	exit(EXIT_FAILURE);
+      }
+
       break;
     /* case 't' : /\* Target platform *\/ */
     /*   targetPlatform = atoi(optarg); */
@@ -153,14 +531,119 @@ int main(int argc, char *argv[]){
     }
   }
 
-  /* Check we have parsed all input options */
-  if(optind != argc-1){
+  /* In mode 2, the +3 receiver switches to its fast serial loop after
+     the set-state block (the IF1 stub sets the baud rate itself). It
+     also answers checked frames from that loop, so needs it for them
+     in any mode. */
+  if((2 == serialMode || framed) && !if1Compatible)
+    transferFlags |= ZXTRANS_FLAG_FAST;
+
+  fastBaud = !tapeSpeed && \
+    (2 == serialMode || (transferFlags & ZXTRANS_FLAG_FAST));
+
+  /* Only the terminal server can change baud rate over raw TCP, and
+     the receiver's answers to the test pattern are on CTS */
+  for(int p=0; writeToSerial && fastBaud && p<portCount; p++)
+    if(0 == strncmp(portNames[p], ZXTRANS_PORT_TCP_PREFIX, \
+		    strlen(ZXTRANS_PORT_TCP_PREFIX))){
+      printf("Mode 2, and checked frames (-c) without -i, cannot be sent " \
+	     "over raw TCP: use %s instead.\n", ZXTRANS_PORT_RFC2217_PREFIX);
+      exit(EXIT_FAILURE);
+    }
+
+  /* Tape receiver loads each block with a timed loop, kept where the
+     fast serial loop goes, and cannot answer the sender */
+  if(tapeSpeed){
+    if(!writeToFile || writeToSerial || if1Compatible || framed || \
+       deltaReload || 2 == serialMode || NULL != daemonSocket || \
+       NULL != clientSocket){
+      printf("Tape is only written to an output file, and not with -i, " \
+	     "-c, -d or -f2.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    transferFlags |= ZXTRANS_FLAG_FAST;
+  }
+
+  /* The +3 receiver that loads in place runs the fast serial loop from
+     the first page, and keeps no record of an earlier snapshot */
+  if(direct && (!(transferFlags & ZXTRANS_FLAG_FAST) || tapeSpeed || \
+		if1Compatible || deltaReload || resume || \
+		NULL != clientSocket)){
+    printf("Loading in place (-p) needs -f2 or -c, and cannot be combined " \
+	   "with -i, -T, -d, -r or -C.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* WAV header is written last, so tape needs a file it can go back
+     to */
+  if(writeToFile && tapeSpeed && !strcmp(outputFilename, "-")){
+    printf("Tape (-T) is written to a named file, not standard output.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Bulk conversion writes a file for each snapshot, and nothing
+     else */
+  if(NULL != convertDir && (writeToFile || portCount > 0 || deltaReload || \
+			    tapeSpeed || NULL != daemonSocket || \
+			    NULL != clientSocket)){
+    printf("Bulk conversion (-O) cannot be combined with -o, -s, -d, -T, " \
+	   "-D or -C.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  portsGiven = portCount;
+
+  if(0 == portCount)
+    portNames[portCount++] = portName;
+
+  portName = portNames[0];
+
+  /* Each port may have been sent something different last time */
+  if(deltaReload && writeToSerial && portCount > 1){
+    printf("Delta reload can only send to one serial port.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Real-time mode is for whatever sends to the receiver, rather than a
+     client asking the daemon to */
+  if(realtime && NULL == daemonSocket && \
+     (!writeToSerial || NULL != clientSocket)){
+    printf("Real-time mode (-R) is only for sending to serial ports, or " \
+	   "for the daemon.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Daemon keeps its ports open, and each port may be sent something
+     different */
+  if(NULL != daemonSocket && (writeToFile || deltaReload)){
+    printf("Daemon can only send to serial ports, and not as delta " \
+	   "reloads.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Requests may only name the daemon's own ports, which must not be
+     files, so a client cannot have it write wherever it can */
+  for(int p=0; NULL != daemonSocket && p<portCount; p++)
+    if(0 == strncmp(portNames[p], ZXTRANS_PORT_FILE_PREFIX, \
+		    strlen(ZXTRANS_PORT_FILE_PREFIX))){
+      printf("Daemon cannot send to %s.\n", portNames[p]);
+      exit(EXIT_FAILURE);
+    }
+
+  /* Check we have at least one snapshot (or directory of them) to send,
+     unless running as a daemon, which is sent them later */
+  if(optind > argc-1 && NULL == daemonSocket){
     usage();
     exit(EXIT_FAILURE);
   }
   
   /* Initialise libSpectrum library */
-  err = libspectrum_init();
+  if((err = libspectrum_init()) != LIBSPECTRUM_ERROR_NONE){
+    printf("Error initialising libspectrum %d\n", err);
+    exit(EXIT_FAILURE);
+  }
+
   libSpectrumVersion = libspectrum_version();
   
   if(verbosity > NORMAL){
@@ -168,136 +651,532 @@ int main(int argc, char *argv[]){
     printf("Serial interface is based on libserialport Version %s\n", \
 	   SP_PACKAGE_VERSION_STRING);
   }
-  
-  /* Try to open input snapshot */
-  if (NULL == (inputSnapshot = fopen(argv[optind], "rb"))){
-    printf("Error opening input file.\n");
+
+  /* Expand any directories into the snapshots they hold */
+  jobCount = zxtrans_list_jobs(&argv[optind], argc-optind, &jobNames);
+
+  if(0 == jobCount && NULL == daemonSocket){
+    printf("No snapshots to send.\n");
     exit(EXIT_FAILURE);
   }
 
-  /* Check size of file, by seeking to end (and then returning to
-     beginning) */
-  fseek(inputSnapshot, 0, SEEK_END);
-  sizeofInputSnapshot = ftell(inputSnapshot);
-  fseek(inputSnapshot, 0, SEEK_SET); 
+  /* Receiver says where to resume on the line back, which only checked
+     frames use */
+  if(resume && (!framed || !writeToSerial || portCount > 1 || \
+		jobCount > 1 || NULL != daemonSocket || \
+		NULL != clientSocket || NULL != convertDir)){
+    printf("Resume (-r) sends one snapshot to one serial port, with " \
+	   "checked frames (-c).\n");
+    exit(EXIT_FAILURE);
+  }
 
-  if(verbosity > NORMAL){
-    printf("Input snapshot is %i bytes long\n", sizeofInputSnapshot);
+  if(deltaReload)
+    cacheName = zxtrans_delta_cache_name(writeToFile ? outputFilename : \
+					 portName);
+
+  /* IF1 leader is the same for every snapshot */
+  if(if1Compatible)
+    leaderBuffer = zxtrans_leader(serialMode, verbosity, &sizeofLeader);
+
+  transfer.leader = leaderBuffer;
+  transfer.sizeofLeader = sizeofLeader;
+  transfer.baudRate = baudRate;
+  transfer.fastBaud = fastBaud;
+  transfer.framed = framed;
+  transfer.burstSize = burstSize;
+  transfer.adaptiveBurst = adaptiveBurst;
+  transfer.realtime = realtime;
+  transfer.realtimeCpu = realtimeCpu;
+  transfer.direct = direct;
+  transfer.progress = (NORMAL == verbosity && 1 == portCount) ? stdout : NULL;
+  transfer.verbosity = verbosity;
+
+  /* Pages prepared later are locked too */
+  if(realtime)
+    zxtrans_realtime_lock();
+
+  /* Daemon sends snapshots as it is asked, and its clients ask it to */
+  if(NULL != daemonSocket || NULL != clientSocket){
+    if(NULL != daemonSocket)
+      failures = !zxtrans_serve(daemonSocket, &transfer, serialMode, \
+				transferFlags, imageCache, metricsFilename, \
+				portNames, portsGiven, jobNames, jobCount);
+    else
+      failures = zxtrans_request_jobs(clientSocket, portNames, portCount, \
+				      jobNames, jobCount, batchWait, \
+				      verbosity);
+
+    for(int j=0; j<jobCount; j++)
+      free(jobNames[j]);
+
+    free(jobNames);
+    free(portNames);
+
+    return failures ? EXIT_FAILURE : 0;
   }
-  
-  /* Create space for serialised input */
-  inputBuffer = malloc(sizeofInputSnapshot*sizeof(char));
 
-  if(NULL == inputBuffer){
-    printf("Out of memory.\n");
-    fclose(inputSnapshot);
-    exit(EXIT_FAILURE);
+  /* Each snapshot is converted to a file of its own, several at once */
+  if(NULL != convertDir){
+    failures = !zxtrans_convert_jobs(jobNames, jobCount, convertDir, \
+				     convertThreads, &transfer, transferFlags);
+
+    for(int j=0; j<jobCount; j++)
+      free(jobNames[j]);
+
+    free(jobNames);
+    free(portNames);
+
+    return failures ? EXIT_FAILURE : 0;
   }
 
-  /* Read snapshot into buffer */
-  sizeofInputRead = fread(inputBuffer,			\
-			  sizeof(char),			\
-			  sizeofInputSnapshot,		\
-			  inputSnapshot);
-     
-  if (sizeofInputRead != sizeofInputSnapshot){
-    printf("Read error: only read %i elements\nError is %i\n",	\
-  	   sizeofInputRead, ferror(inputSnapshot));
-    free(inputBuffer);
-    fclose(inputSnapshot);
-    exit(EXIT_FAILURE);
+  /* If requested, open output file, which receives every snapshot in
+     turn */
+  if(writeToFile){
+    if(verbosity>NORMAL){
+      printf("Writing output to %s\n", outputFilename);
+    }
+    
+    if(tapeSpeed){
+      if(!zxtrans_tape_open(&tape, outputFilename, tapeSpeed)){
+	printf("Error opening output file %s", outputFilename);
+	exit(EXIT_FAILURE);
+      }
+    }
+    else if(!strcmp(outputFilename, "-")){
+      if(NULL == (outputBinary = zxtrans_stream_open())){
+	printf("Error opening standard output for the transfer.\n");
+	exit(EXIT_FAILURE);
+      }
+    }
+    else if(NULL == (outputBinary = fopen(outputFilename,"wb"))){
+      printf("Error opening output file %s", outputFilename);
+      exit(EXIT_FAILURE);
+    }
   }
   
-  /* Close snapshot */
-  fclose(inputSnapshot);
+  /* If requested, open serial ports, which stay open (and configured)
+     for every snapshot */
+  if(writeToSerial){
+    if(NULL == (links = calloc(portCount, sizeof(*links)))){
+      printf("Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
 
-  /* Check it is a snapshot */
-  err = \
-    libspectrum_identify_file_with_class(&bufferType,	\
-					 &bufferClass,	\
-					 argv[optind],	\
-					 inputBuffer,	\
-					 sizeofInputSnapshot);
+    for(int p=0; p<portCount; p++){
+      links[p].portName = portNames[p];
+      links[p].port = zxtrans_open_port(portNames[p], baudRate, framed, \
+					realtime, verbosity);
+      links[p].serialMode = serialMode;
 
-  if(err != 0){
-    printf("Unable to determine file type.\n");
-    free(inputBuffer);
-    exit(EXIT_FAILURE);
+      if(NULL == links[p].port)
+	exit(EXIT_FAILURE);
+    }
   }
 
-  if(bufferClass != LIBSPECTRUM_CLASS_SNAPSHOT){
-    printf("File does not look to be a snapshot.%i\n", bufferClass);
-    free(inputBuffer);
+  /* Pages shared between ports, or written to the output file (unless
+     in frames or as tape) in one gathered write with the rest of the
+     transfer, are prepared up front, each straight into a buffer of its
+     own */
+  holdPages = (writeToSerial && portCount > 1) || \
+    (writeToFile && !framed && !tapeSpeed);
+
+  if(holdPages && NULL == (heldPages = \
+			   malloc(ZXTRANS_MAX_PAGES*ZXTRANS_IMAGE_BOUND))){
+    printf("Out of memory.\n");
     exit(EXIT_FAILURE);
   }
-  
-  /* Allocate space for snapshot */
-  snapshot = libspectrum_snap_alloc();
 
-  err = \
-    libspectrum_snap_read(snapshot,				\
-			  (libspectrum_byte *) inputBuffer,	\
-			  sizeofInputSnapshot,			\
-			  LIBSPECTRUM_ID_UNKNOWN,		\
-			  argv[optind]);
-  
-  if(err != 0 ){
-    printf("Error populating snapshot.\n");
-    free(inputBuffer);
-    libspectrum_snap_free(snapshot);
+  if(!zxtrans_prepare_job(jobNames[0], transferFlags, direct, cacheName, \
+			  imageCache, verbosity, NULL, &job))
     exit(EXIT_FAILURE);
-  }
 
-  /* We are done with serialised buffer */
-  free(inputBuffer);
+  for(int j=0; j<jobCount; j++){
+    if(jobCount > 1 && verbosity > SILENT)
+      printf("Sending %s (%d of %d)\n", jobNames[j], j+1, jobCount);
 
-  /* Check it is a 16k or 48k snapshot */
-  libspectrum_machine machine = libspectrum_snap_machine(snapshot);
+    /* Start preparing pages, which continues while earlier ones are
+       sent, unless they were cached when last sent or are held */
+    if(holdPages && \
+       !zxtrans_hold_pages(&job, heldPages, transfer.pages, \
+			   transfer.pageLength))
+      exit(EXIT_FAILURE);
 
-  /* if(targetPlatform == LIBSPECTRUM_MACHINE_UNKNOWN) */
-  /*   targetPlatform == machine; */
+    if(!job.cached && !holdPages && \
+       !zxtrans_pipeline_start(&pipeline, job.snapshot, \
+			       &job.z80mc[PAGELIST], job.pageCount, \
+			       job.transferFlags, job.keep)){
+      printf("Unable to start preparing memory pages.\n");
+      exit(EXIT_FAILURE);
+    }
 
-  /* if(!(machine == LIBSPECTRUM_MACHINE_16 || \ */
-  /*      machine == LIBSPECTRUM_MACHINE_48)){ */
-  /*   printf("Found snapshot for %s\n", libspectrum_machine_name(machine)); */
-  /*   printf("%s %s", "Sorry, this version of zxtrans can only",	\ */
-  /* 	   "handle 16k and 48k snapshots.\n"); */
-  /*   libspectrum_snap_free(snapshot); */
-  /*   exit(EXIT_FAILURE); */
-  /* } */
-  
-  if(verbosity > NORMAL)
-    printf("Found snapshot for %s\n", libspectrum_machine_name(machine));
-  
-  /* Print out Z80 state, as recorded in snapshot */
-  if (DEBUG == verbosity){
-    printf("A = %X\n", (unsigned) libspectrum_snap_a(snapshot));
-    printf("F = %X\n", (unsigned) libspectrum_snap_f(snapshot));
-    printf("BC = %X\n", (unsigned) libspectrum_snap_bc(snapshot));
-    printf("DE = %X\n", (unsigned) libspectrum_snap_de(snapshot));
-    printf("HL = %X\n", (unsigned) libspectrum_snap_hl(snapshot));
-    
-    printf("A' = %X\n", (unsigned) libspectrum_snap_a_(snapshot));
-    printf("F' = %X\n", (unsigned) libspectrum_snap_f_(snapshot));
-    printf("BC' = %X\n", (unsigned) libspectrum_snap_bc_(snapshot));
-    printf("DE' = %X\n", (unsigned) libspectrum_snap_de_(snapshot));
-    printf("HL' = %X\n", (unsigned) libspectrum_snap_hl_(snapshot));
-    
-    printf("IX = %X\n", (unsigned) libspectrum_snap_ix(snapshot));
-    printf("IY = %X\n", (unsigned) libspectrum_snap_iy(snapshot));
+    zxtrans_frames_init(&fileFrames);
+    transfer.name = jobNames[j];
+    transfer.job = &job;
+
+    memset(&imageWriter, 0, sizeof(imageWriter));
+
+    if(NULL != job.imageName)
+      zxtrans_cache_create(&imageWriter, job.imageName, job.z80mc, \
+			   job.pageCount);
+
+    /* Tape starts with its own loader for the receiver, and the rest is
+       sent in numbered blocks */
+    if(tapeSpeed){
+      zxtrans_tape_loader(&tape, zxtrans_receiver_tape_bin, \
+			  zxtrans_receiver_tape_bin_len);
+      zxtrans_tape_write(&tape, job.z80mc, CODELEN);
+      zxtrans_tape_write(&tape, job.deltaTable, job.deltaLength);
+    }
+    else if(writeToFile && framed){
+      /* Write IF1 Leader routine */
+      if(if1Compatible)
+	fwrite(leaderBuffer, sizeof(libspectrum_byte),	\
+	       sizeofLeader, outputBinary);
     
-    printf("I = %X\n", (unsigned) libspectrum_snap_i(snapshot));
-    printf("R = %X\n", (unsigned) libspectrum_snap_r(snapshot));
-    printf("IFF1 = %X\n", (unsigned) libspectrum_snap_iff1(snapshot));
-    printf("IFF2 = %X\n", (unsigned) libspectrum_snap_iff2(snapshot));
-    printf("IM = %X\n", (unsigned) libspectrum_snap_im(snapshot));
-    printf("SP = %X\n", (unsigned) libspectrum_snap_sp(snapshot));
-    printf("PC = %X\n", (unsigned) libspectrum_snap_pc(snapshot));
-    printf("memptr = %X\n", (unsigned) libspectrum_snap_memptr(snapshot));
-  }
- 
-  /* Write Z80 state information, as m/c program */
-  int pc=0;
+      /* Write Z80 Set State routine */
+      fwrite(job.z80mc, sizeof(libspectrum_byte),	\
+	     CODELEN, outputBinary);
+
+      /* File is played out at one rate, taken to be the fastest, so
+	 receiver settles on that at its first try */
+      if(fastBaud){
+	libspectrum_byte pattern[ZXTRANS_LADDER_LEN+1];
+
+	zxtrans_image_ladder(pattern);
+	pattern[ZXTRANS_LADDER_LEN] = ZXTRANS_LADDER_GO;
+	fwrite(pattern, sizeof(libspectrum_byte), ZXTRANS_LADDER_LEN+1, \
+	       outputBinary);
+      }
+
+      /* Write table for receiver to check memory to be kept */
+      zxtrans_write_frames(outputBinary, job.deltaTable, job.deltaLength, \
+			   &fileFrames);
+    }
+
+    /* With one port, each page is sent as soon as it is prepared. A
+       resumed transfer starts with the first page the receiver does not
+       have. */
+    if(writeToSerial && 1 == portCount){
+      /* Preparation of pages is already under way, so does not take on
+	 real-time priority */
+      if(realtime)
+	zxtrans_realtime_enter(&scheduling, realtimeCpu);
+
+      if(resume)
+	firstPage = zxtrans_send_resume(&links[0], &transfer);
+
+      if(resume ? firstPage < 0 : !zxtrans_send_start(&links[0], &transfer))
+	zxtrans_give_up(&links[0]);
+    }
+
+    /* Write RAM pages: standard configuration of 16k/ 48k Spectrum uses
+       pages 5, 2, and 0 in sequence. */
+    for(int i=0; i<job.pageCount; i++){
+      size_t pageLength;
+      const libspectrum_byte *pageData;
+
+      if(holdPages){
+	pageData = transfer.pages[i];
+	pageLength = transfer.pageLength[i];
+      }
+      else if(job.cached){
+	pageData = job.image.pages[i];
+	pageLength = job.image.pageLength[i];
+      }
+      else
+	pageData = zxtrans_pipeline_next(&pipeline, &pageLength);
+
+      if(NULL == pageData){
+	printf("Error preparing memory page %d.\n", job.z80mc[PAGELIST+i]);
+	exit(EXIT_FAILURE);
+      }
+
+      if(job.transferFlags && verbosity > NORMAL)
+	printf("Memory page %d reduced to %zu bytes\n", \
+	       job.z80mc[PAGELIST+i], pageLength);
+
+      zxtrans_cache_add(&imageWriter, pageData, pageLength);
+
+      if(tapeSpeed)
+	zxtrans_tape_page(&tape, pageData, pageLength, job.transferFlags);
+      else if(writeToFile && framed)
+	zxtrans_write_frames(outputBinary, pageData, pageLength, &fileFrames);
+
+      if(writeToSerial && 1 == portCount && i >= firstPage && \
+	 !zxtrans_send_page(&links[0], &transfer, i, pageData, pageLength))
+	zxtrans_give_up(&links[0]);
+
+      if(!job.cached && !holdPages)
+	zxtrans_pipeline_release(&pipeline);
+    }
+
+    if(!job.cached && !holdPages)
+      zxtrans_pipeline_finish(&pipeline);
+
+    if(writeToFile && holdPages && \
+       !zxtrans_write_gathered(outputBinary, &transfer)){
+      printf("Error writing output file %s.\n", outputFilename);
+      exit(EXIT_FAILURE);
+    }
+
+    if(NULL != job.imageName && !zxtrans_cache_commit(&imageWriter) && \
+       verbosity > NORMAL)
+      printf("Could not cache prepared snapshot as %s\n", job.imageName);
+
+    if(tapeSpeed){
+      zxtrans_tape_finish(&tape);
+
+      if(verbosity > NORMAL)
+	printf("Tape now runs for %.1f seconds\n", tape.seconds);
+    }
+
+    /* Last frame is padded out */
+    if(writeToFile && fileFrames.fill > 0)
+      fwrite(zxtrans_frames_seal(&fileFrames), sizeof(libspectrum_byte), \
+	     ZXTRANS_FRAME_WIRE_LEN, outputBinary);
+
+    if(writeToSerial && 1 == portCount && \
+       !zxtrans_send_finish(&links[0], &transfer))
+      zxtrans_give_up(&links[0]);
+
+    if(writeToSerial && 1 == portCount && realtime)
+      zxtrans_realtime_leave(&scheduling);
+
+    if(writeToSerial && portCount > 1)
+      zxtrans_fan_out(links, portCount, &transfer);
+
+    for(int p=0; writeToSerial && p<portCount; p++){
+      struct zxtrans_link *link = &links[p];
+
+      if(!link->sent){
+	printf("%s: %s\n", link->portName, link->error);
+	failures++;
+	continue;
+      }
+
+      zxtrans_metrics_total(&link->metrics, &total);
+
+      if(portCount > 1 && verbosity > SILENT)
+	printf("%s: sent %zu bytes in %.1f seconds (%.0f baud)\n", \
+	       link->portName, total.sent, total.seconds, \
+	       total.seconds > 0 ? \
+	       total.sent*ZXTRANS_METRICS_BITS_PER_BYTE/total.seconds : 0);
+      else if(verbosity > NORMAL)
+	printf("Sent %zu bytes in %.1f seconds (%.0f baud)\n", total.sent, \
+	       total.seconds, \
+	       total.seconds > 0 ? \
+	       total.sent*ZXTRANS_METRICS_BITS_PER_BYTE/total.seconds : 0);
+
+      if(0 == serialMode && verbosity > NORMAL)
+	printf("Receiver held off transfer for %.2f seconds (%lu of %lu " \
+	       "handshakes, ending with %zu bytes each)\n", \
+	       total.flow.stalledSeconds, total.flow.stalls, \
+	       total.flow.waits, link->burst.size);
+
+      if(0 == serialMode && realtime && verbosity > NORMAL){
+	zxtrans_metrics_print_histogram(stdout, "RTS to CTS turnaround", \
+					&link->metrics.turnaround);
+	zxtrans_metrics_print_histogram(stdout, "Gaps between bursts", \
+					&link->metrics.gaps);
+      }
+
+      if(NULL != metricsFilename && \
+	 !zxtrans_metrics_write(&link->metrics, metricsFilename))
+	printf("Warning: could not write metrics to %s.\n", metricsFilename);
+    }
+
+    /* Remember snapshot, for next delta reload */
+    if(deltaReload && (NULL == cacheName || \
+		       !zxtrans_delta_save(cacheName, job.snapshot, \
+					   &job.z80mc[PAGELIST])))
+      printf("Warning: could not record snapshot for next delta reload.\n");
+
+    zxtrans_free_job(&job);
+
+    if(j+1 == jobCount)
+      break;
+
+    /* Prepare next snapshot while last is still draining from the port
+       and the receiver is restarted */
+    if(!zxtrans_prepare_job(jobNames[j+1], transferFlags, direct, \
+			    cacheName, imageCache, verbosity, NULL, &job))
+      exit(EXIT_FAILURE);
+
+    if(writeToSerial)
+      zxtrans_batch_wait(batchWait, jobNames[j+1]);
+  }
+
+  /* Clean up and close output */
+  if(tapeSpeed && !zxtrans_tape_close(&tape)){
+    printf("Error writing output file %s.\n", outputFilename);
+    exit(EXIT_FAILURE);
+  }
+  else if(writeToFile && !tapeSpeed && 0 != fclose(outputBinary)){
+    printf("Error writing output file %s.\n", outputFilename);
+    exit(EXIT_FAILURE);
+  }
+
+  for(int p=0; writeToSerial && p<portCount; p++){
+    zxtrans_close_port(links[p].port);
+  }
+  
+  /* Exit */
+  free(links);
+  free(heldPages);
+  free(portNames);
+  free(cacheName);
+
+  for(int j=0; j<jobCount; j++)
+    free(jobNames[j]);
+
+  free(jobNames);
+
+  return failures ? EXIT_FAILURE : 0;
+}
+
+/* Read snapshot filename and prepare it for sending, according to
+   transferFlags. With imageCache, a snapshot sent before with the same
+   options is taken from the cache, ready to send. The file is mapped,
+   where possible, and a 48k .sna or uncompressed .z80 read where it
+   lies; otherwise it is read into input, if given, or else a buffer of
+   its own. Returns 0, having said why, if filename cannot be read as a
+   snapshot. */
+int zxtrans_prepare_job(const char *filename, int transferFlags,
+			int direct, const char *cacheName, int imageCache,
+			int verbosity, struct zxtrans_input *input,
+			struct zxtrans_job *job){
+  char *inputBuffer=NULL;
+  struct zxtrans_input scratch={NULL, 0}; /* Unless caller keeps one */
+  
+  libspectrum_snap *snapshot=NULL;
+
+  int sizeofInputSnapshot=0; /* Length of snapshot file */
+
+  libspectrum_byte *z80mc=job->z80mc;
+
+  struct zxtrans_delta previous;
+
+  memset(job, 0, sizeof(*job));
+
+  if(zxtrans_snapfile_map(filename, &job->file)){
+    inputBuffer = (char *) job->file.data;
+    sizeofInputSnapshot = job->file.length;
+  }
+  else if(NULL == (inputBuffer = \
+		   zxtrans_read_file(filename, input ? input : &scratch, \
+				     &sizeofInputSnapshot))){
+    free(scratch.buffer);
+    return 0;
+  }
+
+  if(verbosity > NORMAL){
+    printf("Input snapshot is %i bytes long\n", sizeofInputSnapshot);
+  }
+  
+  /* Cached image of a delta reload would depend on what was sent
+     before it */
+  if(imageCache && !(transferFlags & ZXTRANS_FLAG_DELTA))
+    job->imageName = \
+      zxtrans_cache_name((libspectrum_byte *) inputBuffer, \
+			 sizeofInputSnapshot, transferFlags);
+
+  if(NULL != job->imageName && \
+     zxtrans_cache_open(job->imageName, &job->image)){
+    memcpy(z80mc, job->image.state, CODELEN);
+
+    while(job->pageCount < ZXTRANS_MAX_PAGES && \
+	  0xFF != z80mc[PAGELIST+job->pageCount])
+      job->pageCount++;
+
+    if(job->pageCount == job->image.pageCount){
+      if(verbosity > NORMAL)
+	printf("Using prepared snapshot %s\n", job->imageName);
+
+      free(scratch.buffer);
+      zxtrans_snapfile_unmap(&job->file);
+      free(job->imageName);
+      job->imageName = NULL;
+      job->cached = 1;
+      job->transferFlags = transferFlags;
+      return !direct || zxtrans_check_direct(filename, job);
+    }
+
+    /* Image does not match its own page list, so is replaced */
+    zxtrans_cache_close(&job->image);
+    job->pageCount = 0;
+  }
+
+  /* Common layouts are read where they lie, with the file kept mapped
+     until the snapshot is freed, and anything else by libspectrum */
+  if(NULL != job->file.data && \
+     NULL != (snapshot = zxtrans_snapfile_read(filename, &job->file))){
+    if(verbosity > NORMAL)
+      printf("Reading snapshot in place\n");
+  }
+  else{
+    snapshot = \
+      zxtrans_parse_snapshot(filename, (libspectrum_byte *) inputBuffer, \
+			     sizeofInputSnapshot);
+    zxtrans_snapfile_unmap(&job->file);
+  }
+
+  /* We are done with serialised buffer */
+  free(scratch.buffer);
+
+  if(NULL == snapshot){
+    free(job->imageName);
+    job->imageName = NULL;
+    return 0;
+  }
+
+  /* Check it is a 16k or 48k snapshot */
+  libspectrum_machine machine = libspectrum_snap_machine(snapshot);
+  const struct zxtrans_page_plan *plan = zxtrans_find_plan(machine);
+
+  /* if(targetPlatform == LIBSPECTRUM_MACHINE_UNKNOWN) */
+  /*   targetPlatform == machine; */
+
+  /* if(!(machine == LIBSPECTRUM_MACHINE_16 || \ */
+  /*      machine == LIBSPECTRUM_MACHINE_48)){ */
+  /*   printf("Found snapshot for %s\n", libspectrum_machine_name(machine)); */
+  /*   printf("%s %s", "Sorry, this version of zxtrans can only",	\ */
+  /* 	   "handle 16k and 48k snapshots.\n"); */
+  /*   libspectrum_snap_free(snapshot); */
+  /*   exit(EXIT_FAILURE); */
+  /* } */
+  
+  if(verbosity > NORMAL)
+    printf("Found snapshot for %s\n", libspectrum_machine_name(machine));
+  
+  /* Print out Z80 state, as recorded in snapshot */
+  if (DEBUG == verbosity){
+    printf("A = %X\n", (unsigned) libspectrum_snap_a(snapshot));
+    printf("F = %X\n", (unsigned) libspectrum_snap_f(snapshot));
+    printf("BC = %X\n", (unsigned) libspectrum_snap_bc(snapshot));
+    printf("DE = %X\n", (unsigned) libspectrum_snap_de(snapshot));
+    printf("HL = %X\n", (unsigned) libspectrum_snap_hl(snapshot));
+    
+    printf("A' = %X\n", (unsigned) libspectrum_snap_a_(snapshot));
+    printf("F' = %X\n", (unsigned) libspectrum_snap_f_(snapshot));
+    printf("BC' = %X\n", (unsigned) libspectrum_snap_bc_(snapshot));
+    printf("DE' = %X\n", (unsigned) libspectrum_snap_de_(snapshot));
+    printf("HL' = %X\n", (unsigned) libspectrum_snap_hl_(snapshot));
+    
+    printf("IX = %X\n", (unsigned) libspectrum_snap_ix(snapshot));
+    printf("IY = %X\n", (unsigned) libspectrum_snap_iy(snapshot));
+    
+    printf("I = %X\n", (unsigned) libspectrum_snap_i(snapshot));
+    printf("R = %X\n", (unsigned) libspectrum_snap_r(snapshot));
+    printf("IFF1 = %X\n", (unsigned) libspectrum_snap_iff1(snapshot));
+    printf("IFF2 = %X\n", (unsigned) libspectrum_snap_iff2(snapshot));
+    printf("IM = %X\n", (unsigned) libspectrum_snap_im(snapshot));
+    printf("SP = %X\n", (unsigned) libspectrum_snap_sp(snapshot));
+    printf("PC = %X\n", (unsigned) libspectrum_snap_pc(snapshot));
+    printf("memptr = %X\n", (unsigned) libspectrum_snap_memptr(snapshot));
+  }
+ 
+  /* Write Z80 state information, as m/c program */
+  int pc=0;
 
   /* z80mc[pc++] = 03; /\* Binary code file *\/ */
   /* z80mc[pc++] = CODELEN; /\* Length of code *\/ */
@@ -311,11 +1190,7 @@ int main(int argc, char *argv[]){
   
   z80mc[pc++] = 0xF3; /* DI */
 
-  switch(machine) {
-  case LIBSPECTRUM_MACHINE_128:
-  case LIBSPECTRUM_MACHINE_PLUS2:
-  case LIBSPECTRUM_MACHINE_PLUS2A:
-  case LIBSPECTRUM_MACHINE_PLUS3:
+  if(plan->port128){
     z80mc[pc++] = 0x3e; /* ld a, out_128_memoryport */
     z80mc[pc++] = libspectrum_snap_out_128_memoryport(snapshot); 
     z80mc[pc++] = 0x01; /* ld bc, BANK1 */
@@ -323,51 +1198,23 @@ int main(int argc, char *argv[]){
     z80mc[pc++] = 0x7F;
     z80mc[pc++] = 0xED; /* out (c),a */
     z80mc[pc++] = 0x79;
-    break;
-  default:
-    /* if(LIBSPECTRUM_MACHINE_CAPABILITY_128_MEMORY && libspectrum_machine_capabilities(targetPlatform)){ */
-    /*   if(verbosity > NORMAL) */
-    /* 	printf("128k target detected\n", targetPlatform); */
-
-    /*   z80mc[pc++] = 0x3e; /\* ld a, %00100000 *\/ */
-    /*   z80mc[pc++] = 0x20; /\* Setting bit 6 blocks further paging *\/ */
-    /*   z80mc[pc++] = 0x01; /\* ld bc, BANK1 *\/ */
-    /*   z80mc[pc++] = 0xFD;  */
-    /*   z80mc[pc++] = 0x7F;  */
-    /*   z80mc[pc++] = 0xED; /\* out (c),a *\/ */
-    /*   z80mc[pc++] = 0x79; */
-    /* } */
-    /* else{ */
-      z80mc[pc++] = 00; /* NOP */
-      z80mc[pc++] = 00; /* NOP */
-      z80mc[pc++] = 00; /* NOP */
-      z80mc[pc++] = 00; /* NOP */
-      z80mc[pc++] = 00; /* NOP */
-      z80mc[pc++] = 00; /* NOP */
-      z80mc[pc++] = 00; /* NOP */
-    /* } */
   }
-  
-  switch(machine) {
-  case LIBSPECTRUM_MACHINE_PLUS2A:
-  case LIBSPECTRUM_MACHINE_PLUS3:
-    z80mc[pc++] = 0x3e; /* ld a, out_128_memoryport */
+  else
+    for(int i=0; i<7; i++)
+      z80mc[pc++] = 00; /* NOP */
+
+  if(plan->portPlus3){
+    z80mc[pc++] = 0x3e; /* ld a, out_plus3_memoryport */
     z80mc[pc++] = libspectrum_snap_out_plus3_memoryport(snapshot); 
     z80mc[pc++] = 0x01; /* ld bc, BANK1 */
     z80mc[pc++] = 0xFD;
     z80mc[pc++] = 0x1F;
     z80mc[pc++] = 0xED; /* out (c),a */
     z80mc[pc++] = 0x79;
-    break;
-  default:
-    z80mc[pc++] = 00; /* NOP */
-    z80mc[pc++] = 00; /* NOP */
-    z80mc[pc++] = 00; /* NOP */
-    z80mc[pc++] = 00; /* NOP */
-    z80mc[pc++] = 00; /* NOP */
-    z80mc[pc++] = 00; /* NOP */
-    z80mc[pc++] = 00; /* NOP */
   }
+  else
+    for(int i=0; i<7; i++)
+      z80mc[pc++] = 00; /* NOP */
   
   z80mc[pc++] = 0x3E; /* ld a, NN */
   z80mc[pc++] = libspectrum_snap_i(snapshot); 
@@ -464,346 +1311,304 @@ int main(int argc, char *argv[]){
   /* PC=70 at this point */
   
   /* Store page information */
-  z80mc[pc++] = 0x05; /* RAM page at 0x4000--0x7FFF */
-
-  switch(machine) {
-  case LIBSPECTRUM_MACHINE_16:
-    z80mc[pc++] = 0xFF; /* End */
+  for(int i=0; 0xFF != plan->pages[i]; i++)
+    z80mc[pc++] = plan->pages[i];
+
+  z80mc[pc++] = 0xFF; /* End */
+
+  /* For a delta reload, find memory unchanged since last snapshot sent
+     to same destination */
+  if(transferFlags & ZXTRANS_FLAG_DELTA){
+    if(NULL != cacheName && zxtrans_delta_load(cacheName, &previous)){
+      job->deltaLength = \
+	zxtrans_delta_table(snapshot, &z80mc[PAGELIST], &previous, \
+			    transferFlags, job->keep, job->deltaTable);
+      zxtrans_delta_free(&previous);
+    }
 
-    break;
-  case LIBSPECTRUM_MACHINE_48:
-    z80mc[pc++] = 0x02; /* RAM page at 0x8000--0xBFFF */
-    z80mc[pc++] = 0x00; /* RAM page at 0xC000--0xFFFF */
-    z80mc[pc++] = 0xFF; /* End */
+    if(0 == job->deltaLength){
+      transferFlags &= ~ZXTRANS_FLAG_DELTA;
 
-    break;
-  case LIBSPECTRUM_MACHINE_128:
-  case LIBSPECTRUM_MACHINE_PLUS2:
-  case LIBSPECTRUM_MACHINE_PLUS2A:
-  case LIBSPECTRUM_MACHINE_PLUS3:
-    z80mc[pc++] = 0x02; /* RAM page at 0x8000--0xBFFF */
-    z80mc[pc++] = 0x00; /* First RAM page at 0xC000--0xFFFF */
-    z80mc[pc++] = 0x01; /* First RAM page at 0xC000--0xFFFF */
-    z80mc[pc++] = 0x03; /* First RAM page at 0xC000--0xFFFF */
-    z80mc[pc++] = 0x04; /* First RAM page at 0xC000--0xFFFF */
-    z80mc[pc++] = 0x06; /* First RAM page at 0xC000--0xFFFF */
-    z80mc[pc++] = 0x07; /* First RAM page at 0xC000--0xFFFF */
-    z80mc[pc++] = 0xFF; /* End */
+      if(verbosity > NORMAL)
+	printf("No earlier snapshot to build on: sending in full\n");
+    }
+    else if(verbosity > NORMAL)
+      printf("Using %s as last snapshot sent\n", cacheName);
   }
 
   /* PC=79 at this point */
-  
-  /* If requested, write output to file */
-  if(writeToFile){
-    if(verbosity>NORMAL){
-      printf("Writing output to %s\n", outputFilename);
-    }
-    
-    if(NULL == (outputBinary = fopen(outputFilename,"wb"))){
-      printf("Error opening output file %s", outputFilename);
-      exit(EXIT_FAILURE);
-    }
+  z80mc[FLAGS] = transferFlags;
 
-    if(if1Compatible){
-      if(2 == serialMode){
-	if (NULL == (IF1Leader = fopen("zxtrans_stub_fast.bin", "rb"))){
-	  printf("Error opening IF1 leader file.\n");
-	  exit(EXIT_FAILURE);
-	}
-      }
-      else{
-	if (NULL == (IF1Leader = fopen("zxtrans_stub.bin", "rb"))){
-	  printf("Error opening IF1 leader file.\n");
-	  exit(EXIT_FAILURE);
-	}
-      }
+  /* Pages themselves are prepared as they are sent */
+  while(0xFF != z80mc[PAGELIST+job->pageCount])
+    job->pageCount++;
 
-      if(verbosity>NORMAL){
-	switch (serialMode) {
-	  case 0:
-	    printf("Using single-byte IF1 loader\n");
-	    break;
-	  case 1:
-	    printf("Using standard IF1 loader\n");
-	    break;
-	  case 2:
-	    printf("Using high-speed IF1 loader\n");
-	    break;
-	  }
-      }
-      
-      /* Check size of file, by seeking to end (and then returning to
-	 beginning) */
-      fseek(IF1Leader, 0, SEEK_END);
-      sizeofLeader = ftell(IF1Leader);
-      fseek(IF1Leader, 0, SEEK_SET); 
-
-      leaderBuffer = malloc(sizeofLeader*sizeof(char));
-
-      if(NULL == leaderBuffer){
-	printf("Out of memory.\n");
-	fclose(IF1Leader);
-	exit(EXIT_FAILURE);
-      }
+  job->snapshot = snapshot;
+  job->transferFlags = transferFlags;
 
-      /* Read snapshot into buffer */
-      sizeofInputRead = fread(leaderBuffer,		\
-			      sizeof(char),		\
-			      sizeofLeader,		\
-			      IF1Leader);
-      
-      if (sizeofInputRead != sizeofLeader){
-	printf("Read error: only read %i elements\nError is %i\n",	\
-	       sizeofInputRead, ferror(IF1Leader));
-	free(leaderBuffer);
-	fclose(IF1Leader);
-	exit(EXIT_FAILURE);
-      }
-    
-      /* Close snapshot */
-      fclose(IF1Leader);
+  return !direct || zxtrans_check_direct(filename, job);
+}
 
-      /* Write Z80 Set State routine */
-      fwrite(leaderBuffer, sizeof(char),	\
-	     sizeofLeader, outputBinary);
-    }
-    
-    /* Write Z80 Set State routine */
-    fwrite(z80mc, sizeof(libspectrum_byte),	\
-	   CODELEN, outputBinary);
+/* Check the +3 receiver that loads in place can take job (read from
+   filename): it has no room for 128k pages, and hands over to the
+   snapshot from just below its stack. Returns 1 if so, or 0, having
+   said why and freed job, if not. */
+int zxtrans_check_direct(const char *filename, struct zxtrans_job *job){
+  const libspectrum_byte *z80mc = job->z80mc;
+  unsigned int sp = z80mc[STATE_SP] | z80mc[STATE_SP+1] << 8;
+
+  /* Set-state block only pages memory for a 128k snapshot */
+  if(0 != z80mc[1] || 0 != z80mc[8]){
+    printf("%s is not a 16k or 48k snapshot, so cannot be loaded in " \
+	   "place (-p).\n", filename);
+    zxtrans_free_job(job);
+    return 0;
+  }
 
-    /* Write RAM pages: standard configuration of 16k/ 48k Spectrum uses
-       pages 5, 2, and 0 in sequence. */
-    /* If not sending screen buffer, then use this version */
-    /* fwrite(&libspectrum_snap_pages(snapshot, 5)[6912],	\ */
-    /* 	   sizeof(libspectrum_byte), 9472, outputBinary); */
-    fwrite(libspectrum_snap_pages(snapshot, 5),	\
-    	   sizeof(libspectrum_byte), 0x4000, outputBinary);
-
-    if((machine == LIBSPECTRUM_MACHINE_48) || \
-       (machine == LIBSPECTRUM_MACHINE_128) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2A) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS3)) {
-      fwrite(libspectrum_snap_pages(snapshot, 2),		\
-	     sizeof(libspectrum_byte), 0x4000, outputBinary);
-      fwrite(libspectrum_snap_pages(snapshot, 0),		\
-	     sizeof(libspectrum_byte), 0x4000, outputBinary);
-    }
-    
-    if((machine == LIBSPECTRUM_MACHINE_128) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2A) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS3)) {
-      fwrite(libspectrum_snap_pages(snapshot, 1),		\
-	     sizeof(libspectrum_byte), 0x4000, outputBinary);
-      fwrite(libspectrum_snap_pages(snapshot, 3),		\
-	     sizeof(libspectrum_byte), 0x4000, outputBinary);
-      fwrite(libspectrum_snap_pages(snapshot, 4),		\
-	     sizeof(libspectrum_byte), 0x4000, outputBinary);
-      fwrite(libspectrum_snap_pages(snapshot, 6),		\
-	     sizeof(libspectrum_byte), 0x4000, outputBinary);
-      fwrite(libspectrum_snap_pages(snapshot, 7),		\
-	     sizeof(libspectrum_byte), 0x4000, outputBinary);
-    }
-    
-    /* Close output file */
-    fclose(outputBinary);
+  /* Stack pointer of 0 is the top of memory */
+  if(0 != sp && sp < ZXTRANS_DIRECT_SP_MIN){
+    printf("%s has its stack below 0x%04X, so cannot be loaded in " \
+	   "place (-p).\n", filename, ZXTRANS_DIRECT_SP_MIN);
+    zxtrans_free_job(job);
+    return 0;
   }
-  
-  /* If requested, write output to serial port */
-  if(writeToSerial){
-    struct sp_port *pSerialPort=NULL;
-  
-    if((sp_err = sp_get_port_by_name(portName, &pSerialPort)) != SP_OK){
-      printf("Error initialising serial port %d\n", sp_err);
-      exit(EXIT_FAILURE);
-    }
 
-    if((sp_err = sp_open(pSerialPort, SP_MODE_WRITE)) != SP_OK){
-      printf("Error opening serial port %d\n", sp_err);
-      exit(EXIT_FAILURE);
-    }   
-    else
-      if(verbosity>NORMAL)
-	printf("Successfully opened serial port %s\n", portName);
-    
-    if((sp_err = sp_set_baudrate(pSerialPort, baudRate)) != SP_OK){
-      printf("Error setting baud rate of serial port %d\n", sp_err);
-      exit(EXIT_FAILURE);
-    } 
+  return 1;
+}
 
-    if((sp_err = sp_set_parity(pSerialPort, SP_PARITY_NONE)) != SP_OK){
-      printf("Error setting parity of serial port\n");
-      exit(EXIT_FAILURE);
-    }
+/* Read filename into input, growing its buffer if there is not room
+   enough left from the last snapshot, and set length. Returns the
+   buffer, or NULL having said why. */
+char *zxtrans_read_file(const char *filename, struct zxtrans_input *input,
+			int *length){
+  FILE *inputSnapshot=NULL;
+  char *inputBuffer=NULL;
+  int sizeofInputSnapshot=0; /* Length of snapshot file */
+  int sizeofInputRead=0;
 
-    if((sp_err = sp_set_bits(pSerialPort, 8)) != SP_OK){
-      printf("Error setting bits of serial port\n");
-      exit(EXIT_FAILURE);
-    }
+  /* Try to open input snapshot */
+  if (NULL == (inputSnapshot = fopen(filename, "rb"))){
+    printf("Error opening input file.\n");
+    return NULL;
+  }
 
-    if((sp_err = sp_set_stopbits(pSerialPort, 1)) != SP_OK){
-      printf("Error setting stop bits of serial port\n");
-      exit(EXIT_FAILURE);
-    }
+  /* Check size of file, by seeking to end (and then returning to
+     beginning) */
+  fseek(inputSnapshot, 0, SEEK_END);
+  sizeofInputSnapshot = ftell(inputSnapshot);
+  fseek(inputSnapshot, 0, SEEK_SET); 
 
-    /* sp_err = sp_set_cts(pSerialPort, SP_CTS_FLOW_CONTROL); */
-    if((sp_err = sp_set_flowcontrol(pSerialPort, SP_FLOWCONTROL_RTSCTS)) != SP_OK){
-      printf("Error setting flow control of serial port\n");
-      exit(1);
+  /* Create space for serialised input */
+  if((size_t) sizeofInputSnapshot > input->room){
+    if(NULL == (inputBuffer = realloc(input->buffer, sizeofInputSnapshot))){
+      printf("Out of memory.\n");
+      fclose(inputSnapshot);
+      return NULL;
     }
 
-    if(if1Compatible){
-      if(2 == serialMode){
-	if (NULL == (IF1Leader = fopen("zxtrans_stub_fast.bin", "rb"))){
-	  printf("Error opening IF1 leader file.\n");
-	  exit(EXIT_FAILURE);
-	}
-      }
-      else{
-	if (NULL == (IF1Leader = fopen("zxtrans_stub.bin", "rb"))){
-	  printf("Error opening IF1 leader file.\n");
-	  exit(EXIT_FAILURE);
-	}
-      }
-
-      if(verbosity>NORMAL){
-	switch (serialMode) {
-	  case 0:
-	    printf("Using single-byte IF1 loader\n");
-	    break;
-	  case 1:
-	    printf("Using standard IF1 loader\n");
-	    break;
-	  case 2:
-	    printf("Using high-speed IF1 loader\n");
-	    break;
-	  }
-      }
-      
-      /* Check size of file, by seeking to end (and then returning to
-	 beginning) */
-      fseek(IF1Leader, 0, SEEK_END);
-      sizeofLeader = ftell(IF1Leader);
-      fseek(IF1Leader, 0, SEEK_SET); 
-
-      leaderBuffer = malloc(sizeofLeader*sizeof(char));
-
-      if(NULL == leaderBuffer){
-	fclose(IF1Leader);
-	printf("Not enough memory to read IF1 Loader stub.\n");
-	exit(EXIT_FAILURE);
-      }
+    input->buffer = inputBuffer;
+    input->room = sizeofInputSnapshot;
+  }
 
-      /* Read stub code into buffer */
-      sizeofInputRead = fread(leaderBuffer,		\
-			      sizeof(char),		\
-			      sizeofLeader,		\
-			      IF1Leader);
-      
-      if (sizeofInputRead != sizeofLeader){
-	printf("Read error: only read %i elements\nError is %i\n",	\
-	       sizeofInputRead, ferror(IF1Leader));
-	free(leaderBuffer);
-	fclose(IF1Leader);
-	exit(EXIT_FAILURE);
-      }
-    
-      /* Close IF1 Leader file */
-      fclose(IF1Leader);
+  inputBuffer = input->buffer;
 
-      /* Write IF1 Leader routine */
-      zxtrans_write_block(pSerialPort, leaderBuffer, sizeofLeader, \
-			  serialMode, SERIAL_TIMEOUT);
-    }
-    
-    /* Write Z80 Set State routine */
-    if(verbosity>NORMAL)
-      printf("Writing %d bytes of Z80 Set State information to %s\n", \
-	     CODELEN,  portName);
+  /* Read snapshot into buffer */
+  sizeofInputRead = fread(inputBuffer,			\
+			  sizeof(char),			\
+			  sizeofInputSnapshot,		\
+			  inputSnapshot);
+     
+  if (sizeofInputRead != sizeofInputSnapshot){
+    printf("Read error: only read %i elements\nError is %i\n",	\
+  	   sizeofInputRead, ferror(inputSnapshot));
+    fclose(inputSnapshot);
+    return NULL;
+  }
+  
+  /* Close snapshot */
+  fclose(inputSnapshot);
 
-    zxtrans_write_block(pSerialPort, z80mc, CODELEN, \
-			serialMode, SERIAL_TIMEOUT);
+  *length = sizeofInputSnapshot;
 
-    if(verbosity>NORMAL)
-      printf("Writing memory page 5 information to %s\n", portName);
+  return inputBuffer;
+}
 
-    /* Increase the baud rate for serialMode=2 */
-    if(2 == serialMode){
-      if((sp_err = sp_set_baudrate(pSerialPort, 57600)) != SP_OK){
-	printf("Error setting baud rate of serial port %d\n", sp_err);
-	exit(EXIT_FAILURE);
-      } 
-    }
+/* Snapshot in buffer, as read by libspectrum, or NULL having said why
+   it cannot be */
+libspectrum_snap *zxtrans_parse_snapshot(const char *filename,
+					 const libspectrum_byte *buffer,
+					 size_t length){
+  libspectrum_snap *snapshot=NULL;
+  libspectrum_error err;
+  libspectrum_id_t bufferType;
+  libspectrum_class_t bufferClass;
 
-    zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 5), \
-			0x4000, serialMode, SERIAL_TIMEOUT);
-    
-    if((machine == LIBSPECTRUM_MACHINE_48) || \
-       (machine == LIBSPECTRUM_MACHINE_128) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2A) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS3)) {
-      if(verbosity>NORMAL)
-	printf("Writing memory page 2 information to %s\n", portName);
+  /* Check it is a snapshot */
+  err = \
+    libspectrum_identify_file_with_class(&bufferType,	\
+					 &bufferClass,	\
+					 filename,	\
+					 buffer,	\
+					 length);
 
-      zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 2), \
-			  0x4000, serialMode, SERIAL_TIMEOUT);
+  if(err != 0){
+    printf("Unable to determine file type.\n");
+    return NULL;
+  }
+
+  if(bufferClass != LIBSPECTRUM_CLASS_SNAPSHOT){
+    printf("File does not look to be a snapshot.%i\n", bufferClass);
+    return NULL;
+  }
+  
+  /* Allocate space for snapshot */
+  snapshot = libspectrum_snap_alloc();
 
-      if(verbosity>NORMAL)
-	printf("Writing memory page 0 information to %s\n", portName);
+  err = \
+    libspectrum_snap_read(snapshot,				\
+			  buffer,				\
+			  length,				\
+			  LIBSPECTRUM_ID_UNKNOWN,		\
+			  filename);
+  
+  if(err != 0 ){
+    printf("Error populating snapshot.\n");
+    libspectrum_snap_free(snapshot);
+    return NULL;
+  }
 
-      zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 0), \
-			  0x4000, serialMode, SERIAL_TIMEOUT);
-    }
+  return snapshot;
+}
 
-    if((machine == LIBSPECTRUM_MACHINE_128) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS2A) || \
-       (machine == LIBSPECTRUM_MACHINE_PLUS3)) {
-      if(verbosity>NORMAL)
-	printf("Writing memory page 1 information to %s\n", portName);
+/* Free job's snapshot, and unmap the file it was read in place from */
+void zxtrans_free_snapshot(struct zxtrans_job *job){
+  if(NULL != job->snapshot){
+    if(NULL != job->file.data)
+      zxtrans_snapfile_free(job->snapshot);
+    else
+      libspectrum_snap_free(job->snapshot);
+  }
 
-      zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 1), \
-			  0x4000, serialMode, SERIAL_TIMEOUT);
+  zxtrans_snapfile_unmap(&job->file);
+  job->snapshot = NULL;
+}
 
-      if(verbosity>NORMAL)
-	printf("Writing memory page 3 information to %s\n", portName);
+void zxtrans_free_job(struct zxtrans_job *job){
+  zxtrans_free_snapshot(job);
+  zxtrans_cache_close(&job->image);
+  free(job->imageName);
+  job->imageName = NULL;
+}
 
-      zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 3), \
-			  0x4000, serialMode, SERIAL_TIMEOUT);
+/* Entry of pagePlans for machine */
+const struct zxtrans_page_plan *zxtrans_find_plan(libspectrum_machine machine){
+  const struct zxtrans_page_plan *plan = pagePlans;
 
-      if(verbosity>NORMAL)
-	printf("Writing memory page 4 information to %s\n", portName);
+  while(LIBSPECTRUM_MACHINE_UNKNOWN != plan->machine && \
+	machine != plan->machine)
+    plan++;
 
-      zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 4), \
-			  0x4000, serialMode, SERIAL_TIMEOUT);
+  return plan;
+}
 
-      if(verbosity>NORMAL)
-	printf("Writing memory page 6 information to %s\n", portName);
+/* IF1 leader for serialMode, which is built into the sender */
+const libspectrum_byte *zxtrans_leader(int serialMode, int verbosity,
+				      int *sizeofLeader){
+  /* Mode 2 needs a leader that raises the baud rate, which is not yet
+     written */
+  if(2 == serialMode){
+    printf("No high-speed IF1 loader: use mode 0 or 1 with -i.\n");
+    exit(EXIT_FAILURE);
+  }
 
-      zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 6), \
-			  0x4000, serialMode, SERIAL_TIMEOUT);
+  if(verbosity>NORMAL){
+    switch (serialMode) {
+      case 0:
+	printf("Using single-byte IF1 loader\n");
+	break;
+      case 1:
+	printf("Using standard IF1 loader\n");
+	break;
+      }
+  }
+
+  *sizeofLeader = zxtrans_stub_bin_len;
 
-      if(verbosity>NORMAL)
-	printf("Writing memory page 7 information to %s\n", portName);
+  return zxtrans_stub_bin;
+}
 
-      zxtrans_write_block(pSerialPort, libspectrum_snap_pages(snapshot, 7), \
-			  0x4000, serialMode, SERIAL_TIMEOUT);
+static int compare_names(const void *a, const void *b){
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* Build list of snapshots to send from paths, replacing each directory
+   with the snapshot files it contains, in name order. Returns number
+   of snapshots. */
+int zxtrans_list_jobs(char *paths[], int pathCount, char ***jobNames){
+  static const char *extensions[] = {".sna", ".z80", ".szx", ".sp", \
+				     ".snp", ".sit", ".zx", ".zxs", NULL};
+  int jobCount=0;
+  int room=pathCount;
+
+  *jobNames = malloc(room*sizeof(char *));
+
+  for(int p=0; p<pathCount && NULL != *jobNames; p++){
+    struct stat status;
+    DIR *dir;
+    struct dirent *entry;
+    int first=jobCount;
+
+    if(0 != stat(paths[p], &status) || !S_ISDIR(status.st_mode)){
+      (*jobNames)[jobCount] = malloc(strlen(paths[p])+1);
+      strcpy((*jobNames)[jobCount++], paths[p]);
+      continue;
     }
 
-    
+    if(NULL == (dir = opendir(paths[p]))){
+      printf("Error opening directory %s.\n", paths[p]);
+      exit(EXIT_FAILURE);
+    }
+
+    while(NULL != (entry = readdir(dir))){
+      const char *dot = strrchr(entry->d_name, '.');
+      char extension[8] = "";
+      int known=0;
+
+      /* Compare extensions in lower case */
+      for(int c=0; NULL != dot && c < 7 && dot[c]; c++){
+	extension[c] = tolower((unsigned char) dot[c]);
+	extension[c+1] = '\0';
+      }
 
-    /* Clean up and close serial port */
-    sp_free_config(pSerialOutConfig);
-    sp_err = sp_close(pSerialPort);
-    sp_free_port(pSerialPort);
+      for(int e=0; NULL != extensions[e]; e++)
+	known |= !strcmp(extension, extensions[e]);
+
+      if(!known)
+	continue;
+
+      /* Leave room for remaining paths */
+      if(jobCount+pathCount-p >= room){
+	room *= 2;
+	*jobNames = realloc(*jobNames, room*sizeof(char *));
+
+	if(NULL == *jobNames)
+	  break;
+      }
+
+      (*jobNames)[jobCount] = malloc(strlen(paths[p])+strlen(entry->d_name)+2);
+      sprintf((*jobNames)[jobCount++], "%s/%s", paths[p], entry->d_name);
+    }
+
+    closedir(dir);
+    qsort(&(*jobNames)[first], jobCount-first, sizeof(char *), compare_names);
   }
-  
-  /* Exit */
-  libspectrum_snap_free(snapshot);
-  return 0;
+
+  if(NULL == *jobNames){
+    printf("Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return jobCount;
 }
 
 inline libspectrum_byte lowByte(libspectrum_word regPair){
@@ -817,47 +1622,1494 @@ inline libspectrum_byte highByte(libspectrum_word regPair){
 }
 
 void usage(void){
-  printf("Usage: zxtrans [OPTIONS] <input filename>\n");
-  printf(" -o<output filename>\tOutput to file\n");
-  printf(" -s<port>\t\tOutput to serial\n");
+  printf("Usage: zxtrans [OPTIONS] <input filename|directory>...\n");
+  printf(" -o<output filename>\tOutput to file (- for standard output)\n");
+  printf(" -s<port>\t\tOutput to serial (repeat to send to several at once)\n");
+  printf("\t\t\tor to tcp://<host>:<port>, rfc2217://<host>:<port>\n" \
+	 "\t\t\t(terminal server) or file:<path>\n");
   printf(" -b<baud>\t\tBaud rate\n");
   printf(" -h\t\t\tPrint this help text\n");
   printf(" -v\t\t\tVerbose mode\n");
   printf(" -i\t\t\tWrite IF1-compatible leader\n");
   printf(" -f<transfer mode>\tTransfer mode:- 0=single-byte; 1=block; 2=fast\n");
+  printf(" -z\t\t\tCompress memory pages\n");
+  printf(" -m\t\t\tSend sparse page map (skip zeros, repeated pages)\n");
+  printf(" -d\t\t\tDelta reload: send only changes from last snapshot\n");
+  printf(" -w<seconds>\t\tPause between snapshots, rather than wait for Enter\n");
+  printf(" -M<metrics file>\tAppend transfer metrics (JSON, or CSV if *.csv)\n");
+  printf(" -B<bytes>\t\tBytes per handshake in mode 0 (default: %d)\n", \
+	 ZXTRANS_FLOW_BURST);
+  printf(" -a\t\t\tAdapt handshake size in mode 0 to suit receiver\n");
+  printf(" -c\t\t\tSend checked frames, which the receiver can have resent\n");
+  printf(" -p\t\t\tSend to the +3 receiver that loads in place (needs -f2\n" \
+	 "\t\t\tor -c, and a 16k or 48k snapshot)\n");
+  printf(" -n\t\t\tNeither use nor add to cache of prepared snapshots\n");
+  printf(" -D<socket>\t\tRun as daemon, sending snapshots as asked over socket\n");
+  printf(" -C<socket>\t\tAsk daemon listening on socket to send snapshots\n");
+  printf(" -T<speed>\t\tWrite output file as tape (WAV if *.wav, else TZX),\n" \
+	 "\t\t\tat 1-%d times ROM speed, for a 48k or larger Spectrum\n", \
+	 ZXTRANS_TAPE_SPEED_MAX);
+  printf(" -O<directory>\t\tConvert each snapshot to a file there, several at once\n");
+  printf(" -j<threads>\t\tSnapshots converted at once with -O (default: one\n" \
+	 "\t\t\tfor each processor)\n");
+  printf(" -r\t\t\tResume interrupted transfer (with -c) where the receiver\n" \
+	 "\t\t\tstopped\n");
+  printf(" -R<cpu>\t\tSend at real-time priority from that CPU (-1 for any),\n" \
+	 "\t\t\twith memory locked and low-latency serial settings\n");
 
   return;
 }
 
-int zxtrans_write_block(struct sp_port *port,	      \
-			       const libspectrum_byte *buf,   \
-			       size_t count, int serialMode,  \
-			       unsigned int timeout_ms){
+/* Open and configure portName, which stays open for every snapshot,
+   with low-latency driver settings if asked and it has them. Returns
+   NULL, having said why, if the port cannot be used. */
+struct zxtrans_port *zxtrans_open_port(const char *portName, int baudRate,
+				       int framed, int lowLatency,
+				       int verbosity){
+  struct zxtrans_port *port;
+
+  /* Receiver answers checked frames on the same port */
+  if(NULL == (port = zxtrans_port_open(portName, framed)))
+    return NULL;
+  else
+    if(verbosity>NORMAL)
+      printf("Successfully opened serial port %s\n", portName);
+
+  if(!zxtrans_port_configure(port, baudRate)){
+    zxtrans_port_close(port);
+    return NULL;
+  }
+
+  if(lowLatency && zxtrans_realtime_low_latency(port, portName) > 0 && \
+     verbosity > NORMAL)
+    printf("Low-latency serial settings on %s\n", portName);
+
+  return port;
+}
+
+/* Close port opened by zxtrans_open_port(), putting back any driver
+   settings changed for low latency */
+void zxtrans_close_port(struct zxtrans_port *port){
+  zxtrans_realtime_restore(port);
+  zxtrans_port_close(port);
+}
+
+/* Send IF1 leader, Z80 set-state block and any delta table of transfer
+   over link, which is then ready for the pages. Returns 1 on success,
+   or 0 with the reason in link->error. */
+int zxtrans_send_start(struct zxtrans_link *link,
+		       const struct zxtrans_transfer *transfer){
+  const struct zxtrans_job *job = transfer->job;
+  enum sp_return sp_err;
+
+  link->error[0] = '\0';
+  link->sent = 0;
+
+  zxtrans_metrics_start(&link->metrics, transfer->name, link->portName, \
+			transfer->baudRate, link->serialMode, job->pageCount, \
+			transfer->progress);
+  zxtrans_flow_burst_init(&link->burst, transfer->burstSize, \
+			  transfer->adaptiveBurst, transfer->baudRate);
+  zxtrans_frames_init(&link->frames);
+
+  /* Restore baud rate, if last snapshot was sent fast */
+  if(link->fast){
+    if((sp_err = zxtrans_port_set_baudrate(link->port, \
+					   transfer->baudRate)) != SP_OK){
+      snprintf(link->error, sizeof(link->error), \
+	       "Error setting baud rate of serial port %d", sp_err);
+      return 0;
+    }
+
+    link->fast = 0;
+  }
+
+  /* Write IF1 Leader routine */
+  if(NULL != transfer->leader && \
+     !zxtrans_send_block(link, "leader", transfer->leader, \
+			 transfer->sizeofLeader, 0, 0))
+    return 0;
+    
+  /* Write Z80 Set State routine */
+  if(transfer->verbosity>NORMAL)
+    printf("Writing %d bytes of Z80 Set State information to %s\n", \
+	   CODELEN, link->portName);
+
+  if(!zxtrans_send_block(link, "state", job->z80mc, CODELEN, 0, 0))
+    return 0;
+
+  /* Increase the baud rate for serialMode=2 (or checked frames to the
+     +3), once the set-state block has left at the old one */
+  if(transfer->fastBaud){
+    if((sp_err = zxtrans_port_drain(link->port)) != SP_OK){
+      snprintf(link->error, sizeof(link->error), \
+	       "Error draining serial port %d", sp_err);
+      return 0;
+    }
+
+    if(!zxtrans_settle_rate(link, transfer))
+      return 0;
+  }
+
+  /* Write table for receiver to check memory to be kept */
+  if(job->deltaLength > 0 && \
+     !zxtrans_send_block(link, "table", job->deltaTable, job->deltaLength, \
+			 0, transfer->framed))
+    return 0;
+
+  return 1;
+}
+
+/* Settle with the +3 receiver's fast serial loop on the fastest of
+   ZXTRANS_LADDER_RATES at which it reads the test pattern whole. The
+   receiver says how it went with CTS alone, so this works without a
+   line back from it. Returns 1, with link->fast set to the rate, or 0
+   with the reason in link->error. */
+int zxtrans_settle_rate(struct zxtrans_link *link,
+			const struct zxtrans_transfer *transfer){
+  static const int rates[ZXTRANS_LADDER_COUNT] = ZXTRANS_LADDER_RATES;
+  libspectrum_byte pattern[ZXTRANS_LADDER_LEN];
+  const libspectrum_byte fill = ZXTRANS_FRAME_FILL;
+  const libspectrum_byte go = ZXTRANS_LADDER_GO;
+  struct zxtrans_block_metrics *block;
+  enum sp_return sp_err;
+
+  zxtrans_image_ladder(pattern);
+  block = zxtrans_metrics_block(&link->metrics, "ladder", 0);
+
+  for(int i=0; i<ZXTRANS_LADDER_COUNT; i++){
+    /* Time for pattern to reach receiver, and then some */
+    unsigned int drop_ms = 1000*ZXTRANS_LADDER_LEN* \
+      ZXTRANS_METRICS_BITS_PER_BYTE/rates[i] + FILL_TIMEOUT;
+    int dropped;
+
+    if((sp_err = zxtrans_port_set_baudrate(link->port, \
+					   rates[i])) != SP_OK){
+      snprintf(link->error, sizeof(link->error), \
+	       "Error setting baud rate of serial port %d", sp_err);
+      return 0;
+    }
+
+    link->fast = rates[i];
+
+    /* Receiver is ready for the pattern once it asserts CTS, after
+       the last try at a faster rate */
+    if(zxtrans_flow_wait_cts(link->port, SERIAL_TIMEOUT, &block->flow) <= 0){
+      snprintf(link->error, sizeof(link->error), \
+	       "Timed out waiting for receiver to try %d baud.", rates[i]);
+      return 0;
+    }
+
+    block->bytes += ZXTRANS_LADDER_LEN;
+
+    if(zxtrans_write_block(link, pattern, ZXTRANS_LADDER_LEN, \
+			   SERIAL_TIMEOUT) != ZXTRANS_LADDER_LEN){
+      if('\0' == link->error[0])
+	snprintf(link->error, sizeof(link->error), \
+		 "Error: only part of test pattern sent.");
+
+      return 0;
+    }
+
+    /* Receiver that lost bytes of the pattern is still waiting for the
+       rest, so is sent filler until it drops CTS */
+    dropped = zxtrans_flow_wait_cts_drop(link->port, drop_ms);
+
+    for(int j=0; 0 == dropped && j<ZXTRANS_LADDER_LEN; j++){
+      if(zxtrans_write_block(link, &fill, 1, SERIAL_TIMEOUT) != 1)
+	break;
+
+      dropped = zxtrans_flow_wait_cts_drop(link->port, FILL_TIMEOUT);
+    }
+
+    if(dropped <= 0){
+      snprintf(link->error, sizeof(link->error), \
+	       "Error: receiver did not take test pattern at %d baud.", \
+	       rates[i]);
+      return 0;
+    }
+
+    /* Anything receiver did not take would reach it at the wrong rate */
+    zxtrans_port_flush(link->port, SP_BUF_OUTPUT);
+
+    /* Receiver is soon ready again if it read the pattern whole */
+    if(1 == zxtrans_flow_wait_cts(link->port, ZXTRANS_LADDER_PASS_MS, \
+				  &block->flow)){
+      block->bytes++;
+
+      if(zxtrans_write_block(link, &go, 1, SERIAL_TIMEOUT) != 1){
+	if('\0' == link->error[0])
+	  snprintf(link->error, sizeof(link->error), \
+		   "Error: receiver not told to go ahead.");
+
+	return 0;
+      }
+
+      zxtrans_metrics_end_block(&link->metrics, 0);
+
+      if(transfer->verbosity>NORMAL)
+	printf("Settled on %d baud with receiver on %s\n", rates[i], \
+	       link->portName);
+
+      return 1;
+    }
+  }
+
+  snprintf(link->error, sizeof(link->error), \
+	   "Error: receiver could not read test pattern at any rate.");
+
+  return 0;
+}
+
+/* Ask the receiver on link, left waiting by an interrupted checked
+   transfer, where to resume it. Its fast serial loop may be running at
+   any rate of the ladder, so each is tried in turn. Returns the
+   position in the page list of the first page the receiver has not
+   loaded, or -1 with the reason in link->error. */
+int zxtrans_send_resume(struct zxtrans_link *link,
+			const struct zxtrans_transfer *transfer){
+  static const int ladder[ZXTRANS_LADDER_COUNT] = ZXTRANS_LADDER_RATES;
+  const struct zxtrans_job *job = transfer->job;
+  const int *rates = transfer->fastBaud ? ladder : &transfer->baudRate;
+  int rateCount = transfer->fastBaud ? ZXTRANS_LADDER_COUNT : 1;
+  libspectrum_byte ask[RESUME_ASK_LEN];
+  struct zxtrans_block_metrics *block;
+  enum sp_return sp_err;
+  int position = -1;
+
+  link->error[0] = '\0';
+  link->sent = 0;
+
+  zxtrans_metrics_start(&link->metrics, transfer->name, link->portName, \
+			transfer->baudRate, link->serialMode, job->pageCount, \
+			transfer->progress);
+  zxtrans_flow_burst_init(&link->burst, transfer->burstSize, \
+			  transfer->adaptiveBurst, transfer->baudRate);
+  zxtrans_frames_init(&link->frames);
+
+  memset(ask, ZXTRANS_FRAME_ENQ, sizeof(ask));
+  block = zxtrans_metrics_block(&link->metrics, "resume", 0);
+
+  for(int i=0; i<rateCount && position < 0; i++){
+    libspectrum_byte answer[3];
+    int count = 0;
+
+    if((sp_err = zxtrans_port_set_baudrate(link->port, \
+					   rates[i])) != SP_OK){
+      snprintf(link->error, sizeof(link->error), \
+	       "Error setting baud rate of serial port %d", sp_err);
+      return -1;
+    }
+
+    link->fast = transfer->fastBaud ? rates[i] : 0;
+    zxtrans_port_flush(link->port, SP_BUF_INPUT);
+    block->bytes += sizeof(ask);
+
+    if(zxtrans_write_block(link, ask, sizeof(ask), SERIAL_TIMEOUT) != \
+       (int) sizeof(ask)){
+      if('\0' == link->error[0])
+	snprintf(link->error, sizeof(link->error), \
+		 "Error: receiver not asked where to resume.");
+
+      return -1;
+    }
+
+    if((sp_err = zxtrans_port_drain(link->port)) != SP_OK){
+      snprintf(link->error, sizeof(link->error), \
+	       "Error draining serial port %d", sp_err);
+      return -1;
+    }
+
+    /* Receiver answers each run it sees, and any frame the asking
+       completed, so answers are read until the line goes quiet */
+    for(int c = zxtrans_frame_answer(link->port, SERIAL_TIMEOUT); c >= 0; \
+	c = zxtrans_frame_answer(link->port, FILL_TIMEOUT)){
+      if(0 == count && ZXTRANS_FRAME_ENQ != c)
+	continue;
+
+      answer[count++] = c;
+
+      if(3 == count){
+	if(0xFF == (answer[1] ^ answer[2]))
+	  position = answer[1];
+
+	count = 0;
+      }
+    }
+  }
+
+  zxtrans_metrics_end_block(&link->metrics, 0);
+
+  if(position < 0){
+    snprintf(link->error, sizeof(link->error), \
+	     "Error: receiver did not say where to resume.");
+    return -1;
+  }
+
+  if(position < ZXTRANS_FRAME_RESUME_FIRST || position >= job->pageCount){
+    snprintf(link->error, sizeof(link->error), \
+	     "Error: receiver had not reached the 128k pages, so send " \
+	     "again without -r.");
+    return -1;
+  }
+
+  if(transfer->verbosity>NORMAL)
+    printf("Resuming from memory page %d with receiver on %s\n", \
+	   job->z80mc[PAGELIST+position], link->portName);
+
+  return position;
+}
+
+/* Send page index of transfer over link */
+int zxtrans_send_page(struct zxtrans_link *link,
+		      const struct zxtrans_transfer *transfer, int index,
+		      const libspectrum_byte *pageData, size_t pageLength){
+  int page = transfer->job->z80mc[PAGELIST+index];
+  char label[16];
+
+  if(transfer->verbosity>NORMAL)
+    printf("Writing memory page %d information to %s\n", page, \
+	   link->portName);
+
+  snprintf(label, sizeof(label), "page %d", page);
+
+  return zxtrans_send_block(link, label, pageData, pageLength, 1, \
+			    transfer->framed);
+}
+
+/* Send last checked frame, padded out, and anything the port still
+   holds back, then close metrics */
+int zxtrans_send_finish(struct zxtrans_link *link,
+			const struct zxtrans_transfer *transfer){
+  enum sp_return sp_err;
+
+  if(transfer->framed && link->frames.fill > 0){
+    zxtrans_metrics_block(&link->metrics, "padding", \
+			  ZXTRANS_FRAME_LEN-link->frames.fill);
+
+    if(!zxtrans_send_frame(link))
+      return 0;
+
+    zxtrans_metrics_end_block(&link->metrics, 0);
+  }
+
+  if((sp_err = zxtrans_port_drain(link->port)) != SP_OK){
+    snprintf(link->error, sizeof(link->error), \
+	     "Error draining serial port %d", sp_err);
+    return 0;
+  }
+
+  zxtrans_metrics_finish(&link->metrics);
+  link->sent = 1;
+
+  return 1;
+}
+
+static void *send_snapshot(void *arg){
+  struct zxtrans_link *link = arg;
+  const struct zxtrans_transfer *transfer = link->transfer;
+  struct zxtrans_realtime scheduling; /* Thread ends with transfer, so
+					 is not put back */
+
+  if(transfer->realtime)
+    zxtrans_realtime_enter(&scheduling, link->cpu);
+
+  if(!zxtrans_send_start(link, transfer))
+    return NULL;
+
+  for(int i=0; i<transfer->job->pageCount; i++)
+    if(!zxtrans_send_page(link, transfer, i, transfer->pages[i], \
+			  transfer->pageLength[i]))
+      return NULL;
+
+  zxtrans_send_finish(link, transfer);
+
+  return NULL;
+}
+
+/* Send transfer, with every page prepared, over each of portCount
+   links at once, each from its own thread (in real-time mode, pinned to
+   a CPU of its own from the first given). A link that fails is left
+   with the reason in its error. */
+void zxtrans_fan_out(struct zxtrans_link *links, int portCount,
+		     const struct zxtrans_transfer *transfer){
+  for(int p=0; p<portCount; p++){
+    links[p].transfer = transfer;
+    links[p].sent = 0;
+    links[p].cpu = (transfer->realtimeCpu < 0) ? -1 : \
+      transfer->realtimeCpu + p;
+
+    if(0 != pthread_create(&links[p].thread, NULL, send_snapshot, \
+			   &links[p])){
+      printf("Unable to start sending to %s.\n", links[p].portName);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for(int p=0; p<portCount; p++)
+    pthread_join(links[p].thread, NULL);
+}
+
+/* Sending to the only port has failed, so the transfer is over */
+void zxtrans_give_up(const struct zxtrans_link *link){
+  printf("\n%s\n", link->error);
+  exit(EXIT_FAILURE);
+}
+
+/* Wait before sending next snapshot: batchWait seconds, or until Enter
+   is pressed if it is negative */
+void zxtrans_batch_wait(int batchWait, const char *next){
+  if(batchWait >= 0)
+    sleep(batchWait);
+  else{
+    printf("Restart receiver, then press Enter to send %s\n", next);
+
+    for(int c=getchar(); '\n' != c && EOF != c; c=getchar())
+      ;
+  }
+}
+
+/* filename as an absolute path, as the daemon may be running in
+   another directory. Returns NULL if the current directory is not
+   known; caller must free result. */
+char *zxtrans_absolute_path(const char *filename){
+  char dir[PATH_LEN];
+  char *path;
+
+  if('/' == filename[0])
+    dir[0] = '\0';
+  else if(NULL == getcwd(dir, sizeof(dir)))
+    return NULL;
+
+  if(NULL == (path = malloc(strlen(dir)+strlen(filename)+2)))
+    return NULL;
+
+  sprintf(path, "%s%s%s", dir, ('\0' == dir[0]) ? "" : "/", filename);
+
+  return path;
+}
+
+/* Run as a daemon, sending snapshots as asked over a UNIX socket at
+   socketPath, until asked to stop. Every request is sent with settings.
+   Ports in portNames are opened, and snapshots in jobNames prepared,
+   before the first request. Returns 0 if the daemon cannot start. */
+int zxtrans_serve(const char *socketPath,
+		  const struct zxtrans_transfer *settings, int serialMode,
+		  int transferFlags, int imageCache,
+		  const char *metricsFilename, char *portNames[],
+		  int portCount, char *jobNames[], int jobCount){
+  struct zxtrans_server server;
+  struct zxtrans_request request;
+  int listener;
+  int running=1;
+
+  memset(&server, 0, sizeof(server));
+  server.settings = settings;
+  server.serialMode = serialMode;
+  server.transferFlags = transferFlags;
+  server.imageCache = imageCache;
+  server.metricsFilename = metricsFilename;
+
+  for(int p=0; p<portCount; p++)
+    if(zxtrans_serve_link(&server, portNames[p]) < 0)
+      return 0;
+
+  /* Requests name snapshots by absolute path */
+  for(int j=0; j<jobCount; j++){
+    char *filename = zxtrans_absolute_path(jobNames[j]);
+
+    if(NULL == filename || NULL == zxtrans_serve_snapshot(&server, filename))
+      printf("Unable to prepare %s.\n", jobNames[j]);
+
+    free(filename);
+  }
+
+  if(-1 == (listener = zxtrans_daemon_listen(socketPath))){
+    printf("Unable to listen on %s.\n", socketPath);
+    return 0;
+  }
+
+  if(settings->verbosity > SILENT)
+    printf("Waiting for requests on %s\n", socketPath);
+
+  while(running){
+    FILE *client;
+
+    if(NULL == (client = zxtrans_daemon_accept(listener)))
+      continue;
+
+    switch(zxtrans_daemon_read(client, &request)){
+    case 0:
+      break;
+    case -1:
+      fprintf(client, "error Request not understood.\n");
+      break;
+    default:
+      server.requests++;
+
+      if(ZXTRANS_REQUEST_SEND == request.type)
+	zxtrans_serve_send(&server, &request, client);
+      else if(ZXTRANS_REQUEST_STATUS == request.type)
+	zxtrans_serve_status(&server, client);
+      else{
+	fprintf(client, "ok Stopping.\n");
+	running = 0;
+      }
+    }
+
+    fclose(client);
+  }
+
+  zxtrans_daemon_stop(listener, socketPath);
+
+  for(int l=0; l<server.linkCount; l++){
+    zxtrans_close_port(server.links[l].port);
+    free((char *) server.links[l].portName);
+  }
+
+  free(server.links);
+
+  while(server.warmCount > 0)
+    zxtrans_serve_forget(&server, 0);
+
+  return 1;
+}
+
+/* Open port called portName, as given when the daemon starts, and keep
+   it open. Returns its index in server->links, or -1 if it cannot be
+   opened. */
+int zxtrans_serve_link(struct zxtrans_server *server, const char *portName){
+  const struct zxtrans_transfer *settings = server->settings;
+  struct zxtrans_link *links;
+  struct zxtrans_port *port;
+  char *name;
+
+  for(int l=0; l<server->linkCount; l++)
+    if(0 == strcmp(server->links[l].portName, portName))
+      return l;
+
+  if(NULL == (port = zxtrans_open_port(portName, settings->baudRate, \
+				       settings->framed, settings->realtime, \
+				       settings->verbosity)))
+    return -1;
+
+  links = realloc(server->links, \
+		  (server->linkCount+1)*sizeof(struct zxtrans_link));
+  name = malloc(strlen(portName)+1);
+
+  if(NULL == links || NULL == name){
+    if(NULL != links)
+      server->links = links;
+
+    free(name);
+    zxtrans_close_port(port);
+    return -1;
+  }
+
+  strcpy(name, portName);
+  server->links = links;
+  memset(&links[server->linkCount], 0, sizeof(struct zxtrans_link));
+  links[server->linkCount].portName = name;
+  links[server->linkCount].port = port;
+  links[server->linkCount].serialMode = server->serialMode;
+
+  return server->linkCount++;
+}
+
+/* Snapshot filename (an absolute path), prepared for sending. It is
+   prepared again if the file has changed since; when WARM_MAX are
+   already kept, the one sent least recently makes way. Returns NULL if
+   it cannot be prepared. */
+struct zxtrans_warm *zxtrans_serve_snapshot(struct zxtrans_server *server,
+					    const char *filename){
+  const struct zxtrans_transfer *settings = server->settings;
+  struct zxtrans_warm *warm;
+  struct stat status;
+
+  if(0 != stat(filename, &status))
+    return NULL;
+
+  for(int w=0; w<server->warmCount; w++){
+    warm = server->warm[w];
+
+    if(0 != strcmp(warm->filename, filename))
+      continue;
+
+    if(warm->modified == status.st_mtime && warm->size == status.st_size){
+      warm->lastUsed = server->requests;
+      return warm;
+    }
+
+    zxtrans_serve_forget(server, w);
+    break;
+  }
+
+  if(WARM_MAX == server->warmCount){
+    int oldest=0;
+
+    for(int w=1; w<server->warmCount; w++)
+      if(server->warm[w]->lastUsed < server->warm[oldest]->lastUsed)
+	oldest = w;
+
+    zxtrans_serve_forget(server, oldest);
+  }
+
+  if(NULL == (warm = calloc(1, sizeof(struct zxtrans_warm))))
+    return NULL;
+
+  if(NULL == (warm->filename = malloc(strlen(filename)+1))){
+    free(warm);
+    return NULL;
+  }
+
+  strcpy(warm->filename, filename);
+  warm->modified = status.st_mtime;
+  warm->size = status.st_size;
+  warm->lastUsed = server->requests;
+
+  if(!zxtrans_prepare_job(filename, server->transferFlags, \
+			  settings->direct, NULL, \
+			  server->imageCache, settings->verbosity, NULL, \
+			  &warm->job)){
+    free(warm->filename);
+    free(warm);
+    return NULL;
+  }
+
+  if(!zxtrans_load_pages(&warm->job, &warm->pageBuffer, warm->pages, \
+			 warm->pageLength)){
+    zxtrans_free_job(&warm->job);
+    free(warm->filename);
+    free(warm);
+    return NULL;
+  }
+
+  if(settings->verbosity > NORMAL)
+    printf("Prepared %s\n", filename);
+
+  server->warm[server->warmCount++] = warm;
+
+  return warm;
+}
+
+/* Index in server->links of port called portName, which must have been
+   given when the daemon started, or -1 */
+int zxtrans_serve_find(const struct zxtrans_server *server,
+		       const char *portName){
+  for(int l=0; l<server->linkCount; l++)
+    if(0 == strcmp(server->links[l].portName, portName))
+      return l;
+
+  return -1;
+}
+
+/* Stop keeping snapshot index prepared */
+void zxtrans_serve_forget(struct zxtrans_server *server, int index){
+  struct zxtrans_warm *warm = server->warm[index];
+
+  zxtrans_free_job(&warm->job);
+  free(warm->pageBuffer);
+  free(warm->filename);
+  free(warm);
+
+  server->warm[index] = server->warm[--server->warmCount];
+}
+
+/* Send snapshot of request to each of its ports at once, telling client
+   how it went for each */
+void zxtrans_serve_send(struct zxtrans_server *server,
+			const struct zxtrans_request *request, FILE *client){
+  struct zxtrans_link sending[ZXTRANS_DAEMON_PORTS];
+  int index[ZXTRANS_DAEMON_PORTS];
+  struct zxtrans_transfer transfer = *server->settings;
+  struct zxtrans_block_metrics total;
+  struct zxtrans_warm *warm;
+  int failures=0;
+
+  for(int p=0; p<request->portCount; p++){
+    if((index[p] = zxtrans_serve_find(server, request->ports[p])) < 0){
+      fprintf(client, "error Serial port %s was not given to the " \
+	      "daemon.\n", request->ports[p]);
+      return;
+    }
+
+    for(int q=0; q<p; q++)
+      if(index[q] == index[p]){
+	fprintf(client, "error Serial port %s given twice.\n", \
+		request->ports[p]);
+	return;
+      }
+  }
+
+  if(NULL == (warm = zxtrans_serve_snapshot(server, request->snapshot))){
+    fprintf(client, "error Unable to prepare %s.\n", request->snapshot);
+    return;
+  }
+
+  transfer.name = warm->filename;
+  transfer.job = &warm->job;
+  transfer.progress = (1 == request->portCount) ? client : NULL;
+  memcpy(transfer.pages, warm->pages, sizeof(transfer.pages));
+  memcpy(transfer.pageLength, warm->pageLength, sizeof(transfer.pageLength));
+
+  /* Links are sent to from a list of their own, as the ports asked for
+     need not be next to each other */
+  for(int p=0; p<request->portCount; p++)
+    sending[p] = server->links[index[p]];
+
+  zxtrans_fan_out(sending, request->portCount, &transfer);
+
+  for(int p=0; p<request->portCount; p++){
+    struct zxtrans_link *link = &server->links[index[p]];
+
+    *link = sending[p];
+
+    if(!link->sent){
+      fprintf(client, "port %s: %s\n", link->portName, link->error);
+      failures++;
+      continue;
+    }
+
+    zxtrans_metrics_total(&link->metrics, &total);
+
+    fprintf(client, "port %s: sent %zu bytes in %.1f seconds (%.0f baud)\n", \
+	    link->portName, total.sent, total.seconds, \
+	    total.seconds > 0 ? \
+	    total.sent*ZXTRANS_METRICS_BITS_PER_BYTE/total.seconds : 0);
+
+    if(NULL != server->metricsFilename && \
+       !zxtrans_metrics_write(&link->metrics, server->metricsFilename))
+      printf("Warning: could not write metrics to %s.\n", \
+	     server->metricsFilename);
+  }
+
+  if(failures)
+    fprintf(client, "error %d of %d ports failed.\n", failures, \
+	    request->portCount);
+  else
+    fprintf(client, "ok\n");
+}
+
+/* Tell client which ports are open and which snapshots prepared */
+void zxtrans_serve_status(const struct zxtrans_server *server, FILE *client){
+  for(int l=0; l<server->linkCount; l++)
+    fprintf(client, "port %s\n", server->links[l].portName);
+
+  for(int w=0; w<server->warmCount; w++){
+    const struct zxtrans_warm *warm = server->warm[w];
+    size_t bytes=0;
+
+    for(int i=0; i<warm->job.pageCount; i++)
+      bytes += warm->pageLength[i];
+
+    fprintf(client, "snapshot %s: %d pages in %zu bytes\n", warm->filename, \
+	    warm->job.pageCount, bytes);
+  }
+
+  fprintf(client, "ok %d ports, %d snapshots\n", server->linkCount, \
+	  server->warmCount);
+}
+
+/* Prepare every page of job at once, into *pageBuffer unless they are
+   in its cached image, and add them to the cache. The snapshot itself
+   is then no longer needed. Returns 0 if a page cannot be prepared. */
+int zxtrans_load_pages(struct zxtrans_job *job,
+		       libspectrum_byte **pageBuffer,
+		       const libspectrum_byte *pages[], size_t pageLength[]){
+  struct zxtrans_pipeline pipeline;
+  struct zxtrans_cache_writer imageWriter;
+  int prepared=0;
+
+  *pageBuffer = NULL;
+
+  if(job->cached){
+    for(int i=0; i<job->pageCount; i++){
+      pages[i] = job->image.pages[i];
+      pageLength[i] = job->image.pageLength[i];
+    }
+
+    return 1;
+  }
+
+  if(NULL == (*pageBuffer = malloc(job->pageCount*ZXTRANS_IMAGE_BOUND)))
+    return 0;
+
+  if(!zxtrans_pipeline_start(&pipeline, job->snapshot, \
+			     &job->z80mc[PAGELIST], job->pageCount, \
+			     job->transferFlags, job->keep)){
+    free(*pageBuffer);
+    *pageBuffer = NULL;
+    return 0;
+  }
+
+  memset(&imageWriter, 0, sizeof(imageWriter));
+
+  if(NULL != job->imageName)
+    zxtrans_cache_create(&imageWriter, job->imageName, job->z80mc, \
+			 job->pageCount);
+
+  for(; prepared<job->pageCount; prepared++){
+    libspectrum_byte *page = &(*pageBuffer)[prepared*ZXTRANS_IMAGE_BOUND];
+    const libspectrum_byte *pageData = \
+      zxtrans_pipeline_next(&pipeline, &pageLength[prepared]);
+
+    if(NULL == pageData)
+      break;
+
+    memcpy(page, pageData, pageLength[prepared]);
+    pages[prepared] = page;
+    zxtrans_cache_add(&imageWriter, page, pageLength[prepared]);
+    zxtrans_pipeline_release(&pipeline);
+  }
+
+  zxtrans_pipeline_finish(&pipeline);
+
+  if(NULL != job->imageName)
+    zxtrans_cache_commit(&imageWriter);
+
+  zxtrans_free_snapshot(job);
+
+  if(prepared < job->pageCount){
+    free(*pageBuffer);
+    *pageBuffer = NULL;
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Ask daemon listening on socketPath to send each snapshot in jobNames
+   to every port in portNames, waiting between them as in batch mode.
+   Returns the number of snapshots not sent. */
+int zxtrans_request_jobs(const char *socketPath, char *portNames[],
+			 int portCount, char *jobNames[], int jobCount,
+			 int batchWait, int verbosity){
+  char line[ZXTRANS_DAEMON_LINE];
+  int redraw = NORMAL == verbosity && isatty(fileno(stdout));
+  int failures=0;
+
+  for(int j=0; j<jobCount; j++){
+    char *filename = zxtrans_absolute_path(jobNames[j]);
+    FILE *daemon;
+    int sent=0;
+    int drawn=0; /* Progress line is showing */
+
+    if(jobCount > 1 && verbosity > SILENT)
+      printf("Sending %s (%d of %d)\n", jobNames[j], j+1, jobCount);
+
+    if(NULL == filename){
+      printf("Unable to find %s.\n", jobNames[j]);
+      exit(EXIT_FAILURE);
+    }
+
+    if(NULL == (daemon = zxtrans_daemon_connect(socketPath))){
+      printf("No daemon listening on %s.\n", socketPath);
+      exit(EXIT_FAILURE);
+    }
+
+    fprintf(daemon, "send ");
+
+    for(int p=0; p<portCount; p++)
+      fprintf(daemon, "%s%s", p ? "," : "", portNames[p]);
+
+    fprintf(daemon, " %s\n", filename);
+    fflush(daemon);
+
+    while(NULL != fgets(line, sizeof(line), daemon)){
+      line[strcspn(line, "\r\n")] = '\0';
+
+      if(0 == strncmp(line, "progress ", 9)){
+	if(redraw){
+	  printf("\r%s", &line[9]);
+	  fflush(stdout);
+	  drawn = 1;
+	}
+
+	continue;
+      }
+
+      if(drawn){
+	printf("\n");
+	drawn = 0;
+      }
+
+      /* Each port's result is only shown for several, as in fan-out */
+      if(0 == strncmp(line, "port ", 5)){
+	if((portCount > 1 && verbosity > SILENT) || verbosity > NORMAL)
+	  printf("%s\n", &line[5]);
+      }
+      else if(0 == strncmp(line, "ok", 2))
+	sent = 1;
+      else if(0 == strncmp(line, "error ", 6))
+	printf("%s\n", &line[6]);
+    }
+
+    fclose(daemon);
+    free(filename);
+
+    if(!sent)
+      failures++;
+
+    if(j+1 < jobCount)
+      zxtrans_batch_wait(batchWait, jobNames[j+1]);
+  }
+
+  return failures;
+}
+
+/* Processors available, for converting snapshots */
+static int processor_count(void){
+#ifdef _SC_NPROCESSORS_ONLN
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return (count > 0) ? count : 1;
+#else
+  return 1;
+#endif
+}
+
+static void *convert_snapshots(void *arg){
+  struct zxtrans_convert_worker *worker = arg;
+  struct zxtrans_converter *converter = worker->converter;
+
+  for(;;){
+    long written = 0;
+    int index, converted;
+
+    pthread_mutex_lock(&converter->lock);
+    index = converter->next++;
+    pthread_mutex_unlock(&converter->lock);
+
+    if(index >= converter->jobCount)
+      break;
+
+    converted = zxtrans_convert_job(worker, index, &written);
+
+    pthread_mutex_lock(&converter->lock);
+
+    if(converted){
+      converter->converted++;
+      converter->bytes += written;
+    }
+    else
+      converter->failed[index] = 1;
+
+    pthread_mutex_unlock(&converter->lock);
+  }
+
+  return NULL;
+}
+
+/* Convert each of jobCount snapshots to a file in outputDir, as -o would
+   write it, with threads (or one for each processor, if 0) converting
+   at once. Ends with a summary, naming any not converted. Returns 0 if
+   any snapshot was not converted. */
+int zxtrans_convert_jobs(char *jobNames[], int jobCount,
+			 const char *outputDir, int threads,
+			 const struct zxtrans_transfer *settings,
+			 int transferFlags){
+  struct zxtrans_converter converter;
+  struct zxtrans_convert_worker *workers;
+  char **sorted;
+  struct stat status;
+  double start = zxtrans_metrics_now();
+  int started = 0;
+
+  memset(&converter, 0, sizeof(converter));
+  converter.settings = settings;
+  converter.transferFlags = transferFlags;
+  converter.jobNames = jobNames;
+  converter.jobCount = jobCount;
+
+#ifdef _WIN32
+  _mkdir(outputDir);
+#else
+  mkdir(outputDir, 0755);
+#endif
+
+  if(0 != stat(outputDir, &status) || !S_ISDIR(status.st_mode)){
+    printf("Unable to use output directory %s.\n", outputDir);
+    exit(EXIT_FAILURE);
+  }
+
+  if(0 == threads)
+    threads = processor_count();
+
+  if(threads > jobCount)
+    threads = jobCount;
+
+  converter.outputNames = malloc(jobCount*sizeof(char *));
+  converter.failed = calloc(jobCount, sizeof(char));
+  sorted = malloc(jobCount*sizeof(char *));
+  workers = calloc(threads, sizeof(*workers));
+
+  if(NULL == converter.outputNames || NULL == converter.failed || \
+     NULL == sorted || NULL == workers){
+    printf("Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(int j=0; j<jobCount; j++)
+    if(NULL == (sorted[j] = converter.outputNames[j] = \
+		zxtrans_output_name(outputDir, jobNames[j]))){
+      printf("Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+
+  /* Snapshots differing only in extension, or directory, would
+     overwrite each other */
+  qsort(sorted, jobCount, sizeof(char *), compare_names);
+
+  for(int j=1; j<jobCount; j++)
+    if(0 == strcmp(sorted[j-1], sorted[j])){
+      printf("More than one snapshot would be written to %s.\n", sorted[j]);
+      exit(EXIT_FAILURE);
+    }
+
+  free(sorted);
+  pthread_mutex_init(&converter.lock, NULL);
+
+  for(int t=0; t<threads; t++){
+    struct zxtrans_convert_worker *worker = &workers[t];
+
+    worker->converter = &converter;
+    worker->page = malloc(ZXTRANS_IMAGE_BOUND);
+    worker->output = malloc(CONVERT_BUFFER);
+
+    if(NULL == worker->page || NULL == worker->output){
+      printf("Out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    /* Fewer threads will do, if not all of them start */
+    if(0 != pthread_create(&worker->thread, NULL, convert_snapshots, \
+			   worker))
+      break;
+
+    started++;
+  }
+
+  if(0 == started){
+    printf("Unable to start converting snapshots.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(int t=0; t<started; t++)
+    pthread_join(workers[t].thread, NULL);
+
+  if(settings->verbosity > SILENT)
+    printf("Converted %d of %d snapshots to %s (%llu bytes) in %.1f " \
+	   "seconds, %d at once\n", converter.converted, jobCount, \
+	   outputDir, converter.bytes, zxtrans_metrics_now()-start, started);
+
+  if(converter.converted < jobCount){
+    printf("Not converted:\n");
+
+    for(int j=0; j<jobCount; j++)
+      if(converter.failed[j])
+	printf("  %s\n", jobNames[j]);
+  }
+
+  pthread_mutex_destroy(&converter.lock);
+
+  for(int t=0; t<threads; t++){
+    free(workers[t].input.buffer);
+    free(workers[t].page);
+    free(workers[t].output);
+  }
+
+  for(int j=0; j<jobCount; j++)
+    free(converter.outputNames[j]);
+
+  free(workers);
+  free(converter.outputNames);
+  free(converter.failed);
+
+  return converter.converted == jobCount;
+}
+
+/* File in outputDir for snapshot jobName: its name, with the extension
+   replaced by .bin. Returns NULL if out of memory; caller must free
+   result. */
+char *zxtrans_output_name(const char *outputDir, const char *jobName){
+  const char *base = strrchr(jobName, '/');
+  const char *dot;
+  size_t length;
+  char *outputName;
+
+  base = (NULL == base) ? jobName : base+1;
+  dot = strrchr(base, '.');
+  length = (NULL == dot || dot == base) ? strlen(base) : (size_t) (dot-base);
+
+  if(NULL == (outputName = malloc(strlen(outputDir)+length+6)))
+    return NULL;
+
+  sprintf(outputName, "%s/%.*s.bin", outputDir, (int) length, base);
+
+  return outputName;
+}
+
+/* Convert snapshot index of worker's converter to its file, as -o would
+   write it, giving the bytes written. Returns 0, having said why, if it
+   cannot; no file is left behind. */
+int zxtrans_convert_job(struct zxtrans_convert_worker *worker, int index,
+			long *written){
+  const struct zxtrans_converter *converter = worker->converter;
+  const struct zxtrans_transfer *settings = converter->settings;
+  const char *outputName = converter->outputNames[index];
+  struct zxtrans_job job;
+  struct zxtrans_frames frames;
+  FILE *outputBinary;
+  int converted = 1;
+  int unwritten;
+
+  if(!zxtrans_prepare_job(converter->jobNames[index], \
+			  converter->transferFlags, settings->direct, NULL, 0, \
+			  settings->verbosity, &worker->input, &job))
+    return 0;
+
+  if(NULL == (outputBinary = fopen(outputName, "wb"))){
+    printf("Error opening output file %s.\n", outputName);
+    zxtrans_free_job(&job);
+    return 0;
+  }
+
+  setvbuf(outputBinary, worker->output, _IOFBF, CONVERT_BUFFER);
+  zxtrans_frames_init(&frames);
+
+  if(NULL != settings->leader)
+    fwrite(settings->leader, sizeof(libspectrum_byte), \
+	   settings->sizeofLeader, outputBinary);
+
+  fwrite(job.z80mc, sizeof(libspectrum_byte), CODELEN, outputBinary);
+
+  if(settings->fastBaud){
+    libspectrum_byte pattern[ZXTRANS_LADDER_LEN+1];
+
+    zxtrans_image_ladder(pattern);
+    pattern[ZXTRANS_LADDER_LEN] = ZXTRANS_LADDER_GO;
+    fwrite(pattern, sizeof(libspectrum_byte), ZXTRANS_LADDER_LEN+1, \
+	   outputBinary);
+  }
+
+  /* Each page is prepared straight into the worker's buffer */
+  for(int i=0; converted && i<job.pageCount; i++){
+    size_t pageLength = \
+      zxtrans_image_page(job.snapshot, &job.z80mc[PAGELIST], i, \
+			 job.transferFlags, job.keep[i], worker->page);
+
+    if(0 == pageLength){
+      printf("Error preparing memory page %d of %s.\n", \
+	     job.z80mc[PAGELIST+i], converter->jobNames[index]);
+      converted = 0;
+    }
+    else if(settings->framed)
+      zxtrans_write_frames(outputBinary, worker->page, pageLength, &frames);
+    else
+      fwrite(worker->page, sizeof(libspectrum_byte), pageLength, \
+	     outputBinary);
+  }
+
+  if(converted && frames.fill > 0)
+    fwrite(zxtrans_frames_seal(&frames), sizeof(libspectrum_byte), \
+	   ZXTRANS_FRAME_WIRE_LEN, outputBinary);
+
+  *written = ftell(outputBinary);
+  unwritten = ferror(outputBinary);
+  unwritten |= (0 != fclose(outputBinary));
+
+  if(converted && unwritten){
+    printf("Error writing output file %s.\n", outputName);
+    converted = 0;
+  }
+
+  if(!converted)
+    remove(outputName);
+  else if(settings->verbosity > NORMAL)
+    printf("Converted %s to %s (%ld bytes)\n", converter->jobNames[index], \
+	   outputName, *written);
+
+  zxtrans_free_job(&job);
+
+  return converted;
+}
+
+/* Send one block over link, recording it in its metrics. Returns 0,
+   with the reason in link->error, if the port does not accept every
+   byte. When framed, the block is added to checked frames, which are
+   sent as they fill. */
+int zxtrans_send_block(struct zxtrans_link *link, const char *label,
+		       const libspectrum_byte *buf, size_t count,
+		       int isPage, int framed){
+  int totalSent;
+
+  zxtrans_metrics_block(&link->metrics, label, count);
+
+  if(framed){
+    for(size_t i=0; i<count; ){
+      i += zxtrans_frames_add(&link->frames, &buf[i], count-i);
+
+      if(ZXTRANS_FRAME_LEN == link->frames.fill && !zxtrans_send_frame(link))
+	return 0;
+    }
+
+    zxtrans_metrics_end_block(&link->metrics, isPage);
+    return 1;
+  }
+
+  totalSent = zxtrans_write_block(link, buf, count, SERIAL_TIMEOUT);
+  zxtrans_metrics_end_block(&link->metrics, isPage);
+
+  if(totalSent != (int) count){
+    if('\0' == link->error[0])
+      snprintf(link->error, sizeof(link->error), \
+	       "Error: only %d of %zu bytes of %s sent.", totalSent, count, \
+	       label);
+
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Send current frame of a checked transfer until the receiver has it.
+   A receiver that lost bytes of the frame is still waiting for the
+   rest, so is sent filler until it answers (and asks for the frame
+   again). Returns 0, with the reason in link->error, if it never
+   does. */
+int zxtrans_send_frame(struct zxtrans_link *link){
+  struct zxtrans_frames *frames = &link->frames;
+  struct zxtrans_block_metrics *block = \
+    &link->metrics.block[link->metrics.blockCount-1];
+  const libspectrum_byte *wire = zxtrans_frames_seal(frames);
+  const libspectrum_byte fill = ZXTRANS_FRAME_FILL;
+  int answer = -1;
+
+  for(int tries=0; ZXTRANS_FRAME_ACK != answer; tries++){
+    if(FRAME_TRIES == tries){
+      snprintf(link->error, sizeof(link->error), \
+	       "Error: receiver did not accept frame %d.", frames->sequence);
+      return 0;
+    }
+
+    if(tries > 0)
+      block->framesResent++;
+
+    /* Forget any late answer to an earlier try */
+    zxtrans_port_flush(link->port, SP_BUF_INPUT);
+
+    if(zxtrans_write_block(link, wire, ZXTRANS_FRAME_WIRE_LEN, \
+			   SERIAL_TIMEOUT) != ZXTRANS_FRAME_WIRE_LEN){
+      if('\0' == link->error[0])
+	snprintf(link->error, sizeof(link->error), \
+		 "Error: only part of frame %d sent.", frames->sequence);
+
+      return 0;
+    }
+
+    answer = zxtrans_frame_answer(link->port, SERIAL_TIMEOUT);
+
+    for(int i=0; answer < 0 && i < ZXTRANS_FRAME_WIRE_LEN; i++){
+      if(zxtrans_write_block(link, &fill, 1, SERIAL_TIMEOUT) != 1){
+	if('\0' != link->error[0])
+	  return 0;
+
+	break;
+      }
+
+      answer = zxtrans_frame_answer(link->port, FILL_TIMEOUT);
+    }
+  }
+
+  zxtrans_frames_next(frames);
+
+  return 1;
+}
+
+/* Add bytes to checked frames written to file, writing each frame as
+   it fills */
+void zxtrans_write_frames(FILE *file, const libspectrum_byte *buf,
+			  size_t count, struct zxtrans_frames *frames){
+  for(size_t i=0; i<count; ){
+    i += zxtrans_frames_add(frames, &buf[i], count-i);
+
+    if(ZXTRANS_FRAME_LEN == frames->fill){
+      fwrite(zxtrans_frames_seal(frames), sizeof(libspectrum_byte), \
+	     ZXTRANS_FRAME_WIRE_LEN, file);
+      zxtrans_frames_next(frames);
+    }
+  }
+}
+
+/* Prepare every page of job at once, for pages and pageLength, each
+   straight into its own ZXTRANS_IMAGE_BOUND bytes of buffer. A page
+   sent as it is, or cached, is left where it lies, so stays only while
+   job does. Returns 0, having said why, if a page cannot be prepared. */
+int zxtrans_hold_pages(struct zxtrans_job *job, libspectrum_byte *buffer,
+		       const libspectrum_byte *pages[], size_t pageLength[]){
+  int asItIs = !(job->transferFlags & \
+		 (ZXTRANS_FLAG_PACKED | ZXTRANS_FLAG_SPANS));
+
+  for(int i=0; i<job->pageCount; i++){
+    int pageNo = job->z80mc[PAGELIST+i];
+
+    if(job->cached){
+      pages[i] = job->image.pages[i];
+      pageLength[i] = job->image.pageLength[i];
+    }
+    else if(asItIs){
+      pages[i] = libspectrum_snap_pages(job->snapshot, pageNo);
+      pageLength[i] = ZXTRANS_PAGELEN;
+    }
+    else{
+      libspectrum_byte *page = &buffer[i*ZXTRANS_IMAGE_BOUND];
+
+      if(0 == (pageLength[i] = \
+	       zxtrans_image_page(job->snapshot, &job->z80mc[PAGELIST], i, \
+				  job->transferFlags, job->keep[i], page))){
+	printf("Error preparing memory page %d.\n", pageNo);
+	return 0;
+      }
+
+      pages[i] = page;
+    }
+  }
+
+  return 1;
+}
+
+/* Write transfer, with its pages held by zxtrans_hold_pages, to file
+   in one gathered write. Returns 0 if it is not all written. */
+int zxtrans_write_gathered(FILE *file,
+			   const struct zxtrans_transfer *transfer){
+  const struct zxtrans_job *job = transfer->job;
+  struct zxtrans_piece pieces[ZXTRANS_STREAM_PIECES];
+  libspectrum_byte pattern[ZXTRANS_LADDER_LEN+1];
+  int count=0;
+
+  /* IF1 leader, then Z80 set-state routine */
+  if(NULL != transfer->leader){
+    pieces[count].base = transfer->leader;
+    pieces[count++].length = transfer->sizeofLeader;
+  }
+
+  pieces[count].base = job->z80mc;
+  pieces[count++].length = CODELEN;
+
+  /* File is played out at one rate, taken to be the fastest, so
+     receiver settles on that at its first try */
+  if(transfer->fastBaud){
+    zxtrans_image_ladder(pattern);
+    pattern[ZXTRANS_LADDER_LEN] = ZXTRANS_LADDER_GO;
+    pieces[count].base = pattern;
+    pieces[count++].length = ZXTRANS_LADDER_LEN+1;
+  }
+
+  /* Table for receiver to check memory to be kept */
+  if(job->deltaLength > 0){
+    pieces[count].base = job->deltaTable;
+    pieces[count++].length = job->deltaLength;
+  }
+
+  for(int i=0; i<job->pageCount; i++){
+    pieces[count].base = transfer->pages[i];
+    pieces[count++].length = transfer->pageLength[i];
+  }
+
+  return zxtrans_stream_write(file, pieces, count);
+}
+
+/* Write count bytes over link, using flow control for its serial
+   mode. Returns the number written, which falls short if the port
+   times out; if the receiver never asserts CTS, link->error says
+   so. */
+int zxtrans_write_block(struct zxtrans_link *link,
+			const libspectrum_byte *buf,
+			size_t count, unsigned int timeout_ms){
+  struct zxtrans_port *port = link->port;
+  struct zxtrans_flow_burst *burst = &link->burst;
+  struct zxtrans_metrics *metrics = &link->metrics;
+  struct zxtrans_block_metrics *block = \
+    &metrics->block[metrics->blockCount-1];
+  size_t sentBefore = block->sent; /* Frames share a block */
   int totalSent = 0;
   int bytesSent = 0;
-  enum sp_signal portStatus;
-  enum sp_return sp_err;
+  int ready;
+  double raised = 0, burstEnd = 0;
   
-  if(0 == serialMode)
+  if(0 == link->serialMode)
     /* Following manual-control advice noted at
        http://www.worldofspectrum.org/forums/discussion/comment/534124/#Comment_534124 */
-    for(int i=0; i<count; i+=2){
-      sp_err = sp_set_rts(port, SP_RTS_ON);
-      do
-	sp_err = sp_get_signals(port, &portStatus);
-      while( !(portStatus && SP_SIG_CTS) );
-
-      if (i+1<count)
-    	bytesSent = sp_blocking_write(port, &buf[i], 2, timeout_ms);
-      else
-	bytesSent = sp_blocking_write(port, &buf[i], 1, timeout_ms);
-      
-      totalSent = totalSent + bytesSent;
+    for(int i=0; i<count; i+=bytesSent){
+      int length = (count-i < burst->size) ? count-i : burst->size;
+      double stalled = block->flow.stalledSeconds;
+
+      zxtrans_port_set_rts(port, 1);
+      block->rtsToggles++;
+      raised = zxtrans_metrics_now();
+
+      /* Receiver may not be running yet when a block starts, so only
+	 later waits are limited */
+      ready = zxtrans_flow_wait_cts(port, (0 == i) ? 0 : timeout_ms, \
+				    &block->flow);
+
+      if(ready <= 0){
+	snprintf(link->error, sizeof(link->error), \
+		 "%s waiting for receiver to assert CTS.", \
+		 (0 == ready) ? "Timed out" : "Error");
+	break;
+      }
+
+      /* Judge receiver by how soon it was ready after last burst, and
+	 record the turnaround and gap, as the first handshake of a
+	 block waits for the receiver to start */
+      if(i > 0){
+	double now = zxtrans_metrics_now();
 
-      sp_err = sp_set_rts(port, SP_RTS_OFF);
+	zxtrans_flow_burst_update(burst, bytesSent, \
+				  block->flow.stalledSeconds-stalled);
+	zxtrans_metrics_sample(&metrics->turnaround, now-raised);
+	zxtrans_metrics_sample(&metrics->gaps, now-burstEnd);
+      }
+
+      bytesSent = zxtrans_port_write(port, &buf[i], length, timeout_ms);
+      burstEnd = zxtrans_metrics_now();
+
+      if(bytesSent > 0)
+	totalSent = totalSent + bytesSent;
+
+      zxtrans_port_set_rts(port, 0);
+      block->rtsToggles++;
+
+      if(bytesSent < length){
+	block->shortWrites++;
+	zxtrans_flow_burst_shrink(burst);
+	break;
+      }
+
+      block->sent = sentBefore + totalSent;
+      zxtrans_metrics_progress(metrics);
     }
   else
-    totalSent = sp_blocking_write(port, buf, count, timeout_ms);
+    for(int i=0; i<count; i+=WRITE_CHUNK){
+      int chunk = (count-i < WRITE_CHUNK) ? count-i : WRITE_CHUNK;
+
+      /* As above, first write may wait for receiver to start */
+      bytesSent = zxtrans_port_write(port, &buf[i], chunk, \
+				     (0 == i) ? 0 : timeout_ms);
+
+      if(bytesSent > 0)
+	totalSent = totalSent + bytesSent;
+
+      block->sent = sentBefore + totalSent;
+
+      if(bytesSent < chunk){
+	block->shortWrites++;
+	break;
+      }
+
+      zxtrans_metrics_progress(metrics);
+    }
   
   return totalSent;
 }
@@ -0,0 +1,329 @@
+/*
+   ZX-Trans Snapshot Files - snapshot files mapped into memory, with
+   the common fixed layouts read where they lie.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _XOPEN_SOURCE 700 /* For mmap */
+
+#define SNA_HEADER_LEN 27
+#define Z80_HEADER_LEN 30 /* Version 1, before any additional header */
+#define Z80_COMPRESSED 0x20 /* In flags at offset 12, for version 1 */
+#define Z80_MODIFY_HW 0x80 /* In flags at offset 37: a 16k or +2 */
+#define Z80_STORED 0xFFFF /* Length of a page stored uncompressed */
+#define RAM_48K 0xC000
+#define RAM_PAGES 8
+
+#include <ctype.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "zxtrans_image.h"
+#include "zxtrans_snapfile.h"
+
+static libspectrum_snap *read_sna(const struct zxtrans_snapfile *file);
+static libspectrum_snap *read_z80(const struct zxtrans_snapfile *file);
+static int z80_machine(const libspectrum_byte *header, int extraLength);
+static int has_extension(const char *filename, const char *extension);
+static libspectrum_word word(const libspectrum_byte *bytes);
+
+/* Pages of a 48k machine, from 0x4000 up */
+static const int pages48[] = {5, 2, 0};
+
+/* Map filename into memory. Returns 0 if it cannot be (always, where
+   there is no mmap), when the file is to be read as before. */
+int zxtrans_snapfile_map(const char *filename,
+			 struct zxtrans_snapfile *file){
+#ifdef _WIN32
+  (void) filename;
+  memset(file, 0, sizeof(*file));
+
+  return 0;
+#else
+  struct stat status;
+  void *data;
+  int fd;
+
+  memset(file, 0, sizeof(*file));
+
+  if(-1 == (fd = open(filename, O_RDONLY)))
+    return 0;
+
+  /* Only a regular file can be mapped whole */
+  if(0 != fstat(fd, &status) || !S_ISREG(status.st_mode) || \
+     status.st_size <= 0){
+    close(fd);
+    return 0;
+  }
+
+  data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(MAP_FAILED == data)
+    return 0;
+
+  file->data = data;
+  file->length = status.st_size;
+
+  return 1;
+#endif
+}
+
+void zxtrans_snapfile_unmap(struct zxtrans_snapfile *file){
+#ifndef _WIN32
+  if(NULL != file->data)
+    munmap(file->data, file->length);
+#endif
+
+  memset(file, 0, sizeof(*file));
+}
+
+/* Snapshot read from file, with its pages in place, if filename is a
+   48k .sna or a .z80 with its pages stored uncompressed. Returns NULL
+   for anything else, which is then left to libspectrum. */
+libspectrum_snap *zxtrans_snapfile_read(const char *filename,
+					const struct zxtrans_snapfile *file){
+  if(has_extension(filename, ".sna"))
+    return read_sna(file);
+
+  if(has_extension(filename, ".z80"))
+    return read_z80(file);
+
+  return NULL;
+}
+
+/* Free snapshot read by zxtrans_snapfile_read, whose pages belong to
+   the file */
+void zxtrans_snapfile_free(libspectrum_snap *snapshot){
+  for(int i=0; i<RAM_PAGES; i++)
+    libspectrum_snap_set_pages(snapshot, i, NULL);
+
+  libspectrum_snap_free(snapshot);
+}
+
+/* A 48k .sna holds the registers, then RAM from 0x4000, with PC on the
+   stack */
+static libspectrum_snap *read_sna(const struct zxtrans_snapfile *file){
+  const libspectrum_byte *header = file->data;
+  libspectrum_byte *ram = file->data+SNA_HEADER_LEN;
+  libspectrum_word sp = word(&header[23]);
+  libspectrum_snap *snapshot;
+
+  /* 128k .sna files hold their pages out of order, and libspectrum
+     says why an SP outside RAM is no good */
+  if(SNA_HEADER_LEN+RAM_48K != file->length || sp < 0x4000 || \
+     0xFFFF == sp)
+    return NULL;
+
+  if(NULL == (snapshot = libspectrum_snap_alloc()))
+    return NULL;
+
+  libspectrum_snap_set_machine(snapshot, LIBSPECTRUM_MACHINE_48);
+  libspectrum_snap_set_i(snapshot, header[0]);
+  libspectrum_snap_set_hl_(snapshot, word(&header[1]));
+  libspectrum_snap_set_de_(snapshot, word(&header[3]));
+  libspectrum_snap_set_bc_(snapshot, word(&header[5]));
+  libspectrum_snap_set_f_(snapshot, header[7]);
+  libspectrum_snap_set_a_(snapshot, header[8]);
+  libspectrum_snap_set_hl(snapshot, word(&header[9]));
+  libspectrum_snap_set_de(snapshot, word(&header[11]));
+  libspectrum_snap_set_bc(snapshot, word(&header[13]));
+  libspectrum_snap_set_iy(snapshot, word(&header[15]));
+  libspectrum_snap_set_ix(snapshot, word(&header[17]));
+  libspectrum_snap_set_iff1(snapshot, (header[19] & 0x04) ? 1 : 0);
+  libspectrum_snap_set_iff2(snapshot, (header[19] & 0x04) ? 1 : 0);
+  libspectrum_snap_set_r(snapshot, header[20]);
+  libspectrum_snap_set_f(snapshot, header[21]);
+  libspectrum_snap_set_a(snapshot, header[22]);
+  libspectrum_snap_set_im(snapshot, header[25] & 0x03);
+  libspectrum_snap_set_pc(snapshot, word(&ram[sp-0x4000]));
+  libspectrum_snap_set_sp(snapshot, sp+2);
+
+  for(int i=0; i<3; i++)
+    libspectrum_snap_set_pages(snapshot, pages48[i], \
+			       &ram[i*ZXTRANS_PAGELEN]);
+
+  return snapshot;
+}
+
+/* A .z80 holds the registers, then (for version 1) RAM from 0x4000 or
+   (for versions 2 and 3) an additional header and each page in a
+   block of its own */
+static libspectrum_snap *read_z80(const struct zxtrans_snapfile *file){
+  const libspectrum_byte *header = file->data;
+  libspectrum_byte *page[RAM_PAGES] = {NULL};
+  libspectrum_byte flags;
+  libspectrum_word pc;
+  libspectrum_machine machine = LIBSPECTRUM_MACHINE_48;
+  libspectrum_snap *snapshot;
+
+  if(file->length < Z80_HEADER_LEN)
+    return NULL;
+
+  /* Byte of 255 is read as 1, for compatibility */
+  flags = (0xFF == header[12]) ? 0x01 : header[12];
+  pc = word(&header[6]);
+
+  if(0 != pc){
+    if(flags & Z80_COMPRESSED || \
+       Z80_HEADER_LEN+RAM_48K != file->length)
+      return NULL;
+
+    for(int i=0; i<3; i++)
+      page[pages48[i]] = \
+	&file->data[Z80_HEADER_LEN+i*ZXTRANS_PAGELEN];
+  }
+  else{
+    size_t offset;
+    int extraLength, found;
+
+    if(file->length < Z80_HEADER_LEN+2)
+      return NULL;
+
+    extraLength = word(&header[30]);
+    offset = Z80_HEADER_LEN+2+extraLength;
+
+    if(offset > file->length || \
+       -1 == (found = z80_machine(header, extraLength)))
+      return NULL;
+
+    machine = found;
+
+    pc = word(&header[32]);
+
+    /* Block header is a length, low byte first, and page number: 3 to
+       10 for pages 0 to 7 of a 128k, or 4, 5 and 8 for pages 2, 0 and
+       5 of a 48k */
+    while(offset < file->length){
+      int pageNo;
+
+      if(offset+3+ZXTRANS_PAGELEN > file->length || \
+	 Z80_STORED != word(&file->data[offset]))
+	return NULL;
+
+      pageNo = file->data[offset+2];
+
+      if(LIBSPECTRUM_MACHINE_48 == machine)
+	pageNo = (4 == pageNo) ? 2 : (5 == pageNo) ? 0 : \
+	  (8 == pageNo) ? 5 : -1;
+      else
+	pageNo -= 3;
+
+      if(pageNo < 0 || pageNo >= RAM_PAGES || NULL != page[pageNo])
+	return NULL;
+
+      page[pageNo] = &file->data[offset+3];
+      offset += 3+ZXTRANS_PAGELEN;
+    }
+  }
+
+  /* A page left out is left to libspectrum, which fills it */
+  for(int i=0; i<RAM_PAGES; i++)
+    if(NULL == page[i] && \
+       (LIBSPECTRUM_MACHINE_48 != machine || 0 == i || 2 == i || 5 == i))
+      return NULL;
+
+  if(NULL == (snapshot = libspectrum_snap_alloc()))
+    return NULL;
+
+  libspectrum_snap_set_machine(snapshot, machine);
+  libspectrum_snap_set_a(snapshot, header[0]);
+  libspectrum_snap_set_f(snapshot, header[1]);
+  libspectrum_snap_set_bc(snapshot, word(&header[2]));
+  libspectrum_snap_set_hl(snapshot, word(&header[4]));
+  libspectrum_snap_set_pc(snapshot, pc);
+  libspectrum_snap_set_sp(snapshot, word(&header[8]));
+  libspectrum_snap_set_i(snapshot, header[10]);
+  libspectrum_snap_set_r(snapshot, (header[11] & 0x7F) | ((flags & 0x01) << 7));
+  libspectrum_snap_set_de(snapshot, word(&header[13]));
+  libspectrum_snap_set_bc_(snapshot, word(&header[15]));
+  libspectrum_snap_set_de_(snapshot, word(&header[17]));
+  libspectrum_snap_set_hl_(snapshot, word(&header[19]));
+  libspectrum_snap_set_a_(snapshot, header[21]);
+  libspectrum_snap_set_f_(snapshot, header[22]);
+  libspectrum_snap_set_iy(snapshot, word(&header[23]));
+  libspectrum_snap_set_ix(snapshot, word(&header[25]));
+  libspectrum_snap_set_iff1(snapshot, header[27] ? 1 : 0);
+  libspectrum_snap_set_iff2(snapshot, header[28] ? 1 : 0);
+  libspectrum_snap_set_im(snapshot, header[29] & 0x03);
+
+  if(LIBSPECTRUM_MACHINE_128 == machine)
+    libspectrum_snap_set_out_128_memoryport(snapshot, header[35]);
+
+  for(int i=0; i<RAM_PAGES; i++)
+    if(NULL != page[i])
+      libspectrum_snap_set_pages(snapshot, i, page[i]);
+
+  return snapshot;
+}
+
+/* Machine named by the additional header of a version 2 (23 bytes) or
+   3 (54 or 55 bytes) .z80, or -1 for any this does not read: those
+   with other hardware, or modified to be a 16k or +2 */
+static int z80_machine(const libspectrum_byte *header, int extraLength){
+  int version3 = (54 == extraLength || 55 == extraLength);
+
+  if((23 != extraLength && !version3) || (header[37] & Z80_MODIFY_HW))
+    return -1;
+
+  switch(header[34]){
+  case 0:
+  case 1:			/* With Interface 1 */
+    return LIBSPECTRUM_MACHINE_48;
+  case 3:			/* 128k in version 2, 48k with MGT in 3 */
+    return version3 ? LIBSPECTRUM_MACHINE_48 : LIBSPECTRUM_MACHINE_128;
+  case 4:
+    return LIBSPECTRUM_MACHINE_128;
+  case 5:			/* With Interface 1, in version 3 */
+  case 6:			/* With MGT, in version 3 */
+    return version3 ? LIBSPECTRUM_MACHINE_128 : -1;
+  default:
+    return -1;
+  }
+}
+
+static int has_extension(const char *filename, const char *extension){
+  const char *dot = strrchr(filename, '.');
+
+  if(NULL == dot || strlen(dot) != strlen(extension))
+    return 0;
+
+  for(int i=0; dot[i]; i++)
+    if(tolower((unsigned char) dot[i]) != extension[i])
+      return 0;
+
+  return 1;
+}
+
+static libspectrum_word word(const libspectrum_byte *bytes){
+  return bytes[0] | (bytes[1] << 8);
+}
@@ -0,0 +1,59 @@
+/*
+   ZX-Trans Snapshot Files - snapshot files mapped into memory, with
+   the common fixed layouts read where they lie.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_SNAPFILE_H
+#define ZXTRANS_SNAPFILE_H
+
+#include <stddef.h>
+#include <libspectrum.h>
+
+/* Most snapshots sent or converted in bulk are 48k .sna files, or .z80
+   files with their pages stored uncompressed, which hold the registers
+   at fixed offsets and each page whole. Such a file is read here
+   without libspectrum's parser, and without copying its pages: the
+   snapshot's pages point into the file, mapped into memory, so it must
+   stay mapped until the snapshot is freed. Anything else is left to
+   libspectrum. */
+
+/* Snapshot file, mapped or read */
+struct zxtrans_snapfile {
+  libspectrum_byte *data;
+  size_t length;
+};
+
+int zxtrans_snapfile_map(const char *filename,
+			 struct zxtrans_snapfile *file);
+void zxtrans_snapfile_unmap(struct zxtrans_snapfile *file);
+libspectrum_snap *zxtrans_snapfile_read(const char *filename,
+					const struct zxtrans_snapfile *file);
+void zxtrans_snapfile_free(libspectrum_snap *snapshot);
+
+#endif
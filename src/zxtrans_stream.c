@@ -0,0 +1,117 @@
+/*
+   ZX-Trans Stream - the transfer written to standard output, a FIFO or
+   a file, in one gathered write.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define _XOPEN_SOURCE 700 /* For fdopen, fileno and writev */
+
+#include <errno.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#include "zxtrans_stream.h"
+
+/* Standard output, opened for the transfer, with standard output
+   itself moved to standard error so that messages are kept out of the
+   transfer. Returns NULL if it cannot be. */
+FILE *zxtrans_stream_open(void){
+  FILE *output;
+  int fd;
+
+  fflush(stdout);
+
+  if(-1 == (fd = dup(fileno(stdout))))
+    return NULL;
+
+  if(-1 == dup2(fileno(stderr), fileno(stdout)) || \
+     NULL == (output = fdopen(fd, "wb"))){
+    close(fd);
+    return NULL;
+  }
+
+#ifdef _WIN32
+  _setmode(fd, _O_BINARY);
+#endif
+
+  return output;
+}
+
+/* Write count pieces (at most ZXTRANS_STREAM_PIECES) to output, after
+   anything it holds already, in as few writes as the system takes them.
+   Returns 0 if any is not written. */
+int zxtrans_stream_write(FILE *output, const struct zxtrans_piece *pieces,
+			 int count){
+#ifdef _WIN32
+  for(int i=0; i<count; i++)
+    if(pieces[i].length != fwrite(pieces[i].base, 1, pieces[i].length, \
+				  output))
+      return 0;
+
+  return 1;
+#else
+  struct iovec vector[ZXTRANS_STREAM_PIECES];
+  struct iovec *next = vector;
+  int fd = fileno(output);
+
+  if(count > ZXTRANS_STREAM_PIECES || 0 != fflush(output))
+    return 0;
+
+  for(int i=0; i<count; i++){
+    vector[i].iov_base = (void *) pieces[i].base;
+    vector[i].iov_len = pieces[i].length;
+  }
+
+  /* A pipe or socket may take only part, so carry on from there */
+  while(count > 0){
+    ssize_t written = writev(fd, next, count);
+
+    if(written < 0){
+      if(EINTR == errno)
+	continue;
+
+      return 0;
+    }
+
+    for(; count > 0 && (size_t) written >= next->iov_len; count--)
+      written -= (next++)->iov_len;
+
+    if(count > 0){
+      next->iov_base = (char *) next->iov_base + written;
+      next->iov_len -= written;
+    }
+  }
+
+  return 1;
+#endif
+}
@@ -0,0 +1,57 @@
+/*
+   ZX-Trans Stream - the transfer written to standard output, a FIFO or
+   a file, in one gathered write.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_STREAM_H
+#define ZXTRANS_STREAM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define ZXTRANS_STREAM_PIECES 16 /* Most pieces in one write: the leader,
+				    set-state block, test pattern and
+				    table, then the pages */
+
+/* With -o -, the transfer goes to standard output, so it can be piped
+   straight to a serial line (by socat or ser2net, for example) with no
+   file in between. Each piece is written from where it lies, be it a
+   page of the snapshot file, a prepared page or a cached image. */
+
+/* One piece of the transfer */
+struct zxtrans_piece {
+  const void *base;
+  size_t length;
+};
+
+FILE *zxtrans_stream_open(void);
+int zxtrans_stream_write(FILE *output, const struct zxtrans_piece *pieces,
+			 int count);
+
+#endif
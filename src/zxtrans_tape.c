@@ -0,0 +1,444 @@
+/*
+   ZX-Trans Tape - turbo-speed tape images of a transfer, as TZX files
+   or audio, for Spectrums with no serial port.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#define CLOCK 3500000.0 /* T-states per second, as TZX files count them */
+#define TZX_SIGNATURE "ZXTape!\x1A"
+#define TZX_MAJOR 1
+#define TZX_MINOR 20
+#define TZX_STANDARD 0x10 /* Block at ROM speed */
+#define TZX_TURBO 0x11 /* Block with its own pulse lengths */
+#define SAMPLE_RATE 44100 /* Of WAV audio, which is 8-bit mono */
+#define WAV_HEADER_LEN 44
+#define WAV_HIGH 0xE0
+#define WAV_LOW 0x20
+#define WAV_SILENCE 0x80
+#define ROM_LEADER 2168 /* Pulse lengths of ROM's format, in T-states */
+#define ROM_SYNC_1 667
+#define ROM_SYNC_2 735
+#define ROM_ZERO 855
+#define ROM_ONE 1710
+#define ROM_HEADER_LEADER 8063 /* Pulses of leader before a header ... */
+#define ROM_DATA_LEADER 3223 /* ... and before data */
+#define ROM_HEADER_LEN 17
+#define ROM_PAUSE 1000 /* Milliseconds after each block at ROM speed */
+#define END_PAUSE 2000 /* ... and after the last of a snapshot */
+#define RECEIVER_HEADER_LEN 9 /* Before receiver code, giving its address */
+#define LOADER_LINE 10
+
+/* Receiver's time to use each block, in T-states, allowing for
+   ZXT_READ_BYTE and the unpacking done with what it reads */
+#define WORK_BYTE 400 /* Reading a byte, and storing or decoding it */
+#define WORK_SPAN 400 /* Starting a span, beyond reading its header */
+#define WORK_COPY 21 /* Each byte copied by LDIR, for a match or copy
+			span */
+#define WORK_ZERO 42 /* Each byte of a zero span */
+#define WORK_BANK 101 /* Each byte copied from another bank */
+#define WORK_BLOCK 12000 /* Checking a block, and starting on the next */
+#define WORK_MARGIN 1.25 /* For interrupts, and error in the above */
+#define PAUSE_MIN 10 /* Milliseconds, so receiver is waiting before the
+			leader starts */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zxtrans_image.h"
+#include "zxtrans_pack.h"
+#include "zxtrans_tape.h"
+
+static void add_byte(struct zxtrans_tape *tape, libspectrum_byte byte,
+		     double work);
+static size_t add_data(struct zxtrans_tape *tape,
+		       const libspectrum_byte *image, size_t length,
+		       size_t pos, size_t span, int flags);
+static void send_block(struct zxtrans_tape *tape, unsigned int pause);
+static void rom_header(libspectrum_byte *header, int type,
+		       const char *name, size_t length,
+		       libspectrum_word param1, libspectrum_word param2);
+static void rom_block(struct zxtrans_tape *tape, libspectrum_byte flag,
+		      const libspectrum_byte *data, size_t length);
+static void write_block(struct zxtrans_tape *tape,
+			const libspectrum_byte *data, size_t length,
+			int turbo, unsigned int pause);
+static void pulse(struct zxtrans_tape *tape, double length);
+static void silence(struct zxtrans_tape *tape, unsigned int pause);
+static void put_word(FILE *file, unsigned int value);
+static void put_long(FILE *file, unsigned long value);
+
+/* BASIC loader, which loads the receiver and runs it at 16384, where
+   every receiver starts */
+static const libspectrum_byte loaderProgram[] = {
+  0x00, LOADER_LINE, 0x13, 0x00,	/* Line number, and length */
+  0xEF, '"', '"', 0xAF, ':',		/* LOAD ""CODE : */
+  0xF9, 0xC0, '1', '6', '3', '8', '4',	/* RANDOMIZE USR 16384 */
+  0x0E, 0x00, 0x00, 0x00, 0x40, 0x00,
+  0x0D
+};
+
+/* Start writing tape to filename, with transfer at speed times ROM
+   speed. A filename ending in .wav is written as audio, and any other
+   as a TZX file. Returns 1 on success. */
+int zxtrans_tape_open(struct zxtrans_tape *tape, const char *filename,
+		      int speed){
+  size_t length = strlen(filename);
+
+  memset(tape, 0, sizeof(*tape));
+  tape->speed = speed;
+  tape->audio = length > 4 && '.' == filename[length-4] && \
+    'w' == tolower((unsigned char) filename[length-3]) && \
+    'a' == tolower((unsigned char) filename[length-2]) && \
+    'v' == tolower((unsigned char) filename[length-1]);
+
+  if(NULL == (tape->file = fopen(filename, "wb")))
+    return 0;
+
+  /* WAV header is written once length of audio is known */
+  if(tape->audio)
+    for(int i=0; i<WAV_HEADER_LEN; i++)
+      fputc(0, tape->file);
+  else{
+    fwrite(TZX_SIGNATURE, 1, strlen(TZX_SIGNATURE), tape->file);
+    fputc(TZX_MAJOR, tape->file);
+    fputc(TZX_MINOR, tape->file);
+  }
+
+  return !ferror(tape->file);
+}
+
+/* Write BASIC loader and receiver (length bytes, starting with its
+   header) at ROM speed, ready for a transfer */
+void zxtrans_tape_loader(struct zxtrans_tape *tape,
+			 const libspectrum_byte *receiver, size_t length){
+  libspectrum_byte header[ROM_HEADER_LEN];
+
+  rom_header(header, 0, "zxtrans", sizeof(loaderProgram), LOADER_LINE, \
+	     sizeof(loaderProgram));
+  rom_block(tape, 0x00, header, ROM_HEADER_LEN);
+  rom_block(tape, 0xFF, loaderProgram, sizeof(loaderProgram));
+
+  rom_header(header, 3, "zxtransc", length-RECEIVER_HEADER_LEN, \
+	     receiver[3] | receiver[4]<<8, 0x8000);
+  rom_block(tape, 0x00, header, ROM_HEADER_LEN);
+  rom_block(tape, 0xFF, &receiver[RECEIVER_HEADER_LEN], \
+	    length-RECEIVER_HEADER_LEN);
+
+  tape->fill = 0;
+  tape->number = 0;
+  tape->work = 0;
+}
+
+/* Add count bytes of transfer, which the receiver stores as they are */
+void zxtrans_tape_write(struct zxtrans_tape *tape,
+			const libspectrum_byte *data, size_t count){
+  for(size_t i=0; i<count; i++)
+    add_byte(tape, data[i], WORK_BYTE);
+}
+
+/* Add memory page prepared by zxtrans_image_page() with flags, judging
+   how long the receiver takes to unpack it */
+void zxtrans_tape_page(struct zxtrans_tape *tape,
+		       const libspectrum_byte *image, size_t length,
+		       int flags){
+  size_t pos=0;
+
+  if(!(flags & ZXTRANS_FLAG_SPANS))
+    pos = add_data(tape, image, length, pos, ZXTRANS_PAGELEN, flags);
+
+  while((flags & ZXTRANS_FLAG_SPANS) && pos+1 < length){
+    int type = image[pos+1]>>5;
+    size_t span = (image[pos] | (image[pos+1] & 0x1F)<<8) + 1;
+    int headerLength = 2;
+    double work = WORK_SPAN;
+
+    switch(type){
+    case ZXTRANS_SPAN_ZERO:
+      work += span*WORK_ZERO;
+      break;
+    case ZXTRANS_SPAN_COPY:
+      work += span*WORK_COPY;
+      headerLength = 4;
+      break;
+    case ZXTRANS_SPAN_BANK:
+      work += span*WORK_BANK;
+      headerLength = 4;
+      break;
+    }
+
+    /* Span is filled once its header is read */
+    for(int i=0; i<headerLength && pos < length; i++)
+      add_byte(tape, image[pos++], WORK_BYTE + \
+	       (i+1 == headerLength ? work : 0));
+
+    if(ZXTRANS_SPAN_DATA == type)
+      pos = add_data(tape, image, length, pos, span, flags);
+  }
+
+  while(pos < length)
+    add_byte(tape, image[pos++], WORK_BYTE);
+}
+
+/* Write last block of transfer, padded out */
+void zxtrans_tape_finish(struct zxtrans_tape *tape){
+  if(tape->fill > 0)
+    send_block(tape, END_PAUSE);
+}
+
+/* Finish writing tape. Returns 1 if it was all written. */
+int zxtrans_tape_close(struct zxtrans_tape *tape){
+  int ok;
+
+  if(tape->audio && 0 == fseek(tape->file, 0, SEEK_SET)){
+    fwrite("RIFF", 1, 4, tape->file);
+    put_long(tape->file, WAV_HEADER_LEN-8+tape->samples);
+    fwrite("WAVEfmt ", 1, 8, tape->file);
+    put_long(tape->file, 16);
+    put_word(tape->file, 1);	/* PCM */
+    put_word(tape->file, 1);	/* Mono */
+    put_long(tape->file, SAMPLE_RATE);
+    put_long(tape->file, SAMPLE_RATE);
+    put_word(tape->file, 1);
+    put_word(tape->file, 8);
+    fwrite("data", 1, 4, tape->file);
+    put_long(tape->file, tape->samples);
+  }
+
+  ok = !ferror(tape->file);
+
+  if(fclose(tape->file))
+    ok = 0;
+
+  return ok;
+}
+
+/* Add byte to block, and work to the time receiver needs to use it.
+   A full block is only sent once more follows, so the last block of a
+   snapshot is always sent by zxtrans_tape_finish(). */
+static void add_byte(struct zxtrans_tape *tape, libspectrum_byte byte,
+		     double work){
+  if(ZXTRANS_TAPE_BLOCK_LEN == tape->fill)
+    send_block(tape, PAUSE_MIN + \
+	       (tape->work*WORK_MARGIN + WORK_BLOCK)*1000/CLOCK);
+
+  tape->wire[1+tape->fill++] = byte;
+  tape->work += work;
+}
+
+/* Add bytes of image from pos which fill span bytes of memory, packed
+   if flags say so (see zxtrans_pack.h). Returns position following
+   them. */
+static size_t add_data(struct zxtrans_tape *tape,
+		       const libspectrum_byte *image, size_t length,
+		       size_t pos, size_t span, int flags){
+  if(!(flags & ZXTRANS_FLAG_PACKED)){
+    for(size_t i=0; i<span && pos < length; i++)
+      add_byte(tape, image[pos++], WORK_BYTE);
+
+    return pos;
+  }
+
+  while(span > 0 && pos < length){
+    int token = image[pos];
+    size_t count;
+
+    if(token < 0x80){
+      count = token+2;		/* Token and literals */
+
+      for(size_t i=0; i<count && pos < length; i++)
+	add_byte(tape, image[pos++], WORK_BYTE);
+
+      count--;
+    }
+    else{
+      size_t field = token & 0x3F;
+      int tokenLength = (token & 0x40) ? 3 : 2;
+
+      if(ZXTRANS_PACK_LENGTH_EXT == field && pos+1 < length){
+	field += image[pos+1];
+	tokenLength++;
+      }
+
+      count = field + ((token & 0x40) ? ZXTRANS_PACK_LONG_MIN : \
+		       ZXTRANS_PACK_SHORT_MIN);
+
+      /* Match is copied once its offset is read */
+      for(int i=0; i<tokenLength && pos < length; i++)
+	add_byte(tape, image[pos++], WORK_BYTE + \
+		 (i+1 == tokenLength ? count*WORK_COPY : 0));
+    }
+
+    span -= (count < span) ? count : span;
+  }
+
+  return pos;
+}
+
+/* Send block being filled, followed by pause milliseconds */
+static void send_block(struct zxtrans_tape *tape, unsigned int pause){
+  libspectrum_byte check=0;
+
+  memset(&tape->wire[1+tape->fill], 0, ZXTRANS_TAPE_BLOCK_LEN-tape->fill);
+  tape->wire[0] = tape->number++;
+
+  for(int i=0; i<ZXTRANS_TAPE_WIRE_LEN-1; i++)
+    check ^= tape->wire[i];
+
+  tape->wire[ZXTRANS_TAPE_WIRE_LEN-1] = check;
+  write_block(tape, tape->wire, ZXTRANS_TAPE_WIRE_LEN, 1, pause);
+
+  tape->fill = 0;
+  tape->work = 0;
+}
+
+/* Fill in ROM tape header, of the given type (0 for a program, 3 for
+   code) */
+static void rom_header(libspectrum_byte *header, int type,
+		       const char *name, size_t length,
+		       libspectrum_word param1, libspectrum_word param2){
+  header[0] = type;
+  memset(&header[1], ' ', 10);
+  memcpy(&header[1], name, strlen(name));
+  header[11] = length & 0xFF;
+  header[12] = (length & 0xFF00)>>8;
+  header[13] = param1 & 0xFF;
+  header[14] = (param1 & 0xFF00)>>8;
+  header[15] = param2 & 0xFF;
+  header[16] = (param2 & 0xFF00)>>8;
+}
+
+/* Write block at ROM speed, with flag byte and checksum added */
+static void rom_block(struct zxtrans_tape *tape, libspectrum_byte flag,
+		      const libspectrum_byte *data, size_t length){
+  libspectrum_byte *block = malloc(length+2);
+  libspectrum_byte check = flag;
+
+  if(NULL == block){
+    printf("Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  block[0] = flag;
+  memcpy(&block[1], data, length);
+
+  for(size_t i=0; i<length; i++)
+    check ^= data[i];
+
+  block[length+1] = check;
+  write_block(tape, block, length+2, 0, ROM_PAUSE);
+  free(block);
+}
+
+/* Write block, followed by pause milliseconds. A turbo block is sent
+   at the tape's speed, with a short leader, and any other as the ROM
+   sends it, with a leader that depends on its flag byte. */
+static void write_block(struct zxtrans_tape *tape,
+			const libspectrum_byte *data, size_t length,
+			int turbo, unsigned int pause){
+  int speed = turbo ? tape->speed : 1;
+  int leader = turbo ? ZXTRANS_TAPE_LEADER : \
+    (data[0] & 0x80) ? ROM_DATA_LEADER : ROM_HEADER_LEADER;
+  unsigned int leaderPulse = (ROM_LEADER+speed/2)/speed;
+  unsigned int sync1 = (ROM_SYNC_1+speed/2)/speed;
+  unsigned int sync2 = (ROM_SYNC_2+speed/2)/speed;
+  unsigned int zero = (ROM_ZERO+speed/2)/speed;
+  unsigned int one = (ROM_ONE+speed/2)/speed;
+
+  if(!tape->audio && !turbo){
+    fputc(TZX_STANDARD, tape->file);
+    put_word(tape->file, pause);
+    put_word(tape->file, length);
+  }
+  else if(!tape->audio){
+    fputc(TZX_TURBO, tape->file);
+    put_word(tape->file, leaderPulse);
+    put_word(tape->file, sync1);
+    put_word(tape->file, sync2);
+    put_word(tape->file, zero);
+    put_word(tape->file, one);
+    put_word(tape->file, leader);
+    fputc(8, tape->file);	/* Bits used in last byte */
+    put_word(tape->file, pause);
+    put_word(tape->file, length & 0xFFFF);
+    fputc((length >> 16) & 0xFF, tape->file);
+  }
+
+  if(!tape->audio)
+    fwrite(data, 1, length, tape->file);
+
+  /* Audio is made of the pulses, which also give the length of tape */
+  for(int i=0; i<leader; i++)
+    pulse(tape, leaderPulse);
+
+  pulse(tape, sync1);
+  pulse(tape, sync2);
+
+  for(size_t i=0; i<length; i++)
+    for(int bit=0x80; bit; bit >>= 1){
+      pulse(tape, (data[i] & bit) ? one : zero);
+      pulse(tape, (data[i] & bit) ? one : zero);
+    }
+
+  silence(tape, pause);
+}
+
+/* One pulse of length T-states, after which the level changes */
+static void pulse(struct zxtrans_tape *tape, double length){
+  tape->seconds += length/CLOCK;
+
+  if(!tape->audio)
+    return;
+
+  for(tape->pending += length*SAMPLE_RATE/CLOCK; tape->pending >= 1; \
+	tape->pending--, tape->samples++)
+    fputc(tape->level ? WAV_HIGH : WAV_LOW, tape->file);
+
+  tape->level = !tape->level;
+}
+
+static void silence(struct zxtrans_tape *tape, unsigned int pause){
+  tape->seconds += pause/1000.0;
+
+  if(!tape->audio)
+    return;
+
+  for(unsigned long i=0; i<(unsigned long) pause*SAMPLE_RATE/1000; i++, \
+	tape->samples++)
+    fputc(WAV_SILENCE, tape->file);
+}
+
+/* Little-endian values, as both TZX and WAV files hold them */
+static void put_word(FILE *file, unsigned int value){
+  fputc(value & 0xFF, file);
+  fputc((value >> 8) & 0xFF, file);
+}
+
+static void put_long(FILE *file, unsigned long value){
+  put_word(file, value & 0xFFFF);
+  put_word(file, (value >> 16) & 0xFFFF);
+}
@@ -0,0 +1,85 @@
+/*
+   ZX-Trans Tape - turbo-speed tape images of a transfer, as TZX files
+   or audio, for Spectrums with no serial port.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_TAPE_H
+#define ZXTRANS_TAPE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <libspectrum.h>
+
+/* A tape holds, for each snapshot, a BASIC loader and the tape receiver
+   at ROM speed, then the transfer at speed times ROM speed, decoded by
+   ZXT_READ_SERIAL in zxtrans_reader_tape.asm. The transfer is split
+   into turbo blocks, each holding:
+
+     Block number, counting from 0 (modulo 256)
+     ZXTRANS_TAPE_BLOCK_LEN bytes (the last block is padded with zeros)
+     XOR of number and bytes, as in the ROM's format
+
+   Each block's leader is ZXTRANS_TAPE_LEADER pulses long, and follows
+   a pause long enough for the receiver to use the block before. */
+
+#define ZXTRANS_TAPE_BLOCK_LEN 254
+#define ZXTRANS_TAPE_WIRE_LEN (ZXTRANS_TAPE_BLOCK_LEN+2) /* Bytes per
+							   block */
+#define ZXTRANS_TAPE_LEADER 256
+#define ZXTRANS_TAPE_SPEED_MAX 4 /* Beyond this, pulses are too short to
+				    be played reliably as audio */
+
+/* Tape being written, and the turbo block being filled */
+struct zxtrans_tape {
+  FILE *file;
+  int audio;			/* WAV samples, rather than TZX blocks */
+  int speed;			/* Multiple of ROM speed for transfer */
+  libspectrum_byte wire[ZXTRANS_TAPE_WIRE_LEN];
+  size_t fill;			/* Bytes of transfer held */
+  libspectrum_byte number;
+  double work;			/* Receiver T-states to use block */
+  int level;			/* Of audio, high or low */
+  double pending;		/* T-states not yet written as samples */
+  unsigned long samples;	/* Of audio written */
+  double seconds;		/* Length of tape so far */
+};
+
+int zxtrans_tape_open(struct zxtrans_tape *tape, const char *filename,
+		      int speed);
+void zxtrans_tape_loader(struct zxtrans_tape *tape,
+			 const libspectrum_byte *receiver, size_t length);
+void zxtrans_tape_write(struct zxtrans_tape *tape,
+			const libspectrum_byte *data, size_t count);
+void zxtrans_tape_page(struct zxtrans_tape *tape,
+		       const libspectrum_byte *image, size_t length,
+		       int flags);
+void zxtrans_tape_finish(struct zxtrans_tape *tape);
+int zxtrans_tape_close(struct zxtrans_tape *tape);
+
+#endif
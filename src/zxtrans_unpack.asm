@@ -0,0 +1,145 @@
+	;; ZX-Trans Receiver - unpacker for compressed transfers
+	;; 
+	;; Expand packed snapshot data, as written by zxtrans_sender
+	;; with the -z option, while it is read from the serial port.
+	;;
+	;; 
+	;; Copyright 2015 George Beckett, All Rights Reserved
+	;; 
+	;; Redistribution and use in source and binary forms,
+	;; with or without modification, are permitted provided
+	;; that the following conditions are met:
+	;; 
+	;; - Redistributions of source code must retain the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer.		
+	;; - Redistributions in binary form must reproduce the above
+	;;   copyright notice, this list of conditions and the following
+	;;   disclaimer in the documentation and/or other materials
+	;;   provided with the distribution.
+	;; 
+	;; THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS
+	;; ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING,
+	;; BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+	;; AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+	;; EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+	;; INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	;; DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	;; SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+	;; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+	;; LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	;; (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+	;; THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+	;; OF SUCH DAMAGE.
+	;;
+	;; 
+	;; Version history:
+	;; Written by George Beckett <markgbeckett@gmail.com>
+	;; Version 0.2, Written 25th June 2015
+	;; Version 0.3, Written 2nd September 2015 
+	;; Version 1.0, Written 17th September 2015 - 48k support
+	;; Version 1.1, Written 27th September 2015 - 16k support added
+	;; Version 1.2, Written 16th October 2026 - compressed transfers
+	;;
+	;; 
+	;;
+	;; Packed data is a sequence of one-byte tokens (see
+	;; zxtrans_pack.h):
+	;;
+	;;   0x00-0x7F  literal run of token+1 bytes
+	;;   0x80-0xBF  match of field+3 bytes, 8-bit offset (less one)
+	;;   0xC0-0xFF  match of field+4 bytes, 16-bit offset
+	;;
+	;; where field (bits 0-5) of 0x3F is extended by a further byte.
+	;; A literal run may continue over successive calls, so pending
+	;; literals are counted in ZXT_LITERALS. The sender never lets a
+	;; match cross the end of a block.
+	;;
+	;; On entry:
+	;;   hl = base address for block to be written to
+	;;   bc = number of bytes to write
+	;;
+	;; On exit:
+	;;   hl = address following block
+	;;   CF = set if read is successful; reset otherwise
+	;; 
+ZXT_LOAD_PACKED:
+	ex de, hl		; DE tracks destination
+ZXP_NEXT:
+	ld a, b			; Check if block is complete
+	or c
+	jr z, ZXP_DONE
+	ld a, (ZXT_LITERALS)	; Literals left over from previous token
+	and a
+	jr nz, ZXP_LITERAL
+	call ZXT_READ_BYTE	; Fetch next token
+	ret nc
+	cp 0x80
+	jr nc, ZXP_MATCH
+	inc a			; Literal run of token+1 bytes
+ZXP_LITERAL:
+	dec a			; Count off this literal
+	ld (ZXT_LITERALS), a
+	call ZXT_READ_BYTE
+	ret nc
+	ld (de), a		; Store literal
+	inc de
+	dec bc
+	jr ZXP_NEXT
+ZXP_MATCH:
+	push bc			; Save bytes left in block
+	ld b, a			; Keep token
+	and 0x3F		; Length field
+	ld l, a
+	ld h, 0
+	cp 0x3F
+	jr nz, ZXP_LENGTH
+	call ZXT_READ_BYTE	; Length field is extended
+	jr nc, ZXP_FAIL
+	ld c, a
+	ld a, b
+	ld b, 0
+	add hl, bc		; HL = 0x3F + extension
+	ld b, a			; Restore token
+ZXP_LENGTH:
+	inc hl			; Shortest match is three bytes,
+	inc hl
+	inc hl
+	bit 6, b
+	jr z, ZXP_SHORT
+	inc hl			; or four, with a 16-bit offset
+	call ZXT_READ_BYTE	; Low byte of offset
+	jr nc, ZXP_FAIL
+	ld c, a
+	call ZXT_READ_BYTE	; High byte of offset
+	jr nc, ZXP_FAIL
+	ld b, a
+	jr ZXP_COPY
+ZXP_SHORT:
+	call ZXT_READ_BYTE	; 8-bit offset, less one
+	jr nc, ZXP_FAIL
+	ld c, a
+	ld b, 0
+	inc bc
+ZXP_COPY:
+	;; HL = length, BC = offset, DE = destination
+	push hl			; Save length
+	ld h, d
+	ld l, e
+	and a			; Reset carry flag, ready to subtract
+	sbc hl, bc		; HL = source of match
+	pop bc			; BC = length
+	ex (sp), hl		; Bytes left in block, keeping source
+	and a
+	sbc hl, bc		; Deduct match from block
+	ex (sp), hl		; Restore source, keeping bytes left
+	ldir			; Copy (possibly overlapping) match
+	pop bc			; Bytes left in block
+	jr ZXP_NEXT
+ZXP_FAIL:
+	pop bc			; Balance stack
+	ret			; CF is reset
+ZXP_DONE:
+	ex de, hl
+	scf			; Indicates success
+	ret
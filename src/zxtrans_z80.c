@@ -0,0 +1,870 @@
+/*
+   ZX-Trans Z80 core - instruction-level Z80 emulation with T-state
+   accounting, used to budget the receiver programs.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+/* The core is written for budgeting rather than for running games:
+   it is instruction-accurate and counts uncontended T-states, but does
+   not model memory contention, the undocumented flag bits in block
+   instructions, or MEMPTR. */
+
+#include <string.h>
+#include "zxtrans_z80.h"
+
+#define FLAG_C 0x01
+#define FLAG_N 0x02
+#define FLAG_P 0x04
+#define FLAG_V FLAG_P
+#define FLAG_3 0x08
+#define FLAG_H 0x10
+#define FLAG_5 0x20
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
+
+#define BC(z) ((uint16_t) (((z)->b << 8) | (z)->c))
+#define DE(z) ((uint16_t) (((z)->d << 8) | (z)->e))
+#define HL(z) ((uint16_t) (((z)->h << 8) | (z)->l))
+#define SET_BC(z, v) do { uint16_t v_ = (v); (z)->b = v_ >> 8; (z)->c = v_ & 0xFF; } while(0)
+#define SET_DE(z, v) do { uint16_t v_ = (v); (z)->d = v_ >> 8; (z)->e = v_ & 0xFF; } while(0)
+#define SET_HL(z, v) do { uint16_t v_ = (v); (z)->h = v_ >> 8; (z)->l = v_ & 0xFF; } while(0)
+
+static uint8_t sz53[256], sz53p[256], parity[256];
+static int tables_ready = 0;
+
+/* Base T-states for unprefixed opcodes (conditional branches are
+   adjusted when taken) */
+static const uint8_t cycles_main[256] = {
+   4,10, 7, 6, 4, 4, 7, 4, 4,11, 7, 6, 4, 4, 7, 4,
+   8,10, 7, 6, 4, 4, 7, 4,12,11, 7, 6, 4, 4, 7, 4,
+   7,10,16, 6, 4, 4, 7, 4, 7,11,16, 6, 4, 4, 7, 4,
+   7,10,13, 6,11,11,10, 4, 7,11,13, 6, 4, 4, 7, 4,
+   4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+   4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+   4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+   7, 7, 7, 7, 7, 7, 4, 7, 4, 4, 4, 4, 4, 4, 7, 4,
+   4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+   4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+   4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+   4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+   5,10,10,10,10,11, 7,11, 5,10,10, 0,10,17, 7,11,
+   5,10,10,11,10,11, 7,11, 5, 4,10,11,10, 0, 7,11,
+   5,10,10,19,10,11, 7,11, 5, 4,10, 4,10, 0, 7,11,
+   5,10,10, 4,10,11, 7,11, 5, 6,10, 4,10, 0, 7,11
+};
+
+static void init_tables(void){
+  for(int i=0; i<256; i++){
+    int p = 0;
+
+    for(int bit=0; bit<8; bit++)
+      p ^= (i >> bit) & 1;
+
+    parity[i] = p ? 0 : FLAG_P;
+    sz53[i] = (i & (FLAG_S | FLAG_5 | FLAG_3)) | (i ? 0 : FLAG_Z);
+    sz53p[i] = sz53[i] | parity[i];
+  }
+  tables_ready = 1;
+}
+
+static uint8_t rd(struct zxtrans_z80 *z, uint16_t a){
+  return z->read(z, a);
+}
+
+static void wr(struct zxtrans_z80 *z, uint16_t a, uint8_t v){
+  z->write(z, a, v);
+}
+
+static uint8_t fetch(struct zxtrans_z80 *z){
+  return rd(z, z->pc++);
+}
+
+static uint16_t fetch16(struct zxtrans_z80 *z){
+  uint16_t lo = fetch(z);
+
+  return lo | (fetch(z) << 8);
+}
+
+static uint16_t rd16(struct zxtrans_z80 *z, uint16_t a){
+  return rd(z, a) | (rd(z, (uint16_t) (a + 1)) << 8);
+}
+
+static void wr16(struct zxtrans_z80 *z, uint16_t a, uint16_t v){
+  wr(z, a, v & 0xFF);
+  wr(z, (uint16_t) (a + 1), v >> 8);
+}
+
+static void push(struct zxtrans_z80 *z, uint16_t v){
+  z->sp -= 2;
+  wr16(z, z->sp, v);
+}
+
+static uint16_t pop(struct zxtrans_z80 *z){
+  uint16_t v = rd16(z, z->sp);
+
+  z->sp += 2;
+  return v;
+}
+
+static void inc_r(struct zxtrans_z80 *z){
+  z->r = (z->r & 0x80) | ((z->r + 1) & 0x7F);
+}
+
+/* 8-bit arithmetic */
+
+static void alu(struct zxtrans_z80 *z, int op, uint8_t v){
+  unsigned int res;
+  uint8_t a = z->a;
+
+  switch(op){
+  case 0: /* ADD */
+  case 1: /* ADC */
+    res = a + v + (op == 1 ? (z->f & FLAG_C) : 0);
+    z->f = sz53[res & 0xFF] | ((res >> 8) & FLAG_C) |
+      ((a ^ v ^ res) & FLAG_H) |
+      ((((a ^ ~v) & (a ^ res)) >> 5) & FLAG_V);
+    z->a = res & 0xFF;
+    break;
+  case 2: /* SUB */
+  case 3: /* SBC */
+  case 7: /* CP */
+    res = a - v - (op == 3 ? (z->f & FLAG_C) : 0);
+    z->f = (sz53[res & 0xFF] & ~(FLAG_5 | FLAG_3)) | FLAG_N |
+      ((res >> 8) & FLAG_C) | ((a ^ v ^ res) & FLAG_H) |
+      ((((a ^ v) & (a ^ res)) >> 5) & FLAG_V);
+    if(op == 7)
+      z->f |= v & (FLAG_5 | FLAG_3);
+    else{
+      z->f |= res & (FLAG_5 | FLAG_3);
+      z->a = res & 0xFF;
+    }
+    break;
+  case 4: /* AND */
+    z->a &= v;
+    z->f = sz53p[z->a] | FLAG_H;
+    break;
+  case 5: /* XOR */
+    z->a ^= v;
+    z->f = sz53p[z->a];
+    break;
+  case 6: /* OR */
+    z->a |= v;
+    z->f = sz53p[z->a];
+    break;
+  }
+}
+
+static uint8_t inc8(struct zxtrans_z80 *z, uint8_t v){
+  v++;
+  z->f = (z->f & FLAG_C) | sz53[v] | ((v & 0x0F) ? 0 : FLAG_H) |
+    (v == 0x80 ? FLAG_V : 0);
+  return v;
+}
+
+static uint8_t dec8(struct zxtrans_z80 *z, uint8_t v){
+  z->f = (z->f & FLAG_C) | ((v & 0x0F) ? 0 : FLAG_H) | FLAG_N;
+  v--;
+  z->f |= sz53[v] | (v == 0x7F ? FLAG_V : 0);
+  return v;
+}
+
+static uint16_t add16(struct zxtrans_z80 *z, uint16_t a, uint16_t b){
+  unsigned int res = a + b;
+
+  z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_V)) | ((res >> 16) & FLAG_C) |
+    ((res >> 8) & (FLAG_5 | FLAG_3)) | (((a ^ b ^ res) >> 8) & FLAG_H);
+  return res & 0xFFFF;
+}
+
+static uint16_t adc16(struct zxtrans_z80 *z, uint16_t a, uint16_t b){
+  unsigned int res = a + b + (z->f & FLAG_C);
+
+  z->f = ((res >> 16) & FLAG_C) | ((res >> 8) & (FLAG_S | FLAG_5 | FLAG_3)) |
+    (((a ^ b ^ res) >> 8) & FLAG_H) |
+    ((((a ^ ~b) & (a ^ res)) >> 13) & FLAG_V) |
+    ((res & 0xFFFF) ? 0 : FLAG_Z);
+  return res & 0xFFFF;
+}
+
+static uint16_t sbc16(struct zxtrans_z80 *z, uint16_t a, uint16_t b){
+  unsigned int res = a - b - (z->f & FLAG_C);
+
+  z->f = ((res >> 16) & FLAG_C) | FLAG_N |
+    ((res >> 8) & (FLAG_S | FLAG_5 | FLAG_3)) |
+    (((a ^ b ^ res) >> 8) & FLAG_H) |
+    ((((a ^ b) & (a ^ res)) >> 13) & FLAG_V) |
+    ((res & 0xFFFF) ? 0 : FLAG_Z);
+  return res & 0xFFFF;
+}
+
+/* Rotates and shifts (CB prefix, operation 0-7) */
+static uint8_t rot(struct zxtrans_z80 *z, int op, uint8_t v){
+  uint8_t c;
+
+  switch(op){
+  case 0: c = v >> 7; v = (v << 1) | c; break;			/* RLC */
+  case 1: c = v & 1; v = (v >> 1) | (c << 7); break;		/* RRC */
+  case 2: c = v >> 7; v = (v << 1) | (z->f & FLAG_C); break;	/* RL */
+  case 3: c = v & 1; v = (v >> 1) | ((z->f & FLAG_C) << 7); break; /* RR */
+  case 4: c = v >> 7; v <<= 1; break;				/* SLA */
+  case 5: c = v & 1; v = (v >> 1) | (v & 0x80); break;		/* SRA */
+  case 6: c = v >> 7; v = (v << 1) | 1; break;			/* SLL */
+  default: c = v & 1; v >>= 1; break;				/* SRL */
+  }
+  z->f = sz53p[v] | c;
+  return v;
+}
+
+/* Register access by 3-bit index; index 6 is handled by callers */
+static uint8_t *reg8(struct zxtrans_z80 *z, int r){
+  switch(r){
+  case 0: return &z->b;
+  case 1: return &z->c;
+  case 2: return &z->d;
+  case 3: return &z->e;
+  case 4: return &z->h;
+  case 5: return &z->l;
+  default: return &z->a;
+  }
+}
+
+static uint16_t get_rp(struct zxtrans_z80 *z, int p, uint16_t *xy){
+  switch(p){
+  case 0: return BC(z);
+  case 1: return DE(z);
+  case 2: return xy ? *xy : HL(z);
+  default: return z->sp;
+  }
+}
+
+static void set_rp(struct zxtrans_z80 *z, int p, uint16_t v, uint16_t *xy){
+  switch(p){
+  case 0: SET_BC(z, v); break;
+  case 1: SET_DE(z, v); break;
+  case 2: if(xy) *xy = v; else SET_HL(z, v); break;
+  default: z->sp = v;
+  }
+}
+
+static int condition(struct zxtrans_z80 *z, int cc){
+  switch(cc){
+  case 0: return !(z->f & FLAG_Z);
+  case 1: return z->f & FLAG_Z;
+  case 2: return !(z->f & FLAG_C);
+  case 3: return z->f & FLAG_C;
+  case 4: return !(z->f & FLAG_P);
+  case 5: return z->f & FLAG_P;
+  case 6: return !(z->f & FLAG_S);
+  default: return z->f & FLAG_S;
+  }
+}
+
+static int exec_cb(struct zxtrans_z80 *z, uint16_t *xy, int8_t disp){
+  uint8_t op;
+  int x, y, r;
+  uint8_t v;
+  uint16_t addr = 0;
+
+  if(xy){
+    addr = *xy + disp;
+    op = fetch(z);
+    v = rd(z, addr);
+    r = 6;
+  }
+  else{
+    inc_r(z);
+    op = fetch(z);
+    r = op & 7;
+    v = (r == 6) ? rd(z, HL(z)) : *reg8(z, r);
+    addr = HL(z);
+  }
+
+  x = op >> 6;
+  y = (op >> 3) & 7;
+
+  switch(x){
+  case 0:
+    v = rot(z, y, v);
+    break;
+  case 1:
+    z->f = (z->f & FLAG_C) | FLAG_H | (sz53p[v & (1 << y)] & ~(FLAG_5 | FLAG_3)) |
+      (v & (FLAG_5 | FLAG_3));
+    if(xy)
+      return 20;
+    return r == 6 ? 12 : 8;
+  case 2:
+    v &= ~(1 << y);
+    break;
+  default:
+    v |= 1 << y;
+  }
+
+  if(xy){
+    wr(z, addr, v);
+    if((op & 7) != 6)
+      *reg8(z, op & 7) = v;	/* Undocumented copy to register */
+    return 23;
+  }
+
+  if(r == 6){
+    wr(z, addr, v);
+    return 15;
+  }
+
+  *reg8(z, r) = v;
+  return 8;
+}
+
+static int exec_ed(struct zxtrans_z80 *z){
+  uint8_t op;
+  int x, y, p;
+  uint16_t nn;
+  uint8_t v;
+
+  inc_r(z);
+  op = fetch(z);
+  x = op >> 6;
+  y = (op >> 3) & 7;
+  p = y >> 1;
+
+  if(x == 1){
+    switch(op & 7){
+    case 0: /* IN r,(C) */
+      v = z->in(z, BC(z));
+      if(y != 6)
+	*reg8(z, y) = v;
+      z->f = (z->f & FLAG_C) | sz53p[v];
+      return 12;
+    case 1: /* OUT (C),r */
+      z->out(z, BC(z), y == 6 ? 0 : *reg8(z, y));
+      return 12;
+    case 2: /* SBC/ADC HL,rr */
+      if(y & 1)
+	SET_HL(z, adc16(z, HL(z), get_rp(z, p, NULL)));
+      else
+	SET_HL(z, sbc16(z, HL(z), get_rp(z, p, NULL)));
+      return 15;
+    case 3: /* LD (nn),rr / LD rr,(nn) */
+      nn = fetch16(z);
+      if(y & 1)
+	set_rp(z, p, rd16(z, nn), NULL);
+      else
+	wr16(z, nn, get_rp(z, p, NULL));
+      return 20;
+    case 4: /* NEG */
+      v = z->a;
+      z->a = 0;
+      alu(z, 2, v);
+      return 8;
+    case 5: /* RETN/RETI */
+      z->iff1 = z->iff2;
+      z->pc = pop(z);
+      return 14;
+    case 6: /* IM */
+      z->im = (y & 3) == 2 ? 1 : ((y & 3) == 3 ? 2 : 0);
+      return 8;
+    default:
+      switch(y){
+      case 0: z->i = z->a; return 9;
+      case 1: z->r = z->a; return 9;
+      case 2:
+      case 3:
+	z->a = (y == 2) ? z->i : z->r;
+	z->f = (z->f & FLAG_C) | sz53[z->a] | (z->iff2 ? FLAG_V : 0);
+	return 9;
+      case 4: /* RRD */
+	v = rd(z, HL(z));
+	wr(z, HL(z), (z->a << 4) | (v >> 4));
+	z->a = (z->a & 0xF0) | (v & 0x0F);
+	z->f = (z->f & FLAG_C) | sz53p[z->a];
+	return 18;
+      case 5: /* RLD */
+	v = rd(z, HL(z));
+	wr(z, HL(z), (v << 4) | (z->a & 0x0F));
+	z->a = (z->a & 0xF0) | (v >> 4);
+	z->f = (z->f & FLAG_C) | sz53p[z->a];
+	return 18;
+      default:
+	return 8;
+      }
+    }
+  }
+
+  if(x == 2 && y >= 4 && (op & 7) <= 3){
+    int dir = (y & 1) ? -1 : 1;
+    int repeat = y >= 6;
+    uint16_t bc;
+
+    switch(op & 3){
+    case 0: /* LDI/LDD/LDIR/LDDR */
+      v = rd(z, HL(z));
+      wr(z, DE(z), v);
+      SET_HL(z, HL(z) + dir);
+      SET_DE(z, DE(z) + dir);
+      bc = BC(z) - 1;
+      SET_BC(z, bc);
+      z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_C)) | (bc ? FLAG_V : 0);
+      if(repeat && bc){
+	z->pc -= 2;
+	return 21;
+      }
+      return 16;
+    case 1: /* CPI/CPD/CPIR/CPDR */
+      {
+	uint8_t carry = z->f & FLAG_C;
+
+	v = rd(z, HL(z));
+	alu(z, 7, v);
+	SET_HL(z, HL(z) + dir);
+	bc = BC(z) - 1;
+	SET_BC(z, bc);
+	z->f = (z->f & ~(FLAG_V | FLAG_C)) | carry | (bc ? FLAG_V : 0);
+	if(repeat && bc && !(z->f & FLAG_Z)){
+	  z->pc -= 2;
+	  return 21;
+	}
+	return 16;
+      }
+    case 2: /* INI/IND/INIR/INDR */
+      v = z->in(z, BC(z));
+      wr(z, HL(z), v);
+      SET_HL(z, HL(z) + dir);
+      z->b--;
+      z->f = (z->f & FLAG_C) | sz53[z->b] | FLAG_N;
+      if(repeat && z->b){
+	z->pc -= 2;
+	return 21;
+      }
+      return 16;
+    default: /* OUTI/OUTD/OTIR/OTDR */
+      v = rd(z, HL(z));
+      z->b--;
+      z->out(z, BC(z), v);
+      SET_HL(z, HL(z) + dir);
+      z->f = (z->f & FLAG_C) | sz53[z->b] | FLAG_N;
+      if(repeat && z->b){
+	z->pc -= 2;
+	return 21;
+      }
+      return 16;
+    }
+  }
+
+  return 8; /* Undefined ED opcodes behave as two NOPs */
+}
+
+static int exec(struct zxtrans_z80 *z, uint8_t op, uint16_t *xy){
+  int x = op >> 6;
+  int y = (op >> 3) & 7;
+  int zz = op & 7;
+  int p = y >> 1;
+  int q = y & 1;
+  int t = cycles_main[op];
+  int extra = xy ? 4 : 0;	/* DD/FD prefix costs 4 T-states */
+  int8_t disp = 0;
+  uint16_t hl = xy ? *xy : HL(z);
+  uint16_t nn;
+  uint8_t v;
+
+  /* Indexed memory operand */
+#define MEM_ADDR() (xy ? (uint16_t) (*xy + disp) : HL(z))
+
+  switch(x){
+  case 0:
+    switch(zz){
+    case 0:
+      switch(y){
+      case 0: break;						/* NOP */
+      case 1: /* EX AF,AF' */
+	v = z->a; z->a = z->a_; z->a_ = v;
+	v = z->f; z->f = z->f_; z->f_ = v;
+	break;
+      case 2: /* DJNZ */
+	disp = (int8_t) fetch(z);
+	if(--z->b){
+	  z->pc += disp;
+	  t = 13;
+	}
+	break;
+      case 3: /* JR */
+	disp = (int8_t) fetch(z);
+	z->pc += disp;
+	break;
+      default: /* JR cc */
+	disp = (int8_t) fetch(z);
+	if(condition(z, y - 4)){
+	  z->pc += disp;
+	  t = 12;
+	}
+      }
+      break;
+    case 1:
+      if(q)
+	set_rp(z, 2, add16(z, hl, get_rp(z, p, xy)), xy);
+      else
+	set_rp(z, p, fetch16(z), xy);
+      break;
+    case 2:
+      switch(y){
+      case 0: wr(z, BC(z), z->a); break;
+      case 1: z->a = rd(z, BC(z)); break;
+      case 2: wr(z, DE(z), z->a); break;
+      case 3: z->a = rd(z, DE(z)); break;
+      case 4: wr16(z, fetch16(z), hl); break;
+      case 5: set_rp(z, 2, rd16(z, fetch16(z)), xy); break;
+      case 6: wr(z, fetch16(z), z->a); break;
+      default: z->a = rd(z, fetch16(z));
+      }
+      break;
+    case 3:
+      set_rp(z, p, get_rp(z, p, xy) + (q ? -1 : 1), xy);
+      break;
+    case 4:
+    case 5:
+      if(y == 6){
+	if(xy){
+	  disp = (int8_t) fetch(z);
+	  t = 19;
+	}
+	nn = MEM_ADDR();
+	v = rd(z, nn);
+	wr(z, nn, zz == 4 ? inc8(z, v) : dec8(z, v));
+      }
+      else{
+	uint8_t *r = reg8(z, y);
+
+	if(xy && (y == 4 || y == 5))
+	  r = (y == 4) ? ((uint8_t *) xy) + 1 : (uint8_t *) xy;
+	*r = (zz == 4) ? inc8(z, *r) : dec8(z, *r);
+      }
+      break;
+    case 6:
+      if(y == 6){
+	if(xy){
+	  disp = (int8_t) fetch(z);
+	  t = 15;
+	}
+	nn = MEM_ADDR();
+	wr(z, nn, fetch(z));
+      }
+      else{
+	uint8_t *r = reg8(z, y);
+
+	if(xy && (y == 4 || y == 5))
+	  r = (y == 4) ? ((uint8_t *) xy) + 1 : (uint8_t *) xy;
+	*r = fetch(z);
+      }
+      break;
+    default:
+      switch(y){
+      case 0: /* RLCA */
+	z->a = (z->a << 1) | (z->a >> 7);
+	z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_P)) | (z->a & (FLAG_C | FLAG_5 | FLAG_3));
+	break;
+      case 1: /* RRCA */
+	z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_P)) | (z->a & FLAG_C);
+	z->a = (z->a >> 1) | (z->a << 7);
+	z->f |= z->a & (FLAG_5 | FLAG_3);
+	break;
+      case 2: /* RLA */
+	v = z->a;
+	z->a = (z->a << 1) | (z->f & FLAG_C);
+	z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_P)) | (z->a & (FLAG_5 | FLAG_3)) | (v >> 7);
+	break;
+      case 3: /* RRA */
+	v = z->a;
+	z->a = (z->a >> 1) | (z->f << 7);
+	z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_P)) | (z->a & (FLAG_5 | FLAG_3)) | (v & FLAG_C);
+	break;
+      case 4: /* DAA */
+	{
+	  uint8_t add = 0, carry = z->f & FLAG_C;
+
+	  if((z->f & FLAG_H) || (z->a & 0x0F) > 9)
+	    add = 6;
+	  if(carry || z->a > 0x99){
+	    add |= 0x60;
+	    carry = FLAG_C;
+	  }
+	  if(z->f & FLAG_N){
+	    v = z->a;
+	    z->a -= add;
+	    z->f = FLAG_N | ((v ^ z->a) & FLAG_H);
+	  }
+	  else{
+	    v = z->a;
+	    z->a += add;
+	    z->f = (v ^ z->a) & FLAG_H;
+	  }
+	  z->f |= sz53p[z->a] | carry;
+	}
+	break;
+      case 5: /* CPL */
+	z->a ^= 0xFF;
+	z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_P | FLAG_C)) | FLAG_H | FLAG_N |
+	  (z->a & (FLAG_5 | FLAG_3));
+	break;
+      case 6: /* SCF */
+	z->f = (z->f & (FLAG_S | FLAG_Z | FLAG_P)) | FLAG_C | (z->a & (FLAG_5 | FLAG_3));
+	break;
+      default: /* CCF */
+	z->f = ((z->f & (FLAG_S | FLAG_Z | FLAG_P | FLAG_C)) |
+		((z->f & FLAG_C) ? FLAG_H : 0) | (z->a & (FLAG_5 | FLAG_3))) ^ FLAG_C;
+      }
+    }
+    break;
+
+  case 1:
+    if(op == 0x76){ /* HALT */
+      z->halted = 1;
+      z->pc--;
+      break;
+    }
+    if(y == 6 || zz == 6){
+      /* Memory operand uses H/L, not IXH/IXL */
+      if(xy){
+	disp = (int8_t) fetch(z);
+	t = 15;
+      }
+      nn = MEM_ADDR();
+      if(y == 6)
+	wr(z, nn, *reg8(z, zz));
+      else
+	*reg8(z, y) = rd(z, nn);
+    }
+    else{
+      uint8_t *dst = reg8(z, y), *src = reg8(z, zz);
+
+      if(xy){
+	if(y == 4) dst = ((uint8_t *) xy) + 1;
+	if(y == 5) dst = (uint8_t *) xy;
+	if(zz == 4) src = ((uint8_t *) xy) + 1;
+	if(zz == 5) src = (uint8_t *) xy;
+      }
+      *dst = *src;
+    }
+    break;
+
+  case 2:
+    if(zz == 6){
+      if(xy){
+	disp = (int8_t) fetch(z);
+	t = 15;
+      }
+      v = rd(z, MEM_ADDR());
+    }
+    else if(xy && (zz == 4 || zz == 5))
+      v = (zz == 4) ? (*xy >> 8) : (*xy & 0xFF);
+    else
+      v = *reg8(z, zz);
+    alu(z, y, v);
+    break;
+
+  default:
+    switch(zz){
+    case 0: /* RET cc */
+      if(condition(z, y)){
+	z->pc = pop(z);
+	t = 11;
+      }
+      break;
+    case 1:
+      if(q == 0){
+	nn = pop(z);
+	if(p == 3){
+	  z->a = nn >> 8;
+	  z->f = nn & 0xFF;
+	}
+	else
+	  set_rp(z, p, nn, xy);
+      }
+      else switch(p){
+	case 0: z->pc = pop(z); break;				/* RET */
+	case 1: /* EXX */
+	  v = z->b; z->b = z->b_; z->b_ = v;
+	  v = z->c; z->c = z->c_; z->c_ = v;
+	  v = z->d; z->d = z->d_; z->d_ = v;
+	  v = z->e; z->e = z->e_; z->e_ = v;
+	  v = z->h; z->h = z->h_; z->h_ = v;
+	  v = z->l; z->l = z->l_; z->l_ = v;
+	  break;
+	case 2: z->pc = hl; break;				/* JP (HL) */
+	default: z->sp = hl;					/* LD SP,HL */
+	}
+      break;
+    case 2: /* JP cc,nn */
+      nn = fetch16(z);
+      if(condition(z, y))
+	z->pc = nn;
+      break;
+    case 3:
+      switch(y){
+      case 0: z->pc = fetch16(z); break;			/* JP nn */
+      case 1: return t + extra;	/* CB handled by caller */
+      case 2: z->out(z, (z->a << 8) | fetch(z), z->a); break;	/* OUT (n),A */
+      case 3: z->a = z->in(z, (z->a << 8) | fetch(z)); break;	/* IN A,(n) */
+      case 4: /* EX (SP),HL */
+	nn = rd16(z, z->sp);
+	wr16(z, z->sp, hl);
+	set_rp(z, 2, nn, xy);
+	break;
+      case 5: /* EX DE,HL (never indexed) */
+	nn = DE(z);
+	SET_DE(z, HL(z));
+	SET_HL(z, nn);
+	break;
+      case 6: z->iff1 = z->iff2 = 0; break;			/* DI */
+      default:							/* EI */
+	z->iff1 = z->iff2 = 1;
+	z->ei_pending = 1;
+      }
+      break;
+    case 4: /* CALL cc,nn */
+      nn = fetch16(z);
+      if(condition(z, y)){
+	push(z, z->pc);
+	z->pc = nn;
+	t = 17;
+      }
+      break;
+    case 5:
+      if(q == 0){
+	if(p == 3)
+	  push(z, (z->a << 8) | z->f);
+	else
+	  push(z, get_rp(z, p, xy));
+      }
+      else if(p == 0){ /* CALL nn */
+	nn = fetch16(z);
+	push(z, z->pc);
+	z->pc = nn;
+      }
+      break;
+    case 6:
+      alu(z, y, fetch(z));
+      break;
+    default: /* RST */
+      push(z, z->pc);
+      z->pc = y * 8;
+    }
+  }
+
+#undef MEM_ADDR
+  return t + extra;
+}
+
+void zxtrans_z80_reset(struct zxtrans_z80 *cpu){
+  if(!tables_ready)
+    init_tables();
+
+  cpu->a = cpu->f = 0xFF;
+  cpu->b = cpu->c = cpu->d = cpu->e = cpu->h = cpu->l = 0;
+  cpu->a_ = cpu->f_ = cpu->b_ = cpu->c_ = 0;
+  cpu->d_ = cpu->e_ = cpu->h_ = cpu->l_ = 0;
+  cpu->ix = cpu->iy = 0;
+  cpu->sp = 0xFFFF;
+  cpu->pc = 0;
+  cpu->i = cpu->r = 0;
+  cpu->iff1 = cpu->iff2 = 0;
+  cpu->im = 0;
+  cpu->halted = 0;
+  cpu->ei_pending = 0;
+  cpu->tstates = 0;
+}
+
+/* Execute one instruction, returning the T-states it took */
+int zxtrans_z80_step(struct zxtrans_z80 *cpu){
+  uint8_t op;
+  uint16_t *xy = NULL;
+  int t = 0;
+
+  cpu->ei_pending = 0;
+
+  inc_r(cpu);
+  op = fetch(cpu);
+
+  /* Collapse chains of index prefixes: only the last one counts */
+  while(op == 0xDD || op == 0xFD){
+    xy = (op == 0xDD) ? &cpu->ix : &cpu->iy;
+    inc_r(cpu);
+    op = fetch(cpu);
+    if(op == 0xDD || op == 0xFD)
+      t += 4;
+  }
+
+  if(op == 0xED){
+    t += exec_ed(cpu) + (xy ? 4 : 0);
+  }
+  else if(op == 0xCB){
+    if(xy){
+      int8_t disp = (int8_t) fetch(cpu);
+
+      t += exec_cb(cpu, xy, disp);
+    }
+    else
+      t += exec_cb(cpu, NULL, 0);
+  }
+  else{
+    /* EX DE,HL and EXX ignore the index prefix */
+    if(op == 0xEB || op == 0xD9)
+      xy = NULL;
+    t += exec(cpu, op, xy);
+  }
+
+  cpu->tstates += t;
+  return t;
+}
+
+/* Accept a maskable interrupt if enabled; returns T-states used */
+int zxtrans_z80_interrupt(struct zxtrans_z80 *cpu){
+  int t;
+
+  if(!cpu->iff1 || cpu->ei_pending)
+    return 0;
+
+  if(cpu->halted){
+    cpu->halted = 0;
+    cpu->pc++;
+  }
+
+  cpu->iff1 = cpu->iff2 = 0;
+  inc_r(cpu);
+  push(cpu, cpu->pc);
+
+  if(cpu->im == 2){
+    cpu->pc = rd16(cpu, (cpu->i << 8) | 0xFF);
+    t = 19;
+  }
+  else{
+    cpu->pc = 0x0038;
+    t = 13;
+  }
+
+  cpu->tstates += t;
+  return t;
+}
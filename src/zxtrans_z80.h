@@ -0,0 +1,68 @@
+/*
+   ZX-Trans Z80 core - instruction-level Z80 emulation with T-state
+   accounting, used to budget the receiver programs.
+
+   Copyright 2015 George Beckett. All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   -   Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+   -   Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+   AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+   THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+   PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+   OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+   DAMAGE.
+*/
+
+#ifndef ZXTRANS_Z80_H
+#define ZXTRANS_Z80_H
+
+#include <stdint.h>
+
+struct zxtrans_z80;
+
+/* Memory and I/O callbacks supplied by the machine model */
+typedef uint8_t (*zxtrans_z80_read_fn)(struct zxtrans_z80 *cpu,
+				       uint16_t address);
+typedef void (*zxtrans_z80_write_fn)(struct zxtrans_z80 *cpu,
+				     uint16_t address, uint8_t value);
+typedef uint8_t (*zxtrans_z80_in_fn)(struct zxtrans_z80 *cpu,
+				     uint16_t port);
+typedef void (*zxtrans_z80_out_fn)(struct zxtrans_z80 *cpu,
+				   uint16_t port, uint8_t value);
+
+struct zxtrans_z80 {
+  uint8_t a, f, b, c, d, e, h, l;
+  uint8_t a_, f_, b_, c_, d_, e_, h_, l_;
+  uint16_t ix, iy, sp, pc;
+  uint8_t i, r, iff1, iff2, im, halted;
+  int ei_pending;		/* EI delays interrupt acceptance */
+  unsigned long long tstates;	/* Running total of T-states */
+
+  zxtrans_z80_read_fn read;
+  zxtrans_z80_write_fn write;
+  zxtrans_z80_in_fn in;
+  zxtrans_z80_out_fn out;
+  void *machine;		/* Owner's context */
+};
+
+void zxtrans_z80_reset(struct zxtrans_z80 *cpu);
+int zxtrans_z80_step(struct zxtrans_z80 *cpu);
+int zxtrans_z80_interrupt(struct zxtrans_z80 *cpu);
+
+#endif